@@ -20,6 +20,14 @@ static int tar_umask = 002;
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
 
+static void tar_write_block(const void *buf)
+{
+	write_or_die(1, buf, BLOCKSIZE);
+}
+
+/* all our output goes through here, one BLOCKSIZE at a time */
+static void (*write_block)(const void *) = tar_write_block;
+
 /*
  * This is the max value that a ustar size header can specify, as it is fixed
  * at 11 octal digits. POSIX specifies that we switch to extended headers at
@@ -42,7 +50,7 @@ static int write_tar_filter_archive(const struct archiver *ar,
 static void write_if_needed(void)
 {
 	if (offset == BLOCKSIZE) {
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 		offset = 0;
 	}
 }
@@ -66,7 +74,7 @@ static void do_write_blocked(const void *data, unsigned long size)
 		write_if_needed();
 	}
 	while (size >= BLOCKSIZE) {
-		write_or_die(1, buf, BLOCKSIZE);
+		write_block(buf);
 		size -= BLOCKSIZE;
 		buf += BLOCKSIZE;
 	}
@@ -101,10 +109,10 @@ static void write_trailer(void)
 {
 	int tail = BLOCKSIZE - offset;
 	memset(block + offset, 0, tail);
-	write_or_die(1, block, BLOCKSIZE);
+	write_block(block);
 	if (tail < 2 * RECORDSIZE) {
 		memset(block, 0, offset);
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 	}
 }
 
@@ -440,6 +448,95 @@ static int write_tar_archive(const struct archiver *ar,
 	return err;
 }
 
+/*
+ * The internal gzip filter compresses the tar stream in chunks of this
+ * size, each into a gzip member of its own, so that several threads can
+ * work on it. gunzip(1) and friends read such concatenated members as
+ * one stream. The output does not depend on the number of threads.
+ */
+#define TGZ_CHUNK_SIZE (1024 * 1024)
+
+struct tgz_job {
+	struct strbuf in;
+	struct strbuf out;
+};
+
+static struct archive_job_queue *tgz_queue;
+static struct tgz_job *tgz_job;
+static int tgz_compression_level;
+
+static void tgz_deflate(void *data)
+{
+	struct tgz_job *job = data;
+	git_zstream stream;
+	int result;
+
+	git_deflate_init_gzip(&stream, tgz_compression_level);
+	strbuf_grow(&job->out, git_deflate_bound(&stream, job->in.len));
+	stream.next_in = (unsigned char *)job->in.buf;
+	stream.avail_in = job->in.len;
+	stream.next_out = (unsigned char *)job->out.buf;
+	stream.avail_out = job->out.alloc - 1;
+
+	do {
+		result = git_deflate(&stream, Z_FINISH);
+	} while (result == Z_OK);
+	if (result != Z_STREAM_END)
+		die(_("deflate error (%d)"), result);
+
+	git_deflate_end(&stream);
+	strbuf_setlen(&job->out, stream.total_out);
+	strbuf_release(&job->in);
+}
+
+static void tgz_write_job(void *data)
+{
+	struct tgz_job *job = data;
+
+	write_or_die(1, job->out.buf, job->out.len);
+	strbuf_release(&job->out);
+	free(job);
+}
+
+static void tgz_queue_job(void)
+{
+	if (!tgz_job)
+		return;
+	archive_job_queue_add(tgz_queue, tgz_job);
+	tgz_job = NULL;
+}
+
+static void tgz_write_block(const void *data)
+{
+	if (!tgz_job) {
+		tgz_job = xcalloc(1, sizeof(*tgz_job));
+		strbuf_init(&tgz_job->in, TGZ_CHUNK_SIZE + BLOCKSIZE);
+		strbuf_init(&tgz_job->out, 0);
+	}
+	strbuf_add(&tgz_job->in, data, BLOCKSIZE);
+	if (tgz_job->in.len >= TGZ_CHUNK_SIZE)
+		tgz_queue_job();
+}
+
+static int write_tar_gzip_archive(const struct archiver *ar,
+				  struct archiver_args *args)
+{
+	int r;
+
+	tgz_compression_level = args->compression_level;
+	tgz_queue = archive_job_queue_start(args->nr_threads,
+					    tgz_deflate, tgz_write_job);
+	write_block = tgz_write_block;
+
+	r = write_tar_archive(ar, args);
+
+	tgz_queue_job();
+	archive_job_queue_finish(tgz_queue);
+	tgz_queue = NULL;
+	write_block = tar_write_block;
+	return r;
+}
+
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args)
 {
@@ -451,6 +548,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	if (!ar->data)
 		BUG("tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->data, "git archive gzip"))
+		return write_tar_gzip_archive(ar, args);
+
 	strbuf_addstr(&cmd, ar->data);
 	if (args->compression_level >= 0)
 		strbuf_addf(&cmd, " -%d", args->compression_level);
@@ -282,106 +282,77 @@ static int entry_is_binary(struct index_state *istate, const char *path,
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode)
+/*
+ * An entry on its way into the archive. Entries whose contents we hold
+ * in core are compressed by the threads of zip_queue, and written out
+ * in order afterwards.
+ */
+struct zip_entry {
+	struct archiver_args *args;
+	char *path;
+	size_t pathlen;
+	unsigned long flags;
+	unsigned long attr2;
+	enum zip_method method;
+	unsigned long size;
+	unsigned long compressed_size;
+	unsigned long crc;
+	int is_binary;
+	unsigned int creator_version;
+	void *buffer;
+	void *deflated;
+	void *out;
+	struct git_istream *stream;
+};
+
+static struct archive_job_queue *zip_queue;
+
+static void compress_zip_entry(void *data)
 {
+	struct zip_entry *e = data;
+
+	if (!e->buffer)
+		return;
+
+	e->crc = crc32(e->crc, e->buffer, e->size);
+	e->out = e->buffer;
+
+	if (e->method == ZIP_METHOD_DEFLATE) {
+		e->out = e->deflated = zlib_deflate_raw(e->buffer, e->size,
+						       e->args->compression_level,
+						       &e->compressed_size);
+		if (!e->out || e->compressed_size >= e->size) {
+			e->out = e->buffer;
+			e->method = ZIP_METHOD_STORE;
+			e->compressed_size = e->size;
+		}
+	}
+}
+
+/* Write the entry and its directory record, and free it. */
+static int write_zip_entry_data(struct zip_entry *e)
+{
+	struct archiver_args *args = e->args;
 	struct zip_local_header header;
 	uintmax_t offset = zip_offset;
 	struct zip_extra_mtime extra;
 	struct zip64_extra extra64;
 	size_t header_extra_size = ZIP_EXTRA_MTIME_SIZE;
 	int need_zip64_extra = 0;
-	unsigned long attr2;
-	unsigned long compressed_size;
-	unsigned long crc;
-	enum zip_method method;
-	unsigned char *out;
-	void *deflated = NULL;
-	void *buffer;
-	struct git_istream *stream = NULL;
-	unsigned long flags = 0;
-	unsigned long size;
-	int is_binary = -1;
+	const char *path = e->path;
+	size_t pathlen = e->pathlen;
+	unsigned long flags = e->flags;
+	enum zip_method method = e->method;
+	unsigned long size = e->size;
+	unsigned long compressed_size = e->compressed_size;
+	unsigned long crc = e->crc;
+	int is_binary = e->is_binary;
+	struct git_istream *stream = e->stream;
 	const char *path_without_prefix = path + args->baselen;
-	unsigned int creator_version = 0;
 	unsigned int version_needed = 10;
 	size_t zip_dir_extra_size = ZIP_EXTRA_MTIME_SIZE;
 	size_t zip64_dir_extra_payload_size = 0;
-
-	crc = crc32(0, NULL, 0);
-
-	if (!has_only_ascii(path)) {
-		if (is_utf8(path))
-			flags |= ZIP_UTF8;
-		else
-			warning(_("path is not valid UTF-8: %s"), path);
-	}
-
-	if (pathlen > 0xffff) {
-		return error(_("path too long (%d chars, SHA1: %s): %s"),
-				(int)pathlen, oid_to_hex(oid), path);
-	}
-
-	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		method = ZIP_METHOD_STORE;
-		attr2 = 16;
-		out = NULL;
-		size = 0;
-		compressed_size = 0;
-		buffer = NULL;
-	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
-		enum object_type type = oid_object_info(args->repo, oid,
-							&size);
-
-		method = ZIP_METHOD_STORE;
-		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
-			(mode & 0111) ? ((mode) << 16) : 0;
-		if (S_ISLNK(mode) || (mode & 0111))
-			creator_version = 0x0317;
-		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
-			method = ZIP_METHOD_DEFLATE;
-
-		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
-		    size > big_file_threshold) {
-			stream = open_istream(oid, &type, &size, NULL);
-			if (!stream)
-				return error(_("cannot stream blob %s"),
-					     oid_to_hex(oid));
-			flags |= ZIP_STREAM;
-			out = buffer = NULL;
-		} else {
-			buffer = object_file_to_archive(args, path, oid, mode,
-							&type, &size);
-			if (!buffer)
-				return error(_("cannot read %s"),
-					     oid_to_hex(oid));
-			crc = crc32(crc, buffer, size);
-			is_binary = entry_is_binary(args->repo->index,
-						    path_without_prefix,
-						    buffer, size);
-			out = buffer;
-		}
-		compressed_size = (method == ZIP_METHOD_STORE) ? size : 0;
-	} else {
-		return error(_("unsupported file mode: 0%o (SHA1: %s)"), mode,
-				oid_to_hex(oid));
-	}
-
-	if (creator_version > max_creator_version)
-		max_creator_version = creator_version;
-
-	if (buffer && method == ZIP_METHOD_DEFLATE) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
-		if (!out || compressed_size >= size) {
-			out = buffer;
-			method = ZIP_METHOD_STORE;
-			compressed_size = size;
-		}
-	}
+	int ret = 0;
 
 	copy_le16(extra.magic, 0x5455);
 	copy_le16(extra.extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
@@ -441,8 +412,10 @@ static int write_zip_entry(struct archiver_args *args,
 			write_or_die(1, buf, readlen);
 		}
 		close_istream(stream);
-		if (readlen)
-			return readlen;
+		if (readlen) {
+			ret = readlen;
+			goto out;
+		}
 
 		compressed_size = size;
 		zip_offset += compressed_size;
@@ -488,8 +461,10 @@ static int write_zip_entry(struct archiver_args *args,
 
 		}
 		close_istream(stream);
-		if (readlen)
-			return readlen;
+		if (readlen) {
+			ret = readlen;
+			goto out;
+		}
 
 		zstream.next_in = buf;
 		zstream.avail_in = 0;
@@ -505,13 +480,10 @@ static int write_zip_entry(struct archiver_args *args,
 
 		write_zip_data_desc(size, compressed_size, crc);
 	} else if (compressed_size > 0) {
-		write_or_die(1, out, compressed_size);
+		write_or_die(1, e->out, compressed_size);
 		zip_offset += compressed_size;
 	}
 
-	free(deflated);
-	free(buffer);
-
 	if (compressed_size > 0xffffffff || size > 0xffffffff ||
 	    offset > 0xffffffff) {
 		if (compressed_size >= 0xffffffff)
@@ -524,7 +496,7 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 
 	strbuf_add_le(&zip_dir, 4, 0x02014b50);	/* magic */
-	strbuf_add_le(&zip_dir, 2, creator_version);
+	strbuf_add_le(&zip_dir, 2, e->creator_version);
 	strbuf_add_le(&zip_dir, 2, version_needed);
 	strbuf_add_le(&zip_dir, 2, flags);
 	strbuf_add_le(&zip_dir, 2, method);
@@ -538,7 +510,7 @@ static int write_zip_entry(struct archiver_args *args,
 	strbuf_add_le(&zip_dir, 2, 0);		/* comment length */
 	strbuf_add_le(&zip_dir, 2, 0);		/* disk */
 	strbuf_add_le(&zip_dir, 2, !is_binary);
-	strbuf_add_le(&zip_dir, 4, attr2);
+	strbuf_add_le(&zip_dir, 4, e->attr2);
 	strbuf_add_le(&zip_dir, 4, clamp32(offset));
 	strbuf_add(&zip_dir, path, pathlen);
 	strbuf_add(&zip_dir, &extra, ZIP_EXTRA_MTIME_SIZE);
@@ -554,7 +526,117 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 	zip_dir_entries++;
 
-	return 0;
+out:
+	free(e->deflated);
+	free(e->buffer);
+	free(e->path);
+	free(e);
+	return ret;
+}
+
+static void write_compressed_zip_entry(void *data)
+{
+	/* only entries without a stream are queued, and they cannot fail */
+	write_zip_entry_data(data);
+}
+
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode)
+{
+	struct zip_entry *e;
+	unsigned long attr2;
+	unsigned long compressed_size;
+	enum zip_method method;
+	void *buffer;
+	struct git_istream *stream = NULL;
+	unsigned long flags = 0;
+	unsigned long size;
+	int is_binary = -1;
+	const char *path_without_prefix = path + args->baselen;
+	unsigned int creator_version = 0;
+
+	if (!has_only_ascii(path)) {
+		if (is_utf8(path))
+			flags |= ZIP_UTF8;
+		else
+			warning(_("path is not valid UTF-8: %s"), path);
+	}
+
+	if (pathlen > 0xffff) {
+		return error(_("path too long (%d chars, SHA1: %s): %s"),
+				(int)pathlen, oid_to_hex(oid), path);
+	}
+
+	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
+		method = ZIP_METHOD_STORE;
+		attr2 = 16;
+		size = 0;
+		compressed_size = 0;
+		buffer = NULL;
+	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
+		enum object_type type = oid_object_info(args->repo, oid,
+							&size);
+
+		method = ZIP_METHOD_STORE;
+		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
+			(mode & 0111) ? ((mode) << 16) : 0;
+		if (S_ISLNK(mode) || (mode & 0111))
+			creator_version = 0x0317;
+		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
+			method = ZIP_METHOD_DEFLATE;
+
+		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
+		    size > big_file_threshold) {
+			stream = open_istream(oid, &type, &size, NULL);
+			if (!stream)
+				return error(_("cannot stream blob %s"),
+					     oid_to_hex(oid));
+			flags |= ZIP_STREAM;
+			buffer = NULL;
+		} else {
+			buffer = object_file_to_archive(args, path, oid, mode,
+							&type, &size);
+			if (!buffer)
+				return error(_("cannot read %s"),
+					     oid_to_hex(oid));
+			is_binary = entry_is_binary(args->repo->index,
+						    path_without_prefix,
+						    buffer, size);
+		}
+		compressed_size = (method == ZIP_METHOD_STORE) ? size : 0;
+	} else {
+		return error(_("unsupported file mode: 0%o (SHA1: %s)"), mode,
+				oid_to_hex(oid));
+	}
+
+	if (creator_version > max_creator_version)
+		max_creator_version = creator_version;
+
+	e = xcalloc(1, sizeof(*e));
+	e->args = args;
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	e->flags = flags;
+	e->attr2 = attr2;
+	e->method = method;
+	e->size = size;
+	e->compressed_size = compressed_size;
+	e->crc = crc32(0, NULL, 0);
+	e->is_binary = is_binary;
+	e->creator_version = creator_version;
+	e->buffer = buffer;
+	e->stream = stream;
+
+	if (buffer) {
+		archive_job_queue_add(zip_queue, e);
+		return 0;
+	}
+
+	/* Streams are written as we read them, after what is queued. */
+	archive_job_queue_flush(zip_queue);
+	return write_zip_entry_data(e);
 }
 
 static void write_zip64_trailer(void)
@@ -638,7 +720,12 @@ static int write_zip_archive(const struct archiver *ar,
 
 	strbuf_init(&zip_dir, 0);
 
+	zip_queue = archive_job_queue_start(args->nr_threads,
+					    compress_zip_entry,
+					    write_compressed_zip_entry);
 	err = write_archive_entries(args, write_zip_entry);
+	archive_job_queue_finish(zip_queue);
+	zip_queue = NULL;
 	if (!err)
 		write_zip_trailer(args->commit_oid);
 
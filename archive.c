@@ -299,6 +299,152 @@ int write_archive_entries(struct archiver_args *args,
 	return err;
 }
 
+/*
+ * The jobs in flight are kept in a ring of "nr_slots" slots: job number
+ * "seq" lives in slots[seq % nr_slots]. Jobs [written, started) are
+ * being worked on or done, and jobs [started, added) wait for a thread.
+ */
+struct archive_job_slot {
+	void *job;
+	int done;
+};
+
+struct archive_job_queue {
+	archive_job_fn work, done;
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_added;
+	pthread_cond_t cond_done;
+	struct archive_job_slot *slots;
+	unsigned int nr_slots;
+	uint64_t added, started, written;
+	int stopping;
+};
+
+static void *archive_job_thread(void *data)
+{
+	struct archive_job_queue *q = data;
+
+	pthread_mutex_lock(&q->mutex);
+	for (;;) {
+		struct archive_job_slot *slot;
+
+		while (q->started == q->added && !q->stopping)
+			pthread_cond_wait(&q->cond_added, &q->mutex);
+		if (q->started == q->added)
+			break;
+
+		slot = &q->slots[q->started++ % q->nr_slots];
+		pthread_mutex_unlock(&q->mutex);
+		q->work(slot->job);
+		pthread_mutex_lock(&q->mutex);
+		slot->done = 1;
+		pthread_cond_signal(&q->cond_done);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return NULL;
+}
+
+struct archive_job_queue *archive_job_queue_start(int nr_threads,
+						  archive_job_fn work,
+						  archive_job_fn done)
+{
+	struct archive_job_queue *q = xcalloc(1, sizeof(*q));
+	int i;
+
+	q->work = work;
+	q->done = done;
+	q->nr_threads = HAVE_THREADS ? nr_threads : 1;
+	if (q->nr_threads <= 1)
+		return q;
+
+	/* Give the threads something to do while we write. */
+	q->nr_slots = 2 * q->nr_threads;
+	CALLOC_ARRAY(q->slots, q->nr_slots);
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond_added, NULL);
+	pthread_cond_init(&q->cond_done, NULL);
+
+	CALLOC_ARRAY(q->threads, q->nr_threads);
+	for (i = 0; i < q->nr_threads; i++) {
+		int err = pthread_create(&q->threads[i], NULL,
+					 archive_job_thread, q);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	return q;
+}
+
+/* Wait for the oldest job and write it out; the caller holds the mutex. */
+static void archive_job_queue_write_one(struct archive_job_queue *q)
+{
+	struct archive_job_slot *slot = &q->slots[q->written % q->nr_slots];
+
+	while (!slot->done)
+		pthread_cond_wait(&q->cond_done, &q->mutex);
+
+	pthread_mutex_unlock(&q->mutex);
+	q->done(slot->job);
+	pthread_mutex_lock(&q->mutex);
+	slot->job = NULL;
+	q->written++;
+}
+
+void archive_job_queue_add(struct archive_job_queue *q, void *job)
+{
+	struct archive_job_slot *slot;
+
+	if (q->nr_threads <= 1) {
+		q->work(job);
+		q->done(job);
+		return;
+	}
+
+	pthread_mutex_lock(&q->mutex);
+	while (q->added - q->written == q->nr_slots)
+		archive_job_queue_write_one(q);
+	slot = &q->slots[q->added++ % q->nr_slots];
+	slot->job = job;
+	slot->done = 0;
+	pthread_cond_signal(&q->cond_added);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+void archive_job_queue_flush(struct archive_job_queue *q)
+{
+	if (q->nr_threads <= 1)
+		return;
+
+	pthread_mutex_lock(&q->mutex);
+	while (q->written != q->added)
+		archive_job_queue_write_one(q);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+void archive_job_queue_finish(struct archive_job_queue *q)
+{
+	int i;
+
+	if (q->nr_threads > 1) {
+		archive_job_queue_flush(q);
+
+		pthread_mutex_lock(&q->mutex);
+		q->stopping = 1;
+		pthread_cond_broadcast(&q->cond_added);
+		pthread_mutex_unlock(&q->mutex);
+		for (i = 0; i < q->nr_threads; i++)
+			pthread_join(q->threads[i], NULL);
+
+		pthread_cond_destroy(&q->cond_added);
+		pthread_cond_destroy(&q->cond_done);
+		pthread_mutex_destroy(&q->mutex);
+		free(q->threads);
+		free(q->slots);
+	}
+	free(q);
+}
+
 static const struct archiver *lookup_archiver(const char *name)
 {
 	int i;
@@ -448,6 +594,7 @@ static int parse_archive_args(int argc, const char **argv,
 	const char *exec = NULL;
 	const char *output = NULL;
 	int compression_level = -1;
+	int nr_threads = -1;
 	int verbose = 0;
 	int i;
 	int list = 0;
@@ -472,6 +619,8 @@ static int parse_archive_args(int argc, const char **argv,
 		OPT__COMPR_HIDDEN('7', &compression_level, 7),
 		OPT__COMPR_HIDDEN('8', &compression_level, 8),
 		OPT__COMPR('9', &compression_level, N_("compress better"), 9),
+		OPT_INTEGER(0, "threads", &nr_threads,
+			N_("compress with <n> threads")),
 		OPT_GROUP(""),
 		OPT_BOOL('l', "list", &list,
 			N_("list supported archive formats")),
@@ -523,6 +672,20 @@ static int parse_archive_args(int argc, const char **argv,
 					format, compression_level);
 		}
 	}
+
+	/* Remote clients do not get to decide how busy we get. */
+	if (is_remote || nr_threads < 0) {
+		nr_threads = 0;
+		git_config_get_int("archive.threads", &nr_threads);
+	}
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (!HAVE_THREADS)
+		nr_threads = 1;
+	args->nr_threads = nr_threads;
+
 	args->verbose = verbose;
 	args->base = base;
 	args->baselen = strlen(base);
@@ -19,6 +19,7 @@ struct archiver_args {
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
 	int compression_level;
+	int nr_threads;
 };
 
 /* main api */
@@ -51,6 +52,25 @@ typedef int (*write_archive_entry_fn_t)(struct archiver_args *args,
 					unsigned int mode);
 
 int write_archive_entries(struct archiver_args *args, write_archive_entry_fn_t write_entry);
+
+/*
+ * Compress the parts of an archive in parallel: "work" is run on the
+ * jobs by "nr_threads" threads, and "done" on the calling thread, once
+ * per job and in the order the jobs were added, to write out the result.
+ * With a single thread, each job is handled right away by
+ * archive_job_queue_add().
+ */
+typedef void (*archive_job_fn)(void *job);
+struct archive_job_queue;
+
+struct archive_job_queue *archive_job_queue_start(int nr_threads,
+						  archive_job_fn work,
+						  archive_job_fn done);
+void archive_job_queue_add(struct archive_job_queue *q, void *job);
+/* Wait for all jobs added so far and call "done" on them. */
+void archive_job_queue_flush(struct archive_job_queue *q);
+/* Flush the queue, stop its threads and free it. */
+void archive_job_queue_finish(struct archive_job_queue *q);
 void *object_file_to_archive(const struct archiver_args *args,
 			     const char *path, const struct object_id *oid,
 			     unsigned int mode, enum object_type *type,
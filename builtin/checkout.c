@@ -23,6 +23,7 @@
 #include "submodule-config.h"
 #include "tree.h"
 #include "tree-walk.h"
+#include "sparse-index.h"
 #include "unpack-trees.h"
 #include "wt-status.h"
 #include "xdiff-interface.h"
@@ -468,6 +469,8 @@ static int checkout_paths(const struct checkout_opts *opts,
 	repo_hold_locked_index(the_repository, &lock_file, LOCK_DIE_ON_ERROR);
 	if (read_cache_preload(&opts->pathspec) < 0)
 		return error(_("index file corrupt"));
+	/* Paths are checked out one by one, even outside of the cone. */
+	ensure_full_index(&the_index);
 
 	if (opts->source_tree)
 		read_tree_some(opts->source_tree, &opts->pathspec);
@@ -1534,6 +1537,9 @@ static int checkout_main(int argc, const char **argv, const char *prefix,
 
 	git_config(git_checkout_config, opts);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	opts->track = BRANCH_TRACK_UNSPECIFIED;
 
 	if (!opts->accept_pathspec && !opts->accept_ref)
@@ -32,6 +32,7 @@
 #include "connected.h"
 #include "packfile.h"
 #include "list-objects-filter-options.h"
+#include "bundle-uri.h"
 
 /*
  * Overall FIXMEs:
@@ -52,6 +53,7 @@ static int option_no_tags;
 static int option_shallow_submodules;
 static int deepen;
 static char *option_template, *option_depth, *option_since;
+static char *option_ref_storage;
 static char *option_origin = NULL;
 static char *option_branch = NULL;
 static struct string_list option_not = STRING_LIST_INIT_NODUP;
@@ -69,6 +71,7 @@ static int max_jobs = -1;
 static struct string_list option_recurse_submodules = STRING_LIST_INIT_NODUP;
 static struct list_objects_filter_options filter_options;
 static struct string_list server_options = STRING_LIST_INIT_NODUP;
+static struct string_list option_bundle_uri = STRING_LIST_INIT_NODUP;
 static int option_remote_submodules;
 
 static int recurse_submodules_cb(const struct option *opt,
@@ -136,10 +139,14 @@ static struct option builtin_clone_options[] = {
 		    N_("any cloned submodules will be shallow")),
 	OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 		   N_("separate git dir from working tree")),
+	OPT_STRING(0, "ref-storage", &option_ref_storage, N_("format"),
+		   N_("how to store references (\"files\" or \"reftable\")")),
 	OPT_STRING_LIST('c', "config", &option_config, N_("key=value"),
 			N_("set config inside the new repository")),
 	OPT_STRING_LIST(0, "server-option", &server_options,
 			N_("server-specific"), N_("option to transmit")),
+	OPT_STRING_LIST(0, "bundle-uri", &option_bundle_uri, N_("uri"),
+			N_("seed the clone from a bundle before fetching")),
 	OPT_SET_INT('4', "ipv4", &family, N_("use IPv4 addresses only"),
 			TRANSPORT_FAMILY_IPV4),
 	OPT_SET_INT('6', "ipv6", &family, N_("use IPv6 addresses only"),
@@ -757,6 +764,29 @@ static int git_sparse_checkout_init(const char *repo)
 	return result;
 }
 
+/*
+ * Seed the object store from the bundles given with --bundle-uri or,
+ * when transfer.bundleURI is set, from those the remote advertises.
+ */
+static void fetch_bundles(struct transport *transport)
+{
+	struct string_list uris = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	int advertised = 0;
+
+	for_each_string_list_item(item, &option_bundle_uri)
+		string_list_append(&uris, item->string);
+	if (!uris.nr &&
+	    !git_config_get_bool("transfer.bundleuri", &advertised) &&
+	    advertised)
+		transport_get_bundle_uris(transport, &uris);
+
+	if (uris.nr)
+		fetch_bundle_uris(the_repository, &uris,
+				  !!option_bundle_uri.nr, option_verbosity < 0);
+	string_list_clear(&uris, 0);
+}
+
 static int checkout(int submodule_progress)
 {
 	struct object_id oid;
@@ -967,6 +997,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		deepen = 1;
 	if (option_single_branch == -1)
 		option_single_branch = deepen ? 1 : 0;
+	if (deepen && option_bundle_uri.nr)
+		die(_("--bundle-uri is incompatible with --depth, --shallow-since, and --shallow-exclude"));
 
 	if (option_mirror)
 		option_bare = 1;
@@ -1096,7 +1128,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		}
 	}
 
-	init_db(git_dir, real_git_dir, option_template, INIT_DB_QUIET);
+	init_db(git_dir, real_git_dir, option_template, option_ref_storage,
+		INIT_DB_QUIET);
 
 	if (real_git_dir)
 		git_dir = real_git_dir;
@@ -1204,6 +1237,9 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	refs = transport_get_remote_refs(transport, &ref_prefixes);
 
+	if (refs && !is_local && !deepen)
+		fetch_bundles(transport);
+
 	if (refs) {
 		mapped_refs = wanted_peer_refs(refs, &remote->fetch);
 		/*
@@ -25,6 +25,7 @@ define_commit_slab(commit_names, struct commit_name *);
 static const char * const describe_usage[] = {
 	N_("git describe [<options>] [<commit-ish>...]"),
 	N_("git describe [<options>] --dirty"),
+	N_("git describe [<options>] --stdin"),
 	NULL
 };
 
@@ -524,7 +525,7 @@ static void describe(const char *arg, int last_one)
 
 	puts(sb.buf);
 
-	if (!last_one)
+	if (!last_one && cmit)
 		clear_commit_marks(cmit, -1);
 
 	strbuf_release(&sb);
@@ -532,7 +533,7 @@ static void describe(const char *arg, int last_one)
 
 int cmd_describe(int argc, const char **argv, const char *prefix)
 {
-	int contains = 0;
+	int contains = 0, from_stdin = 0;
 	struct option options[] = {
 		OPT_BOOL(0, "contains",   &contains, N_("find the tag that comes after the commit")),
 		OPT_BOOL(0, "debug",      &debug, N_("debug search strategy on stderr")),
@@ -557,6 +558,8 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 		{OPTION_STRING, 0, "broken",  &broken, N_("mark"),
 			N_("append <mark> on broken working tree (default: \"-broken\")"),
 			PARSE_OPT_OPTARG, NULL, (intptr_t) "-broken"},
+		OPT_BOOL(0, "stdin", &from_stdin,
+			 N_("read commit-ishes to describe from stdin")),
 		OPT_END(),
 	};
 
@@ -575,6 +578,15 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 	if (longformat && abbrev == 0)
 		die(_("--long is incompatible with --abbrev=0"));
 
+	if (from_stdin) {
+		if (argc)
+			die(_("--stdin is incompatible with commit-ishes"));
+		if (dirty)
+			die(_("--dirty is incompatible with --stdin"));
+		if (broken)
+			die(_("--broken is incompatible with --stdin"));
+	}
+
 	if (contains) {
 		struct string_list_item *item;
 		struct argv_array args;
@@ -592,7 +604,18 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 			for_each_string_list_item(item, &exclude_patterns)
 				argv_array_pushf(&args, "--exclude=refs/tags/%s", item->string);
 		}
-		if (argc)
+		if (from_stdin) {
+			struct strbuf line = STRBUF_INIT;
+
+			/*
+			 * Hand the whole batch to a single name-rev run, so
+			 * that the refs are walked once for all of them.
+			 */
+			while (strbuf_getline(&line, stdin) != EOF)
+				if (line.len)
+					argv_array_push(&args, line.buf);
+			strbuf_release(&line);
+		} else if (argc)
 			argv_array_pushv(&args, argv);
 		else
 			argv_array_push(&args, "HEAD");
@@ -604,7 +627,22 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 	if (!hashmap_get_size(&names) && !always)
 		die(_("No names found, cannot describe anything."));
 
-	if (argc == 0) {
+	if (from_stdin) {
+		struct strbuf line = STRBUF_INIT;
+
+		/*
+		 * The names and the commits parsed for one walk are kept
+		 * for the next, so describing many commits in one process
+		 * is much cheaper than running us once for each of them.
+		 */
+		while (strbuf_getline(&line, stdin) != EOF) {
+			if (!line.len)
+				continue;
+			describe(line.buf, 0);
+			fflush(stdout);
+		}
+		strbuf_release(&line);
+	} else if (argc == 0) {
 		if (broken) {
 			struct child_process cp = CHILD_PROCESS_INIT;
 			argv_array_pushv(&cp.args, diff_index_args);
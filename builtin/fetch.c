@@ -27,6 +27,7 @@
 #include "branch.h"
 #include "promisor-remote.h"
 #include "commit-graph.h"
+#include "bundle-uri.h"
 
 #define FORCED_UPDATES_DELAY_WARNING_IN_MS (10 * 1000)
 
@@ -76,6 +77,7 @@ static int shown_url = 0;
 static struct refspec refmap = REFSPEC_INIT_FETCH;
 static struct list_objects_filter_options filter_options;
 static struct string_list server_options = STRING_LIST_INIT_DUP;
+static struct string_list bundle_uris = STRING_LIST_INIT_DUP;
 static struct string_list negotiation_tip = STRING_LIST_INIT_NODUP;
 static int fetch_write_commit_graph = -1;
 
@@ -188,6 +190,8 @@ static struct option builtin_fetch_options[] = {
 	{ OPTION_CALLBACK, 0, "refmap", NULL, N_("refmap"),
 	  N_("specify fetch refmap"), PARSE_OPT_NONEG, parse_refmap_arg },
 	OPT_STRING_LIST('o', "server-option", &server_options, N_("server-specific"), N_("option to transmit")),
+	OPT_STRING_LIST(0, "bundle-uri", &bundle_uris, N_("uri"),
+			N_("seed the repository from a bundle before fetching")),
 	OPT_SET_INT('4', "ipv4", &family, N_("use IPv4 addresses only"),
 			TRANSPORT_FAMILY_IPV4),
 	OPT_SET_INT('6', "ipv6", &family, N_("use IPv6 addresses only"),
@@ -1788,6 +1792,23 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	if (depth || deepen_since || deepen_not.nr)
 		deepen = 1;
 
+	if (bundle_uris.nr) {
+		if (deepen)
+			die(_("--bundle-uri is incompatible with --depth, --shallow-since, and --shallow-exclude"));
+		for (i = 0; i < bundle_uris.nr; i++) {
+			struct string_list_item *item = &bundle_uris.items[i];
+
+			/* paths are relative to where we were started */
+			if (!strstr(item->string, "://")) {
+				char *path = prefix_filename(prefix, item->string);
+				free(item->string);
+				item->string = path;
+			}
+		}
+		fetch_bundle_uris(the_repository, &bundle_uris, 1,
+				  verbosity < 0);
+	}
+
 	if (filter_options.choice && !has_promisor_remote())
 		die("--filter can only be used when extensions.partialClone is set");
 
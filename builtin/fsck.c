@@ -44,6 +44,26 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
+
+/*
+ * While checking loose objects with several threads, everything but
+ * reading and hashing them happens under this lock.
+ */
+static int threads_active;
+static pthread_mutex_t fsck_mutex;
+
+static inline void fsck_lock(void)
+{
+	if (threads_active)
+		pthread_mutex_lock(&fsck_mutex);
+}
+
+static inline void fsck_unlock(void)
+{
+	if (threads_active)
+		pthread_mutex_unlock(&fsck_mutex);
+}
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -620,15 +640,18 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 	int eaten;
 
 	if (read_loose_object(path, oid, &type, &size, &contents) < 0) {
+		fsck_lock();
 		errors_found |= ERROR_OBJECT;
 		error(_("%s: object corrupt or missing: %s"),
 		      oid_to_hex(oid), path);
+		fsck_unlock();
 		return 0; /* keep checking other objects */
 	}
 
 	if (!contents && type != OBJ_BLOB)
 		BUG("read_loose_object streamed a non-blob");
 
+	fsck_lock();
 	obj = parse_object_buffer(the_repository, oid, type, size,
 				  contents, &eaten);
 
@@ -636,6 +659,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 		errors_found |= ERROR_OBJECT;
 		error(_("%s: object could not be parsed: %s"),
 		      oid_to_hex(oid), path);
+		fsck_unlock();
 		if (!eaten)
 			free(contents);
 		return 0; /* keep checking other objects */
@@ -645,6 +669,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 	obj->flags |= HAS_OBJ;
 	if (fsck_obj(obj, contents, size))
 		errors_found |= ERROR_OBJECT;
+	fsck_unlock();
 
 	if (!eaten)
 		free(contents);
@@ -653,31 +678,85 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 
 static int fsck_cruft(const char *basename, const char *path, void *data)
 {
-	if (!starts_with(basename, "tmp_obj_"))
+	if (!starts_with(basename, "tmp_obj_")) {
+		fsck_lock();
 		fprintf_ln(stderr, _("bad sha1 file: %s"), path);
+		fsck_unlock();
+	}
 	return 0;
 }
 
-static int fsck_subdir(unsigned int nr, const char *path, void *progress)
+struct fsck_object_dir_data {
+	const char *path;
+	struct progress *progress;
+	unsigned int next_subdir, nr_done;
+};
+
+/* Check the loose objects of one fan-out directory after another. */
+static void *fsck_object_subdirs(void *data)
 {
-	display_progress(progress, nr + 1);
-	return 0;
+	struct fsck_object_dir_data *d = data;
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addstr(&path, d->path);
+	for (;;) {
+		unsigned int nr;
+
+		fsck_lock();
+		nr = d->next_subdir++;
+		fsck_unlock();
+		if (nr > 0xff)
+			break;
+
+		for_each_file_in_obj_subdir(nr, &path, fsck_loose, fsck_cruft,
+					    NULL, NULL);
+
+		fsck_lock();
+		display_progress(d->progress, ++d->nr_done);
+		fsck_unlock();
+	}
+	strbuf_release(&path);
+	return NULL;
 }
 
 static void fsck_object_dir(const char *path)
 {
-	struct progress *progress = NULL;
+	struct fsck_object_dir_data data;
+	pthread_t *threads;
+	int i;
 
 	if (verbose)
 		fprintf_ln(stderr, _("Checking object directory"));
 
+	memset(&data, 0, sizeof(data));
+	data.path = path;
 	if (show_progress)
-		progress = start_progress(_("Checking object directories"), 256);
+		data.progress = start_progress(_("Checking object directories"), 256);
 
-	for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft, fsck_subdir,
-				      progress);
-	display_progress(progress, 256);
-	stop_progress(&progress);
+	if (nr_threads <= 1) {
+		fsck_object_subdirs(&data);
+	} else {
+		pthread_mutex_init(&fsck_mutex, NULL);
+		threads_active = 1;
+
+		CALLOC_ARRAY(threads, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			int ret = pthread_create(&threads[i], NULL,
+						 fsck_object_subdirs, &data);
+			if (ret)
+				die(_("unable to create thread: %s"),
+				    strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+
+		threads_active = 0;
+		pthread_mutex_destroy(&fsck_mutex);
+	}
+
+	display_progress(data.progress, 256);
+	stop_progress(&data.progress);
 }
 
 static int fsck_head_link(const char *head_ref_name,
@@ -785,6 +864,7 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("check objects with <n> threads")),
 	OPT_END(),
 };
 
@@ -807,6 +887,16 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (check_strict)
 		fsck_obj_options.strict = 1;
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!HAVE_THREADS && nr_threads != 1) {
+		if (nr_threads)
+			warning(_("no threads support, ignoring --threads"));
+		nr_threads = 1;
+	}
+	if (!nr_threads)
+		nr_threads = online_cpus();
+
 	if (show_progress == -1)
 		show_progress = isatty(2);
 	if (verbose)
@@ -850,7 +940,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -0,0 +1,346 @@
+#include "builtin.h"
+#include "config.h"
+#include "fsmonitor--daemon.h"
+#include "fsmonitor-ipc.h"
+#include "parse-options.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "tempfile.h"
+#include "trace2.h"
+#include "unix-socket.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon (start|stop|status)"),
+	N_("git fsmonitor--daemon run [--debug]"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+/*
+ * A long-running daemon cannot remember every path that ever changed;
+ * past this many, it starts over and lets the clients rescan once.
+ */
+#define FSMONITOR_MAX_CHANGED_PATHS (1 << 20)
+
+/*
+ * Clients and the daemon each derive their nanosecond clock from the
+ * wall clock separately; be generous when comparing the two.
+ */
+#define FSMONITOR_CLOCK_SLOP ((uint64_t)10 * 1000 * 1000)
+
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t time;
+	char path[FLEX_ARRAY];
+};
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a, *b;
+
+	a = container_of(eptr, const struct changed_path, ent);
+	b = container_of(entry_or_key, const struct changed_path, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path)
+{
+	struct changed_path key, *e;
+
+	hashmap_entry_init(&key.ent, strhash(path));
+	e = hashmap_get_entry(&state->changed_paths, &key, ent, path);
+	if (!e) {
+		if (hashmap_get_size(&state->changed_paths) >=
+		    FSMONITOR_MAX_CHANGED_PATHS) {
+			fsmonitor_daemon_forget_all(state);
+			return;
+		}
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->ent, key.ent.hash);
+		hashmap_add(&state->changed_paths, &e->ent);
+	}
+	e->time = getnanotime();
+}
+
+void fsmonitor_daemon_forget_all(struct fsmonitor_daemon_state *state)
+{
+	hashmap_free_entries(&state->changed_paths, struct changed_path, ent);
+	hashmap_init(&state->changed_paths, changed_path_cmp, NULL, 0);
+	state->start_time = getnanotime();
+	trace2_data_intmax("fsmonitor", NULL, "forget-all", 1);
+}
+
+static void answer_query(struct fsmonitor_daemon_state *state,
+			 const char *arg, struct strbuf *out)
+{
+	struct hashmap_iter iter;
+	struct changed_path *e;
+	uintmax_t since;
+	char *end;
+	int count = 0;
+
+	since = strtoumax(arg, &end, 10);
+	if (*end)
+		return;
+
+	strbuf_add(out, "ok", 3);
+	if (since < state->start_time) {
+		strbuf_addch(out, '/');
+		return;
+	}
+
+	if (since > FSMONITOR_CLOCK_SLOP)
+		since -= FSMONITOR_CLOCK_SLOP;
+	hashmap_for_each_entry(&state->changed_paths, &iter, e, ent) {
+		if (e->time < since)
+			continue;
+		strbuf_add(out, e->path, strlen(e->path) + 1);
+		count++;
+	}
+	trace2_data_intmax("fsmonitor", NULL, "query/changed", count);
+}
+
+static void serve_one_client(struct fsmonitor_daemon_state *state, int fd)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	const char *arg;
+
+	if (strbuf_read(&request, fd, 128) < 0) {
+		warning_errno(_("could not read fsmonitor request"));
+		goto out;
+	}
+	strbuf_trim_trailing_newline(&request);
+
+	if (skip_prefix(request.buf, "query ", &arg))
+		answer_query(state, arg, &answer);
+	else if (!strcmp(request.buf, "ping"))
+		strbuf_addf(&answer, "ok %s", state->path_worktree_watch.buf);
+	else if (!strcmp(request.buf, "exit"))
+		/*
+		 * As in credential-cache--daemon, exiting removes our
+		 * socket first; the client sees EOF only afterwards.
+		 */
+		exit(0);
+	else
+		warning(_("fsmonitor client sent unknown request: %s"),
+			request.buf);
+
+	/* The client may have given up on us; there is no one to tell. */
+	if (answer.len)
+		write_in_full(fd, answer.buf, answer.len);
+
+out:
+	strbuf_release(&request);
+	strbuf_release(&answer);
+}
+
+static int serve_loop(struct fsmonitor_daemon_state *state, int listen_fd)
+{
+	struct pollfd pfd[2];
+	int ret;
+
+	pfd[0].fd = listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fsmonitor_listen_fd(state);
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return error_errno(_("poll failed"));
+		}
+
+		if (pfd[1].revents) {
+			ret = fsmonitor_listen_drain(state);
+			if (ret)
+				return ret < 0 ? -1 : 0;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			int client = accept(listen_fd, NULL, NULL);
+
+			if (client < 0) {
+				warning_errno(_("accept failed"));
+				continue;
+			}
+
+			/*
+			 * The client asks about changes that happened
+			 * before it connected; make sure we have seen them.
+			 */
+			ret = fsmonitor_listen_drain(state);
+			if (ret) {
+				close(client);
+				return ret < 0 ? -1 : 0;
+			}
+
+			serve_one_client(state, client);
+			close(client);
+		}
+	}
+}
+
+static int fsmonitor_run_daemon(int debug)
+{
+	struct fsmonitor_daemon_state state;
+	struct tempfile *socket_file;
+	char *socket_path;
+	int fd, ret;
+
+	memset(&state, 0, sizeof(state));
+	strbuf_init(&state.path_worktree_watch, 0);
+	strbuf_addstr(&state.path_worktree_watch,
+		      absolute_path(get_git_work_tree()));
+	hashmap_init(&state.changed_paths, changed_path_cmp, NULL, 0);
+
+	if (fsmonitor_listen_init(&state) < 0) {
+		fsmonitor_listen_release(&state);
+		return error(_("could not watch '%s'"),
+			     state.path_worktree_watch.buf);
+	}
+	/* Only from now on do we know about every change. */
+	state.start_time = getnanotime();
+
+	socket_path = absolute_pathdup(fsmonitor_ipc_get_path());
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+	socket_file = register_tempfile(socket_path);
+
+	/* Outlive the terminal of whoever started us. */
+	signal(SIGHUP, SIG_IGN);
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno(_("unable to point stderr to /dev/null"));
+	}
+
+	trace2_region_enter("fsmonitor", "serve", NULL);
+	ret = serve_loop(&state, fd);
+	trace2_region_leave("fsmonitor", "serve", NULL);
+
+	close(fd);
+	delete_tempfile(&socket_file);
+	fsmonitor_listen_release(&state);
+	hashmap_free_entries(&state.changed_paths, struct changed_path, ent);
+	strbuf_release(&state.path_worktree_watch);
+	free(socket_path);
+	return ret < 0;
+}
+
+#else
+
+static int fsmonitor_run_daemon(int debug)
+{
+	die(_("fsmonitor--daemon is not supported on this platform"));
+}
+
+#endif
+
+static int is_daemon_listening(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret = !fsmonitor_ipc_send_command("ping", &answer) &&
+		  starts_with(answer.buf, "ok ");
+
+	strbuf_release(&answer);
+	return ret;
+}
+
+static int fsmonitor_start_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	if (!fsmonitor_ipc_is_supported())
+		die(_("fsmonitor--daemon is not supported on this platform"));
+	if (is_daemon_listening())
+		return error(_("fsmonitor--daemon is already running in '%s'"),
+			     get_git_work_tree());
+
+	argv_array_pushl(&daemon.args, "fsmonitor--daemon", "run", NULL);
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		die_errno(_("unable to start fsmonitor--daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	if (r < 0)
+		die_errno(_("unable to read result code from fsmonitor--daemon"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		die(_("fsmonitor--daemon did not start"));
+	close(daemon.out);
+	return 0;
+}
+
+static int fsmonitor_stop_daemon(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+
+	if (fsmonitor_ipc_send_command("exit", &answer) < 0) {
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			die_errno(_("unable to connect to fsmonitor--daemon"));
+		return error(_("fsmonitor--daemon is not running"));
+	}
+	strbuf_release(&answer);
+	return 0;
+}
+
+static int fsmonitor_daemon_status(void)
+{
+	if (is_daemon_listening()) {
+		printf(_("fsmonitor-daemon is watching '%s'\n"),
+		       get_git_work_tree());
+		return 0;
+	}
+
+	printf(_("fsmonitor-daemon is not watching '%s'\n"),
+	       get_git_work_tree());
+	return 1;
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	int debug = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	trace2_cmd_mode(argv[0]);
+
+	if (!strcmp(argv[0], "start"))
+		return !!fsmonitor_start_daemon();
+	if (!strcmp(argv[0], "run")) {
+		if (is_daemon_listening())
+			return error(_("fsmonitor--daemon is already running in '%s'"),
+				     get_git_work_tree());
+		return !!fsmonitor_run_daemon(debug);
+	}
+	if (!strcmp(argv[0], "stop"))
+		return !!fsmonitor_stop_daemon();
+	if (!strcmp(argv[0], "status"))
+		return fsmonitor_daemon_status();
+
+	die(_("unrecognized subcommand: %s"), argv[0]);
+}
@@ -176,6 +176,19 @@ static int needs_work_tree_config(const char *git_dir, const char *work_tree)
 	return 1;
 }
 
+static int is_reinit(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char junk[2];
+	char *path;
+	int ret;
+
+	path = git_path_buf(&buf, "HEAD");
+	ret = !access(path, R_OK) || readlink(path, junk, sizeof(junk) - 1) != -1;
+	strbuf_release(&buf);
+	return ret;
+}
+
 static int create_default_files(const char *template_path,
 				const char *original_git_dir)
 {
@@ -183,7 +196,6 @@ static int create_default_files(const char *template_path,
 	struct strbuf buf = STRBUF_INIT;
 	char *path;
 	char repo_version_string[10];
-	char junk[2];
 	int reinit;
 	int filemode;
 	struct strbuf err = STRBUF_INIT;
@@ -229,6 +241,12 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Check for an existing HEAD before setting up the refs db,
+	 * which may create a placeholder HEAD file.
+	 */
+	reinit = is_reinit();
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -236,18 +254,22 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
 	}
 
-	/* This forces creation of new config file */
-	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+	/*
+	 * This forces creation of new config file. A reference storage
+	 * other than "files" is an extension, which needs version 1.
+	 */
+	xsnprintf(repo_version_string, sizeof(repo_version_string), "%d",
+		  strcmp(the_repository->ref_storage_format, "files") ?
+		  1 : GIT_REPO_VERSION);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (strcmp(the_repository->ref_storage_format, "files"))
+		git_config_set("extensions.refStorage",
+			       the_repository->ref_storage_format);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -341,7 +363,8 @@ static void separate_git_dir(const char *git_dir, const char *git_link)
 }
 
 int init_db(const char *git_dir, const char *real_git_dir,
-	    const char *template_dir, unsigned int flags)
+	    const char *template_dir, const char *ref_storage_format,
+	    unsigned int flags)
 {
 	int reinit;
 	int exist_ok = flags & INIT_DB_EXIST_OK;
@@ -380,6 +403,17 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	 */
 	check_repository_format();
 
+	if (ref_storage_format) {
+		if (!ref_storage_backend_exists(ref_storage_format))
+			die(_("unknown reference storage format '%s'"),
+			    ref_storage_format);
+		if (is_reinit() &&
+		    strcmp(ref_storage_format, the_repository->ref_storage_format))
+			die(_("attempt to reinitialize repository with a "
+			      "different reference storage format"));
+		repo_set_ref_storage_format(the_repository, ref_storage_format);
+	}
+
 	reinit = create_default_files(template_dir, original_git_dir);
 
 	create_object_directory();
@@ -465,7 +499,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-storage=<format>] [<directory>]"),
 	NULL
 };
 
@@ -481,6 +515,7 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	const char *real_git_dir = NULL;
 	const char *work_tree;
 	const char *template_dir = NULL;
+	const char *ref_storage_format = NULL;
 	unsigned int flags = 0;
 	const struct option init_db_options[] = {
 		OPT_STRING(0, "template", &template_dir, N_("template-directory"),
@@ -494,6 +529,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-storage", &ref_storage_format, N_("format"),
+			   N_("how to store references (\"files\" or \"reftable\")")),
 		OPT_END()
 	};
 
@@ -597,5 +634,6 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	UNLEAK(work_tree);
 
 	flags |= INIT_DB_EXIST_OK;
-	return init_db(git_dir, real_git_dir, template_dir, flags);
+	return init_db(git_dir, real_git_dir, template_dir, ref_storage_format,
+		       flags);
 }
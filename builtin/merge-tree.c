@@ -7,8 +7,18 @@
 #include "blob.h"
 #include "exec-cmd.h"
 #include "merge-blobs.h"
-
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+#include "commit.h"
+#include "config.h"
+#include "merge-incore.h"
+#include "merge-recursive.h"
+#include "parse-options.h"
+#include "quote.h"
+
+static const char * const merge_tree_usage[] = {
+	N_("git merge-tree --write-tree [-z] <branch1> <branch2>"),
+	N_("git merge-tree <base-tree> <branch1> <branch2>"),
+	NULL
+};
 
 struct merge_list {
 	struct merge_list *next;
@@ -28,7 +38,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -227,7 +237,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(r, t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -344,7 +354,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -368,19 +378,98 @@ static void *get_tree_descriptor(struct repository *r,
 	return buf;
 }
 
+static struct commit *get_commit(struct repository *r, const char *rev)
+{
+	struct object_id oid;
+	struct commit *commit;
+
+	if (repo_get_oid(r, rev, &oid))
+		die(_("unknown rev %s"), rev);
+	commit = lookup_commit_reference(r, &oid);
+	if (!commit)
+		die(_("could not parse as a commit: %s"), rev);
+	return commit;
+}
+
+static int write_tree(struct repository *r, const char *branch1,
+		      const char *branch2, int line_termination)
+{
+	struct merge_options opt;
+	struct merge_incore_result result;
+	int i, j;
+
+	init_merge_options(&opt, r);
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+
+	if (merge_incore_recursive(&opt, NULL, get_commit(r, branch1),
+				   get_commit(r, branch2), &result) < 0)
+		die(_("merge of %s and %s failed"), branch1, branch2);
+
+	printf("%s%c", oid_to_hex(&result.tree->object.oid), line_termination);
+
+	/* the conflicted files, in the format of "ls-files -u" */
+	for (i = 0; i < result.conflicts_nr; i++) {
+		struct merge_conflict *c = &result.conflicts[i];
+
+		for (j = 0; j < 3; j++) {
+			struct merge_conflict_stage *stage = &c->stages[j];
+
+			if (!stage->mode)
+				continue;
+			printf("%06o %s %d\t", stage->mode,
+			       oid_to_hex(&stage->oid), j + 1);
+			write_name_quoted(stage->path ? stage->path : c->path,
+					  stdout, line_termination);
+		}
+	}
+
+	/* and what kind of conflict each of them is */
+	if (result.conflicts_nr)
+		putchar(line_termination);
+	for (i = 0; i < result.conflicts_nr; i++) {
+		struct merge_conflict *c = &result.conflicts[i];
+
+		printf("%s\t", merge_conflict_type_name(c->type));
+		write_name_quoted(c->path, stdout, line_termination);
+	}
+
+	i = result.clean;
+	merge_incore_result_release(&result);
+	return !i;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct repository *r = the_repository;
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
+	int write_tree_mode = 0;
+	int line_termination = '\n';
+	struct option options[] = {
+		OPT_BOOL(0, "write-tree", &write_tree_mode,
+			 N_("do a real merge and write the merged tree")),
+		OPT_SET_INT('z', NULL, &line_termination,
+			    N_("separate output lines with NUL"), '\0'),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options, merge_tree_usage, 0);
+
+	if (write_tree_mode) {
+		if (argc != 2)
+			usage_with_options(merge_tree_usage, options);
+		git_config(git_xmerge_config, NULL);
+		return write_tree(r, argv[0], argv[1], line_termination);
+	}
 
-	if (argc != 4)
-		usage(merge_tree_usage);
+	if (argc != 3 || line_termination != '\n')
+		usage_with_options(merge_tree_usage, options);
 
-	buf1 = get_tree_descriptor(r, t+0, argv[1]);
-	buf2 = get_tree_descriptor(r, t+1, argv[2]);
-	buf3 = get_tree_descriptor(r, t+2, argv[3]);
-	merge_trees(t, "");
+	buf1 = get_tree_descriptor(r, t+0, argv[0]);
+	buf2 = get_tree_descriptor(r, t+1, argv[1]);
+	buf3 = get_tree_descriptor(r, t+2, argv[2]);
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
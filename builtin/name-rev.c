@@ -9,6 +9,7 @@
 #include "prio-queue.h"
 #include "sha1-lookup.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
 
 /*
  * One day.  See the 'name a rev shortly after epoch' test in t6120 when
@@ -27,8 +28,22 @@ typedef struct rev_name {
 define_commit_slab(commit_rev_name, struct rev_name *);
 
 static timestamp_t cutoff = TIME_MAX;
+static timestamp_t generation_cutoff = GENERATION_NUMBER_INFINITY;
 static struct commit_rev_name rev_names;
 
+/*
+ * A commit can only be named if it is reachable from a tip, so there is
+ * no point in walking below the oldest commit we were asked about.  With
+ * generation numbers this is exact; otherwise fall back to commit dates
+ * (with some slop for clock skew).
+ */
+static int commit_is_before_cutoff(struct commit *commit)
+{
+	if (generation_cutoff && generation_cutoff < GENERATION_NUMBER_INFINITY)
+		return commit->generation < generation_cutoff;
+	return commit->date < cutoff;
+}
+
 /* How many generations are maximally preferred over _one_ merge traversal? */
 #define MERGE_TRAVERSAL_WEIGHT 65535
 
@@ -116,7 +131,7 @@ static void name_rev(struct commit *start_commit,
 	char *to_free = NULL;
 
 	parse_commit(start_commit);
-	if (start_commit->date < cutoff)
+	if (commit_is_before_cutoff(start_commit))
 		return;
 
 	if (deref)
@@ -146,7 +161,7 @@ static void name_rev(struct commit *start_commit,
 			int generation, distance;
 
 			parse_commit(parent);
-			if (parent->date < cutoff)
+			if (commit_is_before_cutoff(parent))
 				continue;
 
 			if (parent_number > 1) {
@@ -489,6 +504,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 	}
 	if (all || transform_stdin)
 		cutoff = 0;
+	if (!cutoff || !generation_numbers_enabled(the_repository))
+		generation_cutoff = 0;
 
 	for (; argc; argc--, argv++) {
 		struct object_id oid;
@@ -519,6 +536,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		if (commit) {
 			if (cutoff > commit->date)
 				cutoff = commit->date;
+			if (generation_cutoff > commit->generation)
+				generation_cutoff = commit->generation;
 		}
 
 		if (peel_tag) {
@@ -84,6 +84,7 @@ static int window = 10;
 static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
+static int enumeration_threads = 1;
 static int pack_to_stdout;
 static int sparse;
 static int thin;
@@ -115,6 +116,24 @@ static unsigned long window_memory_limit = 0;
 
 static struct list_objects_filter_options filter_options;
 
+/*
+ * Packs configured with "uploadpack.packfileUri" that the client can
+ * download on its own. When the client accepts the protocol of their
+ * URI, their objects are left out of the pack we send, and we print
+ * "<pack-hash> <uri>" before the pack data for those of them that hold
+ * an object we would otherwise have sent.
+ */
+struct configured_pack_uri {
+	char *pack_hash_hex;
+	char *uri;
+	struct packed_git *p;
+	unsigned used : 1;
+};
+static struct configured_pack_uri *pack_uris;
+static size_t pack_uris_nr, pack_uris_alloc;
+static struct string_list uri_protocols = STRING_LIST_INIT_NODUP;
+static int pack_uris_active;
+
 enum missing_action {
 	MA_ERROR = 0,      /* fail if any missing objects are encountered */
 	MA_ALLOW_ANY,      /* silently allow ALL missing objects */
@@ -404,7 +423,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -421,10 +440,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -1013,6 +1037,85 @@ static int have_duplicate_entry(const struct object_id *oid,
 	return 1;
 }
 
+/*
+ * Return 1 if "p", the pack we would take an object from, is one of the
+ * packs whose URI we send instead of their objects, and remember that we
+ * need to send that URI.
+ */
+static int excluded_by_pack_uri(struct packed_git *p)
+{
+	size_t i;
+
+	if (!pack_uris_active || !p)
+		return 0;
+
+	for (i = 0; i < pack_uris_nr; i++) {
+		struct configured_pack_uri *u = &pack_uris[i];
+
+		if (u->p == p) {
+			u->used = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int uri_protocol_allowed(const char *uri)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, &uri_protocols) {
+		const char *rest;
+
+		if (skip_prefix(uri, item->string, &rest) && *rest == ':')
+			return 1;
+	}
+	return 0;
+}
+
+static void prepare_pack_uris(void)
+{
+	struct strbuf name = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < pack_uris_nr; i++) {
+		struct configured_pack_uri *u = &pack_uris[i];
+		struct packed_git *p;
+
+		if (!uri_protocol_allowed(u->uri))
+			continue;
+
+		strbuf_reset(&name);
+		strbuf_addf(&name, "/pack-%s.pack", u->pack_hash_hex);
+		for (p = get_all_packs(the_repository); p; p = p->next) {
+			if (p->pack_local && ends_with(p->pack_name, name.buf))
+				break;
+		}
+		if (!p || open_pack_index(p)) {
+			warning(_("ignoring packfile URI for missing pack %s"),
+				u->pack_hash_hex);
+			continue;
+		}
+		u->p = p;
+		pack_uris_active = 1;
+	}
+	strbuf_release(&name);
+}
+
+static void write_pack_uris(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < pack_uris_nr; i++) {
+		if (pack_uris[i].used)
+			strbuf_addf(&buf, "%s %s\n", pack_uris[i].pack_hash_hex,
+				    pack_uris[i].uri);
+	}
+	write_or_die(1, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
 static int want_found_object(int exclude, struct packed_git *p)
 {
 	if (exclude)
@@ -1185,6 +1288,9 @@ static int add_object_entry(const struct object_id *oid, enum object_type type,
 		return 0;
 	}
 
+	if (!exclude && excluded_by_pack_uri(found_pack))
+		return 0;
+
 	create_object_entry(oid, type, pack_name_hash(name),
 			    exclude, name && no_try_delta(name),
 			    found_pack, found_offset);
@@ -1204,6 +1310,9 @@ static int add_object_entry_from_bitmap(const struct object_id *oid,
 	if (!want_object_in_pack(oid, 0, &pack, &offset))
 		return 0;
 
+	if (excluded_by_pack_uri(pack))
+		return 0;
+
 	create_object_entry(oid, type, name_hash, 0, 0, pack, offset);
 	return 1;
 }
@@ -1603,11 +1712,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+								  pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -1995,11 +2104,9 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 	unsigned long used, avail, size;
 
 	if (e->type_ != OBJ_OFS_DELTA && e->type_ != OBJ_REF_DELTA) {
-		packing_data_lock(&to_pack);
 		if (oid_object_info(the_repository, &e->idx.oid, &size) < 0)
 			die(_("unable to get size of %s"),
 			    oid_to_hex(&e->idx.oid));
-		packing_data_unlock(&to_pack);
 		return size;
 	}
 
@@ -2007,7 +2114,7 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 	if (!p)
 		BUG("when e->type is a delta, it must belong to a pack");
 
-	packing_data_lock(&to_pack);
+	obj_read_lock();
 	w_curs = NULL;
 	buf = use_pack(p, &w_curs, e->in_pack_offset, &avail);
 	used = unpack_object_header_buffer(buf, avail, &type, &size);
@@ -2016,7 +2123,7 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 		    oid_to_hex(&e->idx.oid));
 
 	unuse_pack(&w_curs);
-	packing_data_unlock(&to_pack);
+	obj_read_unlock();
 	return size;
 }
 
@@ -2078,9 +2185,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		packing_data_lock(&to_pack);
 		trg->data = read_object_file(&trg_entry->idx.oid, &type, &sz);
-		packing_data_unlock(&to_pack);
 		if (!trg->data)
 			die(_("object %s cannot be read"),
 			    oid_to_hex(&trg_entry->idx.oid));
@@ -2091,9 +2196,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		packing_data_lock(&to_pack);
 		src->data = read_object_file(&src_entry->idx.oid, &type, &sz);
-		packing_data_unlock(&to_pack);
 		if (!src->data) {
 			if (src_entry->preferred_base) {
 				static int warned = 0;
@@ -2377,6 +2480,7 @@ static void init_threaded_search(void)
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
 	pthread_cond_init(&progress_cond, NULL);
+	enable_obj_read_lock();
 }
 
 static void cleanup_threaded_search(void)
@@ -2384,6 +2488,7 @@ static void cleanup_threaded_search(void)
 	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
+	disable_obj_read_lock();
 }
 
 static void *threaded_find_deltas(void *arg)
@@ -2695,6 +2800,29 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
+	if (!strcmp(k, "uploadpack.packfileuri")) {
+		struct configured_pack_uri *u;
+		struct object_id pack_hash;
+		const char *uri;
+
+		if (!v)
+			return config_error_nonbool(k);
+		if (parse_oid_hex(v, &pack_hash, &uri) || *uri++ != ' ' || !*uri)
+			die(_("value of uploadpack.packfileuri must be "
+			      "of the form '<pack-hash> <uri>' (got '%s')"), v);
+		ALLOC_GROW(pack_uris, pack_uris_nr + 1, pack_uris_alloc);
+		u = &pack_uris[pack_uris_nr++];
+		memset(u, 0, sizeof(*u));
+		u->pack_hash_hex = xstrdup(oid_to_hex(&pack_hash));
+		u->uri = xstrdup(uri);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -2710,6 +2838,17 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		}
 		return 0;
 	}
+	if (!strcmp(k, "pack.enumerationthreads")) {
+		enumeration_threads = git_config_int(k, v);
+		if (enumeration_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    enumeration_threads);
+		if (!HAVE_THREADS && enumeration_threads != 1) {
+			warning(_("no threads support, ignoring %s"), k);
+			enumeration_threads = 1;
+		}
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2717,6 +2856,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -3035,12 +3181,13 @@ static int pack_options_allow_reuse(void)
 	       !ignore_packed_keep_on_disk &&
 	       !ignore_packed_keep_in_core &&
 	       (!local || !have_non_local_packs) &&
-	       !incremental;
+	       !incremental &&
+	       !pack_uris_active;
 }
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
-	if (!(bitmap_git = prepare_bitmap_walk(revs)))
+	if (!(bitmap_git = prepare_bitmap_walk(revs, &filter_options)))
 		return -1;
 
 	if (pack_options_allow_reuse() &&
@@ -3130,9 +3277,9 @@ static void get_object_list(int ac, const char **av)
 
 	if (!fn_show_object)
 		fn_show_object = show_object;
-	traverse_commit_list_filtered(&filter_options, &revs,
+	traverse_commit_list_parallel(&filter_options, &revs,
 				      show_commit, fn_show_object, NULL,
-				      NULL);
+				      enumeration_threads);
 
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
@@ -3256,6 +3403,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use OFS_DELTA objects")),
 		OPT_INTEGER(0, "threads", &delta_search_threads,
 			    N_("use threads when searching for best delta matches")),
+		OPT_INTEGER(0, "enumeration-threads", &enumeration_threads,
+			    N_("use threads when walking trees to find the objects to pack")),
 		OPT_BOOL(0, "non-empty", &non_empty,
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
@@ -3314,6 +3463,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not pack objects in promisor packfiles")),
 		OPT_BOOL(0, "delta-islands", &use_delta_islands,
 			 N_("respect islands during delta compression")),
+		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
+				N_("protocol"),
+				N_("exclude objects of packs configured with a packfile URI using this protocol")),
 		OPT_END(),
 	};
 
@@ -3328,6 +3480,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		sparse = the_repository->settings.pack_use_sparse;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		pack_idx_opts.flags |= WRITE_REV;
 	git_config(git_pack_config, NULL);
 
 	progress = isatty(2);
@@ -3398,6 +3552,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (!HAVE_THREADS && delta_search_threads != 1)
 		warning(_("no threads support, ignoring --threads"));
+	if (!enumeration_threads)
+		enumeration_threads = online_cpus();
+	if (!HAVE_THREADS && enumeration_threads != 1) {
+		warning(_("no threads support, ignoring --enumeration-threads"));
+		enumeration_threads = 1;
+	}
 	if (!pack_to_stdout && !pack_size_limit)
 		pack_size_limit = pack_size_limit_cfg;
 	if (pack_to_stdout && pack_size_limit)
@@ -3418,7 +3578,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (filter_options.choice) {
 		if (!pack_to_stdout)
 			die(_("cannot use --filter without --stdout"));
-		use_bitmap_index = 0;
+	}
+
+	if (uri_protocols.nr) {
+		if (!pack_to_stdout)
+			die(_("cannot use --uri-protocol without --stdout"));
+		prepare_pack_uris();
 	}
 
 	/*
@@ -3502,6 +3667,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 				    the_repository);
 	}
 
+	if (pack_uris_active)
+		write_pack_uris();
+
 	trace2_region_enter("pack-objects", "write-pack-file", the_repository);
 	write_pack_file();
 	trace2_region_leave("pack-objects", "write-pack-file", the_repository);
@@ -133,7 +133,10 @@ static int update_working_directory(struct pattern_list *pl)
 
 	if (!result) {
 		prime_cache_tree(r, r->index, tree);
+		/* The sparse-checkout file still holds the old patterns. */
+		r->index->sparse_checkout_patterns = pl;
 		write_locked_index(r->index, &lock_file, COMMIT_LOCK);
+		r->index->sparse_checkout_patterns = NULL;
 	} else
 		rollback_lock_file(&lock_file);
 
@@ -255,14 +258,30 @@ static int set_config(enum sparse_checkout_mode mode)
 }
 
 static char const * const builtin_sparse_checkout_init_usage[] = {
-	N_("git sparse-checkout init [--cone]"),
+	N_("git sparse-checkout init [--cone] [--[no-]sparse-index]"),
 	NULL
 };
 
 static struct sparse_checkout_init_opts {
 	int cone_mode;
+	int sparse_index;
 } init_opts;
 
+static int set_sparse_index_config(struct repository *repo, int enable)
+{
+	/* Unsetting a variable that was never set is no error. */
+	if (git_config_set_in_file_gently(git_path("config.worktree"),
+					  "index.sparse",
+					  enable ? "true" : NULL) && enable) {
+		error(_("failed to modify sparse-index config"));
+		return 1;
+	}
+
+	prepare_repo_settings(repo);
+	repo->settings.sparse_index = enable;
+	return 0;
+}
+
 static int sparse_checkout_init(int argc, const char **argv)
 {
 	struct pattern_list pl;
@@ -275,6 +294,8 @@ static int sparse_checkout_init(int argc, const char **argv)
 	static struct option builtin_sparse_checkout_init_options[] = {
 		OPT_BOOL(0, "cone", &init_opts.cone_mode,
 			 N_("initialize the sparse-checkout in cone mode")),
+		OPT_BOOL(0, "sparse-index", &init_opts.sparse_index,
+			 N_("toggle the use of a sparse index")),
 		OPT_END(),
 	};
 
@@ -282,6 +303,7 @@ static int sparse_checkout_init(int argc, const char **argv)
 	require_clean_work_tree(the_repository,
 				N_("initialize sparse-checkout"), NULL, 1, 0);
 
+	init_opts.sparse_index = -1;
 	argc = parse_options(argc, argv, NULL,
 			     builtin_sparse_checkout_init_options,
 			     builtin_sparse_checkout_init_usage, 0);
@@ -295,6 +317,10 @@ static int sparse_checkout_init(int argc, const char **argv)
 	if (set_config(mode))
 		return 1;
 
+	if (init_opts.sparse_index >= 0 &&
+	    set_sparse_index_config(the_repository, init_opts.sparse_index))
+		return 1;
+
 	memset(&pl, 0, sizeof(pl));
 
 	sparse_filename = get_sparse_checkout_filename();
@@ -0,0 +1,167 @@
+#include "cache.h"
+#include "repository.h"
+#include "config.h"
+#include "bundle.h"
+#include "bundle-uri.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "pkt-line.h"
+#include "refs.h"
+#include "run-command.h"
+#include "string-list.h"
+
+static void release_ref_list(struct ref_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++)
+		free(list->list[i].name);
+	FREE_AND_NULL(list->list);
+	list->nr = list->alloc = 0;
+}
+
+/*
+ * Download the bundle at "uri" with http-fetch into a temporary file in
+ * the object directory, whose name is left in "path".
+ */
+static int download_bundle(const char *uri, int nth, struct strbuf *path)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+
+	strbuf_addf(path, "%s/tmp_bundle_%"PRIuMAX"_%d",
+		    get_object_directory(), (uintmax_t)getpid(), nth);
+	unlink(path->buf);
+
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.no_stdout = 1;
+	argv_array_push(&cmd.args, "http-fetch");
+	argv_array_pushf(&cmd.args, "--output=%s", path->buf);
+	argv_array_push(&cmd.args, uri);
+	return run_command(&cmd);
+}
+
+static int write_bundle_refs(struct bundle_header *header)
+{
+	struct strbuf refname = STRBUF_INIT;
+	int i, ret = 0;
+
+	for (i = 0; i < header->references.nr; i++) {
+		struct ref_list_entry *e = &header->references.list[i];
+		const char *name;
+
+		if (!skip_prefix(e->name, "refs/", &name))
+			continue;
+
+		strbuf_reset(&refname);
+		strbuf_addf(&refname, "refs/bundles/%s", name);
+		if (check_refname_format(refname.buf, 0) ||
+		    update_ref("bundle-uri", refname.buf, &e->oid, NULL, 0,
+			       UPDATE_REFS_MSG_ON_ERR))
+			ret = -1;
+	}
+
+	strbuf_release(&refname);
+	return ret;
+}
+
+static int fetch_bundle_uri(struct repository *r, const char *uri, int nth,
+			    int from_user, int quiet)
+{
+	struct bundle_header header;
+	struct strbuf tmp = STRBUF_INIT;
+	const char *path;
+	int fd, ret = 0;
+
+	memset(&header, 0, sizeof(header));
+
+	if (starts_with(uri, "http://") || starts_with(uri, "https://")) {
+		if (download_bundle(uri, nth, &tmp)) {
+			ret = error(_("failed to download bundle from '%s'"),
+				    uri);
+			goto cleanup;
+		}
+		path = tmp.buf;
+	} else if (!from_user) {
+		/* do not let a server make us read our own files */
+		ret = error(_("bundle URI '%s' from the server is not http(s)"),
+			    uri);
+		goto cleanup;
+	} else if (!skip_prefix(uri, "file://", &path)) {
+		path = uri;
+	}
+
+	fd = read_bundle_header(path, &header);
+	if (fd < 0) {
+		ret = error(_("could not read bundle '%s'"), uri);
+		goto cleanup;
+	}
+
+	if (verify_bundle(r, &header, 0)) {
+		close(fd);
+		ret = error(_("prerequisites of bundle '%s' are missing"), uri);
+		goto cleanup;
+	}
+	if (unbundle(r, &header, fd, quiet ? 0 : BUNDLE_VERBOSE)) {
+		ret = error(_("failed to unbundle '%s'"), uri);
+		goto cleanup;
+	}
+	reprepare_packed_git(r);
+
+	if (write_bundle_refs(&header))
+		ret = error(_("failed to store the references of bundle '%s'"),
+			    uri);
+
+cleanup:
+	if (tmp.len) {
+		unlink(tmp.buf);
+		strbuf_addstr(&tmp, ".temp");
+		unlink(tmp.buf);
+	}
+	release_ref_list(&header.prerequisites);
+	release_ref_list(&header.references);
+	strbuf_release(&tmp);
+	return ret;
+}
+
+int fetch_bundle_uris(struct repository *r, const struct string_list *uris,
+		      int from_user, int quiet)
+{
+	int i, applied = 0;
+
+	trace2_region_enter("bundle-uri", "fetch", r);
+	for (i = 0; i < uris->nr; i++) {
+		const char *uri = uris->items[i].string;
+
+		if (fetch_bundle_uri(r, uri, i, from_user, quiet))
+			warning(_("ignoring bundle '%s'"), uri);
+		else
+			applied++;
+	}
+	trace2_data_intmax("bundle-uri", r, "applied", applied);
+	trace2_region_leave("bundle-uri", "fetch", r);
+
+	return applied;
+}
+
+int bundle_uri_advertise(struct repository *r, struct strbuf *value)
+{
+	return !!repo_config_get_value_multi(r, "uploadpack.bundleuri");
+}
+
+int bundle_uri_command(struct repository *r, struct argv_array *keys,
+		       struct packet_reader *request)
+{
+	const struct string_list *uris;
+	int i;
+
+	if (packet_reader_read(request) != PACKET_READ_FLUSH)
+		die(_("bundle-uri: expected flush after arguments"));
+
+	uris = repo_config_get_value_multi(r, "uploadpack.bundleuri");
+	for (i = 0; uris && i < uris->nr; i++)
+		packet_write_fmt(1, "%s\n", uris->items[i].string);
+	packet_flush(1);
+
+	return 0;
+}
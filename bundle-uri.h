@@ -0,0 +1,30 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+struct repository;
+struct argv_array;
+struct packet_reader;
+struct string_list;
+struct strbuf;
+
+/*
+ * Seed the object store of "r" from the bundles listed in "uris", in
+ * order, before fetching the rest of the history from a remote. Each
+ * entry is an http(s):// URL or, when "from_user" is set because the
+ * user gave them rather than the server, a local path or a file:// URL. The
+ * references of each bundle are written under "refs/bundles/", so that
+ * fetch-pack uses them as "have"s and negotiates only what is missing.
+ *
+ * A bundle which cannot be downloaded or unbundled (for example because
+ * its prerequisites are missing) is skipped with a warning; returns the
+ * number of bundles which were applied.
+ */
+int fetch_bundle_uris(struct repository *r, const struct string_list *uris,
+		      int from_user, int quiet);
+
+/* Server side of the protocol v2 "bundle-uri" command. */
+int bundle_uri_advertise(struct repository *r, struct strbuf *value);
+int bundle_uri_command(struct repository *r, struct argv_array *keys,
+		       struct packet_reader *request);
+
+#endif /* BUNDLE_URI_H */
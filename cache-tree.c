@@ -45,7 +45,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -72,7 +72,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -123,7 +123,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -257,6 +257,22 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_object_file(&it->oid))
 		return it->entry_count;
 
+	/*
+	 * A sparse directory entry named exactly like this level stands
+	 * for the whole tree; there is nothing below it to look at.
+	 */
+	if (entries > 0) {
+		const struct cache_entry *ce = cache[0];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    ce->ce_namelen == baselen &&
+		    !strncmp(ce->name, base, baselen)) {
+			it->entry_count = 1;
+			oidcpy(&it->oid, &ce->oid);
+			return 1;
+		}
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -700,12 +716,15 @@ int write_index_as_tree(struct object_id *oid, struct index_state *index_state,
 }
 
 static void prime_cache_tree_rec(struct repository *r,
+				 struct index_state *istate,
 				 struct cache_tree *it,
-				 struct tree *tree)
+				 struct tree *tree,
+				 struct strbuf *path)
 {
 	struct tree_desc desc;
 	struct name_entry entry;
 	int cnt;
+	size_t baselen = path->len;
 
 	oidcpy(&it->oid, &tree->object.oid);
 	init_tree_desc(&desc, tree->buffer, tree->size);
@@ -716,14 +735,33 @@ static void prime_cache_tree_rec(struct repository *r,
 		else {
 			struct cache_tree_sub *sub;
 			struct tree *subtree = lookup_tree(r, &entry.oid);
-			if (!subtree->object.parsed)
-				parse_tree(subtree);
+
 			sub = cache_tree_sub(it, entry.path);
 			sub->cache_tree = cache_tree();
-			prime_cache_tree_rec(r, sub->cache_tree, subtree);
+
+			/*
+			 * A directory that the sparse index collapsed
+			 * into one entry counts as just that entry.
+			 */
+			strbuf_setlen(path, baselen);
+			strbuf_add(path, entry.path, entry.pathlen);
+			strbuf_addch(path, '/');
+			if (istate->sparse_index &&
+			    index_name_pos(istate, path->buf, path->len) >= 0) {
+				oidcpy(&sub->cache_tree->oid, &entry.oid);
+				sub->cache_tree->entry_count = 1;
+				cnt++;
+				continue;
+			}
+
+			if (!subtree->object.parsed)
+				parse_tree(subtree);
+			prime_cache_tree_rec(r, istate, sub->cache_tree,
+					     subtree, path);
 			cnt += sub->cache_tree->entry_count;
 		}
 	}
+	strbuf_setlen(path, baselen);
 	it->entry_count = cnt;
 }
 
@@ -731,9 +769,12 @@ void prime_cache_tree(struct repository *r,
 		      struct index_state *istate,
 		      struct tree *tree)
 {
+	struct strbuf path = STRBUF_INIT;
+
 	cache_tree_free(&istate->cache_tree);
 	istate->cache_tree = cache_tree();
-	prime_cache_tree_rec(r, istate->cache_tree, tree);
+	prime_cache_tree_rec(r, istate, istate->cache_tree, tree, &path);
+	strbuf_release(&path);
 	istate->cache_changed |= CACHE_TREE_CHANGED;
 }
 
@@ -791,6 +832,15 @@ static void verify_one(struct repository *r,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			const struct cache_entry *ce = istate->cache[pos];
+
+			if (!S_ISSPARSEDIR(ce->ce_mode) ||
+			    it->entry_count != 1 || !oideq(&ce->oid, &it->oid))
+				BUG("cache-tree for sparse directory %s does not match",
+				    path->buf);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
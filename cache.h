@@ -69,6 +69,13 @@ unsigned long git_deflate_bound(git_zstream *, unsigned long);
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry in a sparse index stands for a whole
+ * directory outside of the sparse-checkout cone. Its name ends in a
+ * slash and it records the tree object with a plain directory mode.
+ */
+#define S_ISSPARSEDIR(m) ((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -304,6 +311,7 @@ static inline unsigned int canon_mode(unsigned int mode)
 
 struct split_index;
 struct untracked_cache;
+struct pattern_list;
 struct progress;
 
 struct index_state {
@@ -319,7 +327,8 @@ struct index_state {
 		 drop_cache_tree : 1,
 		 updated_workdir : 1,
 		 updated_skipworktree : 1,
-		 fsmonitor_has_run_once : 1;
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -328,6 +337,11 @@ struct index_state {
 	struct ewah_bitmap *fsmonitor_dirty;
 	struct mem_pool *ce_mem_pool;
 	struct progress *progress;
+	/*
+	 * Cone-mode patterns about to be written to the sparse-checkout
+	 * file, for convert_to_sparse() to use instead of that file.
+	 */
+	struct pattern_list *sparse_checkout_patterns;
 };
 
 /* Name hashing */
@@ -627,7 +641,8 @@ int path_inside_repo(const char *prefix, const char *path);
 #define INIT_DB_EXIST_OK 0x0002
 
 int init_db(const char *git_dir, const char *real_git_dir,
-	    const char *template_dir, unsigned int flags);
+	    const char *template_dir, const char *ref_storage_format,
+	    unsigned int flags);
 
 void sanitize_stdfds(void);
 int daemonize(void);
@@ -957,6 +972,7 @@ extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_use_builtin_fsmonitor;
 
 extern int core_apply_sparse_checkout;
 extern int core_sparse_checkout_cone;
@@ -1037,6 +1053,7 @@ struct repository_format {
 	int version;
 	int precious_objects;
 	char *partial_clone; /* value of extensions.partialclone */
+	char *ref_storage; /* value of extensions.refstorage */
 	int worktree_config;
 	int is_bare;
 	int hash_algo;
@@ -1687,7 +1704,43 @@ struct checkout {
 #define CHECKOUT_INIT { NULL, "" }
 
 #define TEMPORARY_FILENAME_LENGTH 25
-int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath, int *nr_checkouts);
+/*
+ * Write the contents from ce out to the working tree.
+ *
+ * When topath[] is not NULL, instead of writing to the working tree
+ * file named by ce, a temporary file is created by this function and
+ * its name is returned in topath[], which must be able to hold at
+ * least TEMPORARY_FILENAME_LENGTH bytes long.
+ *
+ * The _ca() variant takes the conversion attributes of ce->name, if
+ * the caller has already looked them up; pass NULL otherwise.
+ */
+int checkout_entry_ca(struct cache_entry *ce, struct conv_attrs *ca,
+		      const struct checkout *state, char *topath,
+		      int *nr_checkouts);
+static inline int checkout_entry(struct cache_entry *ce,
+				 const struct checkout *state, char *topath,
+				 int *nr_checkouts)
+{
+	return checkout_entry_ca(ce, NULL, state, topath, nr_checkouts);
+}
+/*
+ * Read the blob named by ce->oid; returns NULL if it cannot be read
+ * or is not a blob.
+ */
+void *read_blob_entry(const struct cache_entry *ce, unsigned long *size);
+/*
+ * fstat() the just-written checkout output 'fd' into 'st' when that is
+ * reliable and the index stat data is to be refreshed. Returns 1 if
+ * 'st' was filled, 0 otherwise.
+ */
+int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st);
+/*
+ * Refresh the index stat data of ce with 'st', taken from the file that
+ * was just written for it, if state->refresh_cache is set.
+ */
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st);
 void enable_delayed_checkout(struct checkout *state);
 int finish_delayed_checkout(struct checkout *state, int *nr_checkouts);
 /*
@@ -1712,6 +1765,7 @@ int has_symlink_leading_path(const char *name, int len);
 int threaded_has_symlink_leading_path(struct cache_def *, const char *, int);
 int check_leading_path(const char *name, int len);
 int has_dirs_only_path(const char *name, int len, int prefix_len);
+void invalidate_lstat_cache(void);
 void schedule_dir_for_removal(const char *name, int len);
 void remove_scheduled_dirs(void);
 
@@ -20,6 +20,7 @@ linux-gcc)
 	export GIT_TEST_OE_DELTA_SIZE=5
 	export GIT_TEST_COMMIT_GRAPH=1
 	export GIT_TEST_MULTI_PACK_INDEX=1
+	export GIT_TEST_WRITE_REV_INDEX=1
 	export GIT_TEST_ADD_I_USE_BUILTIN=1
 	make test
 	;;
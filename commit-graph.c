@@ -16,12 +16,18 @@
 #include "hashmap.h"
 #include "replace-object.h"
 #include "progress.h"
+#include "bloom.h"
+#include "commit-slab.h"
 
 #define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
 #define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
 
 #define GRAPH_DATA_WIDTH (the_hash_algo->rawsz + 16)
@@ -35,6 +41,8 @@
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW 0x80000000
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -268,6 +276,20 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 				graph->chunk_commit_data = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_EXTRAEDGES:
 			if (graph->chunk_extra_edges)
 				chunk_repeated = 1;
@@ -280,10 +302,38 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 				chunk_repeated = 1;
 			else
 				graph->chunk_base_graphs = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else {
+				uint32_t hash_version;
+				graph->chunk_bloom_data = data + chunk_offset;
+				hash_version = get_be32(data + chunk_offset);
+
+				if (hash_version != 1)
+					break;
+
+				graph->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+				graph->bloom_filter_settings->hash_version = hash_version;
+				graph->bloom_filter_settings->num_hashes = get_be32(data + chunk_offset + 4);
+				graph->bloom_filter_settings->bits_per_entry = get_be32(data + chunk_offset + 8);
+				graph->bloom_filter_settings->max_changed_paths = DEFAULT_BLOOM_MAX_CHANGES;
+			}
+			break;
 		}
 
 		if (chunk_repeated) {
 			error(_("commit-graph chunk id %08x appears multiple times"), chunk_id);
+			free(graph->bloom_filter_settings);
 			free(graph);
 			return NULL;
 		}
@@ -298,9 +348,23 @@ struct commit_graph *parse_commit_graph(void *graph_map, int fd,
 		last_chunk_offset = chunk_offset;
 	}
 
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data &&
+	    graph->bloom_filter_settings) {
+		init_bloom_filters();
+	} else {
+		/* We need both the Bloom chunks to exist together. Else ignore the data */
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+		FREE_AND_NULL(graph->bloom_filter_settings);
+	}
+
+	/* A single file can use its own corrected commit dates. */
+	graph->read_generation_data = !!graph->chunk_generation_data;
+
 	hashcpy(graph->oid.hash, graph->data + graph->data_len - graph->hash_len);
 
 	if (verify_commit_graph_lite(graph)) {
+		free(graph->bloom_filter_settings);
 		free(graph);
 		return NULL;
 	}
@@ -442,6 +506,27 @@ static struct commit_graph *load_commit_graph_chain(struct repository *r, const
 	return graph_chain;
 }
 
+/*
+ * Corrected commit dates and topological levels cannot be compared
+ * with each other, so only use the former if every layer of the chain
+ * has them.
+ */
+static void validate_generation_data(struct repository *r,
+				     struct commit_graph *g)
+{
+	struct commit_graph *p;
+	int read_generation_data;
+
+	prepare_repo_settings(r);
+	read_generation_data = r->settings.commit_graph_generation_version >= 2;
+	for (p = g; p && read_generation_data; p = p->base_graph)
+		if (!p->chunk_generation_data)
+			read_generation_data = 0;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = read_generation_data;
+}
+
 struct commit_graph *read_commit_graph_one(struct repository *r, const char *obj_dir)
 {
 	struct commit_graph *g = load_commit_graph_v1(r, obj_dir);
@@ -449,6 +534,7 @@ struct commit_graph *read_commit_graph_one(struct repository *r, const char *obj
 	if (!g)
 		g = load_commit_graph_chain(r, obj_dir);
 
+	validate_generation_data(r, g);
 	return g;
 }
 
@@ -587,6 +673,54 @@ static struct commit_list **insert_parent_or_die(struct repository *r,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t graph_commit_date(struct commit_graph *g,
+				     const unsigned char *commit_data)
+{
+	uint64_t date_high, date_low;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+static uint32_t graph_topo_level(struct commit_graph *g,
+				 const unsigned char *commit_data)
+{
+	return get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+/*
+ * The GDAT chunk stores the corrected commit date of each commit as an
+ * offset from its commit date. Offsets that do not fit in 31 bits are
+ * stored in the GDOV chunk, and the GDAT entry holds their position
+ * there with the most significant bit set.
+ */
+static timestamp_t graph_corrected_date(struct commit_graph *g,
+					uint32_t lex_index, timestamp_t date)
+{
+	uint32_t offset = get_be32(g->chunk_generation_data +
+				   sizeof(uint32_t) * lex_index);
+
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		uint32_t pos = offset ^ CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+		return date + get_be64(g->chunk_generation_data_overflow +
+				       sizeof(uint64_t) * pos);
+	}
+	return date + offset;
+}
+
+static timestamp_t graph_generation(struct commit_graph *g, uint32_t lex_index,
+				    timestamp_t date)
+{
+	if (g->read_generation_data)
+		return graph_corrected_date(g, lex_index, date);
+	return graph_topo_level(g, g->chunk_commit_data +
+				GRAPH_DATA_WIDTH * lex_index);
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	const unsigned char *commit_data;
@@ -598,7 +732,8 @@ static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
 	lex_index = pos - g->num_commits_in_base;
 	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 	item->graph_pos = pos;
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->generation = graph_generation(g, lex_index,
+					    graph_commit_date(g, commit_data));
 }
 
 static inline void set_commit_tree(struct commit *c, struct tree *t)
@@ -612,7 +747,6 @@ static int fill_commit_in_graph(struct repository *r,
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
 	const unsigned char *commit_data;
 	uint32_t lex_index;
@@ -636,11 +770,8 @@ static int fill_commit_in_graph(struct repository *r,
 
 	set_commit_tree(item, NULL);
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = graph_commit_date(g, commit_data);
+	item->generation = graph_generation(g, lex_index, item->date);
 
 	pptr = &item->parents;
 
@@ -770,6 +901,17 @@ struct packed_oid_list {
 	int alloc;
 };
 
+/*
+ * The generation numbers of a commit, as computed while writing a
+ * commit-graph. A zero topo_level means they are not known yet.
+ */
+struct commit_generation_data {
+	uint32_t topo_level;
+	timestamp_t corrected_date;
+};
+
+define_commit_slab(generation_data_slab, struct commit_generation_data);
+
 struct write_commit_graph_context {
 	struct repository *r;
 	char *obj_dir;
@@ -794,9 +936,15 @@ struct write_commit_graph_context {
 	unsigned append:1,
 		 report_progress:1,
 		 split:1,
-		 check_oids:1;
+		 check_oids:1,
+		 changed_paths:1,
+		 write_generation_data:1;
+
+	struct generation_data_slab generation_data;
+	uint32_t num_generation_data_overflows;
 
 	const struct split_commit_graph_opts *split_opts;
+	size_t total_bloom_filter_data_size;
 };
 
 static void write_graph_chunk_fanout(struct hashfile *f,
@@ -931,7 +1079,8 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl((*list)->generation << 2);
+		packedDate[0] |= htonl(generation_data_slab_at(&ctx->generation_data,
+							       *list)->topo_level << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -940,6 +1089,46 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 	}
 }
 
+static timestamp_t corrected_date_offset(struct write_commit_graph_context *ctx,
+					 struct commit *c)
+{
+	return generation_data_slab_at(&ctx->generation_data, c)->corrected_date -
+		c->date;
+}
+
+static void write_graph_chunk_generation_data(struct hashfile *f,
+					      struct write_commit_graph_context *ctx)
+{
+	uint32_t num_overflows = 0;
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		timestamp_t offset = corrected_date_offset(ctx, ctx->commits.list[i]);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX)
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW |
+				 num_overflows++;
+		hashwrite_be32(f, offset);
+	}
+}
+
+static void write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						       struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		timestamp_t offset = corrected_date_offset(ctx, ctx->commits.list[i]);
+
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX)
+			hashwrite_be64(f, offset);
+	}
+}
+
 static void write_graph_chunk_extra_edges(struct hashfile *f,
 					  struct write_commit_graph_context *ctx)
 {
@@ -992,6 +1181,44 @@ static void write_graph_chunk_extra_edges(struct hashfile *f,
 	}
 }
 
+static void write_graph_chunk_bloom_indexes(struct hashfile *f,
+					    struct write_commit_graph_context *ctx)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		if (!filter)
+			BUG("missing changed-path Bloom filter for commit %s",
+			    oid_to_hex(&(*list)->object.oid));
+		cur_pos += filter->len;
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct hashfile *f,
+					 struct write_commit_graph_context *ctx)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+
+	hashwrite_be32(f, settings.hash_version);
+	hashwrite_be32(f, settings.num_hashes);
+	hashwrite_be32(f, settings.bits_per_entry);
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list, 0);
+		display_progress(ctx->progress, ++ctx->progress_cnt);
+		hashwrite(f, filter->data, filter->len * sizeof(unsigned char));
+		list++;
+	}
+}
+
 static int oid_compare(const void *_a, const void *_b)
 {
 	const struct object_id *a = (const struct object_id *)_a;
@@ -1094,6 +1321,46 @@ static void close_reachable(struct write_commit_graph_context *ctx)
 	stop_progress(&ctx->progress);
 }
 
+/*
+ * Return the generation data of a commit if it is already known, either
+ * because it was computed earlier or because the commit is in the
+ * existing commit-graph, or NULL if it has to be computed from the
+ * parents. Corrected commit dates are only taken from layers that have
+ * them; the others have to be walked again to compute them.
+ */
+static struct commit_generation_data *known_generation_data(
+		struct write_commit_graph_context *ctx, struct commit *c)
+{
+	struct commit_generation_data *data;
+	struct commit_graph *g = ctx->r->objects->commit_graph;
+	const unsigned char *commit_data;
+	uint32_t lex_index, topo_level;
+
+	data = generation_data_slab_at(&ctx->generation_data, c);
+	if (data->topo_level)
+		return data;
+
+	if (!g || c->graph_pos == COMMIT_NOT_FROM_GRAPH ||
+	    c->graph_pos >= g->num_commits + g->num_commits_in_base)
+		return NULL;
+	while (c->graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (ctx->write_generation_data && !g->chunk_generation_data)
+		return NULL;
+
+	lex_index = c->graph_pos - g->num_commits_in_base;
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
+	topo_level = graph_topo_level(g, commit_data);
+	if (topo_level == GENERATION_NUMBER_ZERO)
+		return NULL;
+
+	data->topo_level = topo_level;
+	if (g->chunk_generation_data)
+		data->corrected_date = graph_corrected_date(g, lex_index,
+						graph_commit_date(g, commit_data));
+	return data;
+}
+
 static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
@@ -1105,37 +1372,84 @@ static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 					ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
 		display_progress(ctx->progress, i + 1);
-		if (ctx->commits.list[i]->generation != GENERATION_NUMBER_INFINITY &&
-		    ctx->commits.list[i]->generation != GENERATION_NUMBER_ZERO)
+		if (known_generation_data(ctx, ctx->commits.list[i]))
 			continue;
 
 		commit_list_insert(ctx->commits.list[i], &list);
 		while (list) {
 			struct commit *current = list->item;
 			struct commit_list *parent;
+			struct commit_generation_data *data;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_date = 0;
+
+			if (repo_parse_commit(ctx->r, current))
+				die(_("unable to parse commit %s"),
+				    oid_to_hex(&current->object.oid));
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
-				    parent->item->generation == GENERATION_NUMBER_ZERO) {
+				data = known_generation_data(ctx, parent->item);
+				if (!data) {
 					all_parents_computed = 0;
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (parent->item->generation > max_generation) {
-					max_generation = parent->item->generation;
 				}
+				if (data->topo_level > max_level)
+					max_level = data->topo_level;
+				if (data->corrected_date > max_corrected_date)
+					max_corrected_date = data->corrected_date;
 			}
 
 			if (all_parents_computed) {
-				current->generation = max_generation + 1;
+				data = generation_data_slab_at(&ctx->generation_data,
+							       current);
+				data->topo_level = max_level + 1;
+				if (data->topo_level > GENERATION_NUMBER_V1_MAX)
+					data->topo_level = GENERATION_NUMBER_V1_MAX;
+
+				/*
+				 * The corrected commit date is the commit
+				 * date, bumped to be larger than that of any
+				 * parent.
+				 */
+				data->corrected_date = current->date;
+				if (current->parents &&
+				    data->corrected_date <= max_corrected_date)
+					data->corrected_date = max_corrected_date + 1;
 				pop_commit(&list);
-
-				if (current->generation > GENERATION_NUMBER_MAX)
-					current->generation = GENERATION_NUMBER_MAX;
 			}
 		}
 	}
+
+	stop_progress(&ctx->progress);
+
+	if (!ctx->write_generation_data)
+		return;
+	for (i = 0; i < ctx->commits.nr; i++)
+		if (corrected_date_offset(ctx, ctx->commits.list[i]) >
+		    GENERATION_NUMBER_V2_OFFSET_MAX)
+			ctx->num_generation_data_overflows++;
+}
+
+static void compute_bloom_filters(struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	init_bloom_filters();
+
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+			_("Computing commit changed paths Bloom filters"),
+			ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, c, 1);
+		ctx->total_bloom_filter_data_size += sizeof(unsigned char) * filter->len;
+		display_progress(ctx->progress, i + 1);
+	}
+
 	stop_progress(&ctx->progress);
 }
 
@@ -1356,8 +1670,8 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	int fd;
 	struct hashfile *f;
 	struct lock_file lk = LOCK_INIT;
-	uint32_t chunk_ids[6];
-	uint64_t chunk_offsets[6];
+	uint32_t chunk_ids[10];
+	uint64_t chunk_offsets[10];
 	const unsigned hashsz = the_hash_algo->rawsz;
 	struct strbuf progress_title = STRBUF_INIT;
 	int num_chunks = 3;
@@ -1402,10 +1716,24 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
 	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
 	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	if (ctx->write_generation_data) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA;
+		num_chunks++;
+	}
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_EXTRAEDGES;
 		num_chunks++;
 	}
+	if (ctx->changed_paths) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		num_chunks++;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		num_chunks++;
+	}
 	if (ctx->num_commit_graphs_after > 1) {
 		chunk_ids[num_chunks] = GRAPH_CHUNKID_BASE;
 		num_chunks++;
@@ -1419,11 +1747,30 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	chunk_offsets[3] = chunk_offsets[2] + (hashsz + 16) * ctx->commits.nr;
 
 	num_chunks = 3;
+	if (ctx->write_generation_data) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+	}
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint64_t) * ctx->num_generation_data_overflows;
+		num_chunks++;
+	}
 	if (ctx->num_extra_edges) {
 		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
 						4 * ctx->num_extra_edges;
 		num_chunks++;
 	}
+	if (ctx->changed_paths) {
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * ctx->commits.nr;
+		num_chunks++;
+
+		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
+						sizeof(uint32_t) * 3 + ctx->total_bloom_filter_data_size;
+		num_chunks++;
+	}
 	if (ctx->num_commit_graphs_after > 1) {
 		chunk_offsets[num_chunks + 1] = chunk_offsets[num_chunks] +
 						hashsz * (ctx->num_commit_graphs_after - 1);
@@ -1459,8 +1806,16 @@ static int write_commit_graph_file(struct write_commit_graph_context *ctx)
 	write_graph_chunk_fanout(f, ctx);
 	write_graph_chunk_oids(f, hashsz, ctx);
 	write_graph_chunk_data(f, hashsz, ctx);
+	if (ctx->write_generation_data)
+		write_graph_chunk_generation_data(f, ctx);
+	if (ctx->write_generation_data && ctx->num_generation_data_overflows)
+		write_graph_chunk_generation_data_overflow(f, ctx);
 	if (ctx->num_extra_edges)
 		write_graph_chunk_extra_edges(f, ctx);
+	if (ctx->changed_paths) {
+		write_graph_chunk_bloom_indexes(f, ctx);
+		write_graph_chunk_bloom_data(f, ctx);
+	}
 	if (ctx->num_commit_graphs_after > 1 &&
 	    write_graph_chunk_base(f, ctx)) {
 		return -1;
@@ -1792,8 +2147,17 @@ int write_commit_graph(const char *obj_dir,
 	ctx->report_progress = flags & COMMIT_GRAPH_WRITE_PROGRESS ? 1 : 0;
 	ctx->split = flags & COMMIT_GRAPH_WRITE_SPLIT ? 1 : 0;
 	ctx->check_oids = flags & COMMIT_GRAPH_WRITE_CHECK_OIDS ? 1 : 0;
+	ctx->changed_paths = flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS ? 1 : 0;
+
+	if (git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
+		ctx->changed_paths = 1;
 	ctx->split_opts = split_opts;
 
+	prepare_repo_settings(ctx->r);
+	ctx->write_generation_data =
+		ctx->r->settings.commit_graph_generation_version >= 2;
+	init_generation_data_slab(&ctx->generation_data);
+
 	if (ctx->split) {
 		struct commit_graph *g;
 		prepare_commit_graph(ctx->r);
@@ -1887,6 +2251,9 @@ int write_commit_graph(const char *obj_dir,
 
 	compute_generation_numbers(ctx);
 
+	if (ctx->changed_paths)
+		compute_bloom_filters(ctx);
+
 	res = write_commit_graph_file(ctx);
 
 	if (ctx->split)
@@ -1896,6 +2263,7 @@ int write_commit_graph(const char *obj_dir,
 
 cleanup:
 	free(ctx->graph_name);
+	clear_generation_data_slab(&ctx->generation_data);
 	free(ctx->commits.list);
 	free(ctx->oids.list);
 	free(ctx->obj_dir);
@@ -1933,6 +2301,19 @@ static void graph_report(const char *fmt, ...)
 	va_end(ap);
 }
 
+static uint32_t graph_commit_topo_level(struct commit_graph *g,
+					struct commit *c)
+{
+	uint32_t pos = c->graph_pos;
+
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		return GENERATION_NUMBER_ZERO;
+	while (pos < g->num_commits_in_base)
+		g = g->base_graph;
+	return graph_topo_level(g, g->chunk_commit_data +
+				GRAPH_DATA_WIDTH * (pos - g->num_commits_in_base));
+}
+
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
@@ -2011,7 +2392,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
+		uint32_t max_level = 0, level;
+		timestamp_t max_generation = 0, generation;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
@@ -2050,6 +2432,9 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
+			level = graph_commit_topo_level(g, graph_parents->item);
+			if (level > max_level)
+				max_level = level;
 			if (graph_parents->item->generation > max_generation)
 				max_generation = graph_parents->item->generation;
 
@@ -2061,7 +2446,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			graph_report(_("commit-graph parent list for commit %s terminates early"),
 				     oid_to_hex(&cur_oid));
 
-		if (!graph_commit->generation) {
+		level = graph_commit_topo_level(g, graph_commit);
+		if (!level) {
 			if (generation_zero == GENERATION_NUMBER_EXISTS)
 				graph_report(_("commit-graph has generation number zero for commit %s, but non-zero elsewhere"),
 					     oid_to_hex(&cur_oid));
@@ -2074,18 +2460,28 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
 			continue;
 
 		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
-		 * extra logic in the following condition.
+		 * If one of our parents has generation GENERATION_NUMBER_V1_MAX,
+		 * then our generation is also GENERATION_NUMBER_V1_MAX. Decrement
+		 * to avoid extra logic in the following condition.
 		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
-			max_generation--;
+		if (max_level == GENERATION_NUMBER_V1_MAX)
+			max_level--;
 
-		if (graph_commit->generation != max_generation + 1)
+		if (level != max_level + 1)
 			graph_report(_("commit-graph generation for commit %s is %u != %u"),
 				     oid_to_hex(&cur_oid),
-				     graph_commit->generation,
-				     max_generation + 1);
+				     level, max_level + 1);
+
+		if (g->read_generation_data) {
+			generation = odb_commit->date;
+			if (graph_commit->parents && generation <= max_generation)
+				generation = max_generation + 1;
+			if (graph_commit->generation != generation)
+				graph_report(_("commit-graph corrected commit date for commit %s is %"PRItime" != %"PRItime),
+					     oid_to_hex(&cur_oid),
+					     graph_commit->generation,
+					     generation);
+		}
 
 		if (graph_commit->date != odb_commit->date)
 			graph_report(_("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime),
@@ -2113,6 +2509,7 @@ void free_commit_graph(struct commit_graph *g)
 		close(g->graph_fd);
 	}
 	free(g->filename);
+	free(g->bloom_filter_settings);
 	free(g);
 }
 
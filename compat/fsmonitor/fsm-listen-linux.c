@@ -0,0 +1,306 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor--daemon.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify only watches single directories, so we add one watch per
+ * directory of the working tree and keep a map from the watch
+ * descriptors the kernel hands back to the directory they stand for.
+ */
+struct watched_dir {
+	struct hashmap_entry ent;
+	int wd;
+	/* Relative to the worktree: "" for the root, else "dir/". */
+	char path[FLEX_ARRAY];
+};
+
+struct fsm_listen_data {
+	int fd;
+	int root_wd;
+	struct hashmap dirs;
+};
+
+#define FSM_WATCH_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+			IN_DELETE | IN_DELETE_SELF | IN_MODIFY | \
+			IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+			IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+static int watched_dir_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct watched_dir *a, *b;
+
+	a = container_of(eptr, const struct watched_dir, ent);
+	b = container_of(entry_or_key, const struct watched_dir, ent);
+	return a->wd != b->wd;
+}
+
+static struct watched_dir *find_watched_dir(struct fsm_listen_data *data,
+					    int wd)
+{
+	struct watched_dir key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get_entry(&data->dirs, &key, ent, NULL);
+}
+
+static void forget_watched_dir(struct fsm_listen_data *data, int wd)
+{
+	struct watched_dir key, *dir;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	dir = hashmap_remove_entry(&data->dirs, &key, ent, NULL);
+	free(dir);
+}
+
+static void remember_watched_dir(struct fsm_listen_data *data, int wd,
+				 const char *path)
+{
+	struct watched_dir *dir;
+
+	/*
+	 * Watching an inode twice gives back the same descriptor, e.g.
+	 * when a watched directory was renamed within the worktree.
+	 */
+	forget_watched_dir(data, wd);
+
+	FLEX_ALLOC_STR(dir, path, path);
+	dir->wd = wd;
+	hashmap_entry_init(&dir->ent, memhash(&wd, sizeof(wd)));
+	hashmap_add(&data->dirs, &dir->ent);
+}
+
+/*
+ * Watch the directory "rel" (empty or ending in a slash) and all the
+ * directories below it. When "report" is set, also report everything
+ * we find as changed: the directory may have been populated before
+ * our watches were in place.
+ */
+static int add_watches(struct fsmonitor_daemon_state *state,
+		       struct strbuf *rel, int report)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf abs = STRBUF_INIT;
+	size_t baselen = rel->len;
+	struct dirent *de;
+	DIR *dir;
+	int wd, ret = 0;
+
+	strbuf_addbuf(&abs, &state->path_worktree_watch);
+	strbuf_addch(&abs, '/');
+	strbuf_addbuf(&abs, rel);
+
+	wd = inotify_add_watch(data->fd, abs.buf, FSM_WATCH_MASK);
+	if (wd < 0) {
+		/* The directory went away again while we were looking. */
+		if (errno == ENOENT || errno == ENOTDIR)
+			goto out;
+		if (errno == ENOSPC)
+			ret = error(_("could not watch '%s': too many watches; "
+				      "consider raising fs.inotify.max_user_watches"),
+				    abs.buf);
+		else
+			ret = error_errno(_("could not watch '%s'"), abs.buf);
+		goto out;
+	}
+	remember_watched_dir(data, wd, rel->buf);
+	if (!baselen)
+		data->root_wd = wd;
+
+	dir = opendir(abs.buf);
+	if (!dir)
+		goto out;
+
+	while (!ret && (de = readdir(dir)) != NULL) {
+		int is_dir;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		/* Changes to the repository itself are none of our business. */
+		if (!baselen && !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(rel, baselen);
+		strbuf_addstr(rel, de->d_name);
+
+		is_dir = DTYPE(de) == DT_DIR;
+		if (DTYPE(de) == DT_UNKNOWN) {
+			struct stat st;
+
+			strbuf_setlen(&abs, state->path_worktree_watch.len + 1);
+			strbuf_addbuf(&abs, rel);
+			is_dir = !lstat(abs.buf, &st) && S_ISDIR(st.st_mode);
+		}
+
+		if (is_dir) {
+			strbuf_addch(rel, '/');
+			if (report)
+				fsmonitor_daemon_path_changed(state, rel->buf);
+			ret = add_watches(state, rel, report);
+		} else if (report) {
+			fsmonitor_daemon_path_changed(state, rel->buf);
+		}
+	}
+	closedir(dir);
+
+out:
+	strbuf_setlen(rel, baselen);
+	strbuf_release(&abs);
+	return ret;
+}
+
+/*
+ * A directory was moved away: stop watching it and everything below,
+ * since we would report its contents under the old name. If it was
+ * moved within the worktree, the matching IN_MOVED_TO watches it
+ * again under its new name.
+ */
+static void remove_watches(struct fsm_listen_data *data, const char *path)
+{
+	struct hashmap_iter iter;
+	struct watched_dir *dir;
+	int *wds = NULL;
+	size_t i, nr = 0, alloc = 0;
+
+	hashmap_for_each_entry(&data->dirs, &iter, dir, ent) {
+		if (!starts_with(dir->path, path))
+			continue;
+		ALLOC_GROW(wds, nr + 1, alloc);
+		wds[nr++] = dir->wd;
+	}
+
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd, wds[i]);
+		forget_watched_dir(data, wds[i]);
+	}
+	free(wds);
+}
+
+static int handle_event(struct fsmonitor_daemon_state *state,
+			const struct inotify_event *ev)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct watched_dir *dir;
+	struct strbuf path = STRBUF_INIT;
+	int ret = 0;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/*
+		 * We lost events, possibly about directories that need
+		 * a watch. Forget what we know and look at everything
+		 * again.
+		 */
+		fsmonitor_daemon_forget_all(state);
+		return add_watches(state, &path, 0) ? -1 : 0;
+	}
+
+	dir = find_watched_dir(data, ev->wd);
+	if (!dir)
+		return 0;
+
+	if (ev->mask & IN_IGNORED) {
+		forget_watched_dir(data, ev->wd);
+		return ev->wd == data->root_wd;
+	}
+
+	if (ev->wd == data->root_wd && (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+		return 1;
+
+	/* Events about the watched directory itself do not matter. */
+	if (!ev->len)
+		return 0;
+
+	strbuf_addstr(&path, dir->path);
+	strbuf_addstr(&path, ev->name);
+	if (!dir->path[0] && !strcmp(ev->name, ".git"))
+		goto out;
+
+	if (ev->mask & IN_ISDIR) {
+		strbuf_addch(&path, '/');
+		if (ev->mask & IN_MOVED_FROM)
+			remove_watches(data, path.buf);
+		else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			ret = add_watches(state, &path, 1) ? -1 : 0;
+	}
+	fsmonitor_daemon_path_changed(state, path.buf);
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+int fsmonitor_listen_init(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf rel = STRBUF_INIT;
+
+	data = xcalloc(1, sizeof(*data));
+	data->root_wd = -1;
+	hashmap_init(&data->dirs, watched_dir_cmp, NULL, 0);
+	state->listen_data = data;
+
+	data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd < 0)
+		return error_errno(_("could not initialize inotify"));
+
+	if (add_watches(state, &rel, 0) < 0)
+		return -1;
+	if (data->root_wd < 0)
+		return error(_("could not watch '%s'"),
+			     state->path_worktree_watch.buf);
+	return 0;
+}
+
+int fsmonitor_listen_fd(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	return data->fd;
+}
+
+int fsmonitor_listen_drain(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	for (;;) {
+		ssize_t len = read(data->fd, buf, sizeof(buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return error_errno(_("could not read inotify events"));
+		}
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const void *)p;
+			int ret = handle_event(state, ev);
+
+			if (ret)
+				return ret;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+void fsmonitor_listen_release(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	if (!data)
+		return;
+	if (data->fd >= 0)
+		close(data->fd);
+	hashmap_free_entries(&data->dirs, struct watched_dir, ent);
+	free(data);
+	state->listen_data = NULL;
+}
@@ -2317,6 +2317,14 @@ int git_config_get_max_percent_split_change(void)
 
 int git_config_get_fsmonitor(void)
 {
+	if (!git_config_get_bool("core.usebuiltinfsmonitor",
+				 &core_use_builtin_fsmonitor) &&
+	    core_use_builtin_fsmonitor) {
+		/* Only used to tell that fsmonitor is enabled, and for tracing. */
+		core_fsmonitor = "(built-in daemon)";
+		return 1;
+	}
+
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
 		core_fsmonitor = getenv("GIT_TEST_FSMONITOR");
 
@@ -444,6 +444,27 @@ static void do_oneway_diff(struct unpack_trees_options *o,
 	show_modified(revs, tree, idx, 1, cached, match_missing);
 }
 
+/*
+ * A sparse directory entry in the index stands for a whole tree that
+ * is not checked out; diff it against the tree as such. The pathspec
+ * is applied to the paths inside by diff_tree_oid().
+ */
+static void diff_sparse_directory(struct rev_info *revs,
+				  const struct cache_entry *idx,
+				  const struct cache_entry *tree)
+{
+	struct diff_options *opt = &revs->diffopt;
+	unsigned int recursive = opt->flags.recursive;
+
+	if (idx && tree && oideq(&idx->oid, &tree->oid))
+		return;
+
+	opt->flags.recursive = 1;
+	diff_tree_oid(tree ? &tree->oid : NULL, idx ? &idx->oid : NULL,
+		      (idx ? idx : tree)->name, opt);
+	opt->flags.recursive = recursive;
+}
+
 /*
  * The unpack_trees() interface is designed for merging, so
  * the different source entries are designed primarily for
@@ -475,6 +496,16 @@ static int oneway_diff(const struct cache_entry * const *src,
 	if (tree == o->df_conflict_entry)
 		tree = NULL;
 
+	if ((idx && S_ISSPARSEDIR(idx->ce_mode)) ||
+	    (tree && S_ISSPARSEDIR(tree->ce_mode))) {
+		diff_sparse_directory(revs, idx, tree);
+		if (diff_can_quit_early(&revs->diffopt)) {
+			o->exiting_early = 1;
+			return -1;
+		}
+		return 0;
+	}
+
 	if (ce_path_match(revs->diffopt.repo->index,
 			  idx ? idx : tree,
 			  &revs->prune_data, NULL)) {
@@ -508,6 +539,7 @@ static int diff_cache(struct rev_info *revs,
 				  !revs->diffopt.flags.find_copies_harder);
 	opts.merge = 1;
 	opts.fn = oneway_diff;
+	opts.sparse_dirs_ok = 1;
 	opts.unpack_data = revs;
 	opts.src_index = revs->diffopt.repo->index;
 	opts.dst_index = NULL;
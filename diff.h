@@ -275,8 +275,18 @@ struct diff_options {
 	 */
 	int rename_score;
 	int rename_limit;
+	/*
+	 * When there are more than rename_limit squared pairs to compare,
+	 * only compare those with similar content signatures, instead of
+	 * giving up inexact rename detection.
+	 */
+	int rename_index;
 
 	int needed_rename_limit;
+
+	/* If non-zero, then stop computing after this many changes. */
+	int max_changes;
+
 	int degraded_cc_to_c;
 	int show_rename_progress;
 	int dirstat_permille;
@@ -34,7 +34,7 @@
  * size under the current 2<<17 maximum, which can hold this many
  * different values before overflowing to hashtable of size 2<<18.
  */
-#define HASHBASE 107927
+#define HASHBASE DIFFCORE_SPAN_HASHBASE
 
 struct spanhash {
 	unsigned int hashval;
@@ -231,3 +231,58 @@ int diffcore_count_changes(struct repository *r,
 	*literal_added = la;
 	return 0;
 }
+
+void *diffcore_hash_spans(struct repository *r, struct diff_filespec *one)
+{
+	return hash_chars(r, one);
+}
+
+void diffcore_count_span_files(void *cnt_data, unsigned int *nr_files)
+{
+	struct spanhash_top *top = cnt_data;
+	struct spanhash *s;
+
+	for (s = top->data; s->cnt; s++)
+		nr_files[s->hashval]++;
+}
+
+/*
+ * The i-th of the hash functions MinHash takes the minimum of: it
+ * scrambles the span hash with a different seed each (this is the
+ * finalizer of MurmurHash3).
+ */
+static uint32_t minhash_mix(uint32_t hashval, int i)
+{
+	uint32_t h = hashval ^ ((uint32_t)(i + 1) * 0x9e3779b9u);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+int diffcore_span_signature(void *cnt_data,
+			    const unsigned int *nr_files,
+			    unsigned int max_files,
+			    uint32_t *sig, int nr)
+{
+	struct spanhash_top *top = cnt_data;
+	struct spanhash *s;
+	int i, used = 0;
+
+	for (i = 0; i < nr; i++)
+		sig[i] = UINT32_MAX;
+	for (s = top->data; s->cnt; s++) {
+		if (nr_files && nr_files[s->hashval] > max_files)
+			continue;
+		for (i = 0; i < nr; i++) {
+			uint32_t h = minhash_mix(s->hashval, i);
+			if (h < sig[i])
+				sig[i] = h;
+		}
+		used++;
+	}
+	return used;
+}
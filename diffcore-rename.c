@@ -2,11 +2,13 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -128,8 +130,58 @@ struct diff_score {
 	short name_score;
 };
 
-static int estimate_similarity(struct repository *r,
-			       struct diff_filespec *src,
+/*
+ * Fill in the size of "one"; returns -1 if it is not a file whose
+ * content can be compared.
+ */
+static int prepare_size(struct repository *r, struct diff_filespec *one)
+{
+	if (!S_ISREG(one->mode))
+		return -1;
+	if (one->cnt_data)
+		return 0;
+	return diff_populate_filespec(r, one, CHECK_SIZE_ONLY);
+}
+
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in estimate_similarity() would
+ * not have a divide-by-zero issue.
+ */
+static int sizes_similar(unsigned long a, unsigned long b, int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long base_size = a < b ? a : b;
+	unsigned long delta_size = max_size - base_size;
+
+	return max_size * (MAX_SCORE-minimum_score) >= delta_size * MAX_SCORE;
+}
+
+/*
+ * Read "one" and count its spans up front, so that estimate_similarity()
+ * does not need to touch the object store, and can run in any thread.
+ * The "cnt_data" of a file which cannot be read is left unset. Only
+ * call this for files which passed prepare_size() and are known to
+ * have a partner of similar size, so that a blob which cannot be a
+ * rename candidate is never read.
+ */
+static void prepare_similarity(struct repository *r,
+			       struct diff_filespec *one)
+{
+	if (!one->cnt_data) {
+		if (diff_populate_filespec(r, one, 0))
+			return;
+		one->cnt_data = diffcore_hash_spans(r, one);
+	}
+	/* We do not need the text anymore */
+	diff_free_filespec_blob(one);
+}
+
+static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
 {
@@ -146,7 +198,7 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, src_copied, literal_added;
 	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
@@ -157,42 +209,19 @@ static int estimate_similarity(struct repository *r,
 		return 0;
 
 	/*
-	 * Need to check that source and destination sizes are
-	 * filled in before comparing them.
-	 *
-	 * If we already have "cnt_data" filled in, we know it's
-	 * all good (avoid checking the size for zero, as that
-	 * is a possible size - we really should have a flag to
-	 * say whether the size is valid or not!)
-	 */
-	if (!src->cnt_data &&
-	    diff_populate_filespec(r, src, CHECK_SIZE_ONLY))
-		return 0;
-	if (!dst->cnt_data &&
-	    diff_populate_filespec(r, dst, CHECK_SIZE_ONLY))
-		return 0;
-
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
+	 * Both have gone through prepare_similarity(), so their sizes
+	 * are filled in if "cnt_data" is. A file without "cnt_data" was
+	 * either unreadable or too different in size from every file it
+	 * could be paired with.
 	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (!src->cnt_data || !dst->cnt_data)
 		return 0;
 
-	if (!src->cnt_data && diff_populate_filespec(r, src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(r, dst, 0))
+	if (!sizes_similar(src->size, dst->size, minimum_score))
 		return 0;
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
 
-	if (diffcore_count_changes(r, src, dst,
+	if (diffcore_count_changes(NULL, src, dst,
 				   &src->cnt_data, &dst->cnt_data,
 				   &src_copied, &literal_added))
 		return 0;
@@ -363,6 +392,250 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+static int find_rename_src(const char *path)
+{
+	int first = 0, last = rename_src_nr;
+
+	while (last > first) {
+		int next = first + ((last - first) >> 1);
+		int cmp = strcmp(path, rename_src[next].p->one->path);
+		if (!cmp)
+			return next;
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return -1;
+}
+
+/*
+ * Rename "src" to "dst" if they are at least "min_score" similar; return
+ * 1 if they were.
+ */
+static int try_prematch(struct diff_options *options, int src, int dst,
+			int min_score)
+{
+	struct diff_filespec *one = rename_src[src].p->one;
+	struct diff_filespec *two = rename_dst[dst].two;
+	int score;
+
+	if (one->rename_used || rename_dst[dst].pair)
+		return 0;
+	if (prepare_size(options->repo, one) ||
+	    prepare_size(options->repo, two) ||
+	    !sizes_similar(one->size, two->size, min_score))
+		return 0;
+	prepare_similarity(options->repo, one);
+	prepare_similarity(options->repo, two);
+	score = estimate_similarity(one, two, min_score);
+	if (score < min_score)
+		return 0;
+	record_rename_pair(dst, src, score);
+	return 1;
+}
+
+struct basename_entry {
+	const char *basename;
+	int index;
+};
+
+static int basename_entry_cmp(const void *a_, const void *b_)
+{
+	const struct basename_entry *a = a_, *b = b_;
+	int cmp = strcmp(a->basename, b->basename);
+
+	return cmp ? cmp : a->index - b->index;
+}
+
+static const char *basename_of(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/*
+ * Pair up the sources and destinations which have a basename nobody
+ * else among them has, e.g. when a whole directory moved.
+ */
+static int find_basename_matches(struct diff_options *options, int min_score)
+{
+	struct basename_entry *src, *dst;
+	int src_nr = 0, dst_nr = 0, i, j, renames = 0;
+
+	ALLOC_ARRAY(src, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rename_src[i].p->one->rename_used)
+			continue;
+		src[src_nr].basename = basename_of(rename_src[i].p->one->path);
+		src[src_nr].index = i;
+		src_nr++;
+	}
+	ALLOC_ARRAY(dst, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue;
+		dst[dst_nr].basename = basename_of(rename_dst[i].two->path);
+		dst[dst_nr].index = i;
+		dst_nr++;
+	}
+	QSORT(src, src_nr, basename_entry_cmp);
+	QSORT(dst, dst_nr, basename_entry_cmp);
+
+	i = j = 0;
+	while (i < src_nr && j < dst_nr) {
+		int cmp = strcmp(src[i].basename, dst[j].basename);
+		int i_end = i + 1, j_end = j + 1;
+
+		if (cmp < 0) {
+			i++;
+			continue;
+		}
+		if (cmp > 0) {
+			j++;
+			continue;
+		}
+		while (i_end < src_nr &&
+		       !strcmp(src[i_end].basename, src[i].basename))
+			i_end++;
+		while (j_end < dst_nr &&
+		       !strcmp(dst[j_end].basename, dst[j].basename))
+			j_end++;
+		if (i_end == i + 1 && j_end == j + 1)
+			renames += try_prematch(options, src[i].index,
+						dst[j].index, min_score);
+		i = i_end;
+		j = j_end;
+	}
+
+	free(src);
+	free(dst);
+	return renames;
+}
+
+struct dir_rename {
+	char *old_dir;
+	char *new_dir;
+	int count;
+};
+
+static int dir_rename_cmp(const void *a_, const void *b_)
+{
+	const struct dir_rename *a = a_, *b = b_;
+	int cmp = strcmp(a->new_dir, b->new_dir);
+
+	if (cmp)
+		return cmp;
+	if (a->count != b->count)
+		return b->count - a->count;
+	return strcmp(a->old_dir, b->old_dir);
+}
+
+static int dir_rename_new_cmp(const void *a_, const void *b_)
+{
+	const struct dir_rename *a = a_, *b = b_;
+	return strcmp(a->new_dir, b->new_dir);
+}
+
+static char *dirname_of(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return xstrndup(path, slash ? slash - path : 0);
+}
+
+/*
+ * Infer from the renames found so far where the files of each
+ * directory went, and pair up each destination left in a directory
+ * most files of another directory moved to with the source of the same
+ * basename in that other directory.
+ */
+static int find_dir_rename_matches(struct diff_options *options,
+				   int min_score)
+{
+	struct dir_rename *dirs = NULL;
+	int nr = 0, alloc = 0, i, j, renames = 0;
+	struct strbuf path = STRBUF_INIT;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *pair = rename_dst[i].pair;
+		char *old_dir, *new_dir;
+
+		if (!pair)
+			continue;
+		old_dir = dirname_of(pair->one->path);
+		new_dir = dirname_of(pair->two->path);
+		if (!strcmp(old_dir, new_dir)) {
+			free(old_dir);
+			free(new_dir);
+			continue;
+		}
+		ALLOC_GROW(dirs, nr + 1, alloc);
+		dirs[nr].old_dir = old_dir;
+		dirs[nr].new_dir = new_dir;
+		dirs[nr].count = 1;
+		nr++;
+	}
+	if (!nr)
+		return 0;
+
+	/* count each (new, old) pair, and keep the most frequent per new dir */
+	QSORT(dirs, nr, dir_rename_cmp);
+	for (i = j = 0; i < nr; i++) {
+		if (j && !strcmp(dirs[j - 1].new_dir, dirs[i].new_dir) &&
+		    !strcmp(dirs[j - 1].old_dir, dirs[i].old_dir)) {
+			dirs[j - 1].count++;
+			free(dirs[i].old_dir);
+			free(dirs[i].new_dir);
+			continue;
+		}
+		dirs[j++] = dirs[i];
+	}
+	nr = j;
+	QSORT(dirs, nr, dir_rename_cmp);
+	for (i = j = 0; i < nr; i++) {
+		if (j && !strcmp(dirs[j - 1].new_dir, dirs[i].new_dir)) {
+			free(dirs[i].old_dir);
+			free(dirs[i].new_dir);
+			continue;
+		}
+		dirs[j++] = dirs[i];
+	}
+	nr = j;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		const char *dst_path = rename_dst[i].two->path;
+		struct dir_rename key;
+		struct dir_rename *dir;
+		int src;
+
+		if (rename_dst[i].pair)
+			continue;
+		key.new_dir = dirname_of(dst_path);
+		key.old_dir = NULL;
+		key.count = INT_MAX;
+		dir = bsearch(&key, dirs, nr, sizeof(*dirs), dir_rename_new_cmp);
+		free(key.new_dir);
+		if (!dir)
+			continue;
+
+		strbuf_reset(&path);
+		if (*dir->old_dir)
+			strbuf_addf(&path, "%s/", dir->old_dir);
+		strbuf_addstr(&path, basename_of(dst_path));
+		src = find_rename_src(path.buf);
+		if (src >= 0)
+			renames += try_prematch(options, src, i, min_score);
+	}
+
+	for (i = 0; i < nr; i++) {
+		free(dirs[i].old_dir);
+		free(dirs[i].new_dir);
+	}
+	free(dirs);
+	strbuf_release(&path);
+	return renames;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -379,17 +652,420 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * The sources each destination is compared with: either all of them,
+ * or those picked by find_similar_candidates().
+ */
+struct similarity_task {
+	int dst; /* index in rename_dst */
+	int *src; /* indices in rename_src */
+	int src_nr;
+};
+
+static int size_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Whether any of the "nr" sorted "sizes" passes sizes_similar() with
+ * "size". The closest sizes above and below it are the likeliest to.
+ */
+static int has_similar_size(unsigned long size, const unsigned long *sizes,
+			    int nr, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (sizes[mid] < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < nr && sizes_similar(size, sizes[lo], minimum_score)) ||
+		(lo && sizes_similar(size, sizes[lo - 1], minimum_score));
+}
+
+/*
+ * Run prepare_similarity() on the sources listed in "srcs" and the
+ * destinations of "task" which have a file of similar enough size on
+ * the other side. Only the sizes of the others are looked up, so that
+ * e.g. a huge blob is not read unless a file of about its size was
+ * added or removed too.
+ */
+static void prepare_candidates(struct repository *r,
+			       const int *srcs, int src_nr,
+			       const struct similarity_task *task, int task_nr,
+			       int minimum_score)
+{
+	unsigned long *src_size, *dst_size;
+	int src_sized = 0, dst_sized = 0, i;
+
+	ALLOC_ARRAY(src_size, src_nr);
+	for (i = 0; i < src_nr; i++) {
+		struct diff_filespec *one = rename_src[srcs[i]].p->one;
+		if (!prepare_size(r, one))
+			src_size[src_sized++] = one->size;
+	}
+	ALLOC_ARRAY(dst_size, task_nr);
+	for (i = 0; i < task_nr; i++) {
+		struct diff_filespec *two = rename_dst[task[i].dst].two;
+		if (!prepare_size(r, two))
+			dst_size[dst_sized++] = two->size;
+	}
+	QSORT(src_size, src_sized, size_cmp);
+	QSORT(dst_size, dst_sized, size_cmp);
+
+	for (i = 0; i < src_nr; i++) {
+		struct diff_filespec *one = rename_src[srcs[i]].p->one;
+		if (!prepare_size(r, one) &&
+		    has_similar_size(one->size, dst_size, dst_sized,
+				     minimum_score))
+			prepare_similarity(r, one);
+	}
+	for (i = 0; i < task_nr; i++) {
+		struct diff_filespec *two = rename_dst[task[i].dst].two;
+		if (!prepare_size(r, two) &&
+		    has_similar_size(two->size, src_size, src_sized,
+				     minimum_score))
+			prepare_similarity(r, two);
+	}
+
+	free(src_size);
+	free(dst_size);
+}
+
+/*
+ * The signatures of the files are cut in bands of a few MinHash values
+ * each; two files are compared if they agree on all the values of at
+ * least one band. With 32 bands of 2 values, files sharing a third of
+ * their spans (about what a 50% similar file shares) are found 97% of
+ * the time, and those sharing a tenth of them only 30% of the time.
+ */
+#define SIGNATURE_BANDS 32
+#define SIGNATURE_ROWS 2
+#define SIGNATURE_SIZE (SIGNATURE_BANDS * SIGNATURE_ROWS)
+
+/*
+ * Bound the work for files found in many buckets, e.g. near-duplicates:
+ * only this many sources of a bucket are looked at, and only this many
+ * candidates (those in the most buckets with the destination) are kept.
+ */
+#define MAX_BUCKET_SCAN 128
+#define MAX_CANDIDATES_PER_DST 16
+
+struct band_entry {
+	uint32_t key;
+	int band;
+	int src; /* index in rename_src */
+};
+
+static int band_entry_cmp(const void *a_, const void *b_)
+{
+	const struct band_entry *a = a_, *b = b_;
+
+	if (a->band != b->band)
+		return a->band < b->band ? -1 : 1;
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->src < b->src ? -1 : a->src > b->src;
+}
+
+static uint32_t band_key(const uint32_t *sig, int band)
+{
+	uint32_t key = 2166136261u;
+	int i;
+
+	for (i = 0; i < SIGNATURE_ROWS; i++)
+		key = (key ^ sig[band * SIGNATURE_ROWS + i]) * 16777619u;
+	return key;
+}
+
+static int signature(struct diff_filespec *one,
+		     const unsigned int *nr_files, unsigned int max_files,
+		     uint32_t *sig)
+{
+	if (!S_ISREG(one->mode) || !one->cnt_data)
+		return 0;
+	return diffcore_span_signature(one->cnt_data, nr_files, max_files,
+				       sig, SIGNATURE_SIZE);
+}
+
+struct candidate {
+	int src;
+	int hits;
+};
+
+static int candidate_cmp(const void *a_, const void *b_)
+{
+	const struct candidate *a = a_, *b = b_;
+
+	if (a->hits != b->hits)
+		return b->hits - a->hits;
+	return a->src - b->src;
+}
+
+static int int_cmp(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Index the MinHash signatures of the sources listed in "srcs" (see
+ * diffcore_span_signature()), and point each task at the sources which
+ * share a band with its destination. Returns the number of pairs left.
+ */
+static uint64_t find_similar_candidates(struct similarity_task *task,
+					int task_nr, int *srcs, int src_nr)
+{
+	unsigned int *nr_files, max_files;
+	struct band_entry *entry = NULL;
+	struct candidate *cand = NULL;
+	int entry_nr = 0, entry_alloc = 0, cand_alloc = 0;
+	int *seen, i, j, files = 0;
+	uint32_t sig[SIGNATURE_SIZE];
+	uint64_t nr_pairs = 0;
+
+	/*
+	 * Spans found in many files, like license headers or lone braces,
+	 * tell little about which files are similar.
+	 */
+	nr_files = xcalloc(DIFFCORE_SPAN_HASHBASE, sizeof(*nr_files));
+	for (i = 0; i < src_nr; i++) {
+		struct diff_filespec *one = rename_src[srcs[i]].p->one;
+		if (S_ISREG(one->mode) && one->cnt_data) {
+			diffcore_count_span_files(one->cnt_data, nr_files);
+			files++;
+		}
+	}
+	for (i = 0; i < task_nr; i++) {
+		struct diff_filespec *two = rename_dst[task[i].dst].two;
+		if (S_ISREG(two->mode) && two->cnt_data) {
+			diffcore_count_span_files(two->cnt_data, nr_files);
+			files++;
+		}
+	}
+	max_files = files / 16 > 16 ? files / 16 : 16;
+
+	for (i = 0; i < src_nr; i++) {
+		struct diff_filespec *one = rename_src[srcs[i]].p->one;
+
+		if (!signature(one, nr_files, max_files, sig))
+			continue;
+		ALLOC_GROW(entry, entry_nr + SIGNATURE_BANDS, entry_alloc);
+		for (j = 0; j < SIGNATURE_BANDS; j++) {
+			entry[entry_nr].key = band_key(sig, j);
+			entry[entry_nr].band = j;
+			entry[entry_nr].src = srcs[i];
+			entry_nr++;
+		}
+	}
+	QSORT(entry, entry_nr, band_entry_cmp);
+
+	seen = xcalloc(rename_src_nr, sizeof(*seen));
+	for (i = 0; i < task_nr; i++) {
+		struct diff_filespec *two = rename_dst[task[i].dst].two;
+		int cand_nr = 0;
+
+		task[i].src = NULL;
+		task[i].src_nr = 0;
+		if (!signature(two, nr_files, max_files, sig))
+			continue;
+
+		for (j = 0; j < SIGNATURE_BANDS; j++) {
+			struct band_entry key;
+			int lo = 0, hi = entry_nr, scan;
+
+			/* find the first entry of the bucket */
+			key.key = band_key(sig, j);
+			key.band = j;
+			key.src = -1;
+			while (lo < hi) {
+				int mid = lo + (hi - lo) / 2;
+				if (band_entry_cmp(&entry[mid], &key) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			for (scan = 0;
+			     lo < entry_nr && scan < MAX_BUCKET_SCAN &&
+			     entry[lo].band == j && entry[lo].key == key.key;
+			     lo++, scan++) {
+				int src = entry[lo].src;
+
+				/* "seen" holds the position in "cand", plus one */
+				if (seen[src] && seen[src] <= cand_nr &&
+				    cand[seen[src] - 1].src == src) {
+					cand[seen[src] - 1].hits++;
+					continue;
+				}
+				ALLOC_GROW(cand, cand_nr + 1, cand_alloc);
+				cand[cand_nr].src = src;
+				cand[cand_nr].hits = 1;
+				seen[src] = ++cand_nr;
+			}
+		}
+		if (!cand_nr)
+			continue;
+
+		QSORT(cand, cand_nr, candidate_cmp);
+		if (cand_nr > MAX_CANDIDATES_PER_DST)
+			cand_nr = MAX_CANDIDATES_PER_DST;
+		ALLOC_ARRAY(task[i].src, cand_nr);
+		for (j = 0; j < cand_nr; j++)
+			task[i].src[j] = cand[j].src;
+		/* compare in the same order as without the index */
+		QSORT(task[i].src, cand_nr, int_cmp);
+		task[i].src_nr = cand_nr;
+		nr_pairs += cand_nr;
+	}
+
+	free(seen);
+	free(cand);
+	free(entry);
+	free(nr_files);
+	return nr_pairs;
+}
+
+/*
+ * Comparing one pair takes little time; only use threads when there
+ * are many of them.
+ */
+#define THREAD_COST (1 << 15)
+
+struct progress_data {
+	uint64_t n;
+	struct progress *progress;
+	pthread_mutex_t mutex;
+};
+
+struct similarity_thread {
+	pthread_t pthread;
+	struct similarity_task *task;
+	int nr;
+	struct diff_score *mx; /* NUM_CANDIDATE_PER_DST for each task */
+	int minimum_score;
+	struct progress_data *progress;
+};
+
+static void *score_similarity(void *data)
+{
+	struct similarity_thread *t = data;
+	int i, j;
+
+	for (i = 0; i < t->nr; i++) {
+		struct similarity_task *task = &t->task[i];
+		struct diff_filespec *two = rename_dst[task->dst].two;
+		struct diff_score *m = &t->mx[i * NUM_CANDIDATE_PER_DST];
+
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < task->src_nr; j++) {
+			struct diff_filespec *one = rename_src[task->src[j]].p->one;
+			struct diff_score this_src;
+
+			this_src.score = estimate_similarity(one, two,
+							     t->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = task->dst;
+			this_src.src = task->src[j];
+			record_if_better(m, &this_src);
+		}
+
+		if (t->progress) {
+			struct progress_data *pd = t->progress;
+
+			pthread_mutex_lock(&pd->mutex);
+			pd->n += task->src_nr;
+			display_progress(pd->progress, pd->n);
+			pthread_mutex_unlock(&pd->mutex);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Fill the NUM_CANDIDATE_PER_DST entries of "mx" for each task with the
+ * best of its pairs. The files have gone through prepare_similarity(),
+ * so that the pairs can be spread across threads.
+ */
+static void score_tasks(struct similarity_task *task, int task_nr,
+			uint64_t nr_pairs, struct diff_score *mx,
+			int minimum_score, struct progress *progress)
+{
+	struct similarity_thread *data;
+	struct progress_data pd;
+	int threads = 1, i, offset, work;
+
+	if (HAVE_THREADS) {
+		uint64_t wanted = nr_pairs / THREAD_COST;
+		int cpus = online_cpus();
+
+		threads = wanted < cpus ? wanted : cpus;
+		if (threads < 2 && task_nr > 1 &&
+		    git_env_bool("GIT_TEST_RENAME_THREADS", 0))
+			threads = 2;
+		if (threads > task_nr)
+			threads = task_nr;
+		if (threads < 1)
+			threads = 1;
+	}
+
+	memset(&pd, 0, sizeof(pd));
+	pd.progress = progress;
+	pthread_mutex_init(&pd.mutex, NULL);
+
+	work = DIV_ROUND_UP(task_nr, threads);
+	threads = DIV_ROUND_UP(task_nr, work);
+	CALLOC_ARRAY(data, threads);
+	for (i = offset = 0; i < threads; i++, offset += work) {
+		struct similarity_thread *t = &data[i];
+
+		t->task = task + offset;
+		t->nr = offset + work < task_nr ? work : task_nr - offset;
+		t->mx = mx + (size_t)offset * NUM_CANDIDATE_PER_DST;
+		t->minimum_score = minimum_score;
+		if (progress)
+			t->progress = &pd;
+	}
+
+	if (threads == 1) {
+		score_similarity(&data[0]);
+	} else {
+		for (i = 0; i < threads; i++) {
+			int err = pthread_create(&data[i].pthread, NULL,
+						 score_similarity, &data[i]);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (i = 0; i < threads; i++)
+			if (pthread_join(data[i].pthread, NULL))
+				die(_("unable to join thread"));
+	}
+
+	pthread_mutex_destroy(&pd.mutex);
+	free(data);
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
  * 1 if we need to disable inexact rename detection;
  * 2 if we would be under the limit if we were given -C instead of -C -C.
  */
-static int too_many_rename_candidates(int num_create,
+static int too_many_rename_candidates(int num_create, int num_src,
 				      struct diff_options *options)
 {
 	int rename_limit = options->rename_limit;
-	int num_src = rename_src_nr;
 	int i;
 
 	options->needed_rename_limit = 0;
@@ -455,8 +1131,11 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	struct similarity_task *task;
+	int *srcs;
+	int i, rename_count, skip_unmodified = 0, use_index = 0;
+	int num_create, num_src, dst_cnt, src_cnt;
+	uint64_t nr_pairs;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
@@ -517,9 +1196,24 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	/*
+	 * When looking for renames only, a source cannot be used twice,
+	 * so that a source and a destination which are similar enough
+	 * can be paired up without comparing them to all the others when
+	 * their paths tell they likely belong together. This takes care
+	 * of most files when directories move, and is not bound by the
+	 * rename limit.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		int min_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+
+		rename_count += find_basename_matches(options, min_score);
+		rename_count += find_dir_rename_matches(options, min_score);
+	}
+
 	/*
 	 * Calculate how many renames are left (but all the source
-	 * files still remain as options for rename/copies!)
+	 * files still remain as options for copies!)
 	 */
 	num_create = (rename_dst_nr - rename_count);
 
@@ -527,9 +1221,19 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
-	switch (too_many_rename_candidates(num_create, options)) {
+	for (num_src = i = 0; i < rename_src_nr; i++) {
+		if (detect_rename != DIFF_DETECT_COPY &&
+		    rename_src[i].p->one->rename_used)
+			continue;
+		num_src++;
+	}
+
+	switch (too_many_rename_candidates(num_create, num_src, options)) {
 	case 1:
-		goto cleanup;
+		if (!options->rename_index)
+			goto cleanup;
+		use_index = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -538,51 +1242,54 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
-	if (options->show_rename_progress) {
-		progress = start_delayed_progress(
-				_("Performing inexact rename detection"),
-				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
+	ALLOC_ARRAY(srcs, rename_src_nr);
+	for (src_cnt = i = 0; i < rename_src_nr; i++) {
+		if (skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (detect_rename != DIFF_DETECT_COPY &&
+		    rename_src[i].p->one->rename_used)
+			continue; /* cannot be renamed twice */
+		srcs[src_cnt++] = i;
 	}
 
-	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
+	ALLOC_ARRAY(task, num_create);
 	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
 		if (rename_dst[i].pair)
 			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
+		task[dst_cnt].dst = i;
+		task[dst_cnt].src = srcs;
+		task[dst_cnt].src_nr = src_cnt;
 		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
 	}
+	prepare_candidates(options->repo, srcs, src_cnt, task, dst_cnt,
+			   minimum_score);
+
+	if (use_index) {
+		nr_pairs = find_similar_candidates(task, dst_cnt,
+						   srcs, src_cnt);
+		/* we did not have to give up after all */
+		options->needed_rename_limit = 0;
+	} else {
+		nr_pairs = (uint64_t)dst_cnt * (uint64_t)src_cnt;
+	}
+
+	if (options->show_rename_progress) {
+		progress = start_delayed_progress(
+				_("Performing inexact rename detection"),
+				nr_pairs);
+	}
+
+	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
+	score_tasks(task, dst_cnt, nr_pairs, mx, minimum_score, progress);
 	stop_progress(&progress);
 
+	for (i = 0; i < dst_cnt; i++)
+		if (task[i].src != srcs)
+			free(task[i].src);
+	free(task);
+	free(srcs);
+
 	/* cost matrix sorted by most to least similar pair */
 	STABLE_QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
 
@@ -182,4 +182,34 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * The spans diffcore_count_changes() compares files by are hashed to
+ * values below this.
+ */
+#define DIFFCORE_SPAN_HASHBASE 107927
+
+/*
+ * Compute the "cnt_data" of a populated filespec for
+ * diffcore_count_changes() up front.
+ */
+void *diffcore_hash_spans(struct repository *r, struct diff_filespec *one);
+
+/*
+ * Increment the entry of "nr_files" (DIFFCORE_SPAN_HASHBASE long) for
+ * each distinct span in "cnt_data".
+ */
+void diffcore_count_span_files(void *cnt_data, unsigned int *nr_files);
+
+/*
+ * Fill "sig" with "nr" MinHash values over the distinct spans in
+ * "cnt_data"; the fraction of equal values in the signatures of two
+ * files estimates the fraction of spans they share. Spans found in more
+ * than "max_files" files according to "nr_files", if given, are left
+ * out. Returns the number of spans taken into account.
+ */
+int diffcore_span_signature(void *cnt_data,
+			    const unsigned int *nr_files,
+			    unsigned int max_files,
+			    uint32_t *sig, int nr);
+
 #endif
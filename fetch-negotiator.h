@@ -47,6 +47,18 @@ struct fetch_negotiator {
 	 */
 	int (*ack)(struct fetch_negotiator *, struct commit *);
 
+	/*
+	 * Optional. When set, it is called before each round of "have" lines
+	 * of a protocol v2 fetch, once the acknowledgments of the previous
+	 * round have been passed to ack(); the server acknowledges every
+	 * "have" it has, so the others of that round are not common. Return
+	 * how many "have" lines to send in this round, given the number
+	 * fetch-pack would send, "limit"; next() may return NULL at the end
+	 * of a round and more in the next one. An empty round ends the
+	 * negotiation.
+	 */
+	int (*next_round)(struct fetch_negotiator *, int limit);
+
 	void (*release)(struct fetch_negotiator *);
 
 	/* internal use */
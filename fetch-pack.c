@@ -37,6 +37,7 @@ static int server_supports_filtering;
 static struct lock_file shallow_lock;
 static const char *alternate_shallow_file;
 static struct strbuf fsck_msg_types = STRBUF_INIT;
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
 
 /* Remember to update object flag allocation in object.h */
 #define COMPLETE	(1U << 0)
@@ -792,8 +793,17 @@ static void write_promisor_file(const char *keep_name,
 	strbuf_release(&promisor_name);
 }
 
+static int fsck_objects_enabled(void)
+{
+	return fetch_fsck_objects >= 0
+	       ? fetch_fsck_objects
+	       : transfer_fsck_objects >= 0
+	       ? transfer_fsck_objects
+	       : 0;
+}
+
 static int get_pack(struct fetch_pack_args *args,
-		    int xd[2], char **pack_lockfile,
+		    int xd[2], struct string_list *pack_lockfiles,
 		    struct ref **sought, int nr_sought)
 {
 	struct async demux;
@@ -802,6 +812,7 @@ static int get_pack(struct fetch_pack_args *args,
 	struct pack_header header;
 	int pass_header = 0;
 	struct child_process cmd = CHILD_PROCESS_INIT;
+	char *pack_lockfile = NULL;
 	int ret;
 
 	memset(&demux, 0, sizeof(demux));
@@ -837,7 +848,7 @@ static int get_pack(struct fetch_pack_args *args,
 	}
 
 	if (do_keep || args->from_promisor) {
-		if (pack_lockfile)
+		if (pack_lockfiles)
 			cmd.out = -1;
 		cmd_name = "index-pack";
 		argv_array_push(&cmd.args, cmd_name);
@@ -862,7 +873,7 @@ static int get_pack(struct fetch_pack_args *args,
 		 * information below. If not, we need index-pack to do it for
 		 * us.
 		 */
-		if (!(do_keep && pack_lockfile) && args->from_promisor)
+		if (!(do_keep && pack_lockfiles) && args->from_promisor)
 			argv_array_push(&cmd.args, "--promisor");
 	}
 	else {
@@ -877,11 +888,7 @@ static int get_pack(struct fetch_pack_args *args,
 		argv_array_pushf(&cmd.args, "--pack_header=%"PRIu32",%"PRIu32,
 				 ntohl(header.hdr_version),
 				 ntohl(header.hdr_entries));
-	if (fetch_fsck_objects >= 0
-	    ? fetch_fsck_objects
-	    : transfer_fsck_objects >= 0
-	    ? transfer_fsck_objects
-	    : 0) {
+	if (fsck_objects_enabled()) {
 		if (args->from_promisor)
 			/*
 			 * We cannot use --strict in index-pack because it
@@ -898,8 +905,10 @@ static int get_pack(struct fetch_pack_args *args,
 	cmd.git_cmd = 1;
 	if (start_command(&cmd))
 		die(_("fetch-pack: unable to fork off %s"), cmd_name);
-	if (do_keep && pack_lockfile) {
-		*pack_lockfile = index_pack_lockfile(cmd.out);
+	if (do_keep && pack_lockfiles) {
+		pack_lockfile = index_pack_lockfile(cmd.out);
+		if (pack_lockfile)
+			string_list_append(pack_lockfiles, pack_lockfile);
 		close(cmd.out);
 	}
 
@@ -921,9 +930,10 @@ static int get_pack(struct fetch_pack_args *args,
 	 * Now that index-pack has succeeded, write the promisor file using the
 	 * obtained .keep filename if necessary
 	 */
-	if (do_keep && pack_lockfile && args->from_promisor)
-		write_promisor_file(*pack_lockfile, sought, nr_sought);
+	if (do_keep && pack_lockfiles && args->from_promisor)
+		write_promisor_file(pack_lockfile, sought, nr_sought);
 
+	free(pack_lockfile);
 	return 0;
 }
 
@@ -939,7 +949,7 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 				 const struct ref *orig_ref,
 				 struct ref **sought, int nr_sought,
 				 struct shallow_info *si,
-				 char **pack_lockfile)
+				 struct string_list *pack_lockfiles)
 {
 	struct repository *r = the_repository;
 	struct ref *ref = copy_ref_list(orig_ref);
@@ -1066,7 +1076,7 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		alternate_shallow_file = setup_temporary_shallow(si->shallow);
 	else
 		alternate_shallow_file = NULL;
-	if (get_pack(args, fd, pack_lockfile, sought, nr_sought))
+	if (get_pack(args, fd, pack_lockfiles, sought, nr_sought))
 		die(_("git fetch-pack: fetch failed."));
 
  all_done:
@@ -1148,12 +1158,15 @@ static int add_haves(struct fetch_negotiator *negotiator,
 {
 	int ret = 0;
 	int haves_added = 0;
+	int limit = *haves_to_send;
 	const struct object_id *oid;
 
-	while ((oid = negotiator->next(negotiator))) {
+	if (negotiator->next_round)
+		limit = negotiator->next_round(negotiator, limit);
+
+	while (haves_added < limit && (oid = negotiator->next(negotiator))) {
 		packet_buf_write(req_buf, "have %s\n", oid_to_hex(oid));
-		if (++haves_added >= *haves_to_send)
-			break;
+		haves_added++;
 	}
 
 	*in_vain += haves_added;
@@ -1201,6 +1214,18 @@ static int send_fetch_request(struct fetch_negotiator *negotiator, int fd_out,
 		packet_buf_write(&req_buf, "ofs-delta");
 	if (sideband_all)
 		packet_buf_write(&req_buf, "sideband-all");
+	if (uri_protocols.nr &&
+	    server_supports_feature("fetch", "packfile-uris", 0)) {
+		struct strbuf protocols = STRBUF_INIT;
+		int i;
+
+		for (i = 0; i < uri_protocols.nr; i++)
+			strbuf_addf(&protocols, "%s%s", i ? "," : "",
+				    uri_protocols.items[i].string);
+		print_verbose(args, _("Server supports packfile-uris"));
+		packet_buf_write(&req_buf, "packfile-uris %s", protocols.buf);
+		strbuf_release(&protocols);
+	}
 
 	/* Add shallow-info and deepen request */
 	if (server_supports_feature("fetch", "shallow", 0))
@@ -1419,6 +1444,123 @@ static void receive_wanted_refs(struct packet_reader *reader,
 		die(_("error processing wanted refs: %d"), reader->status);
 }
 
+/*
+ * Read the "packfile-uris" section: each line names a pack, by its hash,
+ * that we are to download from the given URI in addition to the pack
+ * sent inline.
+ */
+static void receive_packfile_uris(struct packet_reader *reader,
+				  struct string_list *uris)
+{
+	process_section_header(reader, "packfile-uris", 0);
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		struct object_id pack_hash;
+		const char *uri;
+
+		if (parse_oid_hex(reader->line, &pack_hash, &uri) ||
+		    *uri++ != ' ' || !*uri)
+			die(_("expected '<hash> <uri>', got '%s'"), reader->line);
+		string_list_append(uris, uri)->util =
+			xstrdup(oid_to_hex(&pack_hash));
+	}
+
+	if (reader->status != PACKET_READ_DELIM)
+		die(_("error processing packfile uris: %d"), reader->status);
+}
+
+/*
+ * The server may only send URIs using a protocol we asked for, and
+ * which is allowed for URIs not given by the user.
+ */
+static void check_packfile_uri(const char *uri)
+{
+	const char *end = strstr(uri, "://");
+	char *scheme;
+
+	if (!end)
+		die(_("packfile URI '%s' has no protocol"), uri);
+	scheme = xstrndup(uri, end - uri);
+	if (!unsorted_string_list_has_string(&uri_protocols, scheme))
+		die(_("packfile URI '%s' uses protocol '%s', "
+		      "which was not requested"), uri, scheme);
+	if (!is_transport_allowed(scheme, 0))
+		die(_("packfile URI '%s' uses protocol '%s', "
+		      "which is not allowed"), uri, scheme);
+	free(scheme);
+}
+
+/*
+ * Download the pack the server named "hash" from "uri", and index it.
+ * A file:// URI is read directly; other URIs are downloaded with
+ * "git http-fetch --packfile".
+ */
+static void fetch_packfile_uri(struct fetch_pack_args *args,
+			       const char *hash, const char *uri,
+			       struct string_list *pack_lockfiles)
+{
+	struct child_process download = CHILD_PROCESS_INIT;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	char hostname[HOST_NAME_MAX + 1];
+	struct strbuf expect = STRBUF_INIT;
+	const char *path;
+	char *lockfile;
+
+	check_packfile_uri(uri);
+	if (skip_prefix(uri, "file://", &path)) {
+		cmd.in = open(path, O_RDONLY);
+		if (cmd.in < 0)
+			die_errno(_("unable to open packfile URI '%s'"), uri);
+	} else {
+		download.git_cmd = 1;
+		download.out = -1;
+		argv_array_push(&download.args, "http-fetch");
+		argv_array_pushf(&download.args, "--packfile=%s", hash);
+		argv_array_push(&download.args, uri);
+		if (start_command(&download))
+			die(_("fetch-pack: unable to fork off %s"), "http-fetch");
+		cmd.in = download.out;
+	}
+
+	/*
+	 * The pack is kept until the refs are updated, like the one sent
+	 * inline. Its objects may point to objects in that other pack,
+	 * so check the objects themselves but not the links.
+	 */
+	cmd.git_cmd = 1;
+	cmd.out = -1;
+	argv_array_pushl(&cmd.args, "index-pack", "--stdin", NULL);
+	if (!args->quiet && !args->no_progress)
+		argv_array_push(&cmd.args, "-v");
+	if (xgethostname(hostname, sizeof(hostname)))
+		xsnprintf(hostname, sizeof(hostname), "localhost");
+	argv_array_pushf(&cmd.args, "--keep=fetch-pack %"PRIuMAX " on %s",
+			 (uintmax_t)getpid(), hostname);
+	if (args->from_promisor)
+		argv_array_push(&cmd.args, "--promisor");
+	if (fsck_objects_enabled())
+		argv_array_push(&cmd.args, "--fsck-objects");
+
+	if (start_command(&cmd))
+		die(_("fetch-pack: unable to fork off %s"), "index-pack");
+	lockfile = index_pack_lockfile(cmd.out);
+	close(cmd.out);
+	if (finish_command(&cmd))
+		die(_("index-pack failed on packfile URI '%s'"), uri);
+	if (download.args.argc && finish_command(&download))
+		die(_("unable to download packfile URI '%s'"), uri);
+
+	strbuf_addf(&expect, "/pack-%s.keep", hash);
+	if (!lockfile || !ends_with(lockfile, expect.buf))
+		die(_("packfile URI '%s' did not provide pack %s"), uri, hash);
+	strbuf_release(&expect);
+
+	if (pack_lockfiles)
+		string_list_append(pack_lockfiles, lockfile);
+	else
+		unlink_or_warn(lockfile);
+	free(lockfile);
+}
+
 enum fetch_state {
 	FETCH_CHECK_LOCAL = 0,
 	FETCH_SEND_REQUEST,
@@ -1433,7 +1575,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 				    struct ref **sought, int nr_sought,
 				    struct oid_array *shallows,
 				    struct shallow_info *si,
-				    char **pack_lockfile)
+				    struct string_list *pack_lockfiles)
 {
 	struct repository *r = the_repository;
 	struct ref *ref = copy_ref_list(orig_ref);
@@ -1444,6 +1586,8 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	int haves_to_send = INITIAL_FLUSH;
 	struct fetch_negotiator negotiator_alloc;
 	struct fetch_negotiator *negotiator;
+	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
+	int i;
 
 	if (args->no_dependents) {
 		negotiator = NULL;
@@ -1530,9 +1674,26 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			if (process_section_header(&reader, "wanted-refs", 1))
 				receive_wanted_refs(&reader, sought, nr_sought);
 
+			/*
+			 * Fetch the packs given by URI before the inline one,
+			 * whose objects may point to theirs.
+			 */
+			if (process_section_header(&reader, "packfile-uris", 1))
+				receive_packfile_uris(&reader, &packfile_uris);
+			for (i = 0; i < packfile_uris.nr; i++) {
+				trace2_region_enter("fetch-pack", "packfile-uri",
+						    the_repository);
+				fetch_packfile_uri(args,
+						   packfile_uris.items[i].util,
+						   packfile_uris.items[i].string,
+						   pack_lockfiles);
+				trace2_region_leave("fetch-pack", "packfile-uri",
+						    the_repository);
+			}
+
 			/* get the pack */
 			process_section_header(&reader, "packfile", 0);
-			if (get_pack(args, fd, pack_lockfile, sought, nr_sought))
+			if (get_pack(args, fd, pack_lockfiles, sought, nr_sought))
 				die(_("git fetch-pack: fetch failed."));
 
 			state = FETCH_DONE;
@@ -1545,6 +1706,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	if (negotiator)
 		negotiator->release(negotiator);
 	oidset_clear(&common);
+	string_list_clear(&packfile_uris, 1);
 	return ref;
 }
 
@@ -1575,11 +1737,17 @@ static int fetch_pack_config_cb(const char *var, const char *value, void *cb)
 
 static void fetch_pack_config(void)
 {
+	const char *str;
+
 	git_config_get_int("fetch.unpacklimit", &fetch_unpack_limit);
 	git_config_get_int("transfer.unpacklimit", &transfer_unpack_limit);
 	git_config_get_bool("repack.usedeltabaseoffset", &prefer_ofs_delta);
 	git_config_get_bool("fetch.fsckobjects", &fetch_fsck_objects);
 	git_config_get_bool("transfer.fsckobjects", &transfer_fsck_objects);
+	if (!git_config_get_string_const("fetch.uriprotocols", &str)) {
+		string_list_split(&uri_protocols, str, ',', -1);
+		free((char *)str);
+	}
 
 	git_config(fetch_pack_config_cb, NULL);
 }
@@ -1732,7 +1900,7 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       const struct ref *ref,
 		       struct ref **sought, int nr_sought,
 		       struct oid_array *shallow,
-		       char **pack_lockfile,
+		       struct string_list *pack_lockfiles,
 		       enum protocol_version version)
 {
 	struct ref *ref_cpy;
@@ -1767,11 +1935,11 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		memset(&si, 0, sizeof(si));
 		ref_cpy = do_fetch_pack_v2(args, fd, ref, sought, nr_sought,
 					   &shallows_scratch, &si,
-					   pack_lockfile);
+					   pack_lockfiles);
 	} else {
 		prepare_shallow_info(&si, shallow);
 		ref_cpy = do_fetch_pack(args, fd, ref, sought, nr_sought,
-					&si, pack_lockfile);
+					&si, pack_lockfiles);
 	}
 	reprepare_packed_git(the_repository);
 
@@ -0,0 +1,60 @@
+#ifndef FSMONITOR_DAEMON_H
+#define FSMONITOR_DAEMON_H
+
+#include "hashmap.h"
+#include "strbuf.h"
+
+/*
+ * State of a running "git fsmonitor--daemon", shared between the
+ * platform independent part in builtin/fsmonitor--daemon.c and the
+ * platform specific listener in compat/fsmonitor/.
+ */
+struct fsmonitor_daemon_state {
+	/* Absolute path of the top of the working tree being watched. */
+	struct strbuf path_worktree_watch;
+
+	/*
+	 * The daemon knows about every change that happened since this
+	 * time; queries about earlier points in time are answered with
+	 * "everything may have changed".
+	 */
+	uint64_t start_time;
+
+	/* Changed paths, relative to the worktree, to their change time. */
+	struct hashmap changed_paths;
+
+	/* Private data of the platform listener. */
+	void *listen_data;
+};
+
+/*
+ * Called by the listener for every path that changed. Directories
+ * are passed with a trailing slash and stand for everything below
+ * them.
+ */
+void fsmonitor_daemon_path_changed(struct fsmonitor_daemon_state *state,
+				   const char *path);
+
+/*
+ * Called by the listener when it lost track of some changes (e.g.
+ * its event queue overflowed): forget everything we know, so that
+ * the next query from every client rescans the working tree.
+ */
+void fsmonitor_daemon_forget_all(struct fsmonitor_daemon_state *state);
+
+/*
+ * The platform listener. fsmonitor_listen_init() starts watching
+ * state->path_worktree_watch recursively, returning 0 on success and
+ * -1 (after reporting an error) otherwise. fsmonitor_listen_fd()
+ * gives a file descriptor that becomes readable when there are
+ * events to process, and fsmonitor_listen_drain() processes all the
+ * pending ones without blocking. It returns 0 to keep going, 1 when
+ * the working tree went away and -1 when we can no longer keep track
+ * of it; in both cases the daemon should stop.
+ */
+int fsmonitor_listen_init(struct fsmonitor_daemon_state *state);
+int fsmonitor_listen_fd(struct fsmonitor_daemon_state *state);
+int fsmonitor_listen_drain(struct fsmonitor_daemon_state *state);
+void fsmonitor_listen_release(struct fsmonitor_daemon_state *state);
+
+#endif /* FSMONITOR_DAEMON_H */
@@ -0,0 +1,83 @@
+#include "cache.h"
+#include "fsmonitor-ipc.h"
+#include "unix-socket.h"
+
+int fsmonitor_ipc_is_supported(void)
+{
+#if defined(HAVE_FSMONITOR_DAEMON_BACKEND) && !defined(NO_UNIX_SOCKETS)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+const char *fsmonitor_ipc_get_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = git_pathdup("fsmonitor--daemon.ipc");
+	return path;
+}
+
+#ifdef NO_UNIX_SOCKETS
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#else
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	int fd, saved_errno;
+
+	fd = unix_stream_connect(fsmonitor_ipc_get_path());
+	if (fd < 0)
+		return -1;
+
+	if (write_in_full(fd, command, strlen(command)) < 0 ||
+	    write_in_full(fd, "\n", 1) < 0)
+		goto fail;
+	shutdown(fd, SHUT_WR);
+
+	if (strbuf_read(answer, fd, 0) < 0 && errno != ECONNRESET)
+		goto fail;
+
+	close(fd);
+	return 0;
+
+fail:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+#endif
+
+int fsmonitor_ipc_send_query(uint64_t since, struct strbuf *answer)
+{
+	struct strbuf command = STRBUF_INIT;
+	struct strbuf raw = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&command, "query %"PRIuMAX, (uintmax_t)since);
+	ret = fsmonitor_ipc_send_command(command.buf, &raw);
+	strbuf_release(&command);
+
+	/*
+	 * A daemon that dies in the middle of the conversation also
+	 * gives us EOF, so only trust answers that carry the "ok" marker.
+	 */
+	if (!ret) {
+		if (raw.len >= 3 && !memcmp(raw.buf, "ok", 3))
+			strbuf_add(answer, raw.buf + 3, raw.len - 3);
+		else
+			ret = -1;
+	}
+	strbuf_release(&raw);
+	return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+struct strbuf;
+
+/*
+ * Client side of the conversation with "git fsmonitor--daemon".
+ *
+ * The daemon listens on a unix socket in the repository's $GIT_DIR.
+ * A client connects, writes a single request line, shuts down its
+ * writing half and reads the answer until EOF. The requests are:
+ *
+ *   "query <since>"  List the paths, relative to the top of the
+ *                    working tree, that may have changed since
+ *                    <since> (nanoseconds since the epoch, as
+ *                    returned by getnanotime()). The answer is "ok"
+ *                    and a NUL, followed by the paths, each terminated
+ *                    by a NUL; directories end in a slash. A lone "/"
+ *                    instead of the paths means that the daemon cannot
+ *                    tell, and that every path must be considered
+ *                    changed.
+ *
+ *   "ping"           Answer "ok <worktree>".
+ *
+ *   "exit"           Remove the socket and exit.
+ */
+
+/*
+ * Return 1 if this platform has a daemon backend at all.
+ */
+int fsmonitor_ipc_is_supported(void);
+
+/*
+ * Return the path of the daemon socket of the current repository.
+ */
+const char *fsmonitor_ipc_get_path(void);
+
+/*
+ * Send `command` to the daemon and store its answer in `answer`.
+ * Returns 0 on success, and -1 (with errno set) when no daemon is
+ * listening or the conversation failed.
+ */
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer);
+
+/*
+ * Ask the daemon which paths may have changed since `since`, in the
+ * format expected from a version 1 fsmonitor hook. Returns 0 on
+ * success and -1 on failure, in which case the caller must assume
+ * that everything is dirty.
+ */
+int fsmonitor_ipc_send_query(uint64_t since, struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
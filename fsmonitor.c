@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -110,7 +111,9 @@ void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
 }
 
 /*
- * Call the query-fsmonitor hook passing the time of the last saved results.
+ * Call the query-fsmonitor hook passing the time of the last saved results,
+ * or ask the built-in daemon, which answers in the same format without
+ * having to spawn anything.
  */
 static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *query_result)
 {
@@ -119,6 +122,9 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	if (!core_fsmonitor)
 		return -1;
 
+	if (core_use_builtin_fsmonitor)
+		return fsmonitor_ipc_send_query(last_update, query_result);
+
 	argv_array_push(&cp.args, core_fsmonitor);
 	argv_array_pushf(&cp.args, "%d", version);
 	argv_array_pushf(&cp.args, "%" PRIuMAX, (uintmax_t)last_update);
@@ -128,10 +134,43 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	return capture_command(&cp, query_result, 1024);
 }
 
+/*
+ * A directory, reported with a trailing slash, stands for everything
+ * below it (e.g. it was renamed or removed as a whole).
+ */
+static void fsmonitor_refresh_directory(struct index_state *istate,
+					const char *name, size_t len)
+{
+	char *dir = xmemdupz(name, len - 1);
+	int pos = index_name_pos(istate, name, len);
+
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (strncmp(ce->name, name, len))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
+	if (verify_path(dir, 0))
+		untracked_cache_invalidate_path(istate, name, 1);
+	free(dir);
+}
+
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	size_t len = strlen(name);
+	int pos;
+
+	if (len > 1 && name[len - 1] == '/') {
+		fsmonitor_refresh_directory(istate, name, len);
+		return;
+	}
 
+	pos = index_name_pos(istate, name, len);
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
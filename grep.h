@@ -20,6 +20,7 @@ typedef int pcre2_compile_context;
 #endif
 #include "thread-utils.h"
 #include "userdiff.h"
+#include "object-store.h"
 
 struct repository;
 
@@ -220,18 +221,21 @@ int grep_threads_ok(const struct grep_opt *opt);
  */
 extern int grep_use_locks;
 extern pthread_mutex_t grep_attr_mutex;
-extern pthread_mutex_t grep_read_mutex;
 
+/*
+ * Object reads take the object read lock by themselves once the
+ * threads have enabled it (see enable_obj_read_lock()). Other uses of
+ * the object store that are not thread-safe, like textconv and the
+ * setup of submodules, hold it explicitly with these.
+ */
 static inline void grep_read_lock(void)
 {
-	if (grep_use_locks)
-		pthread_mutex_lock(&grep_read_mutex);
+	obj_read_lock();
 }
 
 static inline void grep_read_unlock(void)
 {
-	if (grep_use_locks)
-		pthread_mutex_unlock(&grep_read_mutex);
+	obj_read_unlock();
 }
 
 #endif
@@ -5,7 +5,60 @@
 #include "walker.h"
 
 static const char http_fetch_usage[] = "git http-fetch "
-"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
+"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url\n"
+"   or: git http-fetch --packfile=hash url\n"
+"   or: git http-fetch --output=file url";
+
+/*
+ * Download the pack at "url" and copy it to the standard output, for
+ * fetch-pack to index it. The download goes through a temporary file
+ * named after the pack hash, so that it can be resumed.
+ */
+static int fetch_single_packfile(const char *hash, const char *url)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	int fd, ret = 0;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+	http_init(NULL, url, 0);
+
+	strbuf_addf(&tmp, "%s/pack/tmp_uri_pack_%s", get_object_directory(),
+		    hash);
+	if (http_get_file(url, tmp.buf, NULL) != HTTP_OK)
+		ret = error("unable to get pack file %s", url);
+	else {
+		fd = open(tmp.buf, O_RDONLY);
+		if (fd < 0)
+			ret = error_errno("unable to open %s", tmp.buf);
+		else {
+			if (copy_fd(fd, 1) < 0)
+				ret = -1;
+			close(fd);
+		}
+		unlink_or_warn(tmp.buf);
+	}
+
+	http_cleanup();
+	strbuf_release(&tmp);
+	return ret ? 1 : 0;
+}
+
+/* Download "url" to "path", e.g. for fetching a bundle. */
+static int fetch_single_file(const char *path, const char *url)
+{
+	int ret = 0;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+	http_init(NULL, url, 0);
+
+	if (http_get_file(url, path, NULL) != HTTP_OK)
+		ret = error("unable to get %s", url);
+
+	http_cleanup();
+	return ret ? 1 : 0;
+}
 
 int cmd_main(int argc, const char **argv)
 {
@@ -19,9 +72,13 @@ int cmd_main(int argc, const char **argv)
 	int rc = 0;
 	int get_verbosely = 0;
 	int get_recover = 0;
+	const char *packfile_hash = NULL;
+	const char *output = NULL;
 
 	while (arg < argc && argv[arg][0] == '-') {
-		if (argv[arg][1] == 't') {
+		if (skip_prefix(argv[arg], "--packfile=", &packfile_hash)) {
+		} else if (skip_prefix(argv[arg], "--output=", &output)) {
+		} else if (argv[arg][1] == 't') {
 		} else if (argv[arg][1] == 'c') {
 		} else if (argv[arg][1] == 'a') {
 		} else if (argv[arg][1] == 'v') {
@@ -38,6 +95,16 @@ int cmd_main(int argc, const char **argv)
 		}
 		arg++;
 	}
+	if (packfile_hash) {
+		if (argc != arg + 1)
+			usage(http_fetch_usage);
+		return fetch_single_packfile(packfile_hash, argv[arg]);
+	}
+	if (output) {
+		if (argc != arg + 1)
+			usage(http_fetch_usage);
+		return fetch_single_file(output, argv[arg]);
+	}
 	if (argc != arg + 2 - commits_on_stdin)
 		usage(http_fetch_usage);
 	if (commits_on_stdin) {
@@ -12,6 +12,10 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "trace.h"
+#include "trace2.h"
+#include "khash.h"
+#include "thread-utils.h"
+#include "promisor-remote.h"
 
 struct traversal_context {
 	struct rev_info *revs;
@@ -19,8 +23,12 @@ struct traversal_context {
 	show_commit_fn show_commit;
 	void *show_data;
 	struct filter *filter;
+	int nr_threads;
+	int omit_blobs;
 };
 
+static void traverse_trees_and_blobs_parallel(struct traversal_context *ctx);
+
 static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
 			 struct strbuf *path,
@@ -385,7 +393,10 @@ static void do_traverse(struct traversal_context *ctx)
 			 */
 			traverse_trees_and_blobs(ctx, &csp);
 	}
-	traverse_trees_and_blobs(ctx, &csp);
+	if (ctx->nr_threads > 1)
+		traverse_trees_and_blobs_parallel(ctx);
+	else
+		traverse_trees_and_blobs(ctx, &csp);
 	strbuf_release(&csp);
 }
 
@@ -400,6 +411,8 @@ void traverse_commit_list(struct rev_info *revs,
 	ctx.show_object = show_object;
 	ctx.show_data = show_data;
 	ctx.filter = NULL;
+	ctx.nr_threads = 1;
+	ctx.omit_blobs = 0;
 	do_traverse(&ctx);
 }
 
@@ -418,6 +431,478 @@ void traverse_commit_list_filtered(
 	ctx.show_commit = show_commit;
 	ctx.show_data = show_data;
 	ctx.filter = list_objects_filter__init(omitted, filter_options);
+	ctx.nr_threads = 1;
+	ctx.omit_blobs = 0;
 	do_traverse(&ctx);
 	list_objects_filter__free(ctx.filter);
 }
+
+/*
+ * Parallel traversal of trees and blobs.
+ *
+ * The trees of the commits (and the other pending objects) are cut
+ * into chunks of consecutive entries, which the threads pick up in
+ * order. Each chunk is walked depth-first like process_tree() does,
+ * recording the objects it finds and their names. The main thread
+ * shows the records of one chunk after the other, skipping objects
+ * that an earlier chunk already showed, so that the objects and their
+ * names come out exactly as in a single-threaded traversal.
+ *
+ * To avoid walking the same subtrees over and over, every object is
+ * "claimed" by the lowest chunk that reached it so far. A chunk does
+ * not descend into an object claimed by an earlier chunk, as the
+ * single-threaded traversal would have seen it by then. Objects that
+ * are UNINTERESTING or SEEN before we start are claimed by chunk -1.
+ */
+
+#define CLAIM_SHARDS 64
+#define CHUNKS_PER_THREAD 8
+#define EXPAND_MAX_DEPTH 4
+
+struct claim_shard {
+	pthread_mutex_t mutex;
+	kh_oid_pos_t *map;
+};
+
+struct walk_item {
+	struct object_id oid;
+	struct object *obj;	/* the entry of revs->pending, if any */
+	enum object_type type;
+	const char *path;
+	/* show the tree only; its entries are the next items */
+	unsigned shallow:1;
+	unsigned free_path:1;
+};
+
+struct walk_record {
+	struct object_id oid;
+	struct object *obj;
+	enum object_type type;
+	size_t path;		/* offset into walk_chunk.paths */
+	unsigned bad:1;
+};
+
+struct walk_chunk {
+	int first, last;
+	struct walk_record *rec;
+	size_t nr, alloc;
+	struct strbuf paths;
+	int done;
+};
+
+struct parallel_walk {
+	struct traversal_context *ctx;
+	struct walk_item *items;
+	int nr_items, alloc_items;
+	struct walk_chunk *chunks;
+	int nr_chunks;
+	int next_chunk;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct claim_shard shards[CLAIM_SHARDS];
+};
+
+static struct claim_shard *claim_shard(struct parallel_walk *pw,
+				       const struct object_id *oid)
+{
+	/* the first bytes are what the map hashes on */
+	return &pw->shards[oid->hash[sizeof(unsigned int)] % CLAIM_SHARDS];
+}
+
+/*
+ * Claim "oid" for chunk "nr". Returns 0 if it is already claimed by that
+ * chunk or an earlier one, and the caller should not walk it.
+ */
+static int claim_object(struct parallel_walk *pw,
+			const struct object_id *oid, int nr)
+{
+	struct claim_shard *shard = claim_shard(pw, oid);
+	khiter_t pos;
+	int hashret, ret = 1;
+
+	pthread_mutex_lock(&shard->mutex);
+	pos = kh_put_oid_pos(shard->map, *oid, &hashret);
+	if (!hashret && kh_value(shard->map, pos) <= nr)
+		ret = 0;
+	else
+		kh_value(shard->map, pos) = nr;
+	pthread_mutex_unlock(&shard->mutex);
+	return ret;
+}
+
+static int object_is_excluded(struct parallel_walk *pw,
+			      const struct object_id *oid)
+{
+	struct claim_shard *shard = claim_shard(pw, oid);
+	khiter_t pos = kh_get_oid_pos(shard->map, *oid);
+
+	return pos != kh_end(shard->map) && kh_value(shard->map, pos) < 0;
+}
+
+static void *read_tree_buffer(const struct object_id *oid, unsigned long *size)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	void *buf;
+
+	oi.typep = &type;
+	oi.sizep = size;
+	oi.contentp = &buf;
+	if (oid_object_info_extended(the_repository, oid, &oi,
+				     OBJECT_INFO_LOOKUP_REPLACE |
+				     OBJECT_INFO_SKIP_FETCH_OBJECT) < 0)
+		return NULL;
+	if (type != OBJ_TREE) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static struct walk_record *add_record(struct walk_chunk *chunk,
+				      const struct object_id *oid,
+				      struct object *obj,
+				      enum object_type type,
+				      const char *path)
+{
+	struct walk_record *rec;
+
+	ALLOC_GROW(chunk->rec, chunk->nr + 1, chunk->alloc);
+	rec = &chunk->rec[chunk->nr++];
+	oidcpy(&rec->oid, oid);
+	rec->obj = obj;
+	rec->type = type;
+	rec->path = chunk->paths.len;
+	rec->bad = 0;
+	strbuf_addstr(&chunk->paths, path);
+	strbuf_addch(&chunk->paths, '\0');
+	return rec;
+}
+
+static void walk_tree(struct parallel_walk *pw, int nr,
+		      const struct object_id *oid, struct object *obj,
+		      struct strbuf *base)
+{
+	struct walk_chunk *chunk = &pw->chunks[nr];
+	struct walk_record *rec;
+	struct tree_desc desc;
+	struct name_entry entry;
+	unsigned long size;
+	size_t baselen = base->len;
+	void *buf;
+
+	buf = read_tree_buffer(oid, &size);
+	rec = add_record(chunk, oid, obj, OBJ_TREE, base->buf);
+	if (!buf) {
+		rec->bad = 1;
+		return;
+	}
+
+	if (baselen)
+		strbuf_addch(base, '/');
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (!S_ISDIR(entry.mode) && pw->ctx->omit_blobs)
+			continue;
+		if (!claim_object(pw, &entry.oid, nr))
+			continue;
+
+		strbuf_addstr(base, entry.path);
+		if (S_ISDIR(entry.mode))
+			walk_tree(pw, nr, &entry.oid, NULL, base);
+		else
+			add_record(chunk, &entry.oid, NULL, OBJ_BLOB, base->buf);
+		strbuf_setlen(base, baselen + !!baselen);
+	}
+	strbuf_setlen(base, baselen);
+	free(buf);
+}
+
+static void walk_chunk(struct parallel_walk *pw, int nr)
+{
+	struct walk_chunk *chunk = &pw->chunks[nr];
+	struct strbuf base = STRBUF_INIT;
+	int i;
+
+	for (i = chunk->first; i < chunk->last; i++) {
+		struct walk_item *item = &pw->items[i];
+
+		if (!claim_object(pw, &item->oid, nr))
+			continue;
+		if (item->type == OBJ_TREE && !item->shallow) {
+			strbuf_addstr(&base, item->path);
+			walk_tree(pw, nr, &item->oid, item->obj, &base);
+			strbuf_reset(&base);
+		} else {
+			add_record(chunk, &item->oid, item->obj,
+				   item->type, item->path);
+		}
+	}
+	strbuf_release(&base);
+}
+
+static void *walk_chunks_thread(void *data)
+{
+	struct parallel_walk *pw = data;
+
+	for (;;) {
+		int nr;
+
+		pthread_mutex_lock(&pw->mutex);
+		nr = pw->next_chunk++;
+		pthread_mutex_unlock(&pw->mutex);
+		if (nr >= pw->nr_chunks)
+			break;
+
+		walk_chunk(pw, nr);
+
+		pthread_mutex_lock(&pw->mutex);
+		pw->chunks[nr].done = 1;
+		pthread_cond_broadcast(&pw->cond);
+		pthread_mutex_unlock(&pw->mutex);
+	}
+	return NULL;
+}
+
+static void show_chunk(struct parallel_walk *pw, struct walk_chunk *chunk)
+{
+	struct traversal_context *ctx = pw->ctx;
+	struct repository *r = ctx->revs->repo;
+	size_t i;
+
+	for (i = 0; i < chunk->nr; i++) {
+		struct walk_record *rec = &chunk->rec[i];
+		struct object *obj = rec->obj;
+		const char *path = chunk->paths.buf + rec->path;
+
+		if (!obj) {
+			if (rec->type == OBJ_TREE)
+				obj = (struct object *)lookup_tree(r, &rec->oid);
+			else
+				obj = (struct object *)lookup_blob(r, &rec->oid);
+			if (!obj)
+				die(_("unable to parse object %s at '%s'"),
+				    oid_to_hex(&rec->oid), path);
+			obj->flags |= NOT_USER_GIVEN;
+		}
+		if (obj->flags & (UNINTERESTING | SEEN))
+			continue;
+		if (obj->type != OBJ_TREE && obj->type != OBJ_BLOB &&
+		    obj->type != OBJ_TAG)
+			die("unknown pending object %s (%s)",
+			    oid_to_hex(&obj->oid), path);
+		if (rec->bad)
+			die("bad tree object %s", oid_to_hex(&obj->oid));
+
+		obj->flags |= SEEN;
+		/* the threads may still be reading objects */
+		obj_read_lock();
+		ctx->show_object(obj, path, ctx->show_data);
+		obj_read_unlock();
+	}
+	FREE_AND_NULL(chunk->rec);
+	chunk->nr = chunk->alloc = 0;
+	strbuf_release(&chunk->paths);
+}
+
+static void add_item(struct parallel_walk *pw, const struct walk_item *item)
+{
+	ALLOC_GROW(pw->items, pw->nr_items + 1, pw->alloc_items);
+	pw->items[pw->nr_items++] = *item;
+}
+
+/*
+ * With fewer items than threads (a shallow clone has a single root
+ * tree), replace the trees by their entries, one level at a time.
+ */
+static void expand_items(struct parallel_walk *pw)
+{
+	struct walk_item *items = pw->items;
+	int nr = pw->nr_items, i;
+
+	pw->items = NULL;
+	pw->nr_items = pw->alloc_items = 0;
+	for (i = 0; i < nr; i++) {
+		struct walk_item *item = &items[i];
+		struct tree_desc desc;
+		struct name_entry entry;
+		unsigned long size;
+		void *buf = NULL;
+
+		if (item->type == OBJ_TREE && !item->shallow &&
+		    !object_is_excluded(pw, &item->oid))
+			buf = read_tree_buffer(&item->oid, &size);
+		if (!buf) {
+			add_item(pw, item);
+			continue;
+		}
+
+		item->shallow = 1;
+		add_item(pw, item);
+		init_tree_desc(&desc, buf, size);
+		while (tree_entry(&desc, &entry)) {
+			struct walk_item child = { { { 0 } } };
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			if (!S_ISDIR(entry.mode) && pw->ctx->omit_blobs)
+				continue;
+			oidcpy(&child.oid, &entry.oid);
+			child.type = S_ISDIR(entry.mode) ? OBJ_TREE : OBJ_BLOB;
+			child.path = *item->path ?
+				xstrfmt("%s/%s", item->path, entry.path) :
+				xstrdup(entry.path);
+			child.free_path = 1;
+			add_item(pw, &child);
+		}
+		free(buf);
+	}
+	free(items);
+}
+
+static void traverse_trees_and_blobs_parallel(struct traversal_context *ctx)
+{
+	struct parallel_walk pw = { ctx };
+	struct object_array *pending = &ctx->revs->pending;
+	int nr_threads = ctx->nr_threads;
+	pthread_t *threads;
+	unsigned int max, u;
+	int i, chunk_size;
+
+	for (i = 0; i < CLAIM_SHARDS; i++) {
+		pthread_mutex_init(&pw.shards[i].mutex, NULL);
+		pw.shards[i].map = kh_init_oid_pos();
+	}
+	max = get_max_object_index();
+	for (u = 0; u < max; u++) {
+		struct object *obj = get_indexed_object(u);
+		if (obj && (obj->flags & (UNINTERESTING | SEEN)))
+			claim_object(&pw, &obj->oid, -1);
+	}
+
+	for (i = 0; i < pending->nr; i++) {
+		struct object_array_entry *e = &pending->objects[i];
+		struct walk_item item = { { { 0 } } };
+
+		if (e->item->flags & (UNINTERESTING | SEEN))
+			continue;
+		oidcpy(&item.oid, &e->item->oid);
+		item.obj = e->item;
+		item.type = e->item->type;
+		if (item.type == OBJ_TAG)
+			item.path = e->name;
+		else
+			item.path = e->path ? e->path : "";
+		add_item(&pw, &item);
+	}
+	for (i = 0; i < EXPAND_MAX_DEPTH && pw.nr_items < nr_threads; i++)
+		expand_items(&pw);
+
+	enable_obj_read_lock();
+	pthread_mutex_init(&pw.mutex, NULL);
+	pthread_cond_init(&pw.cond, NULL);
+
+	chunk_size = DIV_ROUND_UP(pw.nr_items, nr_threads * CHUNKS_PER_THREAD);
+	if (!chunk_size)
+		chunk_size = 1;
+	pw.nr_chunks = DIV_ROUND_UP(pw.nr_items, chunk_size);
+	CALLOC_ARRAY(pw.chunks, pw.nr_chunks);
+	for (i = 0; i < pw.nr_chunks; i++) {
+		pw.chunks[i].first = i * chunk_size;
+		pw.chunks[i].last = (i + 1) * chunk_size;
+		if (pw.chunks[i].last > pw.nr_items)
+			pw.chunks[i].last = pw.nr_items;
+		strbuf_init(&pw.chunks[i].paths, 0);
+	}
+
+	if (nr_threads > pw.nr_chunks)
+		nr_threads = pw.nr_chunks;
+	trace2_data_intmax("list-objects", ctx->revs->repo,
+			   "parallel/threads", nr_threads);
+	trace2_data_intmax("list-objects", ctx->revs->repo,
+			   "parallel/chunks", pw.nr_chunks);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, walk_chunks_thread, &pw))
+			die(_("unable to create thread"));
+
+	for (i = 0; i < pw.nr_chunks; i++) {
+		pthread_mutex_lock(&pw.mutex);
+		while (!pw.chunks[i].done)
+			pthread_cond_wait(&pw.cond, &pw.mutex);
+		pthread_mutex_unlock(&pw.mutex);
+		show_chunk(&pw, &pw.chunks[i]);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+	pthread_cond_destroy(&pw.cond);
+	pthread_mutex_destroy(&pw.mutex);
+
+	for (i = 0; i < CLAIM_SHARDS; i++) {
+		kh_destroy_oid_pos(pw.shards[i].map);
+		pthread_mutex_destroy(&pw.shards[i].mutex);
+	}
+	for (i = 0; i < pw.nr_items; i++)
+		if (pw.items[i].free_path)
+			free((char *)pw.items[i].path);
+	free(pw.items);
+	free(pw.chunks);
+	object_array_clear(pending);
+}
+
+static int can_traverse_in_parallel(struct list_objects_filter_options *filter_options,
+				    struct rev_info *revs)
+{
+	switch (filter_options->choice) {
+	case LOFC_DISABLED:
+		if (!revs->blob_objects)
+			return 0;
+		break;
+	case LOFC_BLOB_NONE:
+		break;
+	default:
+		return 0;
+	}
+
+	return HAVE_THREADS &&
+		revs->tree_objects &&
+		!revs->diffopt.pathspec.nr &&
+		!revs->tree_blobs_in_commit_order &&
+		!revs->exclude_promisor_objects &&
+		!revs->ignore_missing_links &&
+		!revs->do_not_die_on_missing_tree &&
+		!(fetch_if_missing && has_promisor_remote());
+}
+
+void traverse_commit_list_parallel(
+	struct list_objects_filter_options *filter_options,
+	struct rev_info *revs,
+	show_commit_fn show_commit,
+	show_object_fn show_object,
+	void *show_data,
+	int nr_threads)
+{
+	struct traversal_context ctx;
+
+	if (nr_threads <= 1 ||
+	    !can_traverse_in_parallel(filter_options, revs)) {
+		traverse_commit_list_filtered(filter_options, revs,
+					      show_commit, show_object,
+					      show_data, NULL);
+		return;
+	}
+
+	ctx.revs = revs;
+	ctx.show_object = show_object;
+	ctx.show_commit = show_commit;
+	ctx.show_data = show_data;
+	ctx.filter = NULL;
+	ctx.nr_threads = nr_threads;
+	ctx.omit_blobs = filter_options->choice == LOFC_BLOB_NONE;
+	do_traverse(&ctx);
+}
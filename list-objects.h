@@ -25,4 +25,20 @@ void traverse_commit_list_filtered(
 	void *show_data,
 	struct oidset *omitted);
 
+/*
+ * Like traverse_commit_list_filtered(), but read and walk the trees with
+ * up to "nr_threads" threads. The objects are shown by the calling thread,
+ * in the same order and with the same names as without threads. When the
+ * traversal cannot be done this way (a filter other than "blob:none",
+ * pathspecs, missing objects allowed, ...), this falls back to a
+ * single-threaded traversal.
+ */
+void traverse_commit_list_parallel(
+	struct list_objects_filter_options *filter_options,
+	struct rev_info *revs,
+	show_commit_fn show_commit,
+	show_object_fn show_object,
+	void *show_data,
+	int nr_threads);
+
 #endif /* LIST_OBJECTS_H */
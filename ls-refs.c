@@ -32,6 +32,7 @@ struct ls_refs_data {
 	unsigned peel;
 	unsigned symrefs;
 	struct argv_array prefixes;
+	struct strbuf buf;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -39,7 +40,7 @@ static int send_ref(const char *refname, const struct object_id *oid,
 {
 	struct ls_refs_data *data = cb_data;
 	const char *refname_nons = strip_namespace(refname);
-	struct strbuf refline = STRBUF_INIT;
+	struct strbuf *refline = &data->buf;
 
 	if (ref_is_hidden(refname_nons, refname))
 		return 0;
@@ -47,7 +48,8 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	if (!ref_match(&data->prefixes, refname_nons))
 		return 0;
 
-	strbuf_addf(&refline, "%s %s", oid_to_hex(oid), refname_nons);
+	strbuf_reset(refline);
+	strbuf_addf(refline, "%s %s", oid_to_hex(oid), refname_nons);
 	if (data->symrefs && flag & REF_ISSYMREF) {
 		struct object_id unused;
 		const char *symref_target = resolve_ref_unsafe(refname, 0,
@@ -57,20 +59,18 @@ static int send_ref(const char *refname, const struct object_id *oid,
 		if (!symref_target)
 			die("'%s' is a symref but it is not?", refname);
 
-		strbuf_addf(&refline, " symref-target:%s",
+		strbuf_addf(refline, " symref-target:%s",
 			    strip_namespace(symref_target));
 	}
 
 	if (data->peel) {
 		struct object_id peeled;
 		if (!peel_ref(refname, &peeled))
-			strbuf_addf(&refline, " peeled:%s", oid_to_hex(&peeled));
+			strbuf_addf(refline, " peeled:%s", oid_to_hex(&peeled));
 	}
 
-	strbuf_addch(&refline, '\n');
-	packet_write(1, refline.buf, refline.len);
-
-	strbuf_release(&refline);
+	strbuf_addch(refline, '\n');
+	packet_write(1, refline->buf, refline->len);
 	return 0;
 }
 
@@ -90,6 +90,7 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 	struct ls_refs_data data;
 
 	memset(&data, 0, sizeof(data));
+	strbuf_init(&data.buf, 0);
 
 	git_config(ls_refs_config, NULL);
 
@@ -106,8 +107,10 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 	}
 
 	head_ref_namespaced(send_ref, &data);
-	for_each_namespaced_ref(send_ref, &data);
+	for_each_namespaced_ref_in_prefixes(data.prefixes.argv,
+					    send_ref, &data);
 	packet_flush(1);
 	argv_array_clear(&data.prefixes);
+	strbuf_release(&data.buf);
 	return 0;
 }
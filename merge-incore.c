@@ -0,0 +1,1162 @@
+/*
+ * In-memory three-way merge of trees; see merge-incore.h.
+ */
+#include "cache.h"
+#include "merge-incore.h"
+#include "alloc.h"
+#include "blob.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "hashmap.h"
+#include "ll-merge.h"
+#include "merge-recursive.h"
+#include "object-store.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "xdiff-interface.h"
+
+struct version {
+	unsigned short mode; /* 0 if absent */
+	struct object_id oid;
+};
+
+static int same_version(const struct version *a, const struct version *b)
+{
+	if (a->mode != b->mode)
+		return 0;
+	return !a->mode || oideq(&a->oid, &b->oid);
+}
+
+/*
+ * A path of the merge which could not be resolved by looking at the
+ * whole tree it is in, or a tree which could.
+ */
+struct merge_path {
+	struct hashmap_entry ent;
+
+	/* the merge base, the first side and the second side */
+	struct version stages[3];
+	/* where a stage comes from when it was moved here by a rename */
+	const char *stage_path[3];
+	/* where each side renamed this path to */
+	const char *rename_to[3];
+	/* which sides (bit 1 and 2) renamed another path to this one */
+	unsigned renamed_by;
+
+	struct version result;
+	/* where the result went in the tree, if not at "path" */
+	char *moved_to;
+	unsigned resolved : 1;
+	unsigned has_conflict : 1;
+	enum merge_conflict_type conflict;
+
+	char path[FLEX_ARRAY];
+};
+
+static int merge_path_cmp(const void *unused_cmp_data,
+			  const struct hashmap_entry *eptr,
+			  const struct hashmap_entry *entry_or_key,
+			  const void *keydata)
+{
+	const struct merge_path *a, *b;
+
+	a = container_of(eptr, const struct merge_path, ent);
+	b = container_of(entry_or_key, const struct merge_path, ent);
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merge_path *get_path(struct hashmap *paths, const char *path)
+{
+	return hashmap_get_entry_from_hash(paths, strhash(path), path,
+					   struct merge_path, ent);
+}
+
+static struct merge_path *add_path(struct hashmap *paths, const char *path)
+{
+	struct merge_path *e = get_path(paths, path);
+
+	if (!e) {
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->ent, strhash(path));
+		hashmap_add(paths, &e->ent);
+	}
+	return e;
+}
+
+static void set_conflict(struct merge_path *e, enum merge_conflict_type type)
+{
+	if (e->has_conflict)
+		return;
+	e->has_conflict = 1;
+	e->conflict = type;
+}
+
+/* A directory name, for the set of directories with renamed paths */
+struct dir_name {
+	struct hashmap_entry ent;
+	char name[FLEX_ARRAY];
+};
+
+static int dir_name_cmp(const void *unused_cmp_data,
+			const struct hashmap_entry *eptr,
+			const struct hashmap_entry *entry_or_key,
+			const void *keydata)
+{
+	const struct dir_name *a, *b;
+
+	a = container_of(eptr, const struct dir_name, ent);
+	b = container_of(entry_or_key, const struct dir_name, ent);
+	return strcmp(a->name, keydata ? keydata : b->name);
+}
+
+struct rename_pair {
+	char *src;
+	char *dst;
+};
+
+/* The renames between two trees, computed once per merge_incore_*() */
+struct rename_list {
+	struct hashmap_entry ent;
+	struct object_id base, side;
+	struct rename_pair *pairs;
+	int nr, alloc;
+};
+
+static int rename_list_cmp(const void *unused_cmp_data,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *unused_keydata)
+{
+	const struct rename_list *a, *b;
+
+	a = container_of(eptr, const struct rename_list, ent);
+	b = container_of(entry_or_key, const struct rename_list, ent);
+	return !oideq(&a->base, &b->base) || !oideq(&a->side, &b->side);
+}
+
+/*
+ * The result of merging three trees into a virtual merge base. The
+ * conflict markers in it depend on the depth of the merge and on the
+ * labels, so these are part of the key too.
+ */
+struct merged_trees {
+	struct hashmap_entry ent;
+	struct object_id base, side1, side2;
+	int call_depth;
+	const char *labels[3]; /* owned by the entries in the map */
+	struct object_id result;
+	int clean;
+};
+
+static int merged_trees_cmp(const void *unused_cmp_data,
+			    const struct hashmap_entry *eptr,
+			    const struct hashmap_entry *entry_or_key,
+			    const void *unused_keydata)
+{
+	const struct merged_trees *a, *b;
+
+	a = container_of(eptr, const struct merged_trees, ent);
+	b = container_of(entry_or_key, const struct merged_trees, ent);
+	return !oideq(&a->base, &b->base) || !oideq(&a->side1, &b->side1) ||
+		!oideq(&a->side2, &b->side2) ||
+		a->call_depth != b->call_depth ||
+		strcmp(a->labels[0], b->labels[0]) ||
+		strcmp(a->labels[1], b->labels[1]) ||
+		strcmp(a->labels[2], b->labels[2]);
+}
+
+struct merge_state {
+	struct merge_options *opt;
+	int call_depth;
+	struct hashmap renames; /* struct rename_list */
+	struct hashmap merged; /* struct merged_trees */
+};
+
+/* What one three-way merge of trees works on */
+struct merge_walk {
+	struct merge_state *state;
+	const char *labels[3];
+	struct hashmap paths; /* struct merge_path */
+	struct hashmap rename_dirs; /* struct dir_name */
+	struct rename_list *renames[3]; /* for side 1 and 2 */
+	struct merge_incore_result *result; /* NULL for virtual merges */
+};
+
+static void init_merge_state(struct merge_state *state,
+			     struct merge_options *opt)
+{
+	memset(state, 0, sizeof(*state));
+	state->opt = opt;
+	hashmap_init(&state->renames, rename_list_cmp, NULL, 0);
+	hashmap_init(&state->merged, merged_trees_cmp, NULL, 0);
+}
+
+static void clear_merge_state(struct merge_state *state)
+{
+	struct hashmap_iter iter;
+	struct rename_list *list;
+	struct merged_trees *merged;
+
+	hashmap_for_each_entry(&state->renames, &iter, list, ent) {
+		int i;
+
+		for (i = 0; i < list->nr; i++) {
+			free(list->pairs[i].src);
+			free(list->pairs[i].dst);
+		}
+		free(list->pairs);
+	}
+	hashmap_free_entries(&state->renames, struct rename_list, ent);
+	hashmap_for_each_entry(&state->merged, &iter, merged, ent) {
+		int i;
+
+		for (i = 0; i < 3; i++)
+			free((char *)merged->labels[i]);
+	}
+	hashmap_free_entries(&state->merged, struct merged_trees, ent);
+}
+
+static struct rename_list *get_renames(struct merge_state *state,
+				       struct tree *base, struct tree *side)
+{
+	struct merge_options *opt = state->opt;
+	struct rename_list key, *list;
+	struct diff_options opts;
+	int i;
+
+	oidcpy(&key.base, &base->object.oid);
+	oidcpy(&key.side, &side->object.oid);
+	hashmap_entry_init(&key.ent,
+			   oidhash(&key.base) ^ oidhash(&key.side));
+	list = hashmap_get_entry(&state->renames, &key, ent, NULL);
+	if (list)
+		return list;
+
+	list = xcalloc(1, sizeof(*list));
+	oidcpy(&list->base, &key.base);
+	oidcpy(&list->side, &key.side);
+	hashmap_entry_init(&list->ent, key.ent.hash);
+	hashmap_add(&state->renames, &list->ent);
+
+	if (!opt->detect_renames)
+		return list;
+
+	repo_diff_setup(opt->repo, &opts);
+	opts.flags.recursive = 1;
+	opts.flags.rename_empty = 0;
+	/* as in merge-recursive, copies are not followed */
+	opts.detect_rename = DIFF_DETECT_RENAME;
+	opts.rename_limit = (opt->rename_limit >= 0) ? opt->rename_limit : 1000;
+	opts.rename_score = opt->rename_score;
+	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opts);
+	diff_tree_oid(&base->object.oid, &side->object.oid, "", &opts);
+	diffcore_std(&opts);
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (p->status != 'R')
+			continue;
+		ALLOC_GROW(list->pairs, list->nr + 1, list->alloc);
+		list->pairs[list->nr].src = xstrdup(p->one->path);
+		list->pairs[list->nr].dst = xstrdup(p->two->path);
+		list->nr++;
+	}
+	diff_flush(&opts);
+	return list;
+}
+
+static void add_rename_dirs(struct merge_walk *w, const char *path)
+{
+	struct strbuf dir = STRBUF_INIT;
+	const char *slash;
+
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		struct dir_name *d;
+
+		strbuf_reset(&dir);
+		strbuf_add(&dir, path, slash - path);
+		if (hashmap_get_from_hash(&w->rename_dirs, strhash(dir.buf),
+					  dir.buf))
+			continue;
+		FLEX_ALLOC_MEM(d, name, dir.buf, dir.len);
+		hashmap_entry_init(&d->ent, strhash(d->name));
+		hashmap_add(&w->rename_dirs, &d->ent);
+	}
+	strbuf_release(&dir);
+}
+
+static int walk_trees(struct merge_walk *w, const char *base,
+		      const struct object_id **oids);
+
+/*
+ * Decide the version of a tree which one side left alone, or which both
+ * changed the same way; return 0 if it has to be merged entry by entry.
+ */
+static int resolve_trivially(const struct version v[3], struct version *result)
+{
+	if (same_version(&v[1], &v[2]))
+		*result = v[1];
+	else if (same_version(&v[0], &v[1]))
+		*result = v[2];
+	else if (same_version(&v[0], &v[2]))
+		*result = v[1];
+	else
+		return 0;
+	return 1;
+}
+
+static int collect_entries(int n, unsigned long mask, unsigned long dirmask,
+			   struct name_entry *names, struct traverse_info *info)
+{
+	struct merge_walk *w = info->data;
+	struct strbuf path = STRBUF_INIT;
+	struct name_entry *p;
+	int i, ret = mask;
+
+	for (p = names; !p->mode; p++)
+		; /* find the first side which has this name */
+	strbuf_make_traverse_path(&path, info, p->path, p->pathlen);
+
+	if (dirmask) {
+		struct version v[3];
+		const struct object_id *oids[3];
+
+		for (i = 0; i < 3; i++) {
+			v[i].mode = (dirmask & (1 << i)) ? names[i].mode : 0;
+			oidcpy(&v[i].oid, &names[i].oid);
+			oids[i] = v[i].mode ? &names[i].oid : NULL;
+		}
+
+		/*
+		 * Trees with no renamed path in them do not need to be
+		 * looked into when one side did not change them.
+		 */
+		if (mask == dirmask &&
+		    !hashmap_get_from_hash(&w->rename_dirs, strhash(path.buf),
+					   path.buf) &&
+		    resolve_trivially(v, &v[0])) {
+			if (v[0].mode) {
+				struct merge_path *e = add_path(&w->paths,
+								path.buf);
+				e->result = v[0];
+				e->resolved = 1;
+			}
+		} else if (walk_trees(w, path.buf, oids) < 0) {
+			ret = -1;
+		}
+	}
+
+	if (mask != dirmask) {
+		struct merge_path *e = add_path(&w->paths, path.buf);
+
+		for (i = 0; i < 3; i++) {
+			if (!names[i].mode || (dirmask & (1 << i)))
+				continue;
+			e->stages[i].mode = names[i].mode;
+			oidcpy(&e->stages[i].oid, &names[i].oid);
+		}
+	}
+
+	strbuf_release(&path);
+	return ret;
+}
+
+static int walk_trees(struct merge_walk *w, const char *base,
+		      const struct object_id **oids)
+{
+	struct repository *r = w->state->opt->repo;
+	struct tree_desc t[3];
+	void *buf[3];
+	struct traverse_info info;
+	int i, ret;
+
+	for (i = 0; i < 3; i++) {
+		buf[i] = fill_tree_descriptor(r, &t[i], oids[i]);
+		if (oids[i] && !buf[i]) {
+			while (i--)
+				free(buf[i]);
+			return error(_("unable to read tree under '%s'"), base);
+		}
+	}
+
+	setup_traverse_info(&info, base);
+	info.fn = collect_entries;
+	info.data = w;
+	ret = traverse_trees(r->index, 3, t, &info);
+
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	return ret;
+}
+
+static char *unique_path(struct hashmap *paths, const char *path,
+			 const char *label)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t base_len;
+	int suffix = 0;
+	char *p;
+
+	strbuf_addf(&buf, "%s~", path);
+	base_len = buf.len;
+	strbuf_addstr(&buf, label);
+	for (p = buf.buf + base_len; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	base_len = buf.len;
+	while (get_path(paths, buf.buf)) {
+		strbuf_setlen(&buf, base_len);
+		strbuf_addf(&buf, "_%d", suffix++);
+	}
+	return strbuf_detach(&buf, NULL);
+}
+
+/*
+ * Move the versions of "src" which "side" renamed to "dst" there, so
+ * that all the versions of the file are merged at its new path.
+ */
+static void apply_rename(struct merge_walk *w, int side,
+			 struct merge_path *src, const char *dst_path)
+{
+	int other = 3 - side;
+	struct merge_path *dst = get_path(&w->paths, dst_path);
+
+	if (!dst)
+		return;
+
+	if (dst->renamed_by) {
+		/*
+		 * The other side renamed another file here: keep this one
+		 * next to it.
+		 */
+		char *path = unique_path(&w->paths, dst_path, w->labels[side]);
+		struct merge_path *moved = add_path(&w->paths, path);
+
+		moved->stages[side] = dst->stages[side];
+		moved->stage_path[side] = dst->path;
+		dst->stages[side].mode = 0;
+		set_conflict(dst, MERGE_CONFLICT_RENAME_RENAME);
+		set_conflict(moved, MERGE_CONFLICT_RENAME_RENAME);
+		free(path);
+		dst = moved;
+	} else if (dst->stages[other].mode && !dst->stages[0].mode) {
+		/* The other side added a file here: move it aside */
+		char *path = unique_path(&w->paths, dst_path, w->labels[other]);
+		struct merge_path *moved = add_path(&w->paths, path);
+
+		moved->stages[other] = dst->stages[other];
+		moved->stage_path[other] = dst->path;
+		dst->stages[other].mode = 0;
+		set_conflict(dst, MERGE_CONFLICT_RENAME_ADD);
+		set_conflict(moved, MERGE_CONFLICT_RENAME_ADD);
+		free(path);
+	}
+
+	dst->stages[0] = src->stages[0];
+	dst->stage_path[0] = src->path;
+	if (!src->rename_to[other]) {
+		dst->stages[other] = src->stages[other];
+		dst->stage_path[other] = src->path;
+	}
+	dst->renamed_by |= 1 << side;
+}
+
+static void apply_renames(struct merge_walk *w)
+{
+	int side, i;
+
+	for (side = 1; side <= 2; side++) {
+		struct rename_list *list = w->renames[side];
+
+		for (i = 0; list && i < list->nr; i++) {
+			struct merge_path *src;
+
+			src = get_path(&w->paths, list->pairs[i].src);
+			if (src)
+				src->rename_to[side] = list->pairs[i].dst;
+		}
+	}
+
+	for (side = 1; side <= 2; side++) {
+		struct rename_list *list = w->renames[side];
+
+		for (i = 0; list && i < list->nr; i++) {
+			struct merge_path *src, *dst;
+			const char *to1, *to2;
+
+			src = get_path(&w->paths, list->pairs[i].src);
+			if (!src || !src->stages[0].mode)
+				continue;
+			to1 = src->rename_to[1];
+			to2 = src->rename_to[2];
+
+			if (to1 && to2) {
+				/* both renamed it; handle the pair once */
+				if (side == 2)
+					continue;
+				if (!strcmp(to1, to2)) {
+					dst = get_path(&w->paths, to1);
+					if (dst) {
+						dst->stages[0] = src->stages[0];
+						dst->stage_path[0] = src->path;
+						dst->renamed_by |= 6;
+					}
+				} else {
+					/* keep each side's version at its path */
+					struct merge_path *dst2;
+
+					dst = get_path(&w->paths, to1);
+					dst2 = get_path(&w->paths, to2);
+					if (dst && dst2) {
+						dst->result = dst->stages[1];
+						dst->stages[0] = src->stages[0];
+						dst->stage_path[0] = src->path;
+						dst->stages[2] = dst2->stages[2];
+						dst->stage_path[2] = dst2->path;
+						dst2->result = dst2->stages[2];
+						dst2->stages[0] = src->stages[0];
+						dst2->stage_path[0] = src->path;
+						dst2->stages[1] = dst->stages[1];
+						dst2->stage_path[1] = dst->path;
+						dst->resolved = dst2->resolved = 1;
+						set_conflict(dst, MERGE_CONFLICT_RENAME_RENAME);
+						set_conflict(dst2, MERGE_CONFLICT_RENAME_RENAME);
+						dst->renamed_by |= 2;
+						dst2->renamed_by |= 4;
+					}
+				}
+			} else {
+				apply_rename(w, side, src, list->pairs[i].dst);
+			}
+
+			/* its versions are now at the destination */
+			src->stages[0].mode = 0;
+			src->stages[1].mode = 0;
+			src->stages[2].mode = 0;
+		}
+	}
+}
+
+static const char *stage_label(struct merge_walk *w, struct merge_path *e,
+			       int stage, struct strbuf *buf)
+{
+	if (!e->stage_path[stage] || !strcmp(e->stage_path[stage], e->path))
+		return w->labels[stage];
+	strbuf_addf(buf, "%s:%s", w->labels[stage], e->stage_path[stage]);
+	return buf->buf;
+}
+
+static int merge_contents(struct merge_walk *w, struct merge_path *e,
+			  const struct version *base, struct object_id *oid)
+{
+	struct merge_options *opt = w->state->opt;
+	struct ll_merge_options ll_opts = { 0 };
+	struct strbuf labels[3] = { STRBUF_INIT, STRBUF_INIT, STRBUF_INIT };
+	mmfile_t orig, src1, src2;
+	mmbuffer_t result_buf;
+	int status, i;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.extra_marker_size = w->state->call_depth * 2;
+	ll_opts.xdl_opts = opt->xdl_opts;
+	if (w->state->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+	} else if (opt->recursive_variant == MERGE_VARIANT_OURS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+	} else if (opt->recursive_variant == MERGE_VARIANT_THEIRS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+	}
+
+	read_mmblob(&orig, base ? &base->oid : &null_oid);
+	read_mmblob(&src1, &e->stages[1].oid);
+	read_mmblob(&src2, &e->stages[2].oid);
+
+	status = ll_merge(&result_buf, e->path,
+			  &orig, stage_label(w, e, 0, &labels[0]),
+			  &src1, stage_label(w, e, 1, &labels[1]),
+			  &src2, stage_label(w, e, 2, &labels[2]),
+			  opt->repo->index, &ll_opts);
+
+	if (status >= 0 &&
+	    write_object_file(result_buf.ptr, result_buf.size, blob_type, oid))
+		status = error(_("unable to add %s to database"), e->path);
+
+	free(result_buf.ptr);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	for (i = 0; i < 3; i++)
+		strbuf_release(&labels[i]);
+	return status;
+}
+
+static int resolve_path(struct merge_walk *w, struct merge_path *e)
+{
+	struct version *base = &e->stages[0];
+	struct version *a = &e->stages[1], *b = &e->stages[2];
+
+	if (e->resolved)
+		return 0;
+	e->resolved = 1;
+
+	/* renamed by one side, deleted by the other */
+	if (base->mode && e->renamed_by == 2 && !b->mode) {
+		e->result = *a;
+		set_conflict(e, MERGE_CONFLICT_RENAME_DELETE);
+		return 0;
+	}
+	if (base->mode && e->renamed_by == 4 && !a->mode) {
+		e->result = *b;
+		set_conflict(e, MERGE_CONFLICT_RENAME_DELETE);
+		return 0;
+	}
+
+	if (resolve_trivially(e->stages, &e->result))
+		return 0;
+
+	if (!a->mode || !b->mode) {
+		e->result = a->mode ? *a : *b;
+		set_conflict(e, MERGE_CONFLICT_MODIFY_DELETE);
+		return 0;
+	}
+
+	if ((a->mode & S_IFMT) != (b->mode & S_IFMT) ||
+	    !S_ISREG(a->mode)) {
+		/*
+		 * Symlinks and submodules cannot be merged; like
+		 * merge-recursive, use the base in virtual merge bases.
+		 */
+		if (w->state->call_depth && base->mode)
+			e->result = *base;
+		else
+			e->result = *a;
+		set_conflict(e, (a->mode & S_IFMT) != (b->mode & S_IFMT) ?
+			     MERGE_CONFLICT_TYPE : MERGE_CONFLICT_LINK);
+		return 0;
+	}
+
+	if (!S_ISREG(base->mode))
+		base = NULL;
+
+	if (a->mode == b->mode) {
+		e->result.mode = a->mode;
+	} else if (base && base->mode == a->mode) {
+		e->result.mode = b->mode;
+	} else if (base && base->mode == b->mode) {
+		e->result.mode = a->mode;
+	} else {
+		e->result.mode = a->mode;
+		set_conflict(e, MERGE_CONFLICT_MODE);
+	}
+
+	if (oideq(&a->oid, &b->oid)) {
+		oidcpy(&e->result.oid, &a->oid);
+	} else if (base && oideq(&base->oid, &a->oid)) {
+		oidcpy(&e->result.oid, &b->oid);
+	} else if (base && oideq(&base->oid, &b->oid)) {
+		oidcpy(&e->result.oid, &a->oid);
+	} else {
+		int status = merge_contents(w, e, base, &e->result.oid);
+
+		if (status < 0)
+			return -1;
+		if (status)
+			set_conflict(e, base ? MERGE_CONFLICT_CONTENT :
+				     MERGE_CONFLICT_ADD_ADD);
+	}
+	return 0;
+}
+
+static void record_conflict(struct merge_walk *w, struct merge_path *e,
+			    const char *path)
+{
+	struct merge_incore_result *result = w->result;
+	struct merge_conflict *c;
+	int i;
+
+	if (!result)
+		return;
+	ALLOC_GROW(result->conflicts, result->conflicts_nr + 1,
+		   result->conflicts_alloc);
+	c = &result->conflicts[result->conflicts_nr++];
+	c->type = e->conflict;
+	c->path = xstrdup(path);
+	for (i = 0; i < 3; i++) {
+		c->stages[i].mode = e->stages[i].mode;
+		oidcpy(&c->stages[i].oid, &e->stages[i].oid);
+		if (e->stage_path[i])
+			c->stages[i].path = xstrdup(e->stage_path[i]);
+		else if (strcmp(path, e->path))
+			c->stages[i].path = xstrdup(e->path);
+		else
+			c->stages[i].path = NULL;
+	}
+}
+
+struct tree_entry {
+	const char *name;
+	size_t len;
+	unsigned mode;
+	struct object_id oid;
+	struct merge_path *e; /* NULL for subtrees written here */
+};
+
+static int tree_entry_name_cmp(const void *a_, const void *b_)
+{
+	const struct tree_entry *a = a_, *b = b_;
+	size_t len = a->len < b->len ? a->len : b->len;
+	int cmp = memcmp(a->name, b->name, len);
+
+	if (cmp)
+		return cmp;
+	return a->len < b->len ? -1 : a->len > b->len;
+}
+
+static int tree_entry_cmp(const void *a_, const void *b_)
+{
+	const struct tree_entry *a = a_, *b = b_;
+
+	return base_name_compare(a->name, a->len, a->mode,
+				 b->name, b->len, b->mode);
+}
+
+static int merge_conflict_cmp(const void *a_, const void *b_)
+{
+	const struct merge_conflict *a = a_, *b = b_;
+
+	return strcmp(a->path, b->path);
+}
+
+static int merge_path_sort_cmp(const void *a_, const void *b_)
+{
+	const struct merge_path *a = *(const struct merge_path **)a_;
+	const struct merge_path *b = *(const struct merge_path **)b_;
+
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Write the tree made of "items", sorted by path, which all are under
+ * the directory of the first "prefix_len" bytes of their paths. Returns
+ * the number of its entries, or -1 on error.
+ */
+static int write_merged_tree(struct merge_walk *w, struct merge_path **items,
+			     int nr, size_t prefix_len, struct object_id *oid)
+{
+	struct tree_entry *entries = NULL;
+	int entries_nr = 0, entries_alloc = 0, i, ret = 0;
+	struct strbuf buf = STRBUF_INIT;
+
+	for (i = 0; i < nr; ) {
+		const char *name = items[i]->path + prefix_len;
+		const char *slash = strchr(name, '/');
+		struct tree_entry *t;
+
+		ALLOC_GROW(entries, entries_nr + 1, entries_alloc);
+		t = &entries[entries_nr];
+		memset(t, 0, sizeof(*t));
+		t->name = name;
+
+		if (!slash) {
+			t->len = strlen(name);
+			t->mode = items[i]->result.mode;
+			oidcpy(&t->oid, &items[i]->result.oid);
+			t->e = items[i];
+			entries_nr++;
+			i++;
+		} else {
+			size_t len = slash - name + 1;
+			int j = i + 1, sub;
+
+			while (j < nr &&
+			       !strncmp(items[j]->path + prefix_len, name, len))
+				j++;
+			sub = write_merged_tree(w, items + i, j - i,
+						prefix_len + len, &t->oid);
+			if (sub < 0) {
+				ret = -1;
+				goto out;
+			}
+			if (sub) {
+				t->len = len - 1;
+				t->mode = S_IFDIR;
+				entries_nr++;
+			}
+			i = j;
+		}
+	}
+
+	/*
+	 * A file and a directory with the same name: keep the directory,
+	 * and move the file aside.
+	 */
+	QSORT(entries, entries_nr, tree_entry_name_cmp);
+	for (i = 1; i < entries_nr; i++) {
+		struct tree_entry *file;
+		struct merge_path *e;
+		char *path;
+
+		if (tree_entry_name_cmp(&entries[i - 1], &entries[i]))
+			continue;
+		file = S_ISDIR(entries[i].mode) ? &entries[i - 1] : &entries[i];
+		e = file->e;
+		if (!e)
+			continue;
+		path = unique_path(&w->paths, e->path,
+				   same_version(&e->result, &e->stages[2]) &&
+				   !same_version(&e->result, &e->stages[1]) ?
+				   w->labels[2] : w->labels[1]);
+		e->has_conflict = 1;
+		e->conflict = MERGE_CONFLICT_FILE_DIRECTORY;
+		free(e->moved_to);
+		e->moved_to = path;
+		file->name = path + prefix_len;
+		file->len = strlen(file->name);
+	}
+
+	QSORT(entries, entries_nr, tree_entry_cmp);
+	for (i = 0; i < entries_nr; i++) {
+		strbuf_addf(&buf, "%o %.*s%c", entries[i].mode,
+			    (int)entries[i].len, entries[i].name, '\0');
+		strbuf_add(&buf, entries[i].oid.hash, the_hash_algo->rawsz);
+	}
+	if ((entries_nr || !prefix_len) &&
+	    write_object_file(buf.buf, buf.len, tree_type, oid))
+		ret = error(_("unable to write merged tree"));
+	else
+		ret = entries_nr;
+
+out:
+	free(entries);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static int merge_trees_internal(struct merge_state *state,
+				struct tree *base,
+				struct tree *side1,
+				struct tree *side2,
+				const char *labels[3],
+				struct merge_incore_result *result,
+				struct object_id *result_oid)
+{
+	struct merge_walk w;
+	struct merged_trees key, *merged = NULL;
+	const struct object_id *oids[3];
+	struct merge_path **items = NULL, *e;
+	struct hashmap_iter iter;
+	int items_nr = 0, items_alloc = 0, clean = 1, i;
+
+	/* Nothing to merge when one side is all there is */
+	if (oideq(&side1->object.oid, &side2->object.oid) ||
+	    oideq(&base->object.oid, &side2->object.oid)) {
+		oidcpy(result_oid, &side1->object.oid);
+		return 1;
+	}
+	if (oideq(&base->object.oid, &side1->object.oid)) {
+		oidcpy(result_oid, &side2->object.oid);
+		return 1;
+	}
+
+	/* Virtual merge bases are often merged again */
+	if (state->call_depth) {
+		oidcpy(&key.base, &base->object.oid);
+		oidcpy(&key.side1, &side1->object.oid);
+		oidcpy(&key.side2, &side2->object.oid);
+		key.call_depth = state->call_depth;
+		for (i = 0; i < 3; i++)
+			key.labels[i] = labels[i];
+		hashmap_entry_init(&key.ent, oidhash(&key.base) ^
+				   oidhash(&key.side1) ^
+				   (oidhash(&key.side2) << 1) ^
+				   key.call_depth);
+		merged = hashmap_get_entry(&state->merged, &key, ent, NULL);
+		if (merged) {
+			oidcpy(result_oid, &merged->result);
+			return merged->clean;
+		}
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.state = state;
+	for (i = 0; i < 3; i++)
+		w.labels[i] = labels[i];
+	w.result = state->call_depth ? NULL : result;
+	hashmap_init(&w.paths, merge_path_cmp, NULL, 0);
+	hashmap_init(&w.rename_dirs, dir_name_cmp, NULL, 0);
+
+	w.renames[1] = get_renames(state, base, side1);
+	w.renames[2] = get_renames(state, base, side2);
+	for (i = 1; i <= 2; i++) {
+		int j;
+
+		for (j = 0; j < w.renames[i]->nr; j++) {
+			add_rename_dirs(&w, w.renames[i]->pairs[j].src);
+			add_rename_dirs(&w, w.renames[i]->pairs[j].dst);
+		}
+	}
+
+	oids[0] = &base->object.oid;
+	oids[1] = &side1->object.oid;
+	oids[2] = &side2->object.oid;
+	if (walk_trees(&w, "", oids) < 0) {
+		clean = -1;
+		goto out;
+	}
+
+	apply_renames(&w);
+
+	hashmap_for_each_entry(&w.paths, &iter, e, ent) {
+		if (resolve_path(&w, e) < 0) {
+			clean = -1;
+			goto out;
+		}
+		if (e->result.mode) {
+			ALLOC_GROW(items, items_nr + 1, items_alloc);
+			items[items_nr++] = e;
+		}
+	}
+	QSORT(items, items_nr, merge_path_sort_cmp);
+
+	if (write_merged_tree(&w, items, items_nr, 0, result_oid) < 0) {
+		clean = -1;
+		goto out;
+	}
+
+	hashmap_for_each_entry(&w.paths, &iter, e, ent) {
+		if (!e->has_conflict)
+			continue;
+		clean = 0;
+		record_conflict(&w, e, e->moved_to ? e->moved_to : e->path);
+	}
+	if (w.result && w.result->conflicts_nr) {
+		clean = 0;
+		QSORT(w.result->conflicts, w.result->conflicts_nr,
+		      merge_conflict_cmp);
+	}
+
+	if (state->call_depth) {
+		merged = xmalloc(sizeof(*merged));
+		*merged = key;
+		for (i = 0; i < 3; i++)
+			merged->labels[i] = xstrdup(key.labels[i]);
+		oidcpy(&merged->result, result_oid);
+		merged->clean = clean;
+		hashmap_add(&state->merged, &merged->ent);
+	}
+
+out:
+	free(items);
+	hashmap_for_each_entry(&w.paths, &iter, e, ent)
+		free(e->moved_to);
+	hashmap_free_entries(&w.paths, struct merge_path, ent);
+	hashmap_free_entries(&w.rename_dirs, struct dir_name, ent);
+	return clean;
+}
+
+static struct commit *make_virtual_commit(struct repository *repo,
+					  struct tree *tree)
+{
+	struct commit *commit = alloc_commit_node(repo);
+
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+static int merge_recursive_internal(struct merge_state *state,
+				    struct commit_list *merge_bases,
+				    struct commit *h1,
+				    struct commit *h2,
+				    struct merge_incore_result *result,
+				    struct object_id *result_oid)
+{
+	struct merge_options *opt = state->opt;
+	struct commit *merged_base;
+	struct strbuf base_abbrev = STRBUF_INIT;
+	const char *labels[3];
+	int clean;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(h1, h2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_base = pop_commit(&merge_bases);
+	if (!merged_base) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(opt->repo, opt->repo->hash_algo->empty_tree);
+		merged_base = make_virtual_commit(opt->repo, tree);
+		labels[0] = "empty tree";
+	} else if (opt->ancestor && !state->call_depth) {
+		labels[0] = opt->ancestor;
+	} else if (merge_bases) {
+		labels[0] = "merged common ancestors";
+	} else {
+		strbuf_add_unique_abbrev(&base_abbrev, &merged_base->object.oid,
+					 DEFAULT_ABBREV);
+		labels[0] = base_abbrev.buf;
+	}
+
+	while (merge_bases) {
+		struct commit *next = pop_commit(&merge_bases);
+		struct object_id oid;
+
+		state->call_depth++;
+		clean = merge_recursive_internal(state, NULL, merged_base, next,
+						 NULL, &oid);
+		state->call_depth--;
+		if (clean < 0) {
+			free_commit_list(merge_bases);
+			strbuf_release(&base_abbrev);
+			return clean;
+		}
+		merged_base = make_virtual_commit(opt->repo,
+						  lookup_tree(opt->repo, &oid));
+	}
+
+	if (state->call_depth) {
+		labels[1] = "Temporary merge branch 1";
+		labels[2] = "Temporary merge branch 2";
+	} else {
+		labels[1] = opt->branch1;
+		labels[2] = opt->branch2;
+	}
+
+	if (repo_parse_commit(opt->repo, h1) ||
+	    repo_parse_commit(opt->repo, h2))
+		clean = -1;
+	else
+		clean = merge_trees_internal(state,
+					     repo_get_commit_tree(opt->repo, merged_base),
+					     repo_get_commit_tree(opt->repo, h1),
+					     repo_get_commit_tree(opt->repo, h2),
+					     labels, result, result_oid);
+	strbuf_release(&base_abbrev);
+	return clean;
+}
+
+static void prepare_options(struct merge_options *opt,
+			    struct merge_incore_result *result)
+{
+	memset(result, 0, sizeof(*result));
+	if (opt->detect_renames < 0)
+		opt->detect_renames = 1;
+	if (!opt->branch1)
+		opt->branch1 = "ours";
+	if (!opt->branch2)
+		opt->branch2 = "theirs";
+}
+
+static int finish_result(struct merge_options *opt,
+			 struct merge_incore_result *result,
+			 int clean, const struct object_id *oid)
+{
+	result->clean = clean;
+	if (clean >= 0) {
+		result->tree = parse_tree_indirect(oid);
+		if (!result->tree)
+			result->clean = error(_("unable to read merged tree %s"),
+					      oid_to_hex(oid));
+	}
+	return result->clean;
+}
+
+int merge_incore_nonrecursive(struct merge_options *opt,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2,
+			      struct merge_incore_result *result)
+{
+	struct merge_state state;
+	struct object_id oid;
+	const char *labels[3];
+	int clean;
+
+	prepare_options(opt, result);
+	labels[0] = opt->ancestor ? opt->ancestor : "base";
+	labels[1] = opt->branch1;
+	labels[2] = opt->branch2;
+
+	init_merge_state(&state, opt);
+	clean = merge_trees_internal(&state, merge_base, side1, side2,
+				     labels, result, &oid);
+	clear_merge_state(&state);
+	return finish_result(opt, result, clean, &oid);
+}
+
+int merge_incore_recursive(struct merge_options *opt,
+			   struct commit_list *merge_bases,
+			   struct commit *side1,
+			   struct commit *side2,
+			   struct merge_incore_result *result)
+{
+	struct merge_state state;
+	struct object_id oid;
+	int clean;
+
+	prepare_options(opt, result);
+	init_merge_state(&state, opt);
+	clean = merge_recursive_internal(&state, merge_bases, side1, side2,
+					 result, &oid);
+	clear_merge_state(&state);
+	return finish_result(opt, result, clean, &oid);
+}
+
+void merge_incore_result_release(struct merge_incore_result *result)
+{
+	int i, j;
+
+	for (i = 0; i < result->conflicts_nr; i++) {
+		free(result->conflicts[i].path);
+		for (j = 0; j < 3; j++)
+			free(result->conflicts[i].stages[j].path);
+	}
+	FREE_AND_NULL(result->conflicts);
+	result->conflicts_nr = result->conflicts_alloc = 0;
+}
+
+const char *merge_conflict_type_name(enum merge_conflict_type type)
+{
+	switch (type) {
+	case MERGE_CONFLICT_CONTENT:
+		return "content";
+	case MERGE_CONFLICT_ADD_ADD:
+		return "add/add";
+	case MERGE_CONFLICT_MODIFY_DELETE:
+		return "modify/delete";
+	case MERGE_CONFLICT_RENAME_DELETE:
+		return "rename/delete";
+	case MERGE_CONFLICT_RENAME_RENAME:
+		return "rename/rename";
+	case MERGE_CONFLICT_RENAME_ADD:
+		return "rename/add";
+	case MERGE_CONFLICT_FILE_DIRECTORY:
+		return "file/directory";
+	case MERGE_CONFLICT_MODE:
+		return "mode";
+	case MERGE_CONFLICT_TYPE:
+		return "type";
+	case MERGE_CONFLICT_LINK:
+		return "link";
+	}
+	BUG("unknown merge conflict type %d", type);
+}
@@ -0,0 +1,105 @@
+#ifndef MERGE_INCORE_H
+#define MERGE_INCORE_H
+
+#include "hash.h"
+
+struct commit;
+struct commit_list;
+struct merge_options;
+struct tree;
+
+/*
+ * A rename-aware three-way merge of trees which is done entirely in
+ * memory: neither the index nor the working tree is read or written,
+ * and the only output is the merged tree (and the blobs it needs) in the
+ * object store, along with a description of the conflicts.
+ *
+ * The rename and labelling settings of "struct merge_options" (see
+ * merge-recursive.h) are honored; directory rename detection is not
+ * done, and nothing is shown on the console.
+ */
+
+enum merge_conflict_type {
+	/* both sides changed the contents of a file */
+	MERGE_CONFLICT_CONTENT,
+	/* both sides added a file at the same path */
+	MERGE_CONFLICT_ADD_ADD,
+	/* one side changed a file, the other deleted it */
+	MERGE_CONFLICT_MODIFY_DELETE,
+	/* one side renamed a file, the other deleted it */
+	MERGE_CONFLICT_RENAME_DELETE,
+	/* both sides renamed a file differently, or two files to one path */
+	MERGE_CONFLICT_RENAME_RENAME,
+	/* one side renamed a file to a path the other added */
+	MERGE_CONFLICT_RENAME_ADD,
+	/* one side has a file where the other has a directory */
+	MERGE_CONFLICT_FILE_DIRECTORY,
+	/* both sides changed the executable bit differently */
+	MERGE_CONFLICT_MODE,
+	/* the sides have different kinds of entries, e.g. file and symlink */
+	MERGE_CONFLICT_TYPE,
+	/* both sides changed a symlink or a submodule differently */
+	MERGE_CONFLICT_LINK
+};
+
+/* "content", "add/add", "modify/delete", ... */
+const char *merge_conflict_type_name(enum merge_conflict_type type);
+
+struct merge_conflict_stage {
+	unsigned short mode; /* 0 if the side does not have this file */
+	struct object_id oid;
+	char *path; /* where the side has it, if it was renamed */
+};
+
+struct merge_conflict {
+	enum merge_conflict_type type;
+	/* the path of the conflicted entry in the merged tree */
+	char *path;
+	/* the versions of the merge base, the first and the second side */
+	struct merge_conflict_stage stages[3];
+};
+
+struct merge_incore_result {
+	/*
+	 * 1 if the merge was clean, 0 if there were conflicts, or negative
+	 * if it could not be done.
+	 */
+	int clean;
+
+	/*
+	 * The merged tree. The conflicted files are in it with conflict
+	 * markers, or in the version of one side.
+	 */
+	struct tree *tree;
+
+	/* sorted by path */
+	struct merge_conflict *conflicts;
+	int conflicts_nr, conflicts_alloc;
+};
+
+/*
+ * Merge "side1" and "side2" given their common ancestor "merge_base".
+ * Returns result->clean.
+ */
+int merge_incore_nonrecursive(struct merge_options *opt,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2,
+			      struct merge_incore_result *result);
+
+/*
+ * Merge the commits "side1" and "side2". If there is more than one
+ * common ancestor, they are merged first into a virtual one, the same
+ * way merge_recursive() does; the merges of the same trees done along
+ * the way are only done once. "merge_bases" may be NULL, to have them
+ * computed, and is consumed. Returns result->clean.
+ */
+int merge_incore_recursive(struct merge_options *opt,
+			   struct commit_list *merge_bases,
+			   struct commit *side1,
+			   struct commit *side2,
+			   struct merge_incore_result *result);
+
+void merge_incore_result_release(struct merge_incore_result *result);
+
+#endif
@@ -10,6 +10,11 @@
 #include "progress.h"
 #include "trace2.h"
 #include "run-command.h"
+#include "revision.h"
+#include "tag.h"
+#include "refs.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -21,13 +26,14 @@
 #define MIDX_HEADER_SIZE 12
 #define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + the_hash_algo->rawsz)
 
-#define MIDX_MAX_CHUNKS 5
+#define MIDX_MAX_CHUNKS 6
 #define MIDX_CHUNK_ALIGNMENT 4
 #define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
 #define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
 #define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
 #define MIDX_CHUNKLOOKUP_WIDTH (sizeof(uint32_t) + sizeof(uint64_t))
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_OFFSET_WIDTH (2 * sizeof(uint32_t))
@@ -41,6 +47,23 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+static char *midx_bitmap_filename(const char *object_dir,
+				  const unsigned char *hash)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+		       object_dir, hash_to_hex(hash));
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - the_hash_algo->rawsz;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return midx_bitmap_filename(m->object_dir, get_midx_checksum(m));
+}
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
 {
 	struct multi_pack_index *m = NULL;
@@ -128,6 +151,10 @@ struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local
 				m->chunk_large_offsets = m->data + chunk_offset;
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				m->chunk_revindex = m->data + chunk_offset;
+				break;
+
 			case 0:
 				die(_("terminating multi-pack-index chunk id appears earlier than expected"));
 				break;
@@ -247,7 +274,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -266,11 +293,18 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
 
+uint32_t nth_midxed_pack_order(struct multi_pack_index *m, uint32_t pos)
+{
+	if (!m->chunk_revindex)
+		BUG("multi-pack-index has no reverse index chunk");
+	return get_be32(m->chunk_revindex + pos * sizeof(uint32_t));
+}
+
 static int nth_midxed_pack_entry(struct repository *r,
 				 struct multi_pack_index *m,
 				 struct pack_entry *e,
@@ -494,6 +528,7 @@ struct pack_midx_entry {
 	uint32_t pack_int_id;
 	time_t pack_mtime;
 	uint64_t offset;
+	unsigned preferred : 1;
 };
 
 static int midx_oid_compare(const void *_a, const void *_b)
@@ -502,6 +537,11 @@ static int midx_oid_compare(const void *_a, const void *_b)
 	const struct pack_midx_entry *b = (const struct pack_midx_entry *)_b;
 	int cmp = oidcmp(&a->oid, &b->oid);
 
+	if (cmp)
+		return cmp;
+
+	/* Sort objects in the preferred pack ahead of any duplicates. */
+	cmp = b->preferred - a->preferred;
 	if (cmp)
 		return cmp;
 
@@ -526,19 +566,22 @@ static int nth_midxed_pack_midx_entry(struct multi_pack_index *m,
 
 	/* consider objects in midx to be from "old" packs */
 	e->pack_mtime = 0;
+	e->preferred = 0;
 	return 0;
 }
 
 static void fill_pack_entry(uint32_t pack_int_id,
 			    struct packed_git *p,
 			    uint32_t cur_object,
-			    struct pack_midx_entry *entry)
+			    struct pack_midx_entry *entry,
+			    int preferred)
 {
 	if (!nth_packed_object_oid(&entry->oid, p, cur_object))
 		die(_("failed to locate object %d in packfile"), cur_object);
 
 	entry->pack_int_id = pack_int_id;
 	entry->pack_mtime = p->mtime;
+	entry->preferred = !!preferred;
 
 	entry->offset = nth_packed_object_offset(p, cur_object);
 }
@@ -552,12 +595,14 @@ static void fill_pack_entry(uint32_t pack_int_id,
  * tables to group the data, copy to a local array, then sort.
  *
  * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * of a packfile containing the object), except that a copy in the preferred
+ * pack, if any, always wins.
  */
 static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 						  struct pack_info *info,
 						  uint32_t nr_packs,
-						  uint32_t *nr_objects)
+						  uint32_t *nr_objects,
+						  int preferred_pack)
 {
 	uint32_t cur_fanout, cur_pack, cur_object;
 	uint32_t alloc_fanout, alloc_objects, total_objects = 0;
@@ -594,6 +639,9 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 				nth_midxed_pack_midx_entry(m,
 							   &entries_by_fanout[nr_fanout],
 							   cur_object);
+				if (preferred_pack >= 0 &&
+				    entries_by_fanout[nr_fanout].pack_int_id == preferred_pack)
+					entries_by_fanout[nr_fanout].preferred = 1;
 				nr_fanout++;
 			}
 		}
@@ -607,7 +655,10 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 
 			for (cur_object = start; cur_object < end; cur_object++) {
 				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
-				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object, &entries_by_fanout[nr_fanout]);
+				fill_pack_entry(cur_pack, info[cur_pack].p, cur_object,
+						&entries_by_fanout[nr_fanout],
+						preferred_pack >= 0 &&
+						cur_pack == preferred_pack);
 				nr_fanout++;
 			}
 		}
@@ -787,8 +838,283 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack;
+	off_t offset;
+};
+
+static int midx_pack_order_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+	if (a->pack < b->pack)
+		return -1;
+	else if (a->pack > b->pack)
+		return 1;
+	else if (a->offset < b->offset)
+		return -1;
+	else if (a->offset > b->offset)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * Compute the "pseudo-pack" order of the objects: the order in which
+ * they would appear if all the packs were concatenated, the preferred
+ * pack first and the others in pack-int-id order, keeping only the copy
+ * of each object that the MIDX selected. Bitmap positions are assigned
+ * in this order, so that the objects of the preferred pack come first
+ * and in the same order as in the pack itself.
+ */
+static uint32_t *midx_pack_order(struct pack_midx_entry *entries,
+				 uint32_t nr_entries, uint32_t *pack_perm,
+				 int preferred_pack)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		struct pack_midx_entry *e = &entries[i];
+		data[i].nr = i;
+		data[i].pack = pack_perm[e->pack_int_id];
+		if (preferred_pack < 0 || e->pack_int_id != preferred_pack)
+			data[i].pack |= (1U << 31);
+		data[i].offset = e->offset;
+	}
+
+	QSORT(data, nr_entries, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		pack_order[i] = data[i].nr;
+	free(data);
+
+	return pack_order;
+}
+
+static size_t write_midx_revindex(struct hashfile *f, uint32_t *pack_order,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	return nr_objects * sizeof(uint32_t);
+}
+
+/*
+ * Pick the pack whose objects should come first in the bitmap order,
+ * and thus be eligible for verbatim reuse: the one that contributes the
+ * most objects to the MIDX.
+ */
+static int choose_preferred_pack(struct pack_list *packs)
+{
+	uint32_t *count = xcalloc(packs->nr, sizeof(uint32_t));
+	uint32_t i;
+	int best = -1;
+
+	if (packs->m) {
+		for (i = 0; i < packs->m->num_objects; i++)
+			count[nth_midxed_pack_int_id(packs->m, i)]++;
+	}
+
+	for (i = 0; i < packs->nr; i++) {
+		if (packs->info[i].p)
+			count[i] = packs->info[i].p->num_objects;
+		if (best < 0 || count[i] > count[best])
+			best = i;
+	}
+
+	free(count);
+	return best;
+}
+
+static int midx_entries_contain(struct pack_midx_entry *entries,
+				uint32_t nr_entries,
+				const struct object_id *oid)
+{
+	uint32_t lo = 0, hi = nr_entries;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = oidcmp(oid, &entries[mi].oid);
+
+		if (!cmp)
+			return 1;
+		if (cmp > 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+struct midx_bitmap_refs_data {
+	struct rev_info *revs;
+	struct pack_midx_entry *entries;
+	uint32_t nr_entries;
+};
+
+static int add_ref_to_pending(const char *refname,
+			      const struct object_id *oid,
+			      int flag, void *cb_data)
+{
+	struct midx_bitmap_refs_data *data = cb_data;
+	struct object *object;
+
+	if ((flag & REF_ISSYMREF) && (flag & REF_ISBROKEN)) {
+		warning("symbolic ref is dangling: %s", refname);
+		return 0;
+	}
+
+	object = parse_object(the_repository, oid);
+	if (!object)
+		return 0;
+	object = deref_tag(the_repository, object, refname, 0);
+	if (!object || object->type != OBJ_COMMIT)
+		return 0;
+
+	/* Tips outside of the MIDX (e.g. loose commits) cannot be bitmapped. */
+	if (!midx_entries_contain(data->entries, data->nr_entries, &object->oid))
+		return 0;
+
+	object->flags |= NEEDS_BITMAP;
+	add_pending_object(data->revs, object, "");
+	return 0;
+}
+
+static int write_midx_bitmap(const char *object_dir,
+			     const unsigned char *midx_hash,
+			     struct pack_midx_entry *entries,
+			     uint32_t nr_entries,
+			     uint32_t *pack_order,
+			     unsigned flags)
+{
+	struct rev_info revs;
+	struct midx_bitmap_refs_data refs_data;
+	struct packing_data pdata;
+	struct pack_idx_entry **index = NULL, **index_pack_order = NULL;
+	struct commit **commits = NULL;
+	struct commit *c;
+	uint32_t commits_nr = 0, commits_alloc = 0;
+	char *bitmap_name = midx_bitmap_filename(object_dir, midx_hash);
+	uint32_t i;
+	int ret = 0, lookup_table = 0;
+	uint16_t options = 0;
+
+	trace2_region_enter("midx", "write_midx_bitmap", the_repository);
+
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    lookup_table)
+		options |= BITMAP_OPT_LOOKUP_TABLE;
+
+	/*
+	 * Bitmap every commit reachable from the refs; all of them, and
+	 * everything they reach, must be in the MIDX for it to have the
+	 * closure that reachability bitmaps require.
+	 */
+	repo_init_revisions(the_repository, &revs, NULL);
+	refs_data.revs = &revs;
+	refs_data.entries = entries;
+	refs_data.nr_entries = nr_entries;
+	head_ref(add_ref_to_pending, &refs_data);
+	for_each_ref(add_ref_to_pending, &refs_data);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	while ((c = get_revision(&revs))) {
+		if (!midx_entries_contain(entries, nr_entries, &c->object.oid)) {
+			ret = error(_("commit %s is reachable but not in the "
+				      "multi-pack-index; cannot write bitmap"),
+				    oid_to_hex(&c->object.oid));
+			goto cleanup;
+		}
+		ALLOC_GROW(commits, commits_nr + 1, commits_alloc);
+		commits[commits_nr++] = c;
+	}
+	reset_revision_walk();
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(the_repository, &pdata);
+	for (i = 0; i < nr_entries; i++)
+		packlist_alloc(&pdata, &entries[i].oid);
+
+	ALLOC_ARRAY(index, nr_entries);
+	ALLOC_ARRAY(index_pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		index[i] = &pdata.objects[i].idx;
+		index_pack_order[i] = &pdata.objects[pack_order[i]].idx;
+	}
+
+	bitmap_writer_show_progress(flags & MIDX_PROGRESS);
+	bitmap_writer_build_type_index(&pdata, index_pack_order, nr_entries);
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	bitmap_writer_build(&pdata);
+	bitmap_writer_set_checksum((unsigned char *)midx_hash);
+	bitmap_writer_finish(index, nr_entries, bitmap_name, options);
+
+	free(pdata.objects);
+	free(pdata.in_pack);
+	free(pdata.in_pack_pos);
+	free(pdata.index);
+
+cleanup:
+	trace2_region_leave("midx", "write_midx_bitmap", the_repository);
+	free(index);
+	free(index_pack_order);
+	free(commits);
+	free(bitmap_name);
+	return ret;
+}
+
+struct stale_bitmap_data {
+	const char *keep;
+	struct string_list to_remove;
+};
+
+static void collect_stale_midx_bitmap(const char *full_path, size_t full_path_len,
+				      const char *file_name, void *_data)
+{
+	struct stale_bitmap_data *data = _data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (data->keep && !strcmp(full_path, data->keep))
+		return;
+	string_list_append(&data->to_remove, full_path);
+}
+
+/*
+ * Remove the MIDX bitmaps that do not belong to the MIDX named by
+ * 'midx_hash' (or all of them, if it is NULL).
+ */
+static void clear_stale_midx_bitmaps(const char *object_dir,
+				     const unsigned char *midx_hash)
+{
+	struct stale_bitmap_data data = { NULL, STRING_LIST_INIT_DUP };
+	char *keep = midx_hash ? midx_bitmap_filename(object_dir, midx_hash) : NULL;
+	struct string_list_item *item;
+
+	data.keep = keep;
+	for_each_file_in_pack_dir(object_dir, collect_stale_midx_bitmap, &data);
+	for_each_string_list_item(item, &data.to_remove) {
+		if (unlink(item->string) && errno != ENOENT)
+			warning_errno(_("failed to remove %s"), item->string);
+	}
+
+	string_list_clear(&data.to_remove, 0);
+	free(keep);
+}
+
 static int write_midx_internal(const char *object_dir, struct multi_pack_index *m,
-			       struct string_list *packs_to_drop, unsigned flags)
+			       struct string_list *packs_to_drop,
+			       const char *preferred_pack_name,
+			       unsigned flags)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
@@ -807,6 +1133,9 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	int pack_name_concat_len = 0;
 	int dropped_packs = 0;
 	int result = 0;
+	int preferred_pack = -1;
+	uint32_t *pack_order = NULL;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
 
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name)) {
@@ -846,10 +1175,30 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
 	stop_progress(&packs.progress);
 
-	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop)
+	if (packs.m && packs.nr == packs.m->num_packs && !packs_to_drop &&
+	    !preferred_pack_name && !(flags & MIDX_WRITE_BITMAP))
 		goto cleanup;
 
-	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries);
+	if (preferred_pack_name) {
+		for (i = 0; i < packs.nr; i++) {
+			if (!cmp_idx_or_pack_name(preferred_pack_name,
+						  packs.info[i].pack_name)) {
+				preferred_pack = i;
+				break;
+			}
+		}
+
+		if (preferred_pack < 0) {
+			result = error(_("unknown preferred pack: '%s'"),
+				       preferred_pack_name);
+			goto cleanup;
+		}
+	} else if (flags & MIDX_WRITE_BITMAP) {
+		preferred_pack = choose_preferred_pack(&packs);
+	}
+
+	entries = get_sorted_entries(packs.m, packs.info, packs.nr, &nr_entries,
+				     preferred_pack);
 
 	for (i = 0; i < nr_entries; i++) {
 		if (entries[i].offset > 0x7fffffff)
@@ -913,6 +1262,14 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					(pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
+	if (flags & MIDX_WRITE_BITMAP) {
+		if (preferred_pack >= 0 &&
+		    pack_perm[preferred_pack] == PACK_EXPIRED)
+			preferred_pack = -1;
+		pack_order = midx_pack_order(entries, nr_entries, pack_perm,
+					     preferred_pack);
+	}
+
 	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
 	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
 	FREE_AND_NULL(midx_name);
@@ -922,6 +1279,8 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 
 	cur_chunk = 0;
 	num_chunks = large_offsets_needed ? 5 : 4;
+	if (pack_order)
+		num_chunks++;
 
 	written = write_midx_header(f, num_chunks, packs.nr - dropped_packs);
 
@@ -950,6 +1309,14 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
 	}
 
+	if (pack_order) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_REVINDEX;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   nr_entries * sizeof(uint32_t);
+	}
+
 	chunk_ids[cur_chunk] = 0;
 
 	for (i = 0; i <= num_chunks; i++) {
@@ -1000,6 +1367,10 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 				written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
 				break;
 
+			case MIDX_CHUNKID_REVINDEX:
+				written += write_midx_revindex(f, pack_order, nr_entries);
+				break;
+
 			default:
 				BUG("trying to write unknown chunk id %"PRIx32,
 				    chunk_ids[i]);
@@ -1014,9 +1385,17 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 		    written,
 		    chunk_offsets[num_chunks]);
 
-	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
 	commit_lock_file(&lk);
 
+	/* Any existing bitmap belongs to the MIDX we just replaced. */
+	clear_stale_midx_bitmaps(object_dir, pack_order ? midx_hash : NULL);
+
+	if (pack_order &&
+	    write_midx_bitmap(object_dir, midx_hash, entries, nr_entries,
+			      pack_order, flags))
+		result = 1;
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.info[i].p) {
@@ -1029,13 +1408,16 @@ static int write_midx_internal(const char *object_dir, struct multi_pack_index *
 	free(packs.info);
 	free(entries);
 	free(pack_perm);
+	free(pack_order);
 	free(midx_name);
 	return result;
 }
 
-int write_midx_file(const char *object_dir, unsigned flags)
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags)
 {
-	return write_midx_internal(object_dir, NULL, NULL, flags);
+	return write_midx_internal(object_dir, NULL, NULL, preferred_pack_name,
+				   flags);
 }
 
 void clear_midx_file(struct repository *r)
@@ -1052,6 +1434,8 @@ void clear_midx_file(struct repository *r)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 	}
 
+	clear_stale_midx_bitmaps(r->objects->odb->path, NULL);
+
 	free(midx);
 }
 
@@ -1254,7 +1638,7 @@ int expire_midx_packs(struct repository *r, const char *object_dir, unsigned fla
 	free(count);
 
 	if (packs_to_drop.nr)
-		result = write_midx_internal(object_dir, m, &packs_to_drop, flags);
+		result = write_midx_internal(object_dir, m, &packs_to_drop, NULL, flags);
 
 	string_list_clear(&packs_to_drop, 0);
 	return result;
@@ -1409,7 +1793,7 @@ int midx_repack(struct repository *r, const char *object_dir, size_t batch_size,
 		goto cleanup;
 	}
 
-	result = write_midx_internal(object_dir, m, NULL, flags);
+	result = write_midx_internal(object_dir, m, NULL, NULL, flags);
 	m = NULL;
 
 cleanup:
@@ -0,0 +1,471 @@
+#include "cache.h"
+#include "bisecting.h"
+#include "../commit.h"
+#include "../commit-graph.h"
+#include "../commit-reach.h"
+#include "../fetch-negotiator.h"
+#include "../refs.h"
+#include "../tag.h"
+
+/* Remember to update object flag allocation in object.h */
+/*
+ * Both us and the server know that both parties have this object.
+ */
+#define COMMON		(1U << 2)
+/*
+ * This commit is on the chain of a line (see below).
+ */
+#define WALKED		(1U << 3)
+/*
+ * The server told us, by not acknowledging it, that it does not have this
+ * commit.
+ */
+#define NOT_COMMON	(1U << 4)
+/*
+ * This tip is an ancestor of another one.
+ */
+#define REACHABLE	(1U << 5)
+
+/*
+ * The largest number of "have"s a line sends in one round, while skipping
+ * exponentially.
+ */
+#define MAX_BURST 64
+
+static int marked;
+
+/*
+ * The first-parent chain of a tip, walked lazily. Positions grow towards
+ * the past: once the commit at some position is common, so are all those
+ * after it, and once one is not common, neither are those before it.
+ *
+ * A chain stops at a root, at a commit known to be common, or where it
+ * joins the chain of another line. In the last two cases, "joined" is
+ * that commit: it stands for position "nr", and what is learned about it
+ * from the other line applies to this one.
+ */
+struct line {
+	struct commit **chain;
+	int nr, alloc;
+	unsigned ended : 1;
+	unsigned acked : 1;
+	struct commit *joined;
+
+	/* lowest position known to be common, or INT_MAX */
+	int common;
+	/* highest position known not to be common, or -1 */
+	int uncommon;
+
+	/* next position and distance while skipping exponentially */
+	int probe;
+	int step;
+	/* highest position sent so far, or -1 */
+	int max_sent;
+	/* "have"s sent in the current round, and how many it may send */
+	int sent;
+	int burst;
+};
+
+/*
+ * A "have" sent in the current round: position "pos" of "line", or a commit
+ * known to be common, which has no line.
+ */
+struct probe {
+	struct line *line;
+	int pos;
+	struct commit *commit;
+};
+
+struct data {
+	struct line **lines;
+	int nr, alloc;
+	unsigned sorted : 1;
+
+	/*
+	 * Set once fetch-pack tells us where rounds start, i.e. when the
+	 * server acknowledges every "have" it has at the end of each round,
+	 * so that one that is not acknowledged is known not to be common.
+	 * Otherwise we only skip, and never bisect.
+	 */
+	unsigned rounds : 1;
+
+	struct probe *round;
+	int round_nr, round_alloc, round_pos;
+
+	/*
+	 * The commits known to be common before negotiation starts. The
+	 * server needs to be told about them too; they are sent first.
+	 */
+	struct commit **known;
+	int known_nr, known_alloc, known_sent;
+};
+
+static int clear_marks(const char *refname, const struct object_id *oid,
+		       int flag, void *cb_data)
+{
+	struct object *o = deref_tag(the_repository, parse_object(the_repository, oid), refname, 0);
+
+	if (o && o->type == OBJ_COMMIT)
+		clear_commit_marks((struct commit *)o,
+				   COMMON | WALKED | NOT_COMMON);
+	return 0;
+}
+
+/*
+ * Walk the chain of "l" until it has a commit at "pos"; return 0 if it ends
+ * before that.
+ */
+static int extend_line(struct line *l, int pos)
+{
+	while (l->nr <= pos && !l->ended) {
+		struct commit *c = l->chain[l->nr - 1];
+		struct commit *parent;
+
+		if (parse_commit(c) || !c->parents ||
+		    parse_commit(c->parents->item)) {
+			l->ended = 1;
+			break;
+		}
+
+		parent = c->parents->item;
+		if (parent->object.flags & (COMMON | WALKED)) {
+			l->joined = parent;
+			l->ended = 1;
+			break;
+		}
+
+		parent->object.flags |= WALKED;
+		ALLOC_GROW(l->chain, l->nr + 1, l->alloc);
+		l->chain[l->nr++] = parent;
+	}
+	return pos < l->nr;
+}
+
+static int set_common(struct line *l, int pos)
+{
+	int i;
+
+	if (pos >= l->common)
+		return 0;
+	for (i = pos; i < l->nr && i < l->common; i++)
+		l->chain[i]->object.flags |= COMMON;
+	l->common = pos;
+	return 1;
+}
+
+static int set_uncommon(struct line *l, int pos)
+{
+	int i;
+
+	if (pos <= l->uncommon)
+		return 0;
+	for (i = l->uncommon + 1; i <= pos; i++)
+		l->chain[i]->object.flags |= NOT_COMMON;
+	l->uncommon = pos;
+	return 1;
+}
+
+/*
+ * Learn about the end of the chain of "l" from the line it joined.
+ */
+static int update_joined(struct line *l)
+{
+	if (!l->joined)
+		return 0;
+	if (l->joined->object.flags & COMMON)
+		return set_common(l, l->nr);
+	if ((l->joined->object.flags & NOT_COMMON) && l->nr)
+		return set_uncommon(l, l->nr - 1);
+	return 0;
+}
+
+/*
+ * Read the answer of the server to the "have"s of the last round.
+ */
+static void finish_round(struct data *data)
+{
+	int i, changed;
+
+	for (i = 0; i < data->round_nr; i++) {
+		struct line *l = data->round[i].line;
+		int pos = data->round[i].pos;
+
+		if (!l)
+			continue;
+		if (l->chain[pos]->object.flags & COMMON) {
+			set_common(l, pos);
+			l->acked = 1;
+		} else if (data->rounds) {
+			set_uncommon(l, pos);
+		}
+	}
+
+	/* Skip further ahead on lines which were not acknowledged */
+	for (i = 0; i < data->nr; i++) {
+		struct line *l = data->lines[i];
+
+		if (l->sent && !l->acked && l->burst < MAX_BURST)
+			l->burst *= 2;
+		l->sent = 0;
+		l->acked = 0;
+	}
+
+	do {
+		changed = 0;
+		for (i = 0; i < data->nr; i++)
+			changed |= update_joined(data->lines[i]);
+	} while (changed);
+
+	data->round_nr = data->round_pos = 0;
+}
+
+/*
+ * Return the position of the next "have" to send for "l" in this round,
+ * or -1 if there is none.
+ */
+static int next_probe(struct data *data, struct line *l)
+{
+	if (l->common != INT_MAX) {
+		/*
+		 * Split the positions between the last one known not to be
+		 * common and the first one known to be common in "burst" + 1
+		 * parts, one "have" each; with a burst of 1, this bisects.
+		 */
+		int gap = l->common - l->uncommon;
+		int parts;
+
+		if (!data->rounds || gap <= 1)
+			return -1;
+		parts = (l->burst < gap - 1 ? l->burst : gap - 1) + 1;
+		if (l->sent >= parts - 1)
+			return -1;
+		return l->uncommon + (int)((uint64_t)gap * (l->sent + 1) / parts);
+	}
+
+	if (l->sent >= l->burst)
+		return -1;
+
+	while (extend_line(l, l->probe)) {
+		int pos = l->probe;
+
+		l->probe += l->step;
+		l->step *= 2;
+		if (pos > l->uncommon)
+			return pos;
+	}
+
+	/*
+	 * Like the skipping negotiator, always send roots so that unrelated
+	 * histories do not have to be told apart by the lack of "ACK"s.
+	 */
+	if (!l->joined && l->max_sent < l->nr - 1 && l->uncommon < l->nr - 1)
+		return l->nr - 1;
+	return -1;
+}
+
+static void add_probe(struct data *data, struct line *l, int pos,
+		      struct commit *commit)
+{
+	ALLOC_GROW(data->round, data->round_nr + 1, data->round_alloc);
+	data->round[data->round_nr].line = l;
+	data->round[data->round_nr].pos = pos;
+	data->round[data->round_nr].commit = commit;
+	data->round_nr++;
+}
+
+static void build_round(struct data *data, int limit)
+{
+	int i, progress;
+
+	while (data->known_sent < data->known_nr && data->round_nr < limit)
+		add_probe(data, NULL, 0, data->known[data->known_sent++]);
+
+	do {
+		progress = 0;
+		for (i = 0; i < data->nr && data->round_nr < limit; i++) {
+			struct line *l = data->lines[i];
+			int pos = next_probe(data, l);
+
+			if (pos < 0)
+				continue;
+
+			add_probe(data, l, pos, l->chain[pos]);
+			if (l->max_sent < pos)
+				l->max_sent = pos;
+			l->sent++;
+			progress = 1;
+		}
+	} while (progress && data->round_nr < limit);
+}
+
+static int compare_lines(const void *a_, const void *b_)
+{
+	const struct line *a = *(const struct line **)a_;
+	const struct line *b = *(const struct line **)b_;
+
+	return compare_commits_by_gen_then_commit_date(a->chain[0], b->chain[0],
+						       NULL);
+}
+
+/*
+ * Drop the lines of the tips which are ancestors of other tips, as their
+ * history is walked from those. Generation numbers bound this walk to
+ * the history since the oldest tip.
+ */
+static void drop_reachable_tips(struct data *data)
+{
+	struct commit **tips, **parents = NULL;
+	int nr_parents = 0, alloc = 0, i, j;
+
+	ALLOC_ARRAY(tips, data->nr);
+	for (i = 0; i < data->nr; i++) {
+		struct commit_list *p;
+
+		tips[i] = data->lines[i]->chain[0];
+		if (parse_commit(tips[i]))
+			continue;
+		for (p = tips[i]->parents; p; p = p->next) {
+			ALLOC_GROW(parents, nr_parents + 1, alloc);
+			parents[nr_parents++] = p->item;
+		}
+	}
+	free_commit_list(get_reachable_subset(parents, nr_parents,
+					      tips, data->nr, REACHABLE));
+
+	for (i = j = 0; i < data->nr; i++) {
+		struct line *l = data->lines[i];
+
+		if (l->chain[0]->object.flags & REACHABLE) {
+			l->chain[0]->object.flags &= ~(REACHABLE | WALKED);
+			free(l->chain);
+			free(l);
+		} else {
+			data->lines[j++] = l;
+		}
+	}
+	data->nr = j;
+
+	free(tips);
+	free(parents);
+}
+
+static void start_rounds(struct data *data)
+{
+	if (data->sorted)
+		return;
+	if (data->nr > 1 && generation_numbers_enabled(the_repository))
+		drop_reachable_tips(data);
+	/*
+	 * Walk the most recent tips first, so that the history they share
+	 * with older ones is on their chains, and the older ones stop as
+	 * soon as they join it.
+	 */
+	QSORT(data->lines, data->nr, compare_lines);
+	data->sorted = 1;
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+
+	if (c->object.flags & COMMON)
+		return;
+	c->object.flags |= COMMON;
+	ALLOC_GROW(data->known, data->known_nr + 1, data->known_alloc);
+	data->known[data->known_nr++] = c;
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	struct data *data = n->data;
+	struct line *l;
+
+	n->known_common = NULL;
+	if (c->object.flags & (COMMON | WALKED))
+		return;
+	c->object.flags |= WALKED;
+
+	l = xcalloc(1, sizeof(*l));
+	ALLOC_GROW(l->chain, 1, l->alloc);
+	l->chain[l->nr++] = c;
+	l->common = INT_MAX;
+	l->uncommon = -1;
+	l->step = 1;
+	l->max_sent = -1;
+	l->burst = 1;
+
+	ALLOC_GROW(data->lines, data->nr + 1, data->alloc);
+	data->lines[data->nr++] = l;
+}
+
+static int next_round(struct fetch_negotiator *n, int limit)
+{
+	struct data *data = n->data;
+
+	n->known_common = NULL;
+	n->add_tip = NULL;
+	data->rounds = 1;
+	start_rounds(data);
+	finish_round(data);
+	build_round(data, limit);
+	return data->round_nr;
+}
+
+static const struct object_id *next(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+
+	n->known_common = NULL;
+	n->add_tip = NULL;
+
+	if (data->round_pos >= data->round_nr) {
+		/* With rounds, wait for the server to answer this one */
+		if (data->rounds)
+			return NULL;
+		start_rounds(data);
+		finish_round(data);
+		build_round(data, MAX_BURST);
+		if (!data->round_nr)
+			return NULL;
+	}
+
+	return &data->round[data->round_pos++].commit->object.oid;
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	int known_to_be_common = !!(c->object.flags & COMMON);
+
+	c->object.flags |= COMMON;
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct data *data = n->data;
+	int i;
+
+	for (i = 0; i < data->nr; i++) {
+		free(data->lines[i]->chain);
+		free(data->lines[i]);
+	}
+	free(data->lines);
+	free(data->round);
+	free(data->known);
+	FREE_AND_NULL(n->data);
+}
+
+void bisecting_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->next_round = next_round;
+	negotiator->release = release;
+	negotiator->data = xcalloc(1, sizeof(struct data));
+
+	if (marked)
+		for_each_ref(clear_marks, NULL);
+	marked = 1;
+}
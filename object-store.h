@@ -6,6 +6,7 @@
 #include "list.h"
 #include "sha1-array.h"
 #include "strbuf.h"
+#include "thread-utils.h"
 
 struct object_directory {
 	struct object_directory *next;
@@ -83,6 +84,10 @@ struct packed_git {
 		 multi_pack_index:1;
 	unsigned char hash[GIT_MAX_RAWSZ];
 	struct revindex_entry *revindex;
+	/* mmapped ".rev" file, used instead of 'revindex' when present */
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -311,6 +316,33 @@ int oid_object_info_extended(struct repository *r,
 			     const struct object_id *,
 			     struct object_info *, unsigned flags);
 
+/*
+ * Threads that read objects concurrently have to enable the object read
+ * lock first, and hold it while calling lower-level functions that read
+ * packs, like unpack_entry(); oid_object_info_extended() takes it by
+ * itself. The lock is recursive and is dropped while inflating packed
+ * data and applying deltas, so that the decompression of different
+ * objects can proceed in parallel; the delta base cache has locks of
+ * its own.
+ */
+extern int obj_read_use_lock;
+extern pthread_mutex_t obj_read_mutex;
+
+void enable_obj_read_lock(void);
+void disable_obj_read_lock(void);
+
+static inline void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+static inline void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -62,6 +62,8 @@ struct object_array {
  * revision.h:               0---------10                              25----28
  * fetch-pack.c:             01
  * negotiator/default.c:       2--5
+ * negotiator/skipping.c:      2--5
+ * negotiator/bisecting.c:     2--5
  * walker.c:                 0-2
  * upload-pack.c:                4       11-----14  16-----19
  * builtin/blame.c:                        12-13
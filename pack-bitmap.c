@@ -5,6 +5,7 @@
 #include "revision.h"
 #include "progress.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
@@ -12,6 +13,8 @@
 #include "packfile.h"
 #include "repository.h"
 #include "object-store.h"
+#include "midx.h"
+#include "config.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -33,9 +36,22 @@ struct stored_bitmap {
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
+	/*
+	 * Packfile to which this bitmap index belongs to. For a MIDX
+	 * bitmap, this is the preferred pack, whose objects occupy the
+	 * first bits in pack order and can be reused verbatim, or NULL if
+	 * no pack qualifies.
+	 */
 	struct packed_git *pack;
 
+	/*
+	 * If not NULL, the bitmap covers all the objects of this
+	 * multi-pack-index, in its "pseudo-pack" order, and `midx_pos`
+	 * maps a MIDX position to the corresponding bit.
+	 */
+	struct multi_pack_index *midx;
+	uint32_t *midx_pos;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -69,6 +85,13 @@ struct bitmap_index {
 	/* If not NULL, this is a name-hash cache pointing into map. */
 	uint32_t *hashes;
 
+	/*
+	 * If not NULL, this is the lookup table of the bitmapped commits,
+	 * pointing into map. The bitmaps are then not read when the index
+	 * is loaded, but one at a time when a walk asks for them.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -93,6 +116,13 @@ struct bitmap_index {
 	unsigned int version;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -151,18 +181,31 @@ static int load_bitmap_header(struct bitmap_index *index)
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
+		unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
+		size_t header_size = sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		index->entry_count = ntohl(header->entry_count);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - the_hash_algo->rawsz;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
+			end = (unsigned char *)index->hashes;
+		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = st_mult(index->entry_count,
+						    BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+
+			if ((size_t)(end - index->map) < header_size + table_size)
+				return error("Corrupted bitmap index file (too short to fit lookup table)");
+			if (git_env_bool("GIT_TEST_READ_BITMAP_LOOKUP_TABLE", 1))
+				index->table_lookup = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz;
 	return 0;
 }
@@ -221,13 +264,18 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		struct ewah_bitmap *bitmap = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
-		const unsigned char *sha1;
+		struct object_id oid;
 
 		commit_idx_pos = read_be32(index->map, &index->map_pos);
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (index->midx) {
+			if (!nth_midxed_object_oid(&oid, index->midx, commit_idx_pos))
+				return error("Corrupted bitmap pack index");
+		} else if (!nth_packed_object_oid(&oid, index->pack, commit_idx_pos)) {
+			return error("Corrupted bitmap pack index");
+		}
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -244,12 +292,231 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, sha1, xor_bitmap, flags);
+			index, bitmap, oid.hash, xor_bitmap, flags);
 	}
 
 	return 0;
 }
 
+static inline uint64_t read_be64(const unsigned char *buffer, size_t *pos)
+{
+	uint64_t result = get_be64(buffer + *pos);
+	(*pos) += sizeof(result);
+	return result;
+}
+
+/*
+ * Find the row of the lookup table for the commit at the given
+ * position in the pack (or MIDX) index. The rows are sorted by that
+ * position.
+ */
+static int bitmap_lookup_table_find(struct bitmap_index *bitmap_git,
+				    uint32_t commit_pos, uint32_t *row)
+{
+	uint32_t lo = 0, hi = bitmap_git->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t pos = get_be32(bitmap_git->table_lookup +
+					st_mult(mi, BITMAP_LOOKUP_TABLE_ENTRY_SIZE));
+
+		if (pos == commit_pos) {
+			*row = mi;
+			return 1;
+		}
+		if (pos < commit_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static int bitmap_nth_object_oid(struct bitmap_index *bitmap_git,
+				 struct object_id *oid, uint32_t n)
+{
+	if (bitmap_git->midx)
+		return !!nth_midxed_object_oid(oid, bitmap_git->midx, n);
+	return !!nth_packed_object_oid(oid, bitmap_git->pack, n);
+}
+
+/*
+ * Read the bitmap in the given row of the lookup table, and the ones it
+ * is XOR'ed against which have not been read yet. The chain is followed
+ * from the requested bitmap to its bases, and the bitmaps are then read
+ * in the opposite order so that each one finds its base already stored.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *bitmap_git,
+						 uint32_t row)
+{
+	struct stored_bitmap *stored = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	for (;;) {
+		const unsigned char *entry;
+		uint32_t xor_row;
+		struct object_id oid;
+		khiter_t hash_pos;
+
+		if (chain_nr >= bitmap_git->entry_count) {
+			error("Corrupted bitmap lookup table (XOR cycle)");
+			goto done;
+		}
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		entry = bitmap_git->table_lookup +
+			st_mult(row, BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+		xor_row = get_be32(entry + 12);
+		if (xor_row == BITMAP_NO_XOR_ROW)
+			break;
+		if (xor_row >= bitmap_git->entry_count) {
+			error("Corrupted bitmap lookup table (invalid XOR row)");
+			goto done;
+		}
+
+		entry = bitmap_git->table_lookup +
+			st_mult(xor_row, BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+		if (!bitmap_nth_object_oid(bitmap_git, &oid, get_be32(entry))) {
+			error("Corrupted bitmap pack index");
+			goto done;
+		}
+		hash_pos = kh_get_oid_map(bitmap_git->bitmaps, oid);
+		if (hash_pos < kh_end(bitmap_git->bitmaps)) {
+			stored = kh_value(bitmap_git->bitmaps, hash_pos);
+			break;
+		}
+		row = xor_row;
+	}
+
+	while (chain_nr) {
+		const unsigned char *entry;
+		uint32_t commit_pos;
+		uint64_t offset;
+		int flags;
+		struct object_id oid;
+		struct ewah_bitmap *bitmap;
+
+		entry = bitmap_git->table_lookup +
+			st_mult(chain[--chain_nr], BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+		commit_pos = get_be32(entry);
+		offset = get_be64(entry + 4);
+
+		if (offset + 6 > (uint64_t)(bitmap_git->table_lookup - bitmap_git->map) ||
+		    get_be32(bitmap_git->map + offset) != commit_pos) {
+			error("Corrupted bitmap lookup table (invalid offset)");
+			stored = NULL;
+			goto done;
+		}
+		if (!bitmap_nth_object_oid(bitmap_git, &oid, commit_pos)) {
+			error("Corrupted bitmap pack index");
+			stored = NULL;
+			goto done;
+		}
+
+		bitmap_git->map_pos = offset + 5;
+		flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
+		bitmap = read_bitmap_1(bitmap_git);
+		if (!bitmap) {
+			stored = NULL;
+			goto done;
+		}
+		stored = store_bitmap(bitmap_git, bitmap, oid.hash, stored, flags);
+		if (!stored)
+			goto done;
+	}
+
+done:
+	free(chain);
+	return stored;
+}
+
+/*
+ * Return the bitmap of the given commit, or NULL if it has none. When
+ * the index has a lookup table, the bitmap is read at this point.
+ */
+static struct ewah_bitmap *find_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						  const struct object_id *oid)
+{
+	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps, *oid);
+	struct stored_bitmap *stored;
+	uint32_t commit_pos, row;
+
+	if (hash_pos < kh_end(bitmap_git->bitmaps))
+		return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+
+	if (!bitmap_git->table_lookup)
+		return NULL;
+
+	if (bitmap_git->midx) {
+		if (!bsearch_midx(oid, bitmap_git->midx, &commit_pos))
+			return NULL;
+	} else {
+		struct packed_git *p = bitmap_git->pack;
+		if (!bsearch_pack(oid, p, &commit_pos))
+			return NULL;
+	}
+
+	if (!bitmap_lookup_table_find(bitmap_git, commit_pos, &row))
+		return NULL;
+
+	stored = lazy_bitmap_for_row(bitmap_git, row);
+	if (!stored)
+		return NULL;
+	return lookup_stored_bitmap(stored);
+}
+
+/*
+ * Check the rows of the lookup table without reading any bitmap: they
+ * must be sorted by commit position, and point between the end of the
+ * type bitmaps and the start of the table.
+ */
+static int verify_lookup_table(struct bitmap_index *bitmap_git)
+{
+	uint64_t table_pos = bitmap_git->table_lookup - bitmap_git->map;
+	uint32_t num_objects = bitmap_num_objects(bitmap_git);
+	uint32_t row;
+
+	for (row = 0; row < bitmap_git->entry_count; row++) {
+		const unsigned char *entry = bitmap_git->table_lookup +
+			st_mult(row, BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+		uint32_t commit_pos = get_be32(entry);
+		uint64_t offset = get_be64(entry + 4);
+		uint32_t xor_row = get_be32(entry + 12);
+
+		if (commit_pos >= num_objects ||
+		    (row && commit_pos <= get_be32(entry - BITMAP_LOOKUP_TABLE_ENTRY_SIZE)) ||
+		    offset < bitmap_git->map_pos || offset + 6 > table_pos ||
+		    (xor_row != BITMAP_NO_XOR_ROW && xor_row >= bitmap_git->entry_count))
+			return error("Failed to load bitmap lookup table (corrupted?)");
+	}
+	return 0;
+}
+
+/* Read all the bitmaps which have not been read through the lookup table. */
+static int load_all_lazy_bitmaps(struct bitmap_index *bitmap_git)
+{
+	uint32_t row;
+
+	if (!bitmap_git->table_lookup)
+		return 0;
+
+	for (row = 0; row < bitmap_git->entry_count; row++) {
+		const unsigned char *entry = bitmap_git->table_lookup +
+			st_mult(row, BITMAP_LOOKUP_TABLE_ENTRY_SIZE);
+		struct object_id oid;
+
+		if (!bitmap_nth_object_oid(bitmap_git, &oid, get_be32(entry)))
+			return error("Corrupted bitmap pack index");
+		if (kh_get_oid_map(bitmap_git->bitmaps, oid) < kh_end(bitmap_git->bitmaps))
+			continue;
+		if (!lazy_bitmap_for_row(bitmap_git, row))
+			return -1;
+	}
+	return 0;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -280,7 +547,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -302,13 +569,110 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
+static int open_midx_bitmap_1(struct repository *r,
+			      struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	struct bitmap_disk_header *header;
+	struct stat st;
+	char *bitmap_name;
+	uint32_t i;
+	int fd;
+
+	if (!midx->chunk_revindex)
+		return -1;
+
+	bitmap_name = get_midx_bitmap_filename(midx);
+	fd = git_open(bitmap_name);
+	free(bitmap_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	header = (struct bitmap_disk_header *)bitmap_git->map;
+	if (!hasheq(header->checksum, get_midx_checksum(midx))) {
+		warning("checksum doesn't match in MIDX and bitmap");
+		goto cleanup;
+	}
+
+	for (i = 0; i < midx->num_packs; i++) {
+		if (prepare_midx_pack(r, midx, i)) {
+			warning("could not open pack %s", midx->pack_names[i]);
+			goto cleanup;
+		}
+	}
+
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map = NULL;
+	bitmap_git->map_size = 0;
+	bitmap_git->midx = NULL;
+	return -1;
+}
+
+/*
+ * Fill in the MIDX-position-to-bit map, and find out whether the
+ * objects at the start of the pseudo-pack order are exactly those of
+ * a single pack, in which case that pack can be reused verbatim.
+ */
+static int load_midx_pack_order(struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct packed_git *preferred = NULL;
+	uint32_t preferred_id = 0, i;
+
+	ALLOC_ARRAY(bitmap_git->midx_pos, m->num_objects);
+
+	if (m->num_objects) {
+		preferred_id = nth_midxed_pack_int_id(m, nth_midxed_pack_order(m, 0));
+		preferred = m->packs[preferred_id];
+		if (preferred->num_objects > m->num_objects)
+			preferred = NULL;
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		uint32_t pos = nth_midxed_pack_order(m, i);
+
+		if (pos >= m->num_objects)
+			return error("Corrupted multi-pack-index reverse index");
+		bitmap_git->midx_pos[pos] = i;
+
+		if (preferred && i < preferred->num_objects &&
+		    nth_midxed_pack_int_id(m, pos) != preferred_id)
+			preferred = NULL;
+	}
+
+	if (preferred && !load_pack_revindex(preferred))
+		bitmap_git->pack = preferred;
+	return 0;
+}
+
 static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_oid_map();
 	bitmap_git->ext_index.positions = kh_init_oid_pos();
-	if (load_pack_revindex(bitmap_git->pack))
+	if (bitmap_git->midx) {
+		if (load_midx_pack_order(bitmap_git))
+			goto failed;
+	} else if (load_pack_revindex(bitmap_git->pack))
 		goto failed;
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
@@ -317,7 +681,10 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	if (bitmap_git->table_lookup) {
+		if (verify_lookup_table(bitmap_git) < 0)
+			goto failed;
+	} else if (load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
 	return 0;
@@ -335,8 +702,16 @@ static int open_pack_bitmap(struct repository *r,
 	struct packed_git *p;
 	int ret = -1;
 
+	struct multi_pack_index *m;
+
 	assert(!bitmap_git->map);
 
+	/* A bitmap of the local MIDX covers all its packs; prefer it. */
+	for (m = get_multi_pack_index(r); m; m = m->next) {
+		if (m->local && !open_midx_bitmap_1(r, bitmap_git, m))
+			return 0;
+	}
+
 	for (p = get_all_packs(r); p; p = p->next) {
 		if (open_pack_bitmap_1(bitmap_git, p) == 0)
 			ret = 0;
@@ -370,7 +745,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -379,11 +754,22 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 					   const struct object_id *oid)
 {
-	off_t offset = find_pack_entry_one(oid->hash, bitmap_git->pack);
+	off_t offset;
+	uint32_t pos;
+
+	if (bitmap_git->midx) {
+		if (!bsearch_midx(oid, bitmap_git->midx, &pos))
+			return -1;
+		return bitmap_git->midx_pos[pos];
+	}
+
+	offset = find_pack_entry_one(oid->hash, bitmap_git->pack);
 	if (!offset)
 		return -1;
 
-	return find_revindex_position(bitmap_git->pack, offset);
+	if (offset_to_pack_pos(bitmap_git->pack, offset, &pos) < 0)
+		return -1;
+	return pos;
 }
 
 static int bitmap_position(struct bitmap_index *bitmap_git,
@@ -419,7 +805,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -450,7 +836,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      const struct object_id *oid,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *bitmap;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -458,10 +844,9 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_oid_map(bitmap_git->bitmaps, *oid);
-	if (hash_pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	bitmap = find_bitmap_for_commit(bitmap_git, oid);
+	if (bitmap) {
+		bitmap_or_ewah(data->base, bitmap);
 		return 0;
 	}
 
@@ -518,12 +903,10 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_oid_map(bitmap_git->bitmaps, object->oid);
-
-			if (pos < kh_end(bitmap_git->bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with =
+				find_bitmap_for_commit(bitmap_git, &object->oid);
 
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -608,7 +991,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -630,7 +1013,7 @@ static void show_objects_for_type(
 
 	struct bitmap *objects = bitmap_git->result;
 
-	if (bitmap_git->reuse_objects == bitmap_git->pack->num_objects)
+	if (bitmap_git->reuse_objects == bitmap_num_objects(bitmap_git))
 		return;
 
 	ewah_iterator_init(&it, type_filter);
@@ -640,7 +1023,6 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -651,13 +1033,26 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git->reuse_objects)
 				continue;
 
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+			if (bitmap_git->midx) {
+				struct multi_pack_index *m = bitmap_git->midx;
+				uint32_t midx_pos = nth_midxed_pack_order(m, pos + offset);
+
+				nth_midxed_object_oid(&oid, m, midx_pos);
+				show_reach(&oid, object_type, 0, 0,
+					   m->packs[nth_midxed_pack_int_id(m, midx_pos)],
+					   nth_midxed_offset(m, midx_pos));
+			} else {
+				uint32_t index_pos;
 
-			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
+				nth_packed_object_oid(&oid, bitmap_git->pack, index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+				if (bitmap_git->hashes)
+					hash = get_be32(bitmap_git->hashes + index_pos);
+
+				show_reach(&oid, object_type, 0, hash, bitmap_git->pack,
+					   pack_pos_to_offset(bitmap_git->pack, pos + offset));
+			}
 		}
 
 		pos += BITS_IN_EWORD;
@@ -665,6 +1060,229 @@ static void show_objects_for_type(
 	}
 }
 
+static struct ewah_bitmap *find_type_bitmap(struct bitmap_index *bitmap_git,
+					    enum object_type type)
+{
+	switch (type) {
+	case OBJ_COMMIT:
+		return bitmap_git->commits;
+	case OBJ_TREE:
+		return bitmap_git->trees;
+	case OBJ_BLOB:
+		return bitmap_git->blobs;
+	case OBJ_TAG:
+		return bitmap_git->tags;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Objects asked for by name are never filtered out by a traversal, so
+ * they have to be kept here, too.
+ */
+static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       enum object_type type)
+{
+	struct bitmap *result = bitmap_new();
+	struct object_list *p;
+
+	for (p = tip_objects; p; p = p->next) {
+		int pos;
+
+		if (p->item->type != type)
+			continue;
+
+		pos = bitmap_position(bitmap_git, &p->item->oid);
+		if (pos < 0)
+			continue;
+
+		bitmap_set(result, pos);
+	}
+
+	return result;
+}
+
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       struct bitmap *to_filter,
+				       enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tips;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	tips = find_tip_objects(bitmap_git, tip_objects, type);
+
+	ewah_iterator_init(&it, find_type_bitmap(bitmap_git, type));
+	for (i = 0; i < to_filter->word_alloc && ewah_iterator_next(&mask, &it); i++) {
+		if (i < tips->word_alloc)
+			mask &= ~tips->words[i];
+		to_filter->words[i] &= ~mask;
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = bitmap_num_objects(bitmap_git) + i;
+
+		if (eindex->objects[i]->type == type &&
+		    !bitmap_get(tips, pos))
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tips);
+}
+
+static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
+				     uint32_t pos)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	unsigned long size;
+
+	oi.sizep = &size;
+
+	if (pos < bitmap_num_objects(bitmap_git)) {
+		struct packed_git *pack;
+		struct object_id oid;
+		off_t ofs;
+
+		if (bitmap_git->midx) {
+			struct multi_pack_index *m = bitmap_git->midx;
+			uint32_t midx_pos = nth_midxed_pack_order(m, pos);
+
+			nth_midxed_object_oid(&oid, m, midx_pos);
+			pack = m->packs[nth_midxed_pack_int_id(m, midx_pos)];
+			ofs = nth_midxed_offset(m, midx_pos);
+		} else {
+			pack = bitmap_git->pack;
+			nth_packed_object_oid(&oid, pack,
+					      pack_pos_to_index(pack, pos));
+			ofs = pack_pos_to_offset(pack, pos);
+		}
+
+		if (packed_object_info(the_repository, pack, ofs, &oi) < 0)
+			die(_("unable to get size of %s"), oid_to_hex(&oid));
+	} else {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		struct object *obj = eindex->objects[pos - bitmap_num_objects(bitmap_git)];
+
+		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
+			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
+	}
+
+	return size;
+}
+
+static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
+				     struct object_list *tip_objects,
+				     struct bitmap *to_filter,
+				     unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tips;
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	tips = find_tip_objects(bitmap_git, tip_objects, OBJ_BLOB);
+
+	ewah_iterator_init(&it, bitmap_git->blobs);
+	for (i = 0; i < to_filter->word_alloc && ewah_iterator_next(&mask, &it); i++) {
+		eword_t word = to_filter->words[i] & mask;
+		unsigned offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			uint32_t pos;
+
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			pos = i * BITS_IN_EWORD + offset;
+			if (!bitmap_get(tips, pos) &&
+			    get_size_by_pos(bitmap_git, pos) >= limit)
+				bitmap_unset(to_filter, pos);
+		}
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = bitmap_num_objects(bitmap_git) + i;
+
+		/*
+		 * Like the traversal, keep blobs we do not have: their
+		 * size cannot be checked.
+		 */
+		if (eindex->objects[i]->type == OBJ_BLOB &&
+		    bitmap_get(to_filter, pos) &&
+		    !bitmap_get(tips, pos) &&
+		    has_object_file(&eindex->objects[i]->oid) &&
+		    get_size_by_pos(bitmap_git, pos) >= limit)
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tips);
+}
+
+/*
+ * Remove from "to_filter" the objects the filter would omit from a
+ * traversal, or, if "to_filter" is NULL, only check whether the filter can
+ * be applied to a bitmap. Only the filters that decide on each object by
+ * itself can: the sparse filter and trees down to some depth depend on the
+ * paths at which the objects are reached.
+ */
+static int filter_bitmap(struct bitmap_index *bitmap_git,
+			 struct object_list *tip_objects,
+			 struct bitmap *to_filter,
+			 struct list_objects_filter_options *filter)
+{
+	size_t i;
+
+	if (!filter || filter->choice == LOFC_DISABLED)
+		return 0;
+
+	switch (filter->choice) {
+	case LOFC_BLOB_NONE:
+		if (to_filter)
+			filter_bitmap_exclude_type(bitmap_git, tip_objects,
+						   to_filter, OBJ_BLOB);
+		return 0;
+
+	case LOFC_BLOB_LIMIT:
+		if (to_filter)
+			filter_bitmap_blob_limit(bitmap_git, tip_objects,
+						 to_filter,
+						 filter->blob_limit_value);
+		return 0;
+
+	case LOFC_TREE_DEPTH:
+		if (filter->tree_exclude_depth)
+			return -1;
+		if (to_filter) {
+			filter_bitmap_exclude_type(bitmap_git, tip_objects,
+						   to_filter, OBJ_TREE);
+			filter_bitmap_exclude_type(bitmap_git, tip_objects,
+						   to_filter, OBJ_BLOB);
+		}
+		return 0;
+
+	case LOFC_COMBINE:
+		for (i = 0; i < filter->sub_nr; i++)
+			if (filter_bitmap(bitmap_git, tip_objects, to_filter,
+					  &filter->sub[i]) < 0)
+				return -1;
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+static int can_filter_bitmap(struct list_objects_filter_options *filter)
+{
+	return !filter_bitmap(NULL, NULL, NULL, filter);
+}
+
 static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 			     struct object_list *roots)
 {
@@ -672,14 +1290,20 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
 	return 0;
 }
 
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 
@@ -689,7 +1313,13 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
 
-	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
+	struct bitmap_index *bitmap_git;
+
+	/* let the caller fall back to a traversal for the other filters */
+	if (!can_filter_bitmap(filter))
+		return NULL;
+
+	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	if (open_pack_bitmap(revs->repo, bitmap_git) < 0)
@@ -758,6 +1388,8 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	filter_bitmap(bitmap_git, wants, wants_bitmap, filter);
+
 	bitmap_git->result = wants_bitmap;
 	bitmap_git->haves = haves_bitmap;
 
@@ -785,6 +1417,10 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	/* A MIDX bitmap without a suitable preferred pack. */
+	if (!bitmap_git->pack)
+		return -1;
+
 	for (i = 0; i < result->word_alloc; ++i) {
 		if (result->words[i] != (eword_t)~0) {
 			reuse_objects += ewah_bit_ctz64(~result->words[i]);
@@ -797,10 +1433,10 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 #ifdef GIT_BITMAP_DEBUG
 	{
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 
-		entry = &bitmap_git->reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git->pack,
+					      pack_pos_to_index(bitmap_git->pack,
+								reuse_objects));
 
 		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
 			reuse_objects, result->words[i]);
@@ -824,7 +1460,7 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 		return -1;
 
 	bitmap_git->reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git->pack->revindex[reuse_objects].offset;
+	*up_to = pack_pos_to_offset(bitmap_git->pack, reuse_objects);
 	*packfile = bitmap_git->pack;
 
 	return 0;
@@ -854,29 +1490,13 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 	struct eindex *eindex = &bitmap_git->ext_index;
 
 	uint32_t i = 0, count = 0;
+	struct ewah_bitmap *type_bitmap = find_type_bitmap(bitmap_git, type);
 	struct ewah_iterator it;
 	eword_t filter;
 
-	switch (type) {
-	case OBJ_COMMIT:
-		ewah_iterator_init(&it, bitmap_git->commits);
-		break;
-
-	case OBJ_TREE:
-		ewah_iterator_init(&it, bitmap_git->trees);
-		break;
-
-	case OBJ_BLOB:
-		ewah_iterator_init(&it, bitmap_git->blobs);
-		break;
-
-	case OBJ_TAG:
-		ewah_iterator_init(&it, bitmap_git->tags);
-		break;
-
-	default:
+	if (!type_bitmap)
 		return 0;
-	}
+	ewah_iterator_init(&it, type_bitmap);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
 		eword_t word = objects->words[i++] & filter;
@@ -885,7 +1505,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -950,7 +1570,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 	struct bitmap_index *bitmap_git;
@@ -965,12 +1585,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git->version, bitmap_git->entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_oid_map(bitmap_git->bitmaps, root->oid);
-
-	if (pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = find_bitmap_for_commit(bitmap_git, &root->oid);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			oid_to_hex(&root->oid), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1051,22 +1668,31 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		struct object_id oid;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+		if (bitmap_git->midx) {
+			nth_midxed_object_oid(&oid, bitmap_git->midx,
+					      nth_midxed_pack_order(bitmap_git->midx, i));
+		} else {
+			nth_packed_object_oid(&oid, bitmap_git->pack,
+					      pack_pos_to_index(bitmap_git->pack, i));
+		}
 		oe = packlist_find(mapping, &oid);
 
 		if (oe)
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
 	}
 
+	if (load_all_lazy_bitmaps(bitmap_git) < 0) {
+		free(reposition);
+		return -1;
+	}
+
 	rebuild = bitmap_new();
 	i = 0;
 
@@ -1112,6 +1738,7 @@ void free_bitmap_index(struct bitmap_index *b)
 	free(b->ext_index.hashes);
 	bitmap_free(b->result);
 	bitmap_free(b->haves);
+	free(b->midx_pos);
 	free(b);
 }
 
@@ -24,8 +24,18 @@ struct bitmap_disk_header {
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * A row of the lookup table: the position of the commit in the pack
+ * index (4 bytes), the offset of its bitmap entry in the file (8 bytes)
+ * and the row of the bitmap it is XOR'ed against (4 bytes), or
+ * BITMAP_NO_XOR_ROW.
+ */
+#define BITMAP_LOOKUP_TABLE_ENTRY_SIZE (4 + 8 + 4)
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -46,7 +56,17 @@ void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs);
+struct list_objects_filter_options;
+
+/*
+ * Compute the objects reachable from the pending objects of "revs" and
+ * not from the UNINTERESTING ones, omitting those "filter" would omit.
+ * Returns NULL if the bitmap cannot be used, for example because the
+ * filter is not one that can be applied to a bitmap; the caller should
+ * then fall back to a traversal.
+ */
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter);
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
 				       struct packed_git **packfile,
 				       uint32_t *entries, off_t *up_to);
@@ -37,7 +37,10 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 		void *data = use_pack(p, w_curs, offset, &avail);
 		if (avail > len)
 			avail = len;
+		/* "data" stays mapped until we let go of the window. */
+		obj_read_unlock();
 		data_crc = crc32(data_crc, data, avail);
+		obj_read_lock();
 		offset += avail;
 		len -= avail;
 	} while (len);
@@ -48,11 +51,189 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+struct verify_pack_data {
+	struct repository *r;
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	verify_fn fn;
+	struct progress *progress;
+	uint32_t base_count;
+
+	/* Protected by "mutex" when several threads are at work. */
+	uint32_t next_entry, nr_done;
+	int threads_active;
+	pthread_mutex_t mutex;
+};
+
+/* Hand out the entries in batches this big to the threads. */
+#define VERIFY_PACK_BATCH 256
+
+static inline void verify_lock(struct verify_pack_data *d)
+{
+	if (d->threads_active)
+		pthread_mutex_lock(&d->mutex);
+}
+
+static inline void verify_unlock(struct verify_pack_data *d)
+{
+	if (d->threads_active)
+		pthread_mutex_unlock(&d->mutex);
+}
+
+static int verify_entry(struct verify_pack_data *d,
+			struct pack_window **w_curs, uint32_t i)
+{
+	struct packed_git *p = d->p;
+	struct idx_entry *entries = d->entries;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	off_t curpos;
+	int data_valid;
+	int err = 0;
+
+	obj_read_lock();
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    oid_to_hex(entries[i].oid.oid),
+				    p->pack_name, (uintmax_t)offset);
+	}
+
+	curpos = entries[i].offset;
+	type = unpack_object_header(p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+
+	if (type == OBJ_BLOB && big_file_threshold <= size) {
+		/*
+		 * Let check_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		data = NULL;
+		data_valid = 0;
+	} else {
+		data = unpack_entry(d->r, p, entries[i].offset, &type, &size);
+		data_valid = 1;
+	}
+	obj_read_unlock();
+
+	if (data_valid && !data)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(entries[i].oid.oid), p->pack_name,
+			    (uintmax_t)entries[i].offset);
+	else {
+		int bad;
+
+		/* Streaming reads the pack behind our back. */
+		if (!data)
+			obj_read_lock();
+		bad = check_object_signature(entries[i].oid.oid, data, size,
+					     type_name(type));
+		if (!data)
+			obj_read_unlock();
+
+		if (bad)
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(entries[i].oid.oid), p->pack_name);
+		else if (d->fn) {
+			int eaten = 0;
+			verify_lock(d);
+			err |= d->fn(entries[i].oid.oid, type, size, data, &eaten);
+			verify_unlock(d);
+			if (eaten)
+				data = NULL;
+		}
+	}
+	free(data);
+	return err;
+}
+
+static void *verify_entries_thread(void *data)
+{
+	struct verify_pack_data *d = data;
+	struct pack_window *w_curs = NULL;
+	int err = 0;
+
+	for (;;) {
+		uint32_t i, start, end;
+
+		verify_lock(d);
+		start = d->next_entry;
+		end = start + VERIFY_PACK_BATCH;
+		if (end > d->nr_objects || end < start)
+			end = d->nr_objects;
+		d->next_entry = end;
+		verify_unlock(d);
+
+		if (start >= end)
+			break;
+
+		for (i = start; i < end; i++)
+			err |= verify_entry(d, &w_curs, i);
+
+		verify_lock(d);
+		d->nr_done += end - start;
+		display_progress(d->progress, d->base_count + d->nr_done);
+		verify_unlock(d);
+	}
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return (void *)(intptr_t)err;
+}
+
+static int verify_entries(struct verify_pack_data *d, int nr_threads)
+{
+	pthread_t *threads;
+	int i, err = 0;
+
+	if (!HAVE_THREADS || nr_threads <= 1 ||
+	    d->nr_objects <= VERIFY_PACK_BATCH)
+		return (int)(intptr_t)verify_entries_thread(d);
+
+	/*
+	 * Inflating and hashing happen in parallel; reading the pack
+	 * goes through the object read lock, and the callback is only
+	 * ever called by one thread at a time.
+	 */
+	enable_obj_read_lock();
+	pthread_mutex_init(&d->mutex, NULL);
+	d->threads_active = 1;
+
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&threads[i], NULL,
+					 verify_entries_thread, d);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		err |= (int)(intptr_t)ret;
+	}
+	free(threads);
+
+	d->threads_active = 0;
+	pthread_mutex_destroy(&d->mutex);
+	disable_obj_read_lock();
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -63,6 +244,7 @@ static int verify_packfile(struct repository *r,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_pack_data data;
 
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
@@ -105,60 +287,21 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(entries[i].oid.oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let check_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
-
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_object_signature(entries[i].oid.oid, data, size, type_name(type)))
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(entries[i].oid.oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
+	/*
+	 * Each thread takes the next batch of entries in pack order, so
+	 * that bases tend to be found in the delta base cache.
+	 */
+	memset(&data, 0, sizeof(data));
+	data.r = r;
+	data.p = p;
+	data.entries = entries;
+	data.nr_objects = nr_objects;
+	data.fn = fn;
+	data.progress = progress;
+	data.base_count = base_count;
+	err |= verify_entries(&data, nr_threads);
 
-	}
-	display_progress(progress, base_count + i);
+	display_progress(progress, base_count + nr_objects);
 	free(entries);
 
 	return err;
@@ -188,7 +331,7 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -197,7 +340,10 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_pack_revindex(p);
+
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
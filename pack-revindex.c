@@ -2,6 +2,7 @@
 #include "pack-revindex.h"
 #include "object-store.h"
 #include "packfile.h"
+#include "config.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -159,27 +160,142 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
-int load_pack_revindex(struct packed_git *p)
+static char *pack_revindex_filename(struct packed_git *p)
 {
-	if (!p->revindex) {
-		if (open_pack_index(p))
-			return -1;
-		create_pack_revindex(p);
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+#define RIDX_HEADER_SIZE (12)
+#define RIDX_MIN_SIZE (RIDX_HEADER_SIZE + (2 * the_hash_algo->rawsz))
+
+struct revindex_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t hash_id;
+};
+
+/*
+ * Map the ".rev" file of 'p', if there is one. Returns -1 without
+ * complaining if the file does not exist, and with an error if it
+ * exists but cannot be used.
+ */
+static int load_pack_revindex_from_disk(struct packed_git *p)
+{
+	char *revindex_name = pack_revindex_filename(p);
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct revindex_header *hdr;
+	void *data = NULL;
+	size_t revindex_size = 0;
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = git_open(revindex_name);
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), revindex_name);
+		goto cleanup;
+	}
+
+	revindex_size = xsize_t(st.st_size);
+
+	if (revindex_size < RIDX_MIN_SIZE) {
+		ret = error(_("reverse-index file %s is too small"), revindex_name);
+		goto cleanup;
+	}
+
+	if (revindex_size - RIDX_MIN_SIZE != st_mult(sizeof(uint32_t), p->num_objects)) {
+		ret = error(_("reverse-index file %s is corrupt"), revindex_name);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, revindex_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	hdr = data;
+
+	if (ntohl(hdr->signature) != RIDX_SIGNATURE) {
+		ret = error(_("reverse-index file %s has unknown signature"), revindex_name);
+		goto cleanup;
+	}
+	if (ntohl(hdr->version) != RIDX_VERSION) {
+		ret = error(_("reverse-index file %s has unsupported version %"PRIu32),
+			    revindex_name, ntohl(hdr->version));
+		goto cleanup;
+	}
+	if (ntohl(hdr->hash_id) != hash_algo_by_ptr(the_hash_algo)) {
+		ret = error(_("reverse-index file %s has unsupported hash id %"PRIu32),
+			    revindex_name, ntohl(hdr->hash_id));
+		goto cleanup;
+	}
+
+	/*
+	 * The pack checksum follows the positions; it must match the
+	 * one recorded at the end of the .idx.
+	 */
+	if (!hasheq((const unsigned char *)data + revindex_size - 2 * hashsz,
+		    (const unsigned char *)p->index_data + p->index_size - 2 * hashsz)) {
+		ret = error(_("reverse-index file %s does not match its pack"),
+			    revindex_name);
+		goto cleanup;
+	}
+
+cleanup:
+	if (ret) {
+		if (data)
+			munmap(data, revindex_size);
+	} else {
+		p->revindex_map = data;
+		p->revindex_size = revindex_size;
+		p->revindex_data = (const uint32_t *)((const char *)data + RIDX_HEADER_SIZE);
 	}
+
+	if (fd >= 0)
+		close(fd);
+	free(revindex_name);
+	return ret;
+}
+
+int load_pack_revindex(struct packed_git *p)
+{
+	if (p->revindex || p->revindex_data)
+		return 0;
+
+	if (open_pack_index(p))
+		return -1;
+
+	if (!load_pack_revindex_from_disk(p))
+		return 0;
+
+	if (git_env_bool(GIT_TEST_REV_INDEX_DIE_IN_MEMORY, 0))
+		die("dying as requested by '%s'",
+		    GIT_TEST_REV_INDEX_DIE_IN_MEMORY);
+	create_pack_revindex(p);
 	return 0;
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	const struct revindex_entry *revindex = p->revindex;
+	unsigned lo, hi;
+
+	if (load_pack_revindex(p) < 0)
+		return -1;
+
+	lo = 0;
+	hi = p->num_objects + 1;
 
 	do {
 		const unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		off_t got = pack_pos_to_offset(p, mi);
+
+		if (got == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < got)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -189,17 +305,81 @@ int find_revindex_position(struct packed_git *p, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
+	if (!(p->revindex || p->revindex_data))
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects <= pos)
+		BUG("pack_pos_to_index: out-of-bounds object at %"PRIu32, pos);
 
-	if (load_pack_revindex(p))
-		return NULL;
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	return get_be32(p->revindex_data + pos);
+}
 
-	pos = find_revindex_position(p, ofs);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!(p->revindex || p->revindex_data))
+		BUG("pack_pos_to_offset: reverse index not yet loaded");
+	if (p->num_objects < pos)
+		BUG("pack_pos_to_offset: out-of-bounds object at %"PRIu32, pos);
 
-	if (pos < 0)
-		return NULL;
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	else if (pos == p->num_objects)
+		return p->pack_size - the_hash_algo->rawsz;
+	return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
+}
 
-	return p->revindex + pos;
+int verify_pack_revindex(struct packed_git *p)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	const unsigned char *base;
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	uint32_t i;
+	int res = 0;
+
+	if (load_pack_revindex(p) < 0)
+		return error(_("could not load reverse index for %s"), p->pack_name);
+
+	/* Nothing to check for a reverse index computed in memory. */
+	if (!p->revindex_map)
+		return 0;
+
+	base = p->revindex_map;
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, base, p->revindex_size - hashsz);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, base + p->revindex_size - hashsz))
+		res = error(_("invalid checksum in reverse index for %s"),
+			    p->pack_name);
+
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t nr = get_be32(p->revindex_data + i);
+
+		if (nr >= p->num_objects) {
+			res = error(_("invalid rev-index position at %"PRIu32": %"PRIu32),
+				    i, nr);
+			break;
+		}
+		if (pack_pos_to_offset(p, i) >= pack_pos_to_offset(p, i + 1)) {
+			res = error(_("reverse index for %s is not in pack order at position %"PRIu32),
+				    p->pack_name, i);
+			break;
+		}
+	}
+
+	return res;
+}
+
+void close_pack_revindex(struct packed_git *p)
+{
+	FREE_AND_NULL(p->revindex);
+	if (p->revindex_map) {
+		munmap((void *)p->revindex_map, p->revindex_size);
+		p->revindex_map = NULL;
+		p->revindex_data = NULL;
+		p->revindex_size = 0;
+	}
 }
@@ -328,6 +328,7 @@ void close_pack(struct packed_git *p)
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
+	close_pack_revindex(p);
 }
 
 void close_object_store(struct raw_object_store *o)
@@ -350,7 +351,7 @@ void close_object_store(struct raw_object_store *o)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
+	static const char *exts[] = {".pack", ".idx", ".rev", ".keep", ".bitmap", ".promisor"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -869,6 +870,7 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (ends_with(file_name, ".idx") ||
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
+	    ends_with(file_name, ".rev") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor"))
 		string_list_append(data->garbage, full_name);
@@ -1217,18 +1219,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1238,12 +1239,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_oid(&oid, p, revidx->nr);
+	nth_packed_object_oid(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1321,10 +1321,30 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * Delta bases we have recently unpacked, keyed by pack and offset.
+ *
+ * When several threads read objects (see enable_obj_read_lock()), the
+ * cache is split into shards, each with its own hashmap, LRU list,
+ * mutex and share of core.deltaBaseCacheLimit, so readers only contend
+ * when they want bases that hash to the same shard. A single reader
+ * uses the first shard alone, with the whole limit, as one LRU over
+ * all bases evicts fewer of them than several smaller ones. The cache
+ * is emptied when switching between the two. An entry is handed over
+ * whole: whoever detaches it from the cache owns its data, and a copy
+ * is made for everybody else.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static LIST_HEAD(delta_base_cache_lru);
+struct delta_base_cache_shard {
+	struct hashmap map;
+	struct list_head lru;
+	size_t cached;
+	pthread_mutex_t mutex;
+};
+
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_use_locks;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1349,22 +1369,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1388,71 +1392,206 @@ static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+/*
+ * Pick the shard from the top bits of a multiplicative hash, so that
+ * the entries of one shard still spread over all the buckets of its
+ * hashmap, which are picked by the low bits of pack_entry_hash().
+ */
+static struct delta_base_cache_shard *lock_delta_base_cache_shard(unsigned int hash)
+{
+	struct delta_base_cache_shard *shard;
+
+	if (!delta_base_cache_use_locks)
+		shard = &delta_base_cache[0];
+	else {
+		shard = &delta_base_cache[(hash * 2654435761u) >> 28];
+		pthread_mutex_lock(&shard->mutex);
+	}
+	if (!shard->map.cmpfn) {
+		hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+		INIT_LIST_HEAD(&shard->lru);
+	}
+	return shard;
+}
+
+static void unlock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_use_locks)
+		pthread_mutex_unlock(&shard->mutex);
+}
+
+void enable_delta_base_cache_locks(void)
+{
+	int i;
+
+	if (delta_base_cache_use_locks)
+		return;
+	clear_delta_base_cache();
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_init(&delta_base_cache[i].mutex, NULL);
+	delta_base_cache_use_locks = 1;
+}
+
+void disable_delta_base_cache_locks(void)
+{
+	int i;
+
+	if (!delta_base_cache_use_locks)
+		return;
+	delta_base_cache_use_locks = 0;
+	clear_delta_base_cache();
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++)
+		pthread_mutex_destroy(&delta_base_cache[i].mutex);
+}
+
+/* The caller must hold the lock of "shard". */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry, *e;
+	struct delta_base_cache_key key;
+
+	hashmap_entry_init(&entry, hash);
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, &entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = lock_delta_base_cache_shard(hash);
+	int ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+
+	unlock_delta_base_cache_shard(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * should copy out any fields it wants before detaching. The caller
+ * must hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	shard->cached -= ent->size;
 	free(ent);
 }
 
+/*
+ * Take the entry for "base_offset" out of the cache, if there is one,
+ * and return its data, which the caller now owns.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p, off_t base_offset,
+					 unsigned long *size,
+					 enum object_type *type)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = lock_delta_base_cache_shard(hash);
+	struct delta_base_cache_entry *ent;
+	void *data = NULL;
+
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		data = ent->data;
+		*size = ent->size;
+		*type = ent->type;
+		detach_delta_base_cache_entry(shard, ent);
+	}
+	unlock_delta_base_cache_shard(shard);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = lock_delta_base_cache_shard(hash);
 	struct delta_base_cache_entry *ent;
+	void *data;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (!ent) {
+		unlock_delta_base_cache_shard(shard);
 		return unpack_entry(r, p, base_offset, type, base_size);
+	}
 
 	if (type)
 		*type = ent->type;
 	if (base_size)
 		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	data = xmemdupz(ent->data, ent->size);
+	unlock_delta_base_cache_shard(shard);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+	int i;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		if (delta_base_cache_use_locks)
+			pthread_mutex_lock(&shard->mutex);
+		if (shard->map.cmpfn) {
+			list_for_each_safe(lru, tmp, &shard->lru) {
+				struct delta_base_cache_entry *entry =
+					list_entry(lru, struct delta_base_cache_entry, lru);
+				release_delta_base_cache(shard, entry);
+			}
+		}
+		if (delta_base_cache_use_locks)
+			pthread_mutex_unlock(&shard->mutex);
 	}
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = lock_delta_base_cache_shard(hash);
+	size_t limit = delta_base_cache_limit;
+	struct delta_base_cache_entry *ent;
 	struct list_head *lru, *tmp;
 
-	delta_base_cached += base_size;
+	/*
+	 * Another thread may have unpacked the same base in the
+	 * meantime; keep the copy that is already there.
+	 */
+	if (get_delta_base_cache_entry(shard, hash, p, base_offset)) {
+		unlock_delta_base_cache_shard(shard);
+		free(base);
+		return;
+	}
+
+	if (delta_base_cache_use_locks)
+		limit /= DELTA_BASE_CACHE_SHARDS;
+	ent = xmalloc(sizeof(*ent));
+	shard->cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+	list_for_each_safe(lru, tmp, &shard->lru) {
 		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
+		if (shard->cached <= limit)
 			break;
-		release_delta_base_cache(f);
+		release_delta_base_cache(shard, f);
 	}
 
 	ent->key.p = p;
@@ -1460,12 +1599,11 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	hashmap_entry_init(&ent->ent, hash);
+	hashmap_add(&shard->map, &ent->ent);
+	unlock_delta_base_cache_shard(shard);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1509,8 +1647,15 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			error("could not find object at offset %"PRIuMAX" "
+			      "in pack %s", (uintmax_t)obj_offset, p->pack_name);
+			type = OBJ_BAD;
+			goto out;
+		}
+
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1574,7 +1719,14 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The window stays mapped while we use it (see
+		 * use_pack()), and the stream is ours: let other
+		 * readers go on while we inflate.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1642,24 +1794,29 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &size, &type);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				error("could not find object at offset %"PRIuMAX" in pack %s",
+				      (uintmax_t)obj_offset, p->pack_name);
+				data = NULL;
+				goto out;
+			}
+
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_oid(&oid, p, revidx->nr);
+				nth_packed_object_oid(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1731,12 +1888,10 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
 		int i;
+		off_t base_obj_offset = obj_offset;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -1744,11 +1899,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_oid(&base_oid, p, revidx->nr);
+			if (!(offset_to_pack_pos(p, obj_offset, &pos))) {
+				nth_packed_object_oid(&base_oid, p,
+						      pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -1774,24 +1929,37 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			free(external_base);
-			continue;
-		}
+		} else {
+			/*
+			 * Both buffers are ours alone; let other readers
+			 * go on while we apply the delta.
+			 */
+			obj_read_unlock();
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+			obj_read_lock();
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going. Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
+		}
 
 		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
+		 * Only hand "base" over to the cache once we are done with
+		 * it: unpack_compressed_entry() lets other threads at the
+		 * cache, and they may evict and free what we put there.
 		 */
-		if (!data)
-			error("failed to apply delta");
+		if (!external_base)
+			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
 
 		free(delta_data);
 		free(external_base);
@@ -2039,7 +2207,7 @@ int for_each_object_in_pack(struct packed_git *p,
 		struct object_id oid;
 
 		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
-			pos = p->revindex[i].nr;
+			pos = pack_pos_to_index(p, i);
 		else
 			pos = i;
 
@@ -93,6 +93,14 @@ void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Guard the delta base cache with locks so that several threads can use
+ * it at once. These are called by enable_obj_read_lock() and
+ * disable_obj_read_lock().
+ */
+void enable_delta_base_cache_locks(void);
+void disable_delta_base_cache_locks(void);
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
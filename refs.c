@@ -1627,6 +1627,52 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
+int for_each_namespaced_ref_in_prefixes(const char **prefixes,
+					each_ref_fn fn, void *cb_data)
+{
+	struct string_list starts = STRING_LIST_INIT_DUP;
+	struct strbuf buf = STRBUF_INIT;
+	const char *last = NULL;
+	int i, ret = 0;
+
+	if (!prefixes || !*prefixes)
+		return for_each_namespaced_ref(fn, cb_data);
+
+	/*
+	 * Only refs under "refs/" are iterated; a prefix of "refs/" itself
+	 * asks for all of them, and any other one cannot match.
+	 */
+	for (; *prefixes; prefixes++) {
+		if (starts_with(*prefixes, "refs/"))
+			string_list_append(&starts, *prefixes);
+		else if (starts_with("refs/", *prefixes))
+			string_list_append(&starts, "refs/");
+	}
+	string_list_sort(&starts);
+
+	/*
+	 * Once sorted, a prefix covered by another one comes after it, with
+	 * only prefixes it covers too in between. The remaining prefixes
+	 * do not overlap, so iterating them in order yields sorted refs.
+	 */
+	for (i = 0; !ret && i < starts.nr; i++) {
+		const char *prefix = starts.items[i].string;
+
+		if (last && starts_with(prefix, last))
+			continue;
+		last = prefix;
+
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s%s", get_git_namespace(), prefix);
+		ret = do_for_each_ref(get_main_ref_store(the_repository),
+				      buf.buf, fn, 0, 0, cb_data);
+	}
+
+	strbuf_release(&buf);
+	string_list_clear(&starts, 0);
+	return ret;
+}
+
 int refs_for_each_rawref(struct ref_store *refs, each_ref_fn fn, void *cb_data)
 {
 	return do_for_each_ref(refs, "", fn, 0,
@@ -1837,14 +1883,17 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
  * gitdir.
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *be_name,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (!be_name)
+		be_name = "files";
+	be = find_ref_storage_backend(be_name);
 	if (!be)
-		BUG("reference backend %s is unknown", be_name);
+		die(_("unknown reference storage format '%s'"), be_name);
 
 	refs = be->init(gitdir, flags);
 	return refs;
@@ -1858,7 +1907,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs = ref_store_init(r->gitdir, r->ref_storage_format,
+				 REF_STORE_ALL_CAPS);
 	return r->refs;
 }
 
@@ -1884,6 +1934,8 @@ static void register_ref_store_map(struct hashmap *map,
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
+	struct strbuf config_path = STRBUF_INIT;
+	struct repository_format format = REPOSITORY_FORMAT_INIT;
 	struct ref_store *refs;
 	char *to_free = NULL;
 	size_t len;
@@ -1913,13 +1965,18 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 		goto done;
 
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	get_common_dir_noenv(&config_path, submodule_sb.buf);
+	strbuf_addstr(&config_path, "/config");
+	read_repository_format(&format, config_path.buf);
+	refs = ref_store_init(submodule_sb.buf, format.ref_storage,
 			      REF_STORE_READ | REF_STORE_ODB);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
 done:
 	strbuf_release(&submodule_sb);
+	strbuf_release(&config_path);
+	clear_repository_format(&format);
 	free(to_free);
 
 	return refs;
@@ -1940,9 +1997,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
@@ -345,6 +345,16 @@ int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 int head_ref_namespaced(each_ref_fn fn, void *cb_data);
 int for_each_namespaced_ref(each_ref_fn fn, void *cb_data);
 
+/*
+ * Like for_each_namespaced_ref(), but only for the refs whose name,
+ * without the namespace, starts with one of the NULL-terminated
+ * "prefixes" (all refs if there are none). Each prefix is looked up
+ * directly in the ref store, so the cost is that of the matching refs;
+ * the refs are visited once each, in order.
+ */
+int for_each_namespaced_ref_in_prefixes(const char **prefixes,
+					each_ref_fn fn, void *cb_data);
+
 /* can be used to learn about broken ref and symref */
 int refs_for_each_rawref(struct ref_store *refs, each_ref_fn fn, void *cb_data);
 int for_each_rawref(each_ref_fn fn, void *cb_data);
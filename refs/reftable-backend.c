@@ -0,0 +1,1746 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../object-store.h"
+#include "../worktree.h"
+
+/*
+ * This backend stores references and their reflogs in stacks of
+ * reftables (see reftable.h): the shared references in
+ * "$GIT_COMMON_DIR/reftable", and the per-worktree references of a
+ * linked worktree in "$GIT_DIR/reftable". Pseudorefs like ORIG_HEAD
+ * stay loose files in $GIT_DIR, as other parts of Git read and write
+ * them directly.
+ */
+
+/*
+ * Flags used in ref_update::flags, in addition to the public ones;
+ * they mean the same as in the files backend.
+ */
+
+/* The reference is to be deleted. */
+#define REF_DELETING (1 << 5)
+
+/* A new value has to be written for the reference. */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/* Only the reflog is to be updated. */
+#define REF_LOG_ONLY (1 << 7)
+
+/* The update was split off from an update of HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	/* the shared references, and those of the main worktree */
+	struct reftable_stack main_stack;
+	/* the per-worktree references of a linked worktree, or NULL */
+	struct reftable_stack *worktree_stack;
+	/* the stacks of other worktrees, by worktree id */
+	struct string_list other_stacks;
+};
+
+static struct ref_store *reftable_be_init(const char *gitdir,
+					  unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	/*
+	 * The stacks keep the paths of their tables, so we make sure
+	 * they stay valid if we chdir() later.
+	 */
+	refs->gitdir = absolute_pathdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = absolute_pathdup(sb.buf);
+	string_list_init(&refs->other_stacks, 1);
+
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	reftable_stack_init(&refs->main_stack, sb.buf);
+	if (strcmp(refs->gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+		refs->worktree_stack = xmalloc(sizeof(*refs->worktree_stack));
+		reftable_stack_init(refs->worktree_stack, sb.buf);
+	}
+	strbuf_release(&sb);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store or does not have the required capabilities.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static struct reftable_stack *other_worktree_stack(struct reftable_ref_store *refs,
+						   const char *id, int len)
+{
+	struct string_list_item *item;
+	char *key = xmemdupz(id, len);
+
+	item = string_list_insert(&refs->other_stacks, key);
+	if (!item->util) {
+		struct reftable_stack *st = xmalloc(sizeof(*st));
+		char *dir = xstrfmt("%s/worktrees/%s/reftable",
+				    refs->gitcommondir, key);
+
+		reftable_stack_init(st, dir);
+		item->util = st;
+		free(dir);
+	}
+	free(key);
+	return item->util;
+}
+
+/*
+ * Return the stack holding `refname`, and in `name` the name the
+ * reference has there. Return NULL for pseudorefs, which are files.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname, const char **name)
+{
+	const char *worktree, *real;
+	int len;
+
+	*name = refname;
+	switch (ref_type(refname)) {
+	case REF_TYPE_NORMAL:
+		return &refs->main_stack;
+	case REF_TYPE_PER_WORKTREE:
+		return refs->worktree_stack ? refs->worktree_stack :
+			&refs->main_stack;
+	case REF_TYPE_PSEUDOREF:
+		return NULL;
+	default:
+		if (parse_worktree_ref(refname, &worktree, &len, &real))
+			BUG("refname %s is not a other-worktree ref", refname);
+		if (ref_type(real) != REF_TYPE_PER_WORKTREE)
+			return NULL;
+		*name = real;
+		if (!worktree)
+			return &refs->main_stack;
+		return other_worktree_stack(refs, worktree, len);
+	}
+}
+
+static void pseudoref_path(struct reftable_ref_store *refs,
+			   struct strbuf *sb, const char *refname)
+{
+	const char *worktree, *real;
+	int len;
+
+	if (ref_type(refname) == REF_TYPE_PSEUDOREF)
+		strbuf_addf(sb, "%s/%s", refs->gitdir, refname);
+	else if (parse_worktree_ref(refname, &worktree, &len, &real))
+		BUG("refname %s is not a pseudoref", refname);
+	else if (!worktree)
+		strbuf_addf(sb, "%s/%s", refs->gitcommondir, real);
+	else
+		strbuf_addf(sb, "%s/worktrees/%.*s/%s", refs->gitcommondir,
+			    len, worktree, real);
+}
+
+static int reload_stack(struct reftable_stack *st)
+{
+	struct strbuf err = STRBUF_INIT;
+	int ret = reftable_stack_reload(st, &err);
+
+	if (ret < 0)
+		error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Read all the reflog entries of `name`, newest first. */
+static int read_logs(struct reftable_stack *st, const char *name,
+		     struct reftable_log_record **logs, size_t *nr)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	size_t alloc = 0;
+	int ret;
+
+	*logs = NULL;
+	*nr = 0;
+	if (reload_stack(st) < 0 || !(it = reftable_stack_logs(st, name)))
+		return -1;
+	while (!(ret = reftable_iterator_next_log(it, &rec))) {
+		struct reftable_log_record init = REFTABLE_LOG_RECORD_INIT;
+
+		if (strcmp(rec.refname.buf, name))
+			break;
+		ALLOC_GROW(*logs, *nr + 1, alloc);
+		(*logs)[*nr] = rec;
+		(*nr)++;
+		rec = init;
+	}
+	reftable_iterator_free(it);
+	reftable_log_record_release(&rec);
+	return ret < 0 ? -1 : 0;
+}
+
+static void free_logs(struct reftable_log_record *logs, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		reftable_log_record_release(&logs[i]);
+	free(logs);
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *name)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	int ret = 0;
+
+	if (reload_stack(st) < 0 || !(it = reftable_stack_logs(st, name)))
+		return 0;
+	if (!reftable_iterator_next_log(it, &rec))
+		ret = !strcmp(rec.refname.buf, name);
+	reftable_iterator_free(it);
+	reftable_log_record_release(&rec);
+	return ret;
+}
+
+/*
+ * Writing a table: the records to add to one stack, which is locked
+ * while they are collected.
+ */
+struct write_batch {
+	struct reftable_stack *st;
+	struct lock_file lock;
+	uint64_t update_index;
+
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+static int batch_lock(struct write_batch *b, struct reftable_stack *st,
+		      struct strbuf *err)
+{
+	struct lock_file lock = LOCK_INIT;
+
+	memset(b, 0, sizeof(*b));
+	b->st = st;
+	b->lock = lock;
+	if (reftable_stack_lock(st, &b->lock, err) < 0)
+		return -1;
+	b->update_index = reftable_stack_next_update_index(st);
+	return 0;
+}
+
+static struct reftable_ref_record *batch_add_ref(struct write_batch *b,
+						 const char *name,
+						 enum reftable_ref_type type)
+{
+	struct reftable_ref_record init = REFTABLE_REF_RECORD_INIT;
+	struct reftable_ref_record *rec;
+
+	ALLOC_GROW(b->refs, b->refs_nr + 1, b->refs_alloc);
+	rec = &b->refs[b->refs_nr++];
+	*rec = init;
+	strbuf_addstr(&rec->refname, name);
+	rec->update_index = b->update_index;
+	rec->type = type;
+	return rec;
+}
+
+static struct reftable_log_record *batch_add_log(struct write_batch *b,
+						 const char *name,
+						 uint64_t update_index)
+{
+	struct reftable_log_record init = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_log_record *rec;
+
+	ALLOC_GROW(b->logs, b->logs_nr + 1, b->logs_alloc);
+	rec = &b->logs[b->logs_nr++];
+	*rec = init;
+	strbuf_addstr(&rec->refname, name);
+	rec->update_index = update_index;
+	return rec;
+}
+
+/* Add a reflog entry for an update made by the current committer. */
+static void batch_add_reflog(struct write_batch *b, const char *name,
+			     const struct object_id *old_oid,
+			     const struct object_id *new_oid,
+			     const char *msg)
+{
+	struct reftable_log_record *log;
+	const char *info = git_committer_info(0);
+	struct ident_split ident;
+
+	log = batch_add_log(b, name, b->update_index);
+	oidcpy(&log->old_oid, old_oid);
+	oidcpy(&log->new_oid, new_oid);
+	if (!split_ident_line(&ident, info, strlen(info))) {
+		strbuf_add(&log->who, ident.name_begin,
+			   ident.mail_end + 1 - ident.name_begin);
+		if (ident.date_begin)
+			log->time = parse_timestamp(ident.date_begin, NULL, 10);
+		if (ident.tz_begin)
+			log->tz = strtol(ident.tz_begin, NULL, 10);
+	}
+	if (msg && *msg) {
+		/* like the files backend, but without the leading tab */
+		copy_reflog_msg(&log->message, msg);
+		strbuf_remove(&log->message, 0, 1);
+	}
+}
+
+/* Shadow all the existing reflog entries of `name`. */
+static int batch_delete_logs(struct write_batch *b, const char *name)
+{
+	struct reftable_log_record *logs;
+	size_t nr, i;
+
+	if (read_logs(b->st, name, &logs, &nr) < 0)
+		return -1;
+	for (i = 0; i < nr; i++)
+		batch_add_log(b, name, logs[i].update_index)->deleted = 1;
+	free_logs(logs, nr);
+	return 0;
+}
+
+static int should_write_log(struct write_batch *b, const char *name,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return should_autocreate_reflog(name) ||
+		(flags & REF_FORCE_CREATE_REFLOG) ||
+		stack_reflog_exists(b->st, name);
+}
+
+static int ref_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname.buf, b->refname.buf);
+}
+
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname.buf, b->refname.buf);
+
+	if (cmp)
+		return cmp;
+	/* newest first */
+	if (a->update_index != b->update_index)
+		return a->update_index < b->update_index ? 1 : -1;
+	return 0;
+}
+
+static int write_batch_table(struct reftable_writer *w, void *cb_data)
+{
+	struct write_batch *b = cb_data;
+	size_t i;
+
+	QSORT(b->refs, b->refs_nr, ref_record_cmp);
+	QSORT(b->logs, b->logs_nr, log_record_cmp);
+	for (i = 0; i < b->refs_nr; i++)
+		if (reftable_writer_add_ref(w, &b->refs[i]) < 0)
+			return -1;
+	for (i = 0; i < b->logs_nr; i++)
+		if (reftable_writer_add_log(w, &b->logs[i]) < 0)
+			return -1;
+	return 0;
+}
+
+static void batch_release(struct write_batch *b)
+{
+	size_t i;
+
+	rollback_lock_file(&b->lock);
+	for (i = 0; i < b->refs_nr; i++)
+		reftable_ref_record_release(&b->refs[i]);
+	FREE_AND_NULL(b->refs);
+	b->refs_nr = b->refs_alloc = 0;
+	free_logs(b->logs, b->logs_nr);
+	b->logs = NULL;
+	b->logs_nr = b->logs_alloc = 0;
+}
+
+/* Write the records of the batch (if any), and release it. */
+static int batch_commit(struct write_batch *b, struct strbuf *err)
+{
+	int ret = 0;
+
+	if (b->refs_nr || b->logs_nr)
+		ret = reftable_stack_add(b->st, &b->lock, write_batch_table,
+					 b, err);
+	batch_release(b);
+	return ret;
+}
+
+/*
+ * Fill `rec` with a new value for the reference `refname`, after
+ * checking that the object exists (and that branches point at commits).
+ * Tags are stored with their peeled value.
+ */
+static int set_ref_value(struct reftable_ref_record *rec, const char *refname,
+			 const struct object_id *oid, struct strbuf *err)
+{
+	struct object *o = parse_object(the_repository, oid);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    refname, oid_to_hex(oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    oid_to_hex(oid), refname);
+		return -1;
+	}
+	oidcpy(&rec->value, oid);
+	rec->type = REFTABLE_REF_VAL1;
+	if (o->type == OBJ_TAG && peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->type = REFTABLE_REF_VAL2;
+	return 0;
+}
+
+static int read_pseudoref(const char *path, struct object_id *oid,
+			  struct strbuf *referent, unsigned int *type)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *p;
+	int ret = 0;
+
+	if (strbuf_read_file(&sb, path, 256) < 0) {
+		int save_errno = errno;
+
+		strbuf_release(&sb);
+		errno = save_errno;
+		return -1;
+	}
+	strbuf_rtrim(&sb);
+	if (skip_prefix(sb.buf, "ref:", &p)) {
+		while (isspace(*p))
+			p++;
+		strbuf_reset(referent);
+		strbuf_addstr(referent, p);
+		*type |= REF_ISSYMREF;
+	} else if (parse_oid_hex(sb.buf, oid, &p) || (*p && !isspace(*p))) {
+		*type |= REF_ISBROKEN;
+		errno = EINVAL;
+		ret = -1;
+	}
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int reftable_be_read_raw_ref(struct ref_store *ref_store,
+				    const char *refname, struct object_id *oid,
+				    struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_stack *st;
+	const char *name;
+	int ret;
+
+	*type = 0;
+	st = stack_for(refs, refname, &name);
+	if (!st) {
+		struct strbuf path = STRBUF_INIT;
+
+		pseudoref_path(refs, &path, refname);
+		ret = read_pseudoref(path.buf, oid, referent, type);
+		strbuf_release(&path);
+		return ret;
+	}
+
+	if (reload_stack(st) < 0) {
+		errno = EIO;
+		return -1;
+	}
+	ret = reftable_stack_read_ref(st, name, &rec);
+	if (ret) {
+		errno = ret > 0 ? ENOENT : EIO;
+		ret = -1;
+	} else if (rec.type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addbuf(referent, &rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.value);
+	}
+	reftable_ref_record_release(&rec);
+	return ret;
+}
+
+static int reftable_be_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	safe_create_dir(refs->main_stack.dir, 1);
+
+	/*
+	 * Git recognizes a repository by its HEAD file, so leave one
+	 * that points nowhere; the real HEAD is in the reftable.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (access(sb.buf, F_OK)) {
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+		adjust_shared_perm(sb.buf);
+	}
+	strbuf_release(&sb);
+	return 0;
+}
+
+/*
+ * Iterating over references
+ */
+
+enum worktree_filter {
+	ALL_REFS,
+	SHARED_REFS,
+	PER_WORKTREE_REFS
+};
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_ref_record rec;
+	char *prefix;
+	enum worktree_filter filter;
+	unsigned int flags;
+	struct object_id oid;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ret;
+
+	while (!(ret = reftable_iterator_next_ref(iter->iter, &iter->rec))) {
+		const char *refname = iter->rec.refname.buf;
+		unsigned int flags = 0;
+		int per_worktree;
+
+		if (!starts_with(refname, iter->prefix)) {
+			ret = 1;
+			break;
+		}
+		/* HEAD is not a member of refs/ */
+		if (!starts_with(refname, "refs/"))
+			continue;
+
+		per_worktree = ref_type(refname) == REF_TYPE_PER_WORKTREE;
+		if ((iter->filter == SHARED_REFS && per_worktree) ||
+		    (iter->filter == PER_WORKTREE_REFS && !per_worktree))
+			continue;
+
+		if (iter->rec.type == REFTABLE_REF_SYMREF) {
+			flags |= REF_ISSYMREF;
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, NULL)) {
+				flags |= REF_ISBROKEN;
+				oidclr(&iter->oid);
+			}
+		} else {
+			oidcpy(&iter->oid, &iter->rec.value);
+		}
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+			oidclr(&iter->oid);
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid, flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE || ret < 0)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->rec.type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->rec.peeled);
+		return 0;
+	}
+	if (iter->rec.type == REFTABLE_REF_SYMREF)
+		return -1;
+	return peel_object(&iter->oid, peeled) == PEEL_PEELED ? 0 : -1;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	reftable_ref_record_release(&iter->rec);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(struct reftable_ref_store *refs,
+						     struct reftable_stack *st,
+						     const char *prefix,
+						     enum worktree_filter filter,
+						     unsigned int flags)
+{
+	struct reftable_ref_record init = REFTABLE_REF_RECORD_INIT;
+	struct reftable_ref_iterator *iter;
+	struct reftable_iterator *it;
+
+	if (reload_stack(st) < 0 || !(it = reftable_stack_refs(st, prefix))) {
+		error(_("unable to read references from '%s'"), st->dir);
+		return empty_ref_iterator_begin();
+	}
+
+	iter = xcalloc(1, sizeof(*iter));
+	base_ref_iterator_init(&iter->base, &reftable_ref_iterator_vtable, 1);
+	iter->refs = refs;
+	iter->iter = it;
+	iter->rec = init;
+	iter->prefix = xstrdup(prefix);
+	iter->filter = filter;
+	iter->flags = flags;
+	return &iter->base;
+}
+
+static struct ref_iterator *reftable_be_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "ref_iterator_begin");
+
+	if (!prefix)
+		prefix = "";
+
+	if (!refs->worktree_stack)
+		return stack_ref_iterator_begin(refs, &refs->main_stack, prefix,
+						flags & DO_FOR_EACH_PER_WORKTREE_ONLY ?
+						PER_WORKTREE_REFS : ALL_REFS,
+						flags);
+
+	if (flags & DO_FOR_EACH_PER_WORKTREE_ONLY)
+		return stack_ref_iterator_begin(refs, refs->worktree_stack,
+						prefix, PER_WORKTREE_REFS, flags);
+
+	return overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(refs, refs->worktree_stack,
+						 prefix, PER_WORKTREE_REFS, flags),
+			stack_ref_iterator_begin(refs, &refs->main_stack,
+						 prefix, SHARED_REFS, flags));
+}
+
+/*
+ * Transactions
+ */
+
+struct reftable_update_data {
+	/* the stack the reference lives in, and its name there */
+	struct write_batch *batch;
+	const char *name;
+	struct object_id old_oid;
+
+	/* for pseudorefs */
+	struct lock_file lock;
+	char *path;
+};
+
+struct reftable_transaction_data {
+	struct write_batch **batches;
+	size_t nr, alloc;
+};
+
+static struct write_batch *transaction_batch(struct reftable_transaction_data *data,
+					     struct reftable_stack *st,
+					     struct strbuf *err)
+{
+	struct write_batch *b;
+	size_t i;
+
+	for (i = 0; i < data->nr; i++)
+		if (data->batches[i]->st == st)
+			return data->batches[i];
+
+	b = xmalloc(sizeof(*b));
+	if (batch_lock(b, st, err) < 0) {
+		free(b);
+		return NULL;
+	}
+	ALLOC_GROW(data->batches, data->nr + 1, data->alloc);
+	data->batches[data->nr++] = b;
+	return b;
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *u = update->backend_data;
+
+		if (!u)
+			continue;
+		rollback_lock_file(&u->lock);
+		free(u->path);
+		free(u);
+		update->backend_data = NULL;
+	}
+
+	if (data) {
+		for (i = 0; i < data->nr; i++) {
+			batch_release(data->batches[i]);
+			free(data->batches[i]);
+		}
+		free(data->batches);
+		free(data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Turn it into a REF_LOG_ONLY update, and add a
+ * separate update for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+static int prepare_pseudoref_update(struct reftable_ref_store *refs,
+				    struct ref_update *update,
+				    struct reftable_update_data *u,
+				    struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT, referent = STRBUF_INIT;
+	unsigned int type = 0;
+
+	if (update->flags & REF_LOG_ONLY)
+		return 0;
+
+	pseudoref_path(refs, &path, update->refname);
+	u->path = strbuf_detach(&path, NULL);
+	if (hold_lock_file_for_update_timeout(&u->lock, u->path, 0,
+					      get_files_ref_lock_timeout_ms()) < 0) {
+		unable_to_lock_message(u->path, errno, err);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	if (read_pseudoref(u->path, &u->old_oid, &referent, &type) < 0 ||
+	    (type & REF_ISSYMREF))
+		oidclr(&u->old_oid);
+	strbuf_release(&referent);
+
+	if (check_old_oid(update, &u->old_oid, err))
+		return TRANSACTION_GENERIC_ERROR;
+	if ((update->flags & REF_HAVE_NEW) && !(update->flags & REF_DELETING))
+		update->flags |= REF_NEEDS_COMMIT;
+	return 0;
+}
+
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_ref_record rec = REFTABLE_REF_RECORD_INIT;
+	struct reftable_update_data *u;
+	struct reftable_stack *st;
+	struct ref_update *parent;
+	int ret;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			return ret;
+	}
+
+	u = xcalloc(1, sizeof(*u));
+	update->backend_data = u;
+	st = stack_for(refs, update->refname, &u->name);
+	if (!st)
+		return prepare_pseudoref_update(refs, update, u, err);
+
+	u->batch = transaction_batch(transaction->backend_data, st, err);
+	if (!u->batch)
+		return TRANSACTION_GENERIC_ERROR;
+
+	ret = reftable_stack_read_ref(st, u->name, &rec);
+	if (ret < 0) {
+		strbuf_addf(err, "cannot lock ref '%s': unable to read reftable",
+			    original_update_refname(update));
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto out;
+	}
+
+	if (!ret && rec.type == REFTABLE_REF_SYMREF) {
+		if (!(update->flags & REF_NO_DEREF)) {
+			ret = split_symref_update(update, rec.target.buf,
+						  transaction,
+						  affected_refnames, err);
+			goto out;
+		}
+		/*
+		 * We won't be reading the referent as part of the
+		 * transaction, so read it here to record and possibly
+		 * check old_oid.
+		 */
+		if (refs_read_ref_full(&refs->base, rec.target.buf, 0,
+				       &u->old_oid, NULL)) {
+			if (update->flags & REF_HAVE_OLD) {
+				strbuf_addf(err, "cannot lock ref '%s': "
+					    "error reading reference",
+					    original_update_refname(update));
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else if (check_old_oid(update, &u->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+	} else {
+		if (!ret)
+			oidcpy(&u->old_oid, &rec.value);
+		else if ((update->flags & REF_HAVE_NEW) &&
+			 !(update->flags & REF_DELETING) &&
+			 !(update->flags & REF_LOG_ONLY) &&
+			 refs_verify_refname_available(&refs->base,
+						       update->refname,
+						       affected_refnames,
+						       NULL, err)) {
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+		if (check_old_oid(update, &u->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent update.
+		 */
+		for (parent = update->parent_update; parent;
+		     parent = parent->parent_update) {
+			struct reftable_update_data *pu = parent->backend_data;
+			oidcpy(&pu->old_oid, &u->old_oid);
+		}
+	}
+	ret = 0;
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    !(update->flags & REF_LOG_ONLY) &&
+	    (rec.type == REFTABLE_REF_SYMREF ||
+	     !oideq(&u->old_oid, &update->new_oid))) {
+		struct reftable_ref_record *new_rec =
+			batch_add_ref(u->batch, u->name, REFTABLE_REF_VAL1);
+
+		if (set_ref_value(new_rec, update->refname,
+				  &update->new_oid, err)) {
+			char *write_err = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot update ref '%s': %s",
+				    update->refname, write_err);
+			free(write_err);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		update->flags |= REF_NEEDS_COMMIT;
+	}
+
+out:
+	reftable_ref_record_release(&rec);
+	return ret;
+}
+
+static int reftable_be_transaction_prepare(struct ref_store *ref_store,
+					   struct ref_transaction *transaction,
+					   struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	transaction->backend_data = xcalloc(1, sizeof(struct reftable_transaction_data));
+	if (!transaction->nr)
+		goto cleanup;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * As in the files backend, an update of the branch HEAD points
+	 * at is also logged in the reflog of HEAD.
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/* prepare_update() might append more updates to the transaction */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->updates[i], transaction,
+				     head_ref, &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+	return ret;
+}
+
+static int reftable_be_transaction_abort(struct ref_store *ref_store,
+					 struct ref_transaction *transaction,
+					 struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int finish_pseudoref_update(struct ref_update *update,
+				   struct reftable_update_data *u,
+				   struct strbuf *err)
+{
+	if (!u->path)
+		return 0;
+	if (update->flags & REF_NEEDS_COMMIT) {
+		int fd = get_lock_file_fd(&u->lock);
+
+		if (write_in_full(fd, oid_to_hex(&update->new_oid),
+				  the_hash_algo->hexsz) < 0 ||
+		    write_in_full(fd, "\n", 1) < 0 ||
+		    commit_lock_file(&u->lock) < 0) {
+			strbuf_addf(err, "couldn't write '%s'", u->path);
+			return TRANSACTION_GENERIC_ERROR;
+		}
+	} else if (update->flags & REF_DELETING) {
+		if (unlink(u->path) < 0 && errno != ENOENT) {
+			strbuf_addf(err, "couldn't delete '%s'", u->path);
+			return TRANSACTION_GENERIC_ERROR;
+		}
+		rollback_lock_file(&u->lock);
+	}
+	return 0;
+}
+
+static int reftable_be_transaction_finish(struct ref_store *ref_store,
+					  struct ref_transaction *transaction,
+					  struct strbuf *err)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	assert(err);
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *u = update->backend_data;
+
+		if (!u->batch) {
+			ret = finish_pseudoref_update(update, u, err);
+			if (ret)
+				goto cleanup;
+			continue;
+		}
+
+		if (((update->flags & REF_NEEDS_COMMIT) ||
+		     (update->flags & REF_LOG_ONLY)) &&
+		    should_write_log(u->batch, u->name, update->flags))
+			batch_add_reflog(u->batch, u->name, &u->old_oid,
+					 &update->new_oid, update->msg);
+
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY)) {
+			batch_add_ref(u->batch, u->name, REFTABLE_REF_DELETION);
+			if (batch_delete_logs(u->batch, u->name) < 0) {
+				strbuf_addf(err, "unable to read the reflog of '%s'",
+					    update->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto cleanup;
+			}
+		}
+	}
+
+	/*
+	 * Each stack is updated atomically, but an update that touches
+	 * both the shared and the per-worktree references is not.
+	 */
+	for (i = 0; i < data->nr; i++)
+		if (batch_commit(data->batches[i], err) < 0) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_be_initial_transaction_commit(struct ref_store *ref_store,
+						  struct ref_transaction *transaction,
+						  struct strbuf *err)
+{
+	int ret = reftable_be_transaction_prepare(ref_store, transaction, err);
+
+	if (ret)
+		return ret;
+	return reftable_be_transaction_finish(ref_store, transaction, err);
+}
+
+static int reftable_be_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_compact_all(&refs->main_stack, &err) < 0 ||
+	    (refs->worktree_stack &&
+	     reftable_stack_compact_all(refs->worktree_stack, &err) < 0))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_be_create_symref(struct ref_store *ref_store,
+				     const char *refname, const char *target,
+				     const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct strbuf err = STRBUF_INIT;
+	struct write_batch b;
+	struct reftable_ref_record *rec;
+	struct object_id old_oid, new_oid;
+	struct reftable_stack *st;
+	const char *name;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return error(_("unable to create symref %s: "
+			       "not supported for pseudorefs"), refname);
+	if (batch_lock(&b, st, &err) < 0) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	rec = batch_add_ref(&b, name, REFTABLE_REF_SYMREF);
+	strbuf_addstr(&rec->target, target);
+	if (logmsg &&
+	    !refs_read_ref_full(ref_store, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(&b, name, 0)) {
+		if (!refs_resolve_ref_unsafe(ref_store, refname,
+					     RESOLVE_REF_READING,
+					     &old_oid, NULL))
+			oidclr(&old_oid);
+		batch_add_reflog(&b, name, &old_oid, &new_oid, logmsg);
+	}
+
+	ret = batch_commit(&b, &err);
+	if (ret)
+		ret = error("%s", err.buf);
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_be_delete_refs(struct ref_store *ref_store, const char *msg,
+				   struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+	for (i = 0; i < refnames->nr; i++)
+		if (ref_transaction_delete(transaction, refnames->items[i].string,
+					   NULL, flags, msg, &err))
+			goto error;
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+	ret = -1;
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_be_copy_or_rename_ref(struct ref_store *ref_store,
+					  const char *oldrefname,
+					  const char *newrefname,
+					  const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_ref_record old = REFTABLE_REF_RECORD_INIT;
+	struct reftable_ref_record *rec;
+	struct reftable_log_record *logs = NULL;
+	struct string_list skip = STRING_LIST_INIT_NODUP;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st, *new_st;
+	const char *oldname, *newname;
+	struct write_batch b;
+	size_t logs_nr = 0, i;
+	int ret;
+
+	st = stack_for(refs, oldrefname, &oldname);
+	new_st = stack_for(refs, newrefname, &newname);
+	if (!st || st != new_st)
+		return error(_("cannot %s '%s' to '%s'"),
+			     copy ? "copy" : "rename", oldrefname, newrefname);
+	if (batch_lock(&b, st, &err) < 0) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	ret = reftable_stack_read_ref(st, oldname, &old);
+	if (ret) {
+		ret = error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (old.type == REFTABLE_REF_SYMREF) {
+		ret = error(copy ?
+			    "refname %s is a symbolic ref, copying it is not supported" :
+			    "refname %s is a symbolic ref, renaming it is not supported",
+			    oldrefname);
+		goto out;
+	}
+
+	if (!copy)
+		string_list_insert(&skip, oldrefname);
+	if (refs_verify_refname_available(ref_store, newrefname, NULL,
+					  &skip, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	rec = batch_add_ref(&b, newname, old.type);
+	oidcpy(&rec->value, &old.value);
+	oidcpy(&rec->peeled, &old.peeled);
+	if (!copy)
+		batch_add_ref(&b, oldname, REFTABLE_REF_DELETION);
+
+	if (read_logs(st, oldname, &logs, &logs_nr) < 0) {
+		ret = error(_("unable to read the reflog of '%s'"), oldrefname);
+		goto out;
+	}
+	for (i = 0; i < logs_nr; i++) {
+		struct reftable_log_record *log =
+			batch_add_log(&b, newname, logs[i].update_index);
+
+		oidcpy(&log->old_oid, &logs[i].old_oid);
+		oidcpy(&log->new_oid, &logs[i].new_oid);
+		strbuf_addbuf(&log->who, &logs[i].who);
+		log->time = logs[i].time;
+		log->tz = logs[i].tz;
+		strbuf_addbuf(&log->message, &logs[i].message);
+		if (!copy)
+			batch_add_log(&b, oldname, logs[i].update_index)->deleted = 1;
+	}
+	if (logs_nr || should_write_log(&b, newname, 0))
+		batch_add_reflog(&b, newname, &old.value, &old.value, logmsg);
+
+	ret = batch_commit(&b, &err);
+	if (ret)
+		ret = error("%s", err.buf);
+
+out:
+	batch_release(&b);
+	free_logs(logs, logs_nr);
+	reftable_ref_record_release(&old);
+	string_list_clear(&skip, 0);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_be_rename_ref(struct ref_store *ref_store,
+				  const char *oldrefname, const char *newrefname,
+				  const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname,
+					      newrefname, logmsg, 0);
+}
+
+static int reftable_be_copy_ref(struct ref_store *ref_store,
+				const char *oldrefname, const char *newrefname,
+				const char *logmsg)
+{
+	return reftable_be_copy_or_rename_ref(ref_store, oldrefname,
+					      newrefname, logmsg, 1);
+}
+
+/*
+ * Reflogs
+ */
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+	struct ref_store *ref_store;
+	struct string_list names;
+	size_t pos;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (iter->pos < iter->names.nr) {
+		const char *refname = iter->names.items[iter->pos++].string;
+		int flags;
+
+		if (refs_read_ref_full(iter->ref_store, refname, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for reflog of %s", refname);
+			continue;
+		}
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	string_list_clear(&iter->names, 0);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static void collect_log_names(struct reftable_stack *st,
+			      enum worktree_filter filter,
+			      struct string_list *names)
+{
+	struct reftable_log_record rec = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+
+	if (reload_stack(st) < 0 || !(it = reftable_stack_logs(st, "")))
+		return;
+	while (!reftable_iterator_next_log(it, &rec)) {
+		int per_worktree = ref_type(rec.refname.buf) == REF_TYPE_PER_WORKTREE;
+
+		if ((filter == SHARED_REFS && per_worktree) ||
+		    (filter == PER_WORKTREE_REFS && !per_worktree))
+			continue;
+		if (!names->nr ||
+		    strcmp(names->items[names->nr - 1].string, rec.refname.buf))
+			string_list_append(names, rec.refname.buf);
+	}
+	reftable_iterator_free(it);
+	reftable_log_record_release(&rec);
+}
+
+static struct ref_iterator *reftable_be_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+
+	base_ref_iterator_init(&iter->base, &reftable_reflog_iterator_vtable, 0);
+	iter->ref_store = ref_store;
+	string_list_init(&iter->names, 1);
+	if (refs->worktree_stack) {
+		collect_log_names(refs->worktree_stack, PER_WORKTREE_REFS,
+				  &iter->names);
+		collect_log_names(&refs->main_stack, SHARED_REFS, &iter->names);
+		string_list_sort(&iter->names);
+	} else {
+		collect_log_names(&refs->main_stack, ALL_REFS, &iter->names);
+	}
+	return &iter->base;
+}
+
+static int show_reflog_ent(struct reftable_log_record *log,
+			   each_reflog_ent_fn fn, void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+	struct strbuf msg = STRBUF_INIT;
+	int ret;
+
+	/* callers expect the message as it would be in a reflog file */
+	oidcpy(&old_oid, &log->old_oid);
+	oidcpy(&new_oid, &log->new_oid);
+	strbuf_addbuf(&msg, &log->message);
+	strbuf_addch(&msg, '\n');
+	ret = fn(&old_oid, &new_oid, log->who.buf, log->time, log->tz,
+		 msg.buf, cb_data);
+	strbuf_release(&msg);
+	return ret;
+}
+
+static int reflog_ent_walk(struct ref_store *ref_store, const char *refname,
+			   each_reflog_ent_fn fn, void *cb_data, int reverse)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reftable_log_record *logs;
+	struct reftable_stack *st;
+	const char *name;
+	size_t nr, i;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st || read_logs(st, name, &logs, &nr) < 0)
+		return -1;
+	for (i = 0; !ret && i < nr; i++)
+		ret = show_reflog_ent(&logs[reverse ? i : nr - 1 - i],
+				      fn, cb_data);
+	free_logs(logs, nr);
+	return ret;
+}
+
+static int reftable_be_for_each_reflog_ent(struct ref_store *ref_store,
+					   const char *refname,
+					   each_reflog_ent_fn fn, void *cb_data)
+{
+	return reflog_ent_walk(ref_store, refname, fn, cb_data, 0);
+}
+
+static int reftable_be_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						   const char *refname,
+						   each_reflog_ent_fn fn,
+						   void *cb_data)
+{
+	return reflog_ent_walk(ref_store, refname, fn, cb_data, 1);
+}
+
+static int reftable_be_reflog_exists(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *st;
+	const char *name;
+
+	st = stack_for(refs, refname, &name);
+	return st && stack_reflog_exists(st, name);
+}
+
+static int reftable_be_create_reflog(struct ref_store *ref_store,
+				     const char *refname, int force_create,
+				     struct strbuf *err)
+{
+	/*
+	 * A reflog has no existence apart from its entries; the next
+	 * update of the reference writes the first one.
+	 */
+	reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	return 0;
+}
+
+static int reftable_be_delete_reflog(struct ref_store *ref_store,
+				     const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st;
+	struct write_batch b;
+	const char *name;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return 0;
+	if (batch_lock(&b, st, &err) < 0 ||
+	    batch_delete_logs(&b, name) < 0 ||
+	    batch_commit(&b, &err) < 0)
+		ret = error(_("unable to delete the reflog of '%s': %s"),
+			    refname, err.buf);
+	batch_release(&b);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_be_reflog_expire(struct ref_store *ref_store,
+				     const char *refname, const struct object_id *oid,
+				     unsigned int flags,
+				     reflog_expiry_prepare_fn prepare_fn,
+				     reflog_expiry_should_prune_fn should_prune_fn,
+				     reflog_expiry_cleanup_fn cleanup_fn,
+				     void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record *logs = NULL;
+	struct object_id last_kept_oid;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st;
+	struct write_batch b;
+	const char *name;
+	size_t nr = 0, i;
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return 0;
+
+	/* The lock keeps the reference and its reflog stable. */
+	if (batch_lock(&b, st, &err) < 0) {
+		error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (read_logs(st, name, &logs, &nr) < 0) {
+		ret = -1;
+		goto out;
+	}
+	if (!nr)
+		goto out;
+
+	oidclr(&last_kept_oid);
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	/* the oldest entry first, as in a reflog file */
+	for (i = nr; i--; ) {
+		struct reftable_log_record *log = &logs[i];
+		struct object_id old_oid, new_oid;
+		struct strbuf msg = STRBUF_INIT;
+
+		oidcpy(&old_oid, (flags & EXPIRE_REFLOGS_REWRITE) ?
+		       &last_kept_oid : &log->old_oid);
+		oidcpy(&new_oid, &log->new_oid);
+		strbuf_addbuf(&msg, &log->message);
+		strbuf_addch(&msg, '\n');
+
+		if ((*should_prune_fn)(&old_oid, &new_oid, log->who.buf,
+				       log->time, log->tz, msg.buf,
+				       policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", msg.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", msg.buf);
+			batch_add_log(&b, name, log->update_index)->deleted = 1;
+		} else {
+			if (!dry_run) {
+				if (!oideq(&old_oid, &log->old_oid)) {
+					struct reftable_log_record *rewritten =
+						batch_add_log(&b, name,
+							      log->update_index);
+
+					oidcpy(&rewritten->old_oid, &old_oid);
+					oidcpy(&rewritten->new_oid, &log->new_oid);
+					strbuf_addbuf(&rewritten->who, &log->who);
+					rewritten->time = log->time;
+					rewritten->tz = log->tz;
+					strbuf_addbuf(&rewritten->message,
+						      &log->message);
+				}
+				oidcpy(&last_kept_oid, &log->new_oid);
+			}
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", msg.buf);
+		}
+		strbuf_release(&msg);
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (dry_run)
+		goto out;
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    !reftable_stack_read_ref(st, name, &ref) &&
+	    ref.type != REFTABLE_REF_SYMREF &&
+	    !oideq(&ref.value, &last_kept_oid)) {
+		struct reftable_ref_record *rec =
+			batch_add_ref(&b, name, REFTABLE_REF_VAL1);
+
+		if (set_ref_value(rec, refname, &last_kept_oid, &err) < 0) {
+			ret = error("%s", err.buf);
+			goto out;
+		}
+	}
+	if (batch_commit(&b, &err) < 0)
+		ret = error("unable to write reflog '%s': %s", refname, err.buf);
+
+out:
+	batch_release(&b);
+	free_logs(logs, nr);
+	reftable_ref_record_release(&ref);
+	strbuf_release(&err);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_be_init,
+	reftable_be_init_db,
+	reftable_be_transaction_prepare,
+	reftable_be_transaction_finish,
+	reftable_be_transaction_abort,
+	reftable_be_initial_transaction_commit,
+
+	reftable_be_pack_refs,
+	reftable_be_create_symref,
+	reftable_be_delete_refs,
+	reftable_be_rename_ref,
+	reftable_be_copy_ref,
+
+	reftable_be_ref_iterator_begin,
+	reftable_be_read_raw_ref,
+
+	reftable_be_reflog_iterator_begin,
+	reftable_be_for_each_reflog_ent,
+	reftable_be_for_each_reflog_ent_reverse,
+	reftable_be_reflog_exists,
+	reftable_be_create_reflog,
+	reftable_be_delete_reflog,
+	reftable_be_reflog_expire
+};
@@ -0,0 +1,1515 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../lockfile.h"
+#include "../string-list.h"
+#include "../tempfile.h"
+#include "../varint.h"
+#include "reftable.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_VERSION 1
+
+/* magic, version, block size, hash id, min and max update index */
+#define REFTABLE_HEADER_SIZE (4 + 1 + 3 + 4 + 8 + 8)
+/* a copy of the header, three section offsets and a CRC-32 */
+#define REFTABLE_FOOTER_SIZE (REFTABLE_HEADER_SIZE + 3 * 8 + 4)
+
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+/* type byte and 24-bit length */
+#define BLOCK_HEADER_SIZE 4
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+/* value types of log records */
+#define LOG_DELETION 0
+#define LOG_UPDATE 1
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static int key_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp = memcmp(a, b, alen < blen ? alen : blen);
+
+	if (cmp)
+		return cmp;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+/* Log records sort by name, then from the newest update to the oldest. */
+static void log_record_key(struct strbuf *key, const char *refname,
+			   uint64_t update_index)
+{
+	unsigned char be[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(be, ~update_index);
+	strbuf_add(key, be, sizeof(be));
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->target);
+}
+
+void reftable_log_record_release(struct reftable_log_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->who);
+	strbuf_release(&rec->message);
+}
+
+static void copy_ref_record(struct reftable_ref_record *dst,
+			    const struct reftable_ref_record *src)
+{
+	strbuf_reset(&dst->refname);
+	strbuf_addbuf(&dst->refname, &src->refname);
+	dst->update_index = src->update_index;
+	dst->type = src->type;
+	oidcpy(&dst->value, &src->value);
+	oidcpy(&dst->peeled, &src->peeled);
+	strbuf_reset(&dst->target);
+	strbuf_addbuf(&dst->target, &src->target);
+}
+
+static void copy_log_record(struct reftable_log_record *dst,
+			    const struct reftable_log_record *src)
+{
+	strbuf_reset(&dst->refname);
+	strbuf_addbuf(&dst->refname, &src->refname);
+	dst->update_index = src->update_index;
+	dst->deleted = src->deleted;
+	oidcpy(&dst->old_oid, &src->old_oid);
+	oidcpy(&dst->new_oid, &src->new_oid);
+	strbuf_reset(&dst->who);
+	strbuf_addbuf(&dst->who, &src->who);
+	dst->time = src->time;
+	dst->tz = src->tz;
+	strbuf_reset(&dst->message);
+	strbuf_addbuf(&dst->message, &src->message);
+}
+
+static void write_header(unsigned char *p, uint64_t min_update_index,
+			 uint64_t max_update_index)
+{
+	memcpy(p, REFTABLE_MAGIC, 4);
+	p[4] = REFTABLE_VERSION;
+	put_be24(p + 5, REFTABLE_BLOCK_SIZE);
+	put_be32(p + 8, the_hash_algo->format_id);
+	put_be64(p + 12, min_update_index);
+	put_be64(p + 20, max_update_index);
+}
+
+/*
+ * Writer
+ */
+
+struct index_entry {
+	char *key;
+	size_t len;
+	uint64_t offset;
+};
+
+struct reftable_writer {
+	int fd;
+	uint64_t offset;
+	uint64_t min_update_index, max_update_index;
+	int failed;
+
+	/* the block being filled, and the key of its last record */
+	char block_type;
+	struct strbuf block;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	size_t entries;
+	struct strbuf last_key;
+
+	/* the blocks of the current section, for its index */
+	struct index_entry *index;
+	size_t index_nr, index_alloc;
+
+	uint64_t ref_index_offset, log_offset, log_index_offset;
+	struct strbuf scratch;
+};
+
+struct reftable_writer *reftable_writer_new(int fd, uint64_t min_update_index,
+					    uint64_t max_update_index)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	w->fd = fd;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	strbuf_init(&w->block, REFTABLE_BLOCK_SIZE);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->scratch, 0);
+
+	write_header(header, min_update_index, max_update_index);
+	if (write_in_full(fd, header, sizeof(header)) < 0)
+		w->failed = 1;
+	w->offset = sizeof(header);
+	return w;
+}
+
+static void writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (!w->failed && write_in_full(w->fd, buf, len) < 0)
+		w->failed = 1;
+	w->offset += len;
+}
+
+/* Append the restart table, fill in the block header and write it out. */
+static void write_block(struct reftable_writer *w, struct strbuf *block,
+			uint32_t *restarts, size_t restarts_nr)
+{
+	unsigned char buf[3];
+	size_t i;
+
+	for (i = 0; i < restarts_nr; i++) {
+		put_be24(buf, restarts[i]);
+		strbuf_add(block, buf, 3);
+	}
+	buf[0] = (restarts_nr >> 8) & 0xff;
+	buf[1] = restarts_nr & 0xff;
+	strbuf_add(block, buf, 2);
+	if (block->len >= (1 << 24) || restarts_nr > 0xffff) {
+		/* only an index of a gigantic table can get here */
+		w->failed = 1;
+		return;
+	}
+	put_be24((unsigned char *)block->buf + 1, block->len);
+	writer_write(w, block->buf, block->len);
+}
+
+static void flush_block(struct reftable_writer *w)
+{
+	struct index_entry *e;
+
+	if (!w->block_type || !w->restarts_nr)
+		return;
+
+	ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+	e = &w->index[w->index_nr++];
+	e->key = xmemdupz(w->last_key.buf, w->last_key.len);
+	e->len = w->last_key.len;
+	e->offset = w->offset;
+
+	write_block(w, &w->block, w->restarts, w->restarts_nr);
+	strbuf_reset(&w->block);
+	w->restarts_nr = 0;
+}
+
+static void start_block(struct reftable_writer *w, char type)
+{
+	strbuf_reset(&w->block);
+	strbuf_addch(&w->block, type);
+	strbuf_addchars(&w->block, 0, 3);
+	w->block_type = type;
+	w->restarts_nr = 0;
+	w->entries = 0;
+	strbuf_reset(&w->last_key);
+}
+
+/*
+ * Encode a record for "key" after "last_key": the length of their
+ * common prefix (zero at restart points), the length of the rest of
+ * the key together with the value type, the rest of the key, and the
+ * value.
+ */
+static void encode_record(struct strbuf *out, const struct strbuf *last_key,
+			  const char *key, size_t len, int restart,
+			  int value_type, const struct strbuf *value)
+{
+	size_t prefix = 0;
+
+	if (!restart)
+		while (prefix < len && prefix < last_key->len &&
+		       key[prefix] == last_key->buf[prefix])
+			prefix++;
+	strbuf_add_varint(out, prefix);
+	strbuf_add_varint(out, ((uintmax_t)(len - prefix) << 3) | value_type);
+	strbuf_add(out, key + prefix, len - prefix);
+	strbuf_addbuf(out, value);
+}
+
+/* Write the index of the section that was just finished, if it needs one. */
+static uint64_t write_index(struct reftable_writer *w)
+{
+	struct strbuf block = STRBUF_INIT, last = STRBUF_INIT;
+	struct strbuf value = STRBUF_INIT;
+	uint32_t *restarts = NULL;
+	size_t restarts_nr = 0, restarts_alloc = 0, i;
+	uint64_t offset = 0;
+
+	if (w->index_nr > 1) {
+		offset = w->offset;
+		strbuf_addch(&block, BLOCK_TYPE_INDEX);
+		strbuf_addchars(&block, 0, 3);
+		for (i = 0; i < w->index_nr; i++) {
+			int restart = !(i % REFTABLE_RESTART_INTERVAL);
+
+			if (restart) {
+				ALLOC_GROW(restarts, restarts_nr + 1, restarts_alloc);
+				restarts[restarts_nr++] = block.len;
+			}
+			strbuf_reset(&value);
+			strbuf_add_varint(&value, w->index[i].offset);
+			encode_record(&block, &last, w->index[i].key,
+				      w->index[i].len, restart, 0, &value);
+			strbuf_reset(&last);
+			strbuf_add(&last, w->index[i].key, w->index[i].len);
+		}
+		write_block(w, &block, restarts, restarts_nr);
+	}
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	w->index_nr = 0;
+	free(restarts);
+	strbuf_release(&block);
+	strbuf_release(&last);
+	strbuf_release(&value);
+	return offset;
+}
+
+static void writer_add(struct reftable_writer *w, char type,
+		       const char *key, size_t len,
+		       int value_type, const struct strbuf *value)
+{
+	int restart;
+
+	if (w->block_type != type) {
+		if (type == BLOCK_TYPE_REF && w->block_type)
+			BUG("reftable: references added after reflog entries");
+		flush_block(w);
+		if (w->block_type == BLOCK_TYPE_REF)
+			w->ref_index_offset = write_index(w);
+		if (type == BLOCK_TYPE_LOG)
+			w->log_offset = w->offset;
+		start_block(w, type);
+	} else if (key_cmp(key, len, w->last_key.buf, w->last_key.len) <= 0) {
+		BUG("reftable: records added out of order");
+	}
+
+	restart = !(w->entries % REFTABLE_RESTART_INTERVAL);
+	strbuf_reset(&w->scratch);
+	encode_record(&w->scratch, &w->last_key, key, len, restart,
+		      value_type, value);
+
+	/* Start a new block if this record would not fit (with its restart). */
+	if (w->entries &&
+	    w->block.len + w->scratch.len + 3 * (w->restarts_nr + 1) + 2 >
+	    REFTABLE_BLOCK_SIZE) {
+		flush_block(w);
+		start_block(w, type);
+		restart = 1;
+		strbuf_reset(&w->scratch);
+		encode_record(&w->scratch, &w->last_key, key, len, restart,
+			      value_type, value);
+	}
+
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &w->scratch);
+	strbuf_reset(&w->last_key);
+	strbuf_add(&w->last_key, key, len);
+	w->entries++;
+}
+
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *rec)
+{
+	struct strbuf value = STRBUF_INIT;
+
+	if (rec->update_index < w->min_update_index ||
+	    rec->update_index > w->max_update_index)
+		BUG("reftable: update index %"PRIu64" out of range",
+		    rec->update_index);
+
+	strbuf_add_varint(&value, rec->update_index - w->min_update_index);
+	switch (rec->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&value, rec->value.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&value, rec->value.hash, the_hash_algo->rawsz);
+		strbuf_add(&value, rec->peeled.hash, the_hash_algo->rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_add_varint(&value, rec->target.len);
+		strbuf_addbuf(&value, &rec->target);
+		break;
+	default:
+		BUG("reftable: unknown reference type %d", rec->type);
+	}
+	writer_add(w, BLOCK_TYPE_REF, rec->refname.buf, rec->refname.len,
+		   rec->type, &value);
+	strbuf_release(&value);
+	return w->failed ? -1 : 0;
+}
+
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *rec)
+{
+	struct strbuf key = STRBUF_INIT, value = STRBUF_INIT;
+	unsigned char tz[2];
+
+	log_record_key(&key, rec->refname.buf, rec->update_index);
+	if (!rec->deleted) {
+		strbuf_add(&value, rec->old_oid.hash, the_hash_algo->rawsz);
+		strbuf_add(&value, rec->new_oid.hash, the_hash_algo->rawsz);
+		strbuf_add_varint(&value, rec->who.len);
+		strbuf_addbuf(&value, &rec->who);
+		strbuf_add_varint(&value, rec->time);
+		tz[0] = ((uint16_t)rec->tz >> 8) & 0xff;
+		tz[1] = (uint16_t)rec->tz & 0xff;
+		strbuf_add(&value, tz, 2);
+		strbuf_add_varint(&value, rec->message.len);
+		strbuf_addbuf(&value, &rec->message);
+	}
+	writer_add(w, BLOCK_TYPE_LOG, key.buf, key.len,
+		   rec->deleted ? LOG_DELETION : LOG_UPDATE, &value);
+	strbuf_release(&key);
+	strbuf_release(&value);
+	return w->failed ? -1 : 0;
+}
+
+void reftable_writer_free(struct reftable_writer *w)
+{
+	size_t i;
+
+	if (!w)
+		return;
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	free(w->index);
+	free(w->restarts);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->scratch);
+	free(w);
+}
+
+int reftable_writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	unsigned char *p = footer;
+	int ret;
+
+	flush_block(w);
+	if (w->block_type == BLOCK_TYPE_REF)
+		w->ref_index_offset = write_index(w);
+	if (w->block_type != BLOCK_TYPE_LOG)
+		w->log_offset = w->offset;
+	else
+		w->log_index_offset = write_index(w);
+
+	write_header(p, w->min_update_index, w->max_update_index);
+	p += REFTABLE_HEADER_SIZE;
+	put_be64(p, w->ref_index_offset);
+	put_be64(p + 8, w->log_offset);
+	put_be64(p + 16, w->log_index_offset);
+	p += 24;
+	put_be32(p, crc32(0, footer, p - footer));
+	writer_write(w, footer, sizeof(footer));
+
+	ret = w->failed ? -1 : 0;
+	reftable_writer_free(w);
+	return ret;
+}
+
+/*
+ * Reader
+ */
+
+struct reftable_table {
+	char *name;
+	const unsigned char *data;
+	size_t size;
+	int refcount;
+	uint64_t min_update_index, max_update_index;
+
+	/* the sections; an index offset of zero means there is no index */
+	uint64_t ref_end, ref_index_offset;
+	uint64_t log_offset, log_end, log_index_offset;
+};
+
+static struct reftable_table *open_table(const char *dir, const char *name,
+					 struct strbuf *err)
+{
+	struct reftable_table *t;
+	struct strbuf path = STRBUF_INIT;
+	const unsigned char *header, *footer;
+	struct stat st;
+	int fd;
+
+	strbuf_addf(&path, "%s/%s", dir, name);
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			strbuf_addf(err, _("unable to open '%s': %s"),
+				    path.buf, strerror(errno));
+		strbuf_release(&path);
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		strbuf_addf(err, _("unable to stat '%s': %s"),
+			    path.buf, strerror(errno));
+		close(fd);
+		strbuf_release(&path);
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->refcount = 1;
+	t->size = xsize_t(st.st_size);
+	if (t->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE)
+		goto corrupt;
+	t->data = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	fd = -1;
+
+	header = t->data;
+	footer = t->data + t->size - REFTABLE_FOOTER_SIZE;
+	if (memcmp(header, REFTABLE_MAGIC, 4) ||
+	    header[4] != REFTABLE_VERSION ||
+	    get_be32(header + 8) != the_hash_algo->format_id ||
+	    memcmp(header, footer, REFTABLE_HEADER_SIZE) ||
+	    get_be32(footer + REFTABLE_FOOTER_SIZE - 4) !=
+	    crc32(0, footer, REFTABLE_FOOTER_SIZE - 4))
+		goto corrupt;
+
+	t->min_update_index = get_be64(header + 12);
+	t->max_update_index = get_be64(header + 20);
+	footer += REFTABLE_HEADER_SIZE;
+	t->ref_index_offset = get_be64(footer);
+	t->log_offset = get_be64(footer + 8);
+	t->log_index_offset = get_be64(footer + 16);
+	t->ref_end = t->ref_index_offset ? t->ref_index_offset : t->log_offset;
+	t->log_end = t->log_index_offset ? t->log_index_offset :
+		t->size - REFTABLE_FOOTER_SIZE;
+	if (t->ref_end < REFTABLE_HEADER_SIZE || t->ref_end > t->log_offset ||
+	    t->log_offset > t->log_end ||
+	    t->log_end > t->size - REFTABLE_FOOTER_SIZE)
+		goto corrupt;
+
+	strbuf_release(&path);
+	return t;
+
+corrupt:
+	strbuf_addf(err, _("reftable '%s' is corrupt"), path.buf);
+	if (fd >= 0)
+		close(fd);
+	if (t->data)
+		munmap((void *)t->data, t->size);
+	free(t->name);
+	free(t);
+	strbuf_release(&path);
+	return NULL;
+}
+
+static void unref_table(struct reftable_table *t)
+{
+	if (--t->refcount)
+		return;
+	munmap((void *)t->data, t->size);
+	free(t->name);
+	free(t);
+}
+
+/*
+ * Iterating over the records of one block. "pos" is the offset of the
+ * next record, and "key" holds the key of the record before it, which
+ * the next one is encoded against.
+ */
+struct block_iter {
+	const unsigned char *block;
+	uint32_t len;
+	uint32_t restarts;	/* offset of the restart table */
+	uint32_t restart_nr;
+	uint32_t pos;
+	struct strbuf key;
+};
+
+static int block_iter_init(struct block_iter *bi, struct reftable_table *t,
+			   uint64_t offset, uint64_t end, char type)
+{
+	const unsigned char *p = t->data + offset;
+
+	if (offset + BLOCK_HEADER_SIZE + 2 > end || p[0] != type)
+		return -1;
+	bi->block = p;
+	bi->len = get_be24(p + 1);
+	if (bi->len < BLOCK_HEADER_SIZE + 2 || offset + bi->len > end)
+		return -1;
+	bi->restart_nr = get_be16(p + bi->len - 2);
+	if (bi->len < BLOCK_HEADER_SIZE + 2 + 3 * bi->restart_nr)
+		return -1;
+	bi->restarts = bi->len - 2 - 3 * bi->restart_nr;
+	bi->pos = BLOCK_HEADER_SIZE;
+	strbuf_reset(&bi->key);
+	return 0;
+}
+
+static int block_iter_done(const struct block_iter *bi)
+{
+	return bi->pos >= bi->restarts;
+}
+
+/*
+ * Decode the key of the next record into bi->key, and return a pointer
+ * to its value (or NULL if the record is corrupt). The caller decodes
+ * the value and stores the offset of the following record in bi->pos.
+ */
+static const unsigned char *block_iter_key(struct block_iter *bi, int *value_type)
+{
+	const unsigned char *p = bi->block + bi->pos;
+	const unsigned char *end = bi->block + bi->restarts;
+	uintmax_t prefix, suffix;
+
+	prefix = decode_varint(&p);
+	suffix = decode_varint(&p);
+	*value_type = suffix & 7;
+	suffix >>= 3;
+	if (p > end || prefix > bi->key.len || suffix > end - p)
+		return NULL;
+	strbuf_setlen(&bi->key, prefix);
+	strbuf_add(&bi->key, p, suffix);
+	return p + suffix;
+}
+
+static int check_value(struct block_iter *bi, const unsigned char *p)
+{
+	if (p > bi->block + bi->restarts)
+		return -1;
+	bi->pos = p - bi->block;
+	return 0;
+}
+
+static int decode_ref(struct block_iter *bi, struct reftable_table *t,
+		      struct reftable_ref_record *rec)
+{
+	const unsigned char *p;
+	int type;
+	uintmax_t len;
+
+	p = block_iter_key(bi, &type);
+	if (!p)
+		return -1;
+	strbuf_reset(&rec->refname);
+	strbuf_addbuf(&rec->refname, &bi->key);
+	rec->update_index = t->min_update_index + decode_varint(&p);
+	rec->type = type;
+	strbuf_reset(&rec->target);
+	switch (type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		oidread(&rec->value, p);
+		p += the_hash_algo->rawsz;
+		break;
+	case REFTABLE_REF_VAL2:
+		oidread(&rec->value, p);
+		p += the_hash_algo->rawsz;
+		oidread(&rec->peeled, p);
+		p += the_hash_algo->rawsz;
+		break;
+	case REFTABLE_REF_SYMREF:
+		len = decode_varint(&p);
+		if (p > bi->block + bi->restarts ||
+		    len > bi->block + bi->restarts - p)
+			return -1;
+		strbuf_add(&rec->target, p, len);
+		p += len;
+		break;
+	default:
+		return -1;
+	}
+	return check_value(bi, p);
+}
+
+static int decode_log(struct block_iter *bi, struct reftable_log_record *rec)
+{
+	const unsigned char *p, *end = bi->block + bi->restarts;
+	size_t namelen;
+	uintmax_t len;
+	int type;
+
+	p = block_iter_key(bi, &type);
+	if (!p)
+		return -1;
+	namelen = strnlen(bi->key.buf, bi->key.len);
+	if (namelen + 9 != bi->key.len)
+		return -1;
+	strbuf_reset(&rec->refname);
+	strbuf_add(&rec->refname, bi->key.buf, namelen);
+	rec->update_index = ~get_be64(bi->key.buf + namelen + 1);
+	strbuf_reset(&rec->who);
+	strbuf_reset(&rec->message);
+
+	switch (type) {
+	case LOG_DELETION:
+		rec->deleted = 1;
+		break;
+	case LOG_UPDATE:
+		rec->deleted = 0;
+		if (2 * the_hash_algo->rawsz > end - p)
+			return -1;
+		oidread(&rec->old_oid, p);
+		p += the_hash_algo->rawsz;
+		oidread(&rec->new_oid, p);
+		p += the_hash_algo->rawsz;
+		len = decode_varint(&p);
+		if (p > end || len > end - p)
+			return -1;
+		strbuf_add(&rec->who, p, len);
+		p += len;
+		rec->time = decode_varint(&p);
+		if (p + 2 > end)
+			return -1;
+		rec->tz = (int16_t)get_be16(p);
+		p += 2;
+		len = decode_varint(&p);
+		if (p > end || len > end - p)
+			return -1;
+		strbuf_add(&rec->message, p, len);
+		p += len;
+		break;
+	default:
+		return -1;
+	}
+	return check_value(bi, p);
+}
+
+static int decode_index(struct block_iter *bi, uint64_t *offset)
+{
+	const unsigned char *p;
+	int type;
+
+	p = block_iter_key(bi, &type);
+	if (!p || type)
+		return -1;
+	*offset = decode_varint(&p);
+	return check_value(bi, p);
+}
+
+/*
+ * Skip a record we are not interested in. Only its key is needed, but
+ * we do not know the length of its value without decoding it.
+ */
+static int block_iter_skip(struct block_iter *bi, struct reftable_table *t,
+			   char type)
+{
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	uint64_t offset;
+	int ret;
+
+	switch (type) {
+	case BLOCK_TYPE_REF:
+		ret = decode_ref(bi, t, &ref);
+		break;
+	case BLOCK_TYPE_LOG:
+		ret = decode_log(bi, &log);
+		break;
+	default:
+		ret = decode_index(bi, &offset);
+	}
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+/*
+ * Position the iterator at the first record whose key is at least
+ * "key" (or at the end of the block if there is none). Restart points
+ * hold full keys, so we can bisect them before scanning forward.
+ */
+static int block_iter_seek(struct block_iter *bi, struct reftable_table *t,
+			   char type, const char *key, size_t len)
+{
+	uint32_t lo = 0, hi = bi->restart_nr, start = BLOCK_HEADER_SIZE;
+	struct strbuf prev = STRBUF_INIT;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t off = get_be24(bi->block + bi->restarts + 3 * mid);
+		int value_type;
+
+		if (off >= bi->restarts)
+			return -1;
+		bi->pos = off;
+		strbuf_reset(&bi->key);
+		if (!block_iter_key(bi, &value_type))
+			return -1;
+		if (key_cmp(bi->key.buf, bi->key.len, key, len) <= 0) {
+			start = off;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	bi->pos = start;
+	strbuf_reset(&bi->key);
+	while (!block_iter_done(bi)) {
+		uint32_t pos = bi->pos;
+
+		strbuf_reset(&prev);
+		strbuf_addbuf(&prev, &bi->key);
+		if (block_iter_skip(bi, t, type) < 0) {
+			strbuf_release(&prev);
+			return -1;
+		}
+		if (key_cmp(bi->key.buf, bi->key.len, key, len) >= 0) {
+			/* step back so that this record is read next */
+			bi->pos = pos;
+			strbuf_swap(&bi->key, &prev);
+			break;
+		}
+	}
+	strbuf_release(&prev);
+	return 0;
+}
+
+/* Iterating over the reference or the reflog section of a table. */
+struct table_iter {
+	struct reftable_table *t;
+	char type;
+	uint64_t start, end, index_offset, index_end;
+	uint64_t block_offset;
+	struct block_iter bi;
+	int done;
+};
+
+static void table_iter_init(struct table_iter *ti, struct reftable_table *t,
+			    char type)
+{
+	memset(ti, 0, sizeof(*ti));
+	ti->t = t;
+	ti->type = type;
+	strbuf_init(&ti->bi.key, 0);
+	if (type == BLOCK_TYPE_REF) {
+		ti->start = REFTABLE_HEADER_SIZE;
+		ti->end = t->ref_end;
+		ti->index_offset = t->ref_index_offset;
+		ti->index_end = t->log_offset;
+	} else {
+		ti->start = t->log_offset;
+		ti->end = t->log_end;
+		ti->index_offset = t->log_index_offset;
+		ti->index_end = t->size - REFTABLE_FOOTER_SIZE;
+	}
+}
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->bi.key);
+}
+
+/*
+ * Find the block that may hold "key": the first one whose last key is
+ * at least "key", according to the index of the section if there is
+ * one.
+ */
+static int table_iter_seek(struct table_iter *ti, const char *key, size_t len)
+{
+	uint64_t offset = ti->start;
+
+	ti->done = 0;
+	if (ti->start >= ti->end) {
+		ti->done = 1;
+		return 0;
+	}
+
+	if (ti->index_offset) {
+		struct block_iter index = { NULL };
+		int ret = 0;
+
+		strbuf_init(&index.key, 0);
+		if (block_iter_init(&index, ti->t, ti->index_offset,
+				    ti->index_end, BLOCK_TYPE_INDEX) < 0 ||
+		    block_iter_seek(&index, ti->t, BLOCK_TYPE_INDEX, key, len) < 0)
+			ret = -1;
+		else if (block_iter_done(&index))
+			ti->done = 1;
+		else if (decode_index(&index, &offset) < 0 ||
+			 offset < ti->start || offset >= ti->end)
+			ret = -1;
+		strbuf_release(&index.key);
+		if (ret < 0 || ti->done)
+			return ret;
+	}
+
+	ti->block_offset = offset;
+	if (block_iter_init(&ti->bi, ti->t, offset, ti->end, ti->type) < 0)
+		return -1;
+	return block_iter_seek(&ti->bi, ti->t, ti->type, key, len);
+}
+
+/* Make sure there is a record to read; return 1 at the end. */
+static int table_iter_advance_block(struct table_iter *ti)
+{
+	while (!ti->done && block_iter_done(&ti->bi)) {
+		uint64_t next = ti->block_offset + ti->bi.len;
+
+		if (next >= ti->end) {
+			ti->done = 1;
+			break;
+		}
+		ti->block_offset = next;
+		if (block_iter_init(&ti->bi, ti->t, next, ti->end, ti->type) < 0)
+			return -1;
+	}
+	return ti->done;
+}
+
+static int table_iter_next_ref(struct table_iter *ti,
+			       struct reftable_ref_record *rec)
+{
+	int ret = table_iter_advance_block(ti);
+
+	if (ret)
+		return ret;
+	return decode_ref(&ti->bi, ti->t, rec);
+}
+
+static int table_iter_next_log(struct table_iter *ti,
+			       struct reftable_log_record *rec)
+{
+	int ret = table_iter_advance_block(ti);
+
+	if (ret)
+		return ret;
+	return decode_log(&ti->bi, rec);
+}
+
+/*
+ * Merged iterators
+ *
+ * The sub-iterators are ordered from the oldest table to the newest;
+ * among records with the same key, the one from the newest table
+ * wins and the others are skipped.
+ */
+struct merged_sub {
+	struct table_iter ti;
+	int has_record;
+	struct reftable_ref_record ref;
+	struct reftable_log_record log;
+	struct strbuf key;
+};
+
+struct reftable_iterator {
+	char type;
+	int keep_deletions;
+	struct reftable_table **tables;
+	struct merged_sub *subs;
+	size_t nr;
+};
+
+static int merged_sub_fetch(struct reftable_iterator *it, struct merged_sub *sub)
+{
+	int ret;
+
+	if (it->type == BLOCK_TYPE_REF) {
+		ret = table_iter_next_ref(&sub->ti, &sub->ref);
+		if (!ret) {
+			strbuf_reset(&sub->key);
+			strbuf_addbuf(&sub->key, &sub->ref.refname);
+		}
+	} else {
+		ret = table_iter_next_log(&sub->ti, &sub->log);
+		if (!ret)
+			log_record_key(&sub->key, sub->log.refname.buf,
+				       sub->log.update_index);
+	}
+	sub->has_record = !ret;
+	return ret < 0 ? -1 : 0;
+}
+
+static struct reftable_iterator *merged_iterator_new(struct reftable_table **tables,
+						     size_t nr, char type,
+						     const char *key, size_t len)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+	size_t i;
+
+	it->type = type;
+	it->nr = nr;
+	ALLOC_ARRAY(it->tables, nr);
+	CALLOC_ARRAY(it->subs, nr);
+	for (i = 0; i < nr; i++) {
+		struct merged_sub *sub = &it->subs[i];
+		struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+		struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+
+		it->tables[i] = tables[i];
+		tables[i]->refcount++;
+		sub->ref = ref;
+		sub->log = log;
+		strbuf_init(&sub->key, 0);
+		table_iter_init(&sub->ti, tables[i], type);
+		if (table_iter_seek(&sub->ti, key, len) < 0 ||
+		    merged_sub_fetch(it, sub) < 0) {
+			reftable_iterator_free(it);
+			return NULL;
+		}
+	}
+	return it;
+}
+
+void reftable_iterator_free(struct reftable_iterator *it)
+{
+	size_t i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		struct merged_sub *sub = &it->subs[i];
+
+		table_iter_release(&sub->ti);
+		reftable_ref_record_release(&sub->ref);
+		reftable_log_record_release(&sub->log);
+		strbuf_release(&sub->key);
+		if (it->tables[i])
+			unref_table(it->tables[i]);
+	}
+	free(it->subs);
+	free(it->tables);
+	free(it);
+}
+
+/*
+ * Find the sub-iterator with the smallest key, preferring newer tables,
+ * and move all the others past that key. Return its index, or -1 at the
+ * end (-2 on errors).
+ */
+static int merged_iterator_pick(struct reftable_iterator *it)
+{
+	int best = -1;
+	size_t i;
+
+	for (i = it->nr; i--; ) {
+		struct merged_sub *sub = &it->subs[i];
+
+		if (!sub->has_record)
+			continue;
+		if (best < 0 ||
+		    key_cmp(sub->key.buf, sub->key.len,
+			    it->subs[best].key.buf, it->subs[best].key.len) < 0)
+			best = i;
+	}
+	if (best < 0)
+		return -1;
+
+	for (i = 0; i < it->nr; i++) {
+		struct merged_sub *sub = &it->subs[i];
+
+		if (i == best || !sub->has_record ||
+		    key_cmp(sub->key.buf, sub->key.len,
+			    it->subs[best].key.buf, it->subs[best].key.len))
+			continue;
+		if (merged_sub_fetch(it, sub) < 0)
+			return -2;
+	}
+	return best;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec)
+{
+	if (it->type != BLOCK_TYPE_REF)
+		BUG("reftable: reading references from a reflog iterator");
+	for (;;) {
+		int i = merged_iterator_pick(it);
+
+		if (i < 0)
+			return i == -1 ? 1 : -1;
+		copy_ref_record(rec, &it->subs[i].ref);
+		if (merged_sub_fetch(it, &it->subs[i]) < 0)
+			return -1;
+		if (rec->type != REFTABLE_REF_DELETION || it->keep_deletions)
+			return 0;
+	}
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec)
+{
+	if (it->type != BLOCK_TYPE_LOG)
+		BUG("reftable: reading reflog entries from a reference iterator");
+	for (;;) {
+		int i = merged_iterator_pick(it);
+
+		if (i < 0)
+			return i == -1 ? 1 : -1;
+		copy_log_record(rec, &it->subs[i].log);
+		if (merged_sub_fetch(it, &it->subs[i]) < 0)
+			return -1;
+		if (!rec->deleted || it->keep_deletions)
+			return 0;
+	}
+}
+
+/*
+ * Stacks
+ */
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir)
+{
+	memset(st, 0, sizeof(*st));
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+}
+
+static void drop_tables(struct reftable_stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		unref_table(st->tables[i]);
+	st->nr = 0;
+}
+
+void reftable_stack_release(struct reftable_stack *st)
+{
+	drop_tables(st);
+	FREE_AND_NULL(st->tables);
+	st->alloc = 0;
+	stat_validity_clear(&st->list_validity);
+	FREE_AND_NULL(st->dir);
+	FREE_AND_NULL(st->list_file);
+}
+
+/*
+ * Read the list of tables and open them, reusing the tables we already
+ * have open. Return 1 if a table went away under us, which happens when
+ * another process compacts the stack between our reading the list and
+ * opening the table; reading the list again is the cure.
+ */
+static int read_stack(struct reftable_stack *st, struct strbuf *err)
+{
+	struct reftable_table **tables = NULL;
+	size_t nr = 0, alloc = 0, i, j;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct strbuf list = STRBUF_INIT;
+	int fd, ret = 0;
+
+	fd = open(st->list_file, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			strbuf_addf(err, _("unable to open '%s': %s"),
+				    st->list_file, strerror(errno));
+			return -1;
+		}
+	} else if (strbuf_read(&list, fd, 0) < 0) {
+		strbuf_addf(err, _("unable to read '%s': %s"),
+			    st->list_file, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	string_list_split(&names, list.buf, '\n', -1);
+	for (i = 0; i < names.nr; i++) {
+		const char *name = names.items[i].string;
+		struct reftable_table *t = NULL;
+
+		if (!*name)
+			continue;
+		for (j = 0; j < st->nr; j++)
+			if (st->tables[j] && !strcmp(st->tables[j]->name, name)) {
+				t = st->tables[j];
+				t->refcount++;
+				break;
+			}
+		if (!t)
+			t = open_table(st->dir, name, err);
+		if (!t) {
+			ret = err->len ? -1 : 1;
+			break;
+		}
+		ALLOC_GROW(tables, nr + 1, alloc);
+		tables[nr++] = t;
+	}
+
+	if (!ret) {
+		drop_tables(st);
+		free(st->tables);
+		st->tables = tables;
+		st->nr = nr;
+		st->alloc = alloc;
+		if (fd >= 0)
+			stat_validity_update(&st->list_validity, fd);
+		else
+			stat_validity_clear(&st->list_validity);
+	} else {
+		for (i = 0; i < nr; i++)
+			unref_table(tables[i]);
+		free(tables);
+	}
+
+	if (fd >= 0)
+		close(fd);
+	string_list_clear(&names, 0);
+	strbuf_release(&list);
+	return ret;
+}
+
+int reftable_stack_reload(struct reftable_stack *st, struct strbuf *err)
+{
+	int tries = 0, ret;
+
+	if (stat_validity_check(&st->list_validity, st->list_file))
+		return 0;
+	while ((ret = read_stack(st, err)) > 0) {
+		if (++tries > 100) {
+			strbuf_addf(err, _("'%s' keeps changing"), st->list_file);
+			return -1;
+		}
+	}
+	return ret;
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	if (!st->nr)
+		return 1;
+	return st->tables[st->nr - 1]->max_update_index + 1;
+}
+
+struct reftable_iterator *reftable_stack_refs(struct reftable_stack *st,
+					      const char *prefix)
+{
+	return merged_iterator_new(st->tables, st->nr, BLOCK_TYPE_REF,
+				   prefix, strlen(prefix));
+}
+
+struct reftable_iterator *reftable_stack_logs(struct reftable_stack *st,
+					      const char *prefix)
+{
+	return merged_iterator_new(st->tables, st->nr, BLOCK_TYPE_LOG,
+				   prefix, strlen(prefix));
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec)
+{
+	struct reftable_iterator *it = reftable_stack_refs(st, refname);
+	int ret;
+
+	if (!it)
+		return -1;
+	ret = reftable_iterator_next_ref(it, rec);
+	if (!ret && strcmp(rec->refname.buf, refname))
+		ret = 1;
+	reftable_iterator_free(it);
+	return ret;
+}
+
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err)
+{
+	static int timeout_configured = 0;
+	static int timeout_value = 1000;
+
+	if (!timeout_configured) {
+		git_config_get_int("core.packedrefstimeout", &timeout_value);
+		timeout_configured = 1;
+	}
+
+	if (safe_create_leading_directories_const(st->list_file) < 0 &&
+	    errno != EEXIST) {
+		strbuf_addf(err, _("unable to create directory for '%s'"),
+			    st->list_file);
+		return -1;
+	}
+	if (hold_lock_file_for_update_timeout(lock, st->list_file, 0,
+					      timeout_value) < 0) {
+		unable_to_lock_message(st->list_file, errno, err);
+		return -1;
+	}
+	if (reftable_stack_reload(st, err) < 0) {
+		rollback_lock_file(lock);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write the tables[0..keep) of the stack followed by "name" (if any)
+ * into the lock and commit it.
+ */
+static int commit_stack(struct reftable_stack *st, struct lock_file *lock,
+			size_t keep, const char *name, struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < keep; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (name)
+		strbuf_addf(&list, "%s\n", name);
+	if (write_in_full(get_lock_file_fd(lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(lock) < 0) {
+		strbuf_addf(err, _("unable to write '%s': %s"),
+			    st->list_file, strerror(errno));
+		rollback_lock_file(lock);
+		strbuf_release(&list);
+		return -1;
+	}
+	strbuf_release(&list);
+
+	/* make sure we see our own update, even within the same second */
+	stat_validity_clear(&st->list_validity);
+	return 0;
+}
+
+/*
+ * Write a new table covering update indexes [min, max] into the stack
+ * directory, and store its name in "name".
+ */
+static int write_table(struct reftable_stack *st, uint64_t min, uint64_t max,
+		       reftable_write_fn *fn, void *cb_data,
+		       struct strbuf *name, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct reftable_writer *w;
+	struct tempfile *tmp;
+	const char *suffix;
+	int ret = -1;
+
+	strbuf_addf(&path, "%s/tmp_XXXXXX", st->dir);
+	tmp = mks_tempfile(path.buf);
+	if (!tmp) {
+		strbuf_addf(err, _("unable to create '%s': %s"),
+			    path.buf, strerror(errno));
+		goto out;
+	}
+
+	w = reftable_writer_new(get_tempfile_fd(tmp), min, max);
+	if (fn(w, cb_data) < 0) {
+		reftable_writer_free(w);
+		if (!err->len)
+			strbuf_addf(err, _("unable to write '%s'"),
+				    get_tempfile_path(tmp));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+	if (reftable_writer_finish(w) < 0 || close_tempfile_gently(tmp) < 0) {
+		strbuf_addf(err, _("unable to write '%s': %s"),
+			    get_tempfile_path(tmp), strerror(errno));
+		delete_tempfile(&tmp);
+		goto out;
+	}
+
+	suffix = strrchr(get_tempfile_path(tmp), '_') + 1;
+	strbuf_reset(name);
+	strbuf_addf(name, "0x%012"PRIx64"-0x%012"PRIx64"-%s.ref",
+		    min, max, suffix);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", st->dir, name->buf);
+	if (rename_tempfile(&tmp, path.buf) < 0) {
+		strbuf_addf(err, _("unable to rename table to '%s': %s"),
+			    path.buf, strerror(errno));
+		goto out;
+	}
+	ret = 0;
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+struct compaction {
+	struct reftable_stack *st;
+	size_t first;
+};
+
+static int write_compacted(struct reftable_writer *w, void *cb_data)
+{
+	struct compaction *c = cb_data;
+	struct reftable_stack *st = c->st;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	int ret;
+
+	/*
+	 * Deletions must survive unless there is nothing older left for
+	 * them to shadow.
+	 */
+	it = merged_iterator_new(st->tables + c->first, st->nr - c->first,
+				 BLOCK_TYPE_REF, "", 0);
+	if (!it)
+		return -1;
+	it->keep_deletions = c->first > 0;
+	while (!(ret = reftable_iterator_next_ref(it, &ref)))
+		if (reftable_writer_add_ref(w, &ref) < 0) {
+			ret = -1;
+			break;
+		}
+	reftable_iterator_free(it);
+
+	if (ret > 0) {
+		it = merged_iterator_new(st->tables + c->first, st->nr - c->first,
+					 BLOCK_TYPE_LOG, "", 0);
+		if (!it) {
+			ret = -1;
+			goto out;
+		}
+		it->keep_deletions = c->first > 0;
+		while (!(ret = reftable_iterator_next_log(it, &log)))
+			if (reftable_writer_add_log(w, &log) < 0) {
+				ret = -1;
+				break;
+			}
+		reftable_iterator_free(it);
+	}
+
+out:
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	return ret < 0 ? -1 : 0;
+}
+
+/* Merge tables[first..] of the locked stack into one and release the lock. */
+static int compact_locked(struct reftable_stack *st, struct lock_file *lock,
+			  size_t first, struct strbuf *err)
+{
+	struct compaction c = { st, first };
+	struct strbuf name = STRBUF_INIT, path = STRBUF_INIT;
+	struct reftable_table **old;
+	size_t i, nr = st->nr - first;
+
+	if (nr < 2) {
+		rollback_lock_file(lock);
+		return 0;
+	}
+
+	if (write_table(st, st->tables[first]->min_update_index,
+			st->tables[st->nr - 1]->max_update_index,
+			write_compacted, &c, &name, err) < 0) {
+		rollback_lock_file(lock);
+		strbuf_release(&name);
+		return -1;
+	}
+	if (commit_stack(st, lock, first, name.buf, err) < 0) {
+		strbuf_addf(&path, "%s/%s", st->dir, name.buf);
+		unlink(path.buf);
+		strbuf_release(&path);
+		strbuf_release(&name);
+		return -1;
+	}
+
+	/*
+	 * Readers that still have the old tables open keep them mapped;
+	 * those that come later will not look for them.
+	 */
+	ALLOC_ARRAY(old, nr);
+	for (i = 0; i < nr; i++) {
+		old[i] = st->tables[first + i];
+		old[i]->refcount++;
+	}
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, old[i]->name);
+		unlink(path.buf);
+		unref_table(old[i]);
+	}
+	free(old);
+	strbuf_release(&path);
+	strbuf_release(&name);
+	return reftable_stack_reload(st, err);
+}
+
+/*
+ * Keep the stack geometric: every table should be at least twice as
+ * large as all the tables above it together, so that there are only a
+ * logarithmic number of them. Find the oldest table that breaks the
+ * rule, and merge it with everything above.
+ */
+static size_t compaction_start(struct reftable_stack *st)
+{
+	size_t first, sum;
+
+	if (st->nr < 2)
+		return st->nr;
+	first = st->nr - 1;
+	sum = st->tables[first]->size;
+	while (first > 0 && st->tables[first - 1]->size < 2 * sum) {
+		first--;
+		sum += st->tables[first]->size;
+	}
+	return first;
+}
+
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       reftable_write_fn *fn, void *cb_data,
+		       struct strbuf *err)
+{
+	uint64_t next = reftable_stack_next_update_index(st);
+	struct strbuf name = STRBUF_INIT;
+	size_t first;
+
+	if (write_table(st, next, next, fn, cb_data, &name, err) < 0) {
+		rollback_lock_file(lock);
+		strbuf_release(&name);
+		return -1;
+	}
+	if (commit_stack(st, lock, st->nr, name.buf, err) < 0 ||
+	    reftable_stack_reload(st, err) < 0) {
+		strbuf_release(&name);
+		return -1;
+	}
+	strbuf_release(&name);
+
+	first = compaction_start(st);
+	if (first + 1 >= st->nr)
+		return 0;
+
+	/*
+	 * The update is done; failing to compact only means that the
+	 * stack stays longer than it should until the next update.
+	 */
+	if (reftable_stack_lock(st, lock, err) < 0 ||
+	    compact_locked(st, lock, compaction_start(st), err) < 0)
+		strbuf_reset(err);
+	return 0;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err)
+{
+	struct lock_file lock = LOCK_INIT;
+
+	if (reftable_stack_lock(st, &lock, err) < 0)
+		return -1;
+	return compact_locked(st, &lock, 0, err);
+}
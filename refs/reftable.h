@@ -0,0 +1,151 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "../lockfile.h"
+
+/*
+ * Reading and writing reftables, and maintaining a stack of them.
+ *
+ * A reftable is an immutable file holding a sorted set of reference
+ * records followed by a sorted set of reflog records, cut into blocks
+ * with an index on top; see Documentation/technical/reftable.txt for
+ * the format. A repository keeps a stack of reftables, listed oldest
+ * first in `tables.list`; a record in a newer table shadows the
+ * records with the same key in the older ones, so an update only
+ * needs to write a new small table and append it to the list. The
+ * stack is compacted on the fly to keep it short.
+ */
+
+enum reftable_ref_type {
+	REFTABLE_REF_DELETION = 0,
+	REFTABLE_REF_VAL1 = 1,		/* an object name */
+	REFTABLE_REF_VAL2 = 2,		/* an object name and its peeled value */
+	REFTABLE_REF_SYMREF = 3		/* a symbolic reference */
+};
+
+struct reftable_ref_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_ref_type type;
+	struct object_id value;
+	struct object_id peeled;
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_RECORD_INIT { STRBUF_INIT, 0, REFTABLE_REF_DELETION, \
+		{ { 0 } }, { { 0 } }, STRBUF_INIT }
+
+void reftable_ref_record_release(struct reftable_ref_record *rec);
+
+struct reftable_log_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	/* A deleted entry only shadows the older entry with the same key. */
+	int deleted;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf who;		/* "Name <email>" */
+	timestamp_t time;
+	int tz;
+	struct strbuf message;
+};
+
+#define REFTABLE_LOG_RECORD_INIT { STRBUF_INIT, 0, 0, { { 0 } }, { { 0 } }, \
+		STRBUF_INIT, 0, 0, STRBUF_INIT }
+
+void reftable_log_record_release(struct reftable_log_record *rec);
+
+/*
+ * Writing a table. Records must be added in order: all references
+ * sorted by name, then all reflog entries sorted by name and, for
+ * each name, from the newest update to the oldest.
+ */
+struct reftable_writer;
+
+struct reftable_writer *reftable_writer_new(int fd, uint64_t min_update_index,
+					    uint64_t max_update_index);
+int reftable_writer_add_ref(struct reftable_writer *w,
+			    const struct reftable_ref_record *rec);
+int reftable_writer_add_log(struct reftable_writer *w,
+			    const struct reftable_log_record *rec);
+/* Write the indexes and the footer, and free the writer. */
+int reftable_writer_finish(struct reftable_writer *w);
+/* Free the writer without finishing the table. */
+void reftable_writer_free(struct reftable_writer *w);
+
+/*
+ * A stack of tables in a directory. The tables are opened when the
+ * stack is loaded and stay mapped until they are dropped from the
+ * stack and no iterator uses them any more.
+ */
+struct reftable_table;
+
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+	struct reftable_table **tables;
+	size_t nr, alloc;
+	struct stat_validity list_validity;
+};
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir);
+void reftable_stack_release(struct reftable_stack *st);
+
+/*
+ * Reload the list of tables if it changed on disk since it was last
+ * read. Return 0 on success, -1 (with a message in `err`) on errors.
+ */
+int reftable_stack_reload(struct reftable_stack *st, struct strbuf *err);
+
+/* The update index to be used for the next table added to the stack. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Look up the reference `refname`. Return 0 and fill `rec` if it
+ * exists, 1 if it does not, and -1 on errors.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec);
+
+/*
+ * Iterators over the merged view of the stack, starting at the first
+ * record whose name is at least `prefix`. Deleted records are
+ * skipped. The iterators keep the tables they read alive, so they
+ * are not affected by later changes to the stack.
+ */
+struct reftable_iterator;
+
+struct reftable_iterator *reftable_stack_refs(struct reftable_stack *st,
+					      const char *prefix);
+struct reftable_iterator *reftable_stack_logs(struct reftable_stack *st,
+					      const char *prefix);
+/* Return 0 and fill `rec` with the next record, 1 at the end, -1 on errors. */
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec);
+void reftable_iterator_free(struct reftable_iterator *it);
+
+/*
+ * Lock `tables.list` and bring the stack up to date, so that the
+ * caller can check the current state before adding a table.
+ */
+int reftable_stack_lock(struct reftable_stack *st, struct lock_file *lock,
+			struct strbuf *err);
+
+/*
+ * Write a new table with `write_table`, add it on top of the locked
+ * stack, compact the stack if it got out of shape, and release the
+ * lock. `write_table` is called with a writer for the update index
+ * returned by reftable_stack_next_update_index(). On errors, the lock
+ * is rolled back and -1 is returned with a message in `err`.
+ */
+typedef int reftable_write_fn(struct reftable_writer *w, void *cb_data);
+int reftable_stack_add(struct reftable_stack *st, struct lock_file *lock,
+		       reftable_write_fn *write_table, void *cb_data,
+		       struct strbuf *err);
+
+/* Merge all the tables of the stack into one. */
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
@@ -11,6 +11,7 @@ static int register_replace_ref(struct repository *r,
 				const struct object_id *oid,
 				int flag, void *cb_data)
 {
+	struct oidmap *map = cb_data;
 	/* Get sha1 from refname */
 	const char *slash = strrchr(refname, '/');
 	const char *hash = slash ? slash + 1 : refname;
@@ -26,7 +27,7 @@ static int register_replace_ref(struct repository *r,
 	oidcpy(&repl_obj->replacement, oid);
 
 	/* Register new object */
-	if (oidmap_put(r->objects->replace_map, repl_obj))
+	if (oidmap_put(map, repl_obj))
 		die(_("duplicate replace ref: %s"), refname);
 
 	return 0;
@@ -34,14 +35,23 @@ static int register_replace_ref(struct repository *r,
 
 void prepare_replace_object(struct repository *r)
 {
+	struct oidmap *map;
+
 	if (r->objects->replace_map)
 		return;
 
-	r->objects->replace_map =
-		xmalloc(sizeof(*r->objects->replace_map));
-	oidmap_init(r->objects->replace_map, 0);
-
-	for_each_replace_ref(r, register_replace_ref, NULL);
+	/*
+	 * Threaded readers look at the map without taking the lock, so
+	 * only publish it once it is complete.
+	 */
+	obj_read_lock();
+	if (!r->objects->replace_map) {
+		map = xmalloc(sizeof(*map));
+		oidmap_init(map, 0);
+		for_each_replace_ref(r, register_replace_ref, map);
+		r->objects->replace_map = map;
+	}
+	obj_read_unlock();
 }
 
 /* We allow "recursive" replacement. Only within reason, though */
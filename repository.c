@@ -25,6 +25,7 @@ void initialize_the_repository(void)
 	the_repo.parsed_objects = parsed_object_pool_new();
 
 	repo_set_hash_algo(&the_repo, GIT_HASH_SHA1);
+	repo_set_ref_storage_format(&the_repo, NULL);
 }
 
 static void expand_base_dir(char **out, const char *in,
@@ -91,6 +92,12 @@ void repo_set_hash_algo(struct repository *repo, int hash_algo)
 	repo->hash_algo = &hash_algos[hash_algo];
 }
 
+void repo_set_ref_storage_format(struct repository *repo, const char *format)
+{
+	free(repo->ref_storage_format);
+	repo->ref_storage_format = xstrdup(format ? format : "files");
+}
+
 /*
  * Attempt to resolve and set the provided 'gitdir' for repository 'repo'.
  * Return 0 upon success and a non-zero value upon failure.
@@ -170,6 +177,7 @@ int repo_init(struct repository *repo,
 		goto error;
 
 	repo_set_hash_algo(repo, format.hash_algo);
+	repo_set_ref_storage_format(repo, format.ref_storage);
 
 	if (worktree)
 		repo_set_worktree(repo, worktree);
@@ -235,6 +243,7 @@ void repo_clear(struct repository *repo)
 	FREE_AND_NULL(repo->index_file);
 	FREE_AND_NULL(repo->worktree);
 	FREE_AND_NULL(repo->submodule_prefix);
+	FREE_AND_NULL(repo->ref_storage_format);
 
 	raw_object_store_clear(repo->objects);
 	FREE_AND_NULL(repo->objects);
@@ -23,12 +23,15 @@ enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_NONE = 0,
 	FETCH_NEGOTIATION_DEFAULT = 1,
 	FETCH_NEGOTIATION_SKIPPING = 2,
+	FETCH_NEGOTIATION_BISECTING = 3,
 };
 
 struct repo_settings {
 	int initialized;
 
 	int core_commit_graph;
+	int commit_graph_read_changed_paths;
+	int commit_graph_generation_version;
 	int gc_write_commit_graph;
 	int fetch_write_commit_graph;
 
@@ -37,6 +40,14 @@ struct repo_settings {
 
 	int pack_use_sparse;
 	enum fetch_negotiation_setting fetch_negotiation_algorithm;
+
+	int sparse_index;
+	/*
+	 * Commands that can work with a sparse index clear this after
+	 * calling prepare_repo_settings(); everybody else gets the index
+	 * expanded to every path as soon as it is read.
+	 */
+	int command_requires_full_index;
 };
 
 struct repository {
@@ -122,6 +133,9 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/* The name of the reference backend, "files" unless configured. */
+	char *ref_storage_format;
+
 	/* A unique-id for tracing purposes. */
 	int trace2_repo_id;
 
@@ -152,6 +166,7 @@ void repo_set_gitdir(struct repository *repo, const char *root,
 		     const struct set_gitdir_args *extra_args);
 void repo_set_worktree(struct repository *repo, const char *path);
 void repo_set_hash_algo(struct repository *repo, int algo);
+void repo_set_ref_storage_format(struct repository *repo, const char *format);
 void initialize_the_repository(void);
 int repo_init(struct repository *r, const char *gitdir, const char *worktree);
 
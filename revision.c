@@ -29,6 +29,8 @@
 #include "prio-queue.h"
 #include "hashmap.h"
 #include "utf8.h"
+#include "bloom.h"
+#include "json-writer.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -624,11 +626,144 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
+static int bloom_filter_atexit_registered;
+static unsigned int count_bloom_filter_maybe;
+static unsigned int count_bloom_filter_definitely_not;
+static unsigned int count_bloom_filter_false_positive;
+static unsigned int count_bloom_filter_not_present;
+
+static void trace2_bloom_filter_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "filter_not_present", count_bloom_filter_not_present);
+	jw_object_intmax(&jw, "maybe", count_bloom_filter_maybe);
+	jw_object_intmax(&jw, "definitely_not", count_bloom_filter_definitely_not);
+	jw_object_intmax(&jw, "false_positive", count_bloom_filter_false_positive);
+	jw_end(&jw);
+
+	trace2_data_json("bloom", the_repository, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
+static int forbid_bloom_filters(struct pathspec *spec)
+{
+	int i;
+
+	if (spec->has_wildcard)
+		return 1;
+	if (spec->magic & ~PATHSPEC_LITERAL)
+		return 1;
+	for (i = 0; i < spec->nr; i++)
+		if (spec->items[i].magic & ~PATHSPEC_LITERAL)
+			return 1;
+
+	return 0;
+}
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	struct commit_graph *g;
+	int i;
+
+	if (!revs->commits)
+		return;
+
+	if (!revs->prune || !revs->pruning.pathspec.nr)
+		return;
+
+	if (forbid_bloom_filters(&revs->pruning.pathspec))
+		return;
+
+	prepare_repo_settings(revs->repo);
+	if (!revs->repo->settings.commit_graph_read_changed_paths)
+		return;
+
+	repo_parse_commit(revs->repo, revs->commits->item);
+
+	g = revs->repo->objects->commit_graph;
+	if (!g)
+		return;
+
+	/* Any layer of a split commit-graph may carry the settings. */
+	while (g && !g->bloom_filter_settings)
+		g = g->base_graph;
+	if (!g)
+		return;
+	revs->bloom_filter_settings = g->bloom_filter_settings;
+
+	revs->bloom_keys_nr = revs->pruning.pathspec.nr;
+	CALLOC_ARRAY(revs->bloom_keys, revs->bloom_keys_nr);
+
+	for (i = 0; i < revs->pruning.pathspec.nr; i++) {
+		const char *path = revs->pruning.pathspec.items[i].match;
+		size_t len = revs->pruning.pathspec.items[i].len;
+
+		/* remove trailing slashes from the path, if needed */
+		while (len && path[len - 1] == '/')
+			len--;
+
+		fill_bloom_key(path, len, &revs->bloom_keys[i],
+			       revs->bloom_filter_settings);
+	}
+
+	if (trace2_is_enabled() && !bloom_filter_atexit_registered) {
+		atexit(trace2_bloom_filter_statistics_atexit);
+		bloom_filter_atexit_registered = 1;
+	}
+}
+
+/*
+ * Return 0 if the changed-path Bloom filter of 'commit' proves that none
+ * of the pathspec items changed relative to its first parent, 1 if some
+ * may have changed, and -1 if no filter is available.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter *filter;
+	int i, result = 0;
+
+	if (!revs->repo->objects->commit_graph)
+		return -1;
+
+	if (commit->generation == GENERATION_NUMBER_INFINITY)
+		return -1;
+
+	filter = get_bloom_filter(revs->repo, commit, 0);
+
+	if (!filter) {
+		count_bloom_filter_not_present++;
+		return -1;
+	}
+
+	for (i = 0; !result && i < revs->bloom_keys_nr; i++) {
+		result = bloom_filter_contains(filter,
+					       &revs->bloom_keys[i],
+					       revs->bloom_filter_settings);
+		if (result < 0) {
+			count_bloom_filter_not_present++;
+			return -1;
+		}
+	}
+
+	if (result)
+		count_bloom_filter_maybe++;
+	else
+		count_bloom_filter_definitely_not++;
+
+	return result;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
 	struct tree *t1 = get_commit_tree(parent);
 	struct tree *t2 = get_commit_tree(commit);
+	int bloom_ret = 1;
 
 	if (!t1)
 		return REV_TREE_NEW;
@@ -653,11 +788,23 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	if (revs->bloom_keys_nr && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+
+		if (bloom_ret == 0)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	if (diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+
+	if (revs->bloom_keys_nr && !nth_parent &&
+	    bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		count_bloom_filter_false_positive++;
+
 	return tree_difference;
 }
 
@@ -855,7 +1002,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -3104,7 +3251,7 @@ define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
 
 struct topo_walk_info {
-	uint32_t min_generation;
+	timestamp_t min_generation;
 	struct prio_queue explore_queue;
 	struct prio_queue indegree_queue;
 	struct prio_queue topo_queue;
@@ -3150,7 +3297,7 @@ static void explore_walk_step(struct rev_info *revs)
 }
 
 static void explore_to_depth(struct rev_info *revs,
-			     uint32_t gen_cutoff)
+			     timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3190,7 +3337,7 @@ static void indegree_walk_step(struct rev_info *revs)
 }
 
 static void compute_indegrees_to_depth(struct rev_info *revs,
-				       uint32_t gen_cutoff)
+				       timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3366,6 +3513,8 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	if (!revs->reflog_info)
+		prepare_to_use_bloom_filter(revs);
 	if (revs->limited) {
 		if (limit_list(revs) < 0)
 			return -1;
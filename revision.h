@@ -82,6 +82,8 @@ struct rev_cmdline_info {
 
 struct oidset;
 struct topo_walk_info;
+struct bloom_key;
+struct bloom_filter_settings;
 
 struct rev_info {
 	/* Starting list */
@@ -291,6 +293,15 @@ struct rev_info {
 	struct revision_sources *sources;
 
 	struct topo_walk_info *topo_walk_info;
+
+	/*
+	 * Changed-path Bloom filter keys for each pruning pathspec item,
+	 * or NULL if the filters in the commit-graph cannot be used for
+	 * this walk. See prepare_to_use_bloom_filter().
+	 */
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+	struct bloom_filter_settings *bloom_filter_settings;
 };
 
 int ref_excluded(struct string_list *, const char *path);
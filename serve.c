@@ -5,6 +5,7 @@
 #include "version.h"
 #include "argv-array.h"
 #include "ls-refs.h"
+#include "bundle-uri.h"
 #include "serve.h"
 #include "upload-pack.h"
 
@@ -57,6 +58,7 @@ static struct protocol_capability capabilities[] = {
 	{ "ls-refs", always_advertise, ls_refs },
 	{ "fetch", upload_pack_advertise, upload_pack_v2 },
 	{ "server-option", always_advertise, NULL },
+	{ "bundle-uri", bundle_uri_advertise, bundle_uri_command },
 };
 
 static void advertise_capabilities(void)
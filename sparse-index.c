@@ -0,0 +1,310 @@
+#include "cache.h"
+#include "cache-tree.h"
+#include "config.h"
+#include "dir.h"
+#include "pathspec.h"
+#include "repository.h"
+#include "sparse-index.h"
+#include "tree.h"
+
+static struct cache_entry *construct_sparse_dir_entry(
+				struct index_state *istate,
+				const char *sparse_dir,
+				struct cache_tree *tree)
+{
+	size_t len = strlen(sparse_dir);
+	struct cache_entry *de = make_empty_cache_entry(istate, len);
+
+	de->ce_mode = S_IFDIR;
+	de->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	de->ce_namelen = len;
+	oidcpy(&de->oid, &tree->oid);
+	memcpy(de->name, sparse_dir, len + 1);
+	return de;
+}
+
+static void discard_collapsed_entries(struct index_state *istate,
+				      int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		remove_name_hash(istate, istate->cache[i]);
+		discard_cache_entry(istate->cache[i]);
+	}
+}
+
+/*
+ * Collapse what can be collapsed of the entries [start, end) that
+ * make up the directory "ct_path" (empty or ending in a slash),
+ * described by "ct". The result is written back into istate->cache
+ * from position "num_converted" on; returns the number of entries
+ * written.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 struct pattern_list *pl,
+				 int num_converted,
+				 int start, int end,
+				 const char *ct_path, size_t ct_pathlen,
+				 struct cache_tree *ct)
+{
+	int i, can_convert = 1;
+	int start_converted = num_converted;
+	int dtype = DT_DIR;
+	struct strbuf child_path = STRBUF_INIT;
+
+	/*
+	 * Everything below a directory that is entirely outside of the
+	 * cone can be replaced by a single entry, unless some of it is
+	 * checked out after all, unmerged, or a submodule.
+	 */
+	if (path_matches_pattern_list(ct_path, ct_pathlen, NULL, &dtype,
+				      pl, istate) != NOT_MATCHED)
+		can_convert = 0;
+
+	for (i = start; can_convert && i < end; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) ||
+		    S_ISGITLINK(ce->ce_mode) ||
+		    !(ce->ce_flags & CE_SKIP_WORKTREE))
+			can_convert = 0;
+	}
+
+	if (can_convert) {
+		struct cache_entry *se;
+
+		se = construct_sparse_dir_entry(istate, ct_path, ct);
+		discard_collapsed_entries(istate, start, end);
+		add_name_hash(istate, se);
+		istate->cache[num_converted++] = se;
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		int count, span, pos = -1;
+		const char *base, *slash;
+		struct cache_entry *ce = istate->cache[i];
+
+		/* Is this a file of this directory rather than a subtree? */
+		base = ce->name + ct_pathlen;
+		slash = strchr(base, '/');
+
+		if (slash)
+			pos = cache_tree_subtree_pos(ct, base, slash - base);
+
+		if (pos < 0) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_setlen(&child_path, 0);
+		strbuf_add(&child_path, ce->name, slash - ce->name + 1);
+
+		span = ct->down[pos]->cache_tree->entry_count;
+		count = convert_to_sparse_rec(istate, pl,
+					      num_converted, i, i + span,
+					      child_path.buf, child_path.len,
+					      ct->down[pos]->cache_tree);
+		num_converted += count;
+		i += span;
+	}
+
+	strbuf_release(&child_path);
+	return num_converted - start_converted;
+}
+
+static int index_can_be_sparse(struct index_state *istate)
+{
+	int i;
+
+	if (!core_apply_sparse_checkout || !core_sparse_checkout_cone)
+		return 0;
+
+	prepare_repo_settings(the_repository);
+	if (!the_repository->settings.sparse_index &&
+	    !git_env_bool("GIT_TEST_SPARSE_INDEX", 0))
+		return 0;
+
+	/* The split-index and sparse-index formats do not mix. */
+	if (istate->split_index)
+		return 0;
+
+	/*
+	 * The cache-tree, which tells us where directories start and
+	 * end, cannot describe unmerged or intent-to-add entries.
+	 */
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) ||
+		    ce->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD))
+			return 0;
+	}
+	return 1;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	struct pattern_list pl, *patterns = istate->sparse_checkout_patterns;
+	char *sparse_filename = NULL;
+	int ret = 0;
+
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !index_can_be_sparse(istate))
+		return 0;
+
+	memset(&pl, 0, sizeof(pl));
+	if (!patterns) {
+		pl.use_cone_patterns = 1;
+		sparse_filename = git_pathdup("info/sparse-checkout");
+		if (add_patterns_from_file_to_list(sparse_filename, "", 0,
+						   &pl, NULL) < 0)
+			goto out;
+		patterns = &pl;
+	}
+	if (!patterns->use_cone_patterns)
+		goto out;
+
+	/*
+	 * Collapsing needs a valid cache-tree. This may have to write
+	 * tree objects, for directories that changed since the last
+	 * commit.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_MISSING_OK | WRITE_TREE_SILENT))
+		goto out;
+
+	trace2_region_enter("index", "convert_to_sparse", the_repository);
+	istate->cache_nr = convert_to_sparse_rec(istate, patterns, 0,
+						 0, istate->cache_nr,
+						 "", 0, istate->cache_tree);
+	istate->sparse_index = 1;
+	istate->cache_changed |= SOMETHING_CHANGED;
+
+	/* The sparse directories are leaves of the cache-tree now. */
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_MISSING_OK | WRITE_TREE_SILENT))
+		ret = -1;
+	trace2_region_leave("index", "convert_to_sparse", the_repository);
+
+out:
+	clear_pattern_list(&pl);
+	free(sparse_filename);
+	return ret;
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct expand_data *data = context;
+	size_t len = base->len + strlen(path);
+	struct cache_entry *ce;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	ce = make_empty_cache_entry(data->istate, len);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len + 1);
+
+	ALLOC_GROW(data->cache, data->nr + 1, data->alloc);
+	data->cache[data->nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data data;
+	struct pathspec ps;
+	unsigned int i, first_new, cache_changed;
+
+	if (!istate || !istate->sparse_index)
+		return;
+
+	trace2_region_enter("index", "ensure_full_index", the_repository);
+
+	/* Expanding does not change what the index says. */
+	cache_changed = istate->cache_changed;
+	memset(&data, 0, sizeof(data));
+	data.istate = istate;
+	memset(&ps, 0, sizeof(ps));
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(data.cache, data.nr + 1, data.alloc);
+			data.cache[data.nr++] = ce;
+			continue;
+		}
+
+		tree = lookup_tree(the_repository, &ce->oid);
+		first_new = data.nr;
+		if (!tree ||
+		    read_tree_recursive(the_repository, tree,
+					ce->name, ce->ce_namelen, 0, &ps,
+					add_path_to_index, &data))
+			die(_("unable to expand sparse directory '%s' (%s)"),
+			    ce->name, oid_to_hex(&ce->oid));
+		for (; first_new < data.nr; first_new++)
+			add_name_hash(istate, data.cache[first_new]);
+
+		/* Only this directory and those above it need a new tree. */
+		cache_tree_invalidate_path(istate, ce->name);
+		remove_name_hash(istate, ce);
+		discard_cache_entry(ce);
+	}
+
+	free(istate->cache);
+	istate->cache = data.cache;
+	istate->cache_nr = data.nr;
+	istate->cache_alloc = data.alloc;
+	istate->sparse_index = 0;
+
+	if (istate->cache_tree)
+		cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_REPAIR);
+	istate->cache_changed = cache_changed;
+
+	trace2_region_leave("index", "ensure_full_index", the_repository);
+}
+
+void ensure_full_index_for_patterns(struct index_state *istate,
+				    struct pattern_list *pl)
+{
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	if (pl && pl->use_cone_patterns) {
+		for (i = 0; i < istate->cache_nr; i++) {
+			const struct cache_entry *ce = istate->cache[i];
+			int dtype = DT_DIR;
+
+			if (S_ISSPARSEDIR(ce->ce_mode) &&
+			    path_matches_pattern_list(ce->name, ce_namelen(ce),
+						      NULL, &dtype, pl,
+						      istate) != NOT_MATCHED)
+				break;
+		}
+		if (i == istate->cache_nr)
+			return;
+	}
+	ensure_full_index(istate);
+}
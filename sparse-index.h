@@ -0,0 +1,33 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+struct pattern_list;
+
+/*
+ * Replace every directory outside of the sparse-checkout cone whose
+ * entries are all skip-worktree by a single sparse directory entry
+ * recording its tree (see S_ISSPARSEDIR()).
+ *
+ * Nothing happens unless index.sparse is set and the worktree uses a
+ * cone-mode sparse-checkout, or when the index cannot be collapsed
+ * (split index, unmerged or intent-to-add entries). Returns 0 when the
+ * index was left alone or converted, and -1 on error.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Replace every sparse directory entry by the entries of the tree it
+ * records, so that the index lists every path again.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Expand the index unless "pl" is a set of cone-mode patterns that
+ * exclude every sparse directory of the index, i.e. unless applying
+ * "pl" leaves all of them outside of the worktree.
+ */
+void ensure_full_index_for_patterns(struct index_state *istate,
+				    struct pattern_list *pl);
+
+#endif
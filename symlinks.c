@@ -272,6 +272,15 @@ static int threaded_has_dirs_only_path(struct cache_def *cache, const char *name
 		FL_DIR;
 }
 
+/*
+ * Forget everything the default lstat cache has learned, e.g. because
+ * the directories it describes may have been replaced behind its back.
+ */
+void invalidate_lstat_cache(void)
+{
+	reset_lstat_cache(&default_cache);
+}
+
 static struct strbuf removal = STRBUF_INIT;
 
 static void do_remove_scheduled_dirs(int new_len)
@@ -0,0 +1,47 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "fsmonitor-ipc.h"
+
+static const char *usage_str =
+"test-tool fsmonitor-client (is-supported | now | query <since>)";
+
+int cmd__fsmonitor_client(int argc, const char **argv)
+{
+	struct strbuf answer = STRBUF_INIT;
+	uintmax_t since;
+	char *end;
+	size_t i;
+
+	if (argc < 2)
+		usage(usage_str);
+
+	if (!strcmp(argv[1], "is-supported"))
+		return !fsmonitor_ipc_is_supported();
+
+	if (!strcmp(argv[1], "now")) {
+		printf("%"PRIuMAX"\n", (uintmax_t)getnanotime());
+		return 0;
+	}
+
+	if (strcmp(argv[1], "query") || argc != 3)
+		usage(usage_str);
+
+	since = strtoumax(argv[2], &end, 10);
+	if (*end)
+		die("not a timestamp: '%s'", argv[2]);
+
+	setup_git_directory();
+	if (fsmonitor_ipc_send_query(since, &answer) < 0)
+		die_errno("could not query fsmonitor--daemon");
+
+	/* Show one path per line. */
+	for (i = 0; i < answer.len; i++)
+		if (!answer.buf[i])
+			answer.buf[i] = '\n';
+	fwrite(answer.buf, 1, answer.len, stdout);
+	if (answer.len && answer.buf[answer.len - 1] != '\n')
+		putchar('\n');
+
+	strbuf_release(&answer);
+	return 0;
+}
@@ -0,0 +1,87 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "commit.h"
+#include "merge-incore.h"
+#include "merge-recursive.h"
+
+static void print_result(struct merge_incore_result *result)
+{
+	int i, j;
+
+	printf("%s\n", oid_to_hex(&result->tree->object.oid));
+	for (i = 0; i < result->conflicts_nr; i++) {
+		struct merge_conflict *c = &result->conflicts[i];
+
+		printf("%s %s\n", merge_conflict_type_name(c->type), c->path);
+		for (j = 0; j < 3; j++) {
+			if (!c->stages[j].mode)
+				continue;
+			printf("%06o %s %d\t%s\n", c->stages[j].mode,
+			       oid_to_hex(&c->stages[j].oid), j + 1,
+			       c->stages[j].path ? c->stages[j].path : c->path);
+		}
+	}
+}
+
+static struct commit *get_commit(const char *name)
+{
+	struct object_id oid;
+	struct commit *commit;
+
+	if (get_oid(name, &oid))
+		die("cannot parse %s as an object name", name);
+	commit = lookup_commit_reference(the_repository, &oid);
+	if (!commit)
+		die("not a commit %s", name);
+	return commit;
+}
+
+static struct tree *get_tree(const char *name)
+{
+	struct object_id oid;
+	struct tree *tree;
+
+	if (get_oid(name, &oid))
+		die("cannot parse %s as an object name", name);
+	tree = parse_tree_indirect(&oid);
+	if (!tree)
+		die("not a tree-ish %s", name);
+	return tree;
+}
+
+/*
+ * test-tool merge-incore recursive <side1> <side2>
+ * test-tool merge-incore nonrecursive <base> <side1> <side2>
+ */
+int cmd__merge_incore(int argc, const char **argv)
+{
+	struct merge_options opt;
+	struct merge_incore_result result;
+	int clean;
+
+	setup_git_directory();
+	init_merge_options(&opt, the_repository);
+
+	if (argc == 4 && !strcmp(argv[1], "recursive")) {
+		opt.branch1 = argv[2];
+		opt.branch2 = argv[3];
+		clean = merge_incore_recursive(&opt, NULL, get_commit(argv[2]),
+					       get_commit(argv[3]), &result);
+	} else if (argc == 5 && !strcmp(argv[1], "nonrecursive")) {
+		opt.ancestor = argv[2];
+		opt.branch1 = argv[3];
+		opt.branch2 = argv[4];
+		clean = merge_incore_nonrecursive(&opt, get_tree(argv[2]),
+						  get_tree(argv[3]),
+						  get_tree(argv[4]), &result);
+	} else {
+		die("usage: test-tool merge-incore "
+		    "(recursive <side1> | nonrecursive <base> <side1>) <side2>");
+	}
+
+	if (clean < 0)
+		return 128;
+	print_result(&result);
+	merge_incore_result_release(&result);
+	return !clean;
+}
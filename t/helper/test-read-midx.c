@@ -30,6 +30,8 @@ static int read_midx_file(const char *object_dir)
 		printf(" object-offsets");
 	if (m->chunk_large_offsets)
 		printf(" large-offsets");
+	if (m->chunk_revindex)
+		printf(" pack-order");
 
 	printf("\nnum_objects: %d\n", m->num_objects);
 
@@ -42,10 +44,35 @@ static int read_midx_file(const char *object_dir)
 	return 0;
 }
 
+static int read_midx_checksum(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+
+	if (!m)
+		return 1;
+	printf("%s\n", hash_to_hex(get_midx_checksum(m)));
+	return 0;
+}
+
+static int read_midx_preferred_pack(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+
+	if (!m || !m->chunk_revindex || !m->num_objects)
+		return 1;
+	printf("%s\n", m->pack_names[nth_midxed_pack_int_id(m,
+					nth_midxed_pack_order(m, 0))]);
+	return 0;
+}
+
 int cmd__read_midx(int argc, const char **argv)
 {
+	if (argc == 3 && !strcmp(argv[1], "--checksum"))
+		return read_midx_checksum(argv[2]);
+	if (argc == 3 && !strcmp(argv[1], "--preferred-pack"))
+		return read_midx_preferred_pack(argv[2]);
 	if (argc != 2)
-		usage("read-midx <object-dir>");
+		usage("read-midx [--checksum | --preferred-pack] <object-dir>");
 
 	return read_midx_file(argv[1]);
 }
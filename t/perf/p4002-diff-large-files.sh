@@ -0,0 +1,40 @@
+#!/bin/sh
+
+test_description='Test diff performance on large generated files
+
+This mostly measures how fast xdiff splits the files into lines and
+hashes them, with and without the options ignoring whitespace.
+'
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	awk "BEGIN {
+		for (i = 0; i < 500000; i++)
+			printf \"\\t%d,  \\\"generated value %d\\\", /* %x */  \\n\", i, i * 7, i
+	}" >old &&
+	awk "{ print } NR % 5000 == 0 { print \"inserted line \" NR }" \
+		<old >new &&
+	sed -e "s/  */ /g" <new >new-spaces
+'
+
+for opts in '' '--ignore-space-at-eol' '--ignore-space-change' \
+	'--ignore-all-space' '--ignore-cr-at-eol'
+do
+	test_perf "diff --no-index $opts" "
+		test_expect_code 1 git diff --no-index $opts old new >/dev/null
+	"
+done
+
+test_perf 'diff --no-index --ignore-space-change (whitespace changes)' '
+	test_expect_code 1 git diff --no-index --ignore-space-change \
+		old new-spaces >/dev/null
+'
+
+test_perf 'diff --no-index --histogram' '
+	test_expect_code 1 git diff --no-index --histogram old new >/dev/null
+'
+
+test_done
@@ -0,0 +1,35 @@
+#!/bin/sh
+
+test_description="Tests archive compression performance"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup' '
+	git config tar.tgz.command "git archive gzip"
+'
+
+test_perf 'archive tar' '
+	git archive --format=tar HEAD >out.tar
+'
+
+test_perf 'archive tgz with gzip(1)' '
+	git -c tar.tgz.command="gzip -cn" archive --format=tgz HEAD >out.tgz
+'
+
+for threads in 1 2 4 8
+do
+	test_perf "archive tgz, $threads threads" "
+		git archive --threads=$threads --format=tgz HEAD >out.tgz
+	"
+done
+
+for threads in 1 2 4 8
+do
+	test_perf "archive zip, $threads threads" "
+		git archive --threads=$threads --format=zip HEAD >out.zip
+	"
+done
+
+test_done
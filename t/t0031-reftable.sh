@@ -0,0 +1,229 @@
+#!/bin/sh
+
+test_description='reftable reference backend'
+
+. ./test-lib.sh
+
+INVALID_OID=$(test_oid 001)
+
+test_expect_success 'init --ref-storage=reftable' '
+	git init --ref-storage=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_missing repo/.git/refs/heads &&
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown reference storage format' '
+	test_must_fail git init --ref-storage=bogus bogus 2>err &&
+	test_i18ngrep "unknown reference storage format" err
+'
+
+test_expect_success 'reinit with a different format' '
+	test_must_fail git init --ref-storage=files repo 2>err &&
+	test_i18ngrep "different reference storage format" err &&
+	git init repo &&
+	git init --ref-storage=reftable repo
+'
+
+test_expect_success 'HEAD is a symref to master' '
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commit and read back' '
+	test_commit -C repo first &&
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse refs/heads/master >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/.git/refs/heads/master &&
+	test_path_is_missing repo/.git/packed-refs
+'
+
+test_expect_success 'update-ref and for-each-ref' '
+	test_commit -C repo second &&
+	git -C repo update-ref refs/heads/other first &&
+	git -C repo update-ref refs/heads/a/b second &&
+	git -C repo for-each-ref --format="%(objectname) %(refname)" \
+		refs/heads/ >actual &&
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse second) refs/heads/a/b
+	$(git -C repo rev-parse second) refs/heads/master
+	$(git -C repo rev-parse first) refs/heads/other
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'old value is checked' '
+	test_must_fail git -C repo update-ref refs/heads/other second second &&
+	git -C repo update-ref refs/heads/other second first
+'
+
+test_expect_success 'D/F conflicts are detected' '
+	test_must_fail git -C repo update-ref refs/heads/a second &&
+	test_must_fail git -C repo update-ref refs/heads/other/x second
+'
+
+test_expect_success 'nonexistent objects are rejected' '
+	test_must_fail git -C repo update-ref refs/heads/bad $INVALID_OID
+'
+
+test_expect_success 'delete a reference' '
+	git -C repo update-ref -d refs/heads/a/b &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/a/b &&
+	git -C repo update-ref refs/heads/a second
+'
+
+test_expect_success 'annotated tags are peeled' '
+	git -C repo tag -a -m tag annotated first &&
+	git -C repo rev-parse first >expect &&
+	git -C repo for-each-ref --format="%(*objectname)" refs/tags/annotated >actual &&
+	test_cmp expect actual &&
+	git -C repo show-ref -d annotated >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'reflogs' '
+	git -C repo reflog show --format="%gs" master >actual &&
+	cat >expect <<-\EOF &&
+	commit: second
+	commit (initial): first
+	EOF
+	test_cmp expect actual &&
+	git -C repo reflog show --format="%gs" HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse master@{1} >actual &&
+	git -C repo rev-parse first >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'branch rename moves the reflog' '
+	git -C repo branch -m other renamed &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/other &&
+	git -C repo reflog exists refs/heads/renamed &&
+	test_must_fail git -C repo reflog exists refs/heads/other &&
+	git -C repo reflog show --format="%gs" renamed >actual &&
+	test_i18ngrep "renamed refs/heads/other to refs/heads/renamed" actual
+'
+
+test_expect_success 'deleting a branch deletes its reflog' '
+	git -C repo branch -D renamed &&
+	test_must_fail git -C repo reflog exists refs/heads/renamed
+'
+
+test_expect_success 'checkout updates HEAD and its reflog' '
+	git -C repo checkout -b topic first &&
+	echo refs/heads/topic >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show --format="%gs" -1 HEAD >actual &&
+	echo "checkout: moving from master to topic" >expect &&
+	test_cmp expect actual &&
+	git -C repo checkout master
+'
+
+test_expect_success 'stash uses the reflog' '
+	echo change >repo/first.t &&
+	git -C repo stash &&
+	echo change2 >repo/first.t &&
+	git -C repo stash &&
+	git -C repo stash list >actual &&
+	test_line_count = 2 actual &&
+	git -C repo stash drop &&
+	git -C repo stash list >actual &&
+	test_line_count = 1 actual &&
+	git -C repo stash pop &&
+	git -C repo checkout first.t &&
+	test_must_fail git -C repo rev-parse --verify refs/stash
+'
+
+test_expect_success 'reflog expire' '
+	git -C repo reflog expire --expire=all refs/heads/master &&
+	git -C repo reflog show refs/heads/master >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'pseudorefs stay files' '
+	git -C repo update-ref ORIG_HEAD first &&
+	test_path_is_file repo/.git/ORIG_HEAD &&
+	git -C repo rev-parse first >expect &&
+	git -C repo rev-parse ORIG_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many updates keep the stack short' '
+	for i in $(test_seq 1 50)
+	do
+		git -C repo update-ref refs/heads/branch-$i first || return 1
+	done &&
+	test_line_count -lt 10 repo/.git/reftable/tables.list &&
+	git -C repo for-each-ref refs/heads/branch-* >actual &&
+	test_line_count = 50 actual
+'
+
+test_expect_success 'pack-refs compacts the stack' '
+	git -C repo pack-refs --all &&
+	test_line_count = 1 repo/.git/reftable/tables.list &&
+	ls repo/.git/reftable >actual &&
+	test_line_count = 2 actual &&
+	git -C repo for-each-ref refs/heads/branch-* >actual &&
+	test_line_count = 50 actual
+'
+
+test_expect_success 'many references in one table' '
+	test_seq 1 2000 |
+	sed "s,.*,create refs/tags/t& $(git -C repo rev-parse first)," |
+	git -C repo update-ref --stdin &&
+	git -C repo for-each-ref refs/tags/t* >actual &&
+	test_line_count = 2000 actual &&
+	git -C repo rev-parse --verify refs/tags/t1000 &&
+	test_must_fail git -C repo rev-parse --verify refs/tags/t2001 &&
+	git -C repo for-each-ref refs/tags/t1999 >actual &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'gc and fsck' '
+	git -C repo gc &&
+	git -C repo fsck &&
+	git -C repo rev-parse --verify refs/tags/t1000
+'
+
+test_expect_success 'worktrees have their own HEAD' '
+	git -C repo worktree add ../wt topic &&
+	echo refs/heads/topic >expect &&
+	git -C wt symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual &&
+	test_commit -C wt in-worktree &&
+	git -C repo rev-parse in-worktree >expect &&
+	git -C repo rev-parse topic >actual &&
+	test_cmp expect actual &&
+	git -C wt rev-parse main-worktree/HEAD >actual &&
+	git -C repo rev-parse HEAD >expect &&
+	test_cmp expect actual &&
+	git -C repo worktree list >actual &&
+	grep "\[topic\]" actual
+'
+
+test_expect_success 'clone --ref-storage=reftable' '
+	git clone --ref-storage=reftable repo clone &&
+	echo reftable >expect &&
+	git -C clone config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	git -C clone rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_done
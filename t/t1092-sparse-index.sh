@@ -0,0 +1,148 @@
+#!/bin/sh
+
+test_description='compare full and sparse index in a sparse checkout'
+
+. ./test-lib.sh
+
+GIT_TEST_SPARSE_INDEX=0
+export GIT_TEST_SPARSE_INDEX
+
+# Run the same command in the full and sparse clones and compare
+# what it says.
+test_all_match () {
+	(
+		cd full-checkout &&
+		"$@" >../full-out 2>../full-err
+	) &&
+	(
+		cd sparse-index &&
+		"$@" >../sparse-out 2>../sparse-err
+	) &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+sparse_dirs () {
+	test-tool -C "$1" read-cache --table >cache &&
+	grep "^040000 tree" cache | cut -f2
+}
+
+test_expect_success 'setup' '
+	git init initial-repo &&
+	(
+		cd initial-repo &&
+		echo a >a &&
+		echo "after deep" >e &&
+		mkdir folder1 folder2 deep x &&
+		mkdir deep/deeper1 deep/deeper2 &&
+		mkdir deep/deeper1/deepest &&
+		cp a folder1 &&
+		cp a folder2 &&
+		cp a x &&
+		cp a deep &&
+		cp a deep/deeper1 &&
+		cp a deep/deeper2 &&
+		cp a deep/deeper1/deepest &&
+		git add . &&
+		git commit -m "initial commit" &&
+		git checkout -b base &&
+		echo changed >>deep/deeper1/a &&
+		echo changed >>folder1/a &&
+		git commit -a -m "change inside and outside of the cone" &&
+		git checkout master
+	) &&
+	git clone --no-checkout initial-repo full-checkout &&
+	git -C full-checkout checkout master &&
+	git clone --no-checkout initial-repo sparse-index &&
+	(
+		cd sparse-index &&
+		git sparse-checkout init --cone --sparse-index &&
+		git sparse-checkout set deep &&
+		git checkout master
+	)
+'
+
+test_expect_success 'out-of-cone directories are collapsed' '
+	sparse_dirs sparse-index >actual &&
+	cat >expect <<-\EOF &&
+	folder1/
+	folder2/
+	x/
+	EOF
+	test_cmp expect actual &&
+	git -C sparse-index rev-parse HEAD:folder1 >expect &&
+	grep "	folder1/\$" cache | cut -d" " -f3 | cut -f1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'sparse index keeps the out-of-cone paths' '
+	git -C full-checkout ls-files >expect &&
+	git -C sparse-index ls-files >actual &&
+	test_cmp expect actual &&
+	git -C sparse-index sparse-checkout list >actual &&
+	echo deep >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache-tree of a sparse index' '
+	git -C full-checkout write-tree >expect &&
+	git -C sparse-index write-tree >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'status' '
+	test_all_match git status --porcelain=v2 &&
+	echo extra >>full-checkout/deep/a &&
+	echo extra >>sparse-index/deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	sparse_dirs sparse-index >actual &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'add and commit inside the cone' '
+	test_all_match git add deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -m "modify deep/a" &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	sparse_dirs sparse-index >actual &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'checkout between branches' '
+	test_all_match git checkout base &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	test_all_match git diff --cached --stat master &&
+	test_all_match git checkout master &&
+	test_all_match git status --porcelain=v2 &&
+	sparse_dirs sparse-index >actual &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'reset --hard expands the index and stays correct' '
+	test_all_match git reset --hard base &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git ls-files -s &&
+	test_all_match git reset --hard master
+'
+
+test_expect_success 'expanding the cone expands the index' '
+	git -C sparse-index sparse-checkout set deep folder1 &&
+	test_path_is_file sparse-index/folder1/a &&
+	sparse_dirs sparse-index >actual &&
+	cat >expect <<-\EOF &&
+	folder2/
+	x/
+	EOF
+	test_cmp expect actual &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'sparse-checkout init --no-sparse-index' '
+	git -C sparse-index sparse-checkout init --cone --no-sparse-index &&
+	sparse_dirs sparse-index >actual &&
+	test_must_be_empty actual &&
+	test_all_match git ls-files -s
+'
+
+test_done
@@ -816,4 +816,44 @@ test_expect_success 'detect corrupt index file in fsck' '
 	test_i18ngrep "bad index file" errors
 '
 
+test_expect_success 'setup: repository with a large pack' '
+	git init threaded &&
+	(
+		cd threaded &&
+		test_commit_bulk --filename=file-%s.t 300 &&
+		git repack -ad &&
+		for i in 1 2 3 4 5
+		do
+			test_commit loose-$i || return 1
+		done &&
+		git count-objects -v >count &&
+		! grep "^count: 0" count
+	)
+'
+
+test_expect_success 'fsck --threads agrees with a single thread' '
+	(
+		cd threaded &&
+		git fsck --threads=1 --unreachable >expect 2>&1 &&
+		git fsck --threads=4 --unreachable >actual 2>&1 &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'fsck --threads finds a corrupt object in a large pack' '
+	(
+		cd threaded &&
+		pack=$(echo .git/objects/pack/*.pack) &&
+		blob=$(git rev-parse HEAD~100:file-200.t) &&
+		ofs=$(git show-index <${pack%.pack}.idx | grep $blob | cut -d" " -f1) &&
+		chmod +w $pack &&
+		printf "\377\377\377" |
+		dd of=$pack bs=1 conv=notrunc seek=$(($ofs + 3)) &&
+		test_must_fail git fsck --threads=1 2>err.1 &&
+		test_must_fail git fsck --threads=4 2>err.4 &&
+		grep "$blob" err.1 &&
+		grep "$blob" err.4
+	)
+'
+
 test_done
@@ -0,0 +1,173 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Ensure that parallel-checkout basically works on clone, switch and
+reset, writing the same working tree and index stat data as the
+sequential code, and that it falls back to sequential checkout for
+entries it cannot handle.
+'
+
+. ./test-lib.sh
+
+# The tests below choose the number of workers themselves.
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Runs "$@" with parallel checkout forced to <workers> workers and no
+# threshold, and checks in the trace2 output that the workers were used.
+test_checkout_workers () {
+	workers=$1 &&
+	shift &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c checkout.workers=$workers \
+		    -c checkout.thresholdForParallelism=0 "$@" &&
+	grep "\"key\":\"parallel-checkout/workers\",\"value\":\"$workers\"" trace
+}
+
+# Compares the working trees and index stat data of two clones.
+test_cmp_worktrees () {
+	(cd "$1" && git ls-files -s && git status --porcelain) >expect &&
+	(cd "$2" && git ls-files -s && git status --porcelain) >actual &&
+	test_cmp expect actual &&
+	(cd "$2" && git diff-files --quiet) &&
+	for f in $(cd "$1" && git ls-files)
+	do
+		if test -h "$1/$f"
+		then
+			test -h "$2/$f" &&
+			test "$(test_readlink "$1/$f")" = "$(test_readlink "$2/$f")" ||
+			return 1
+		else
+			test_cmp "$1/$f" "$2/$f" ||
+			return 1
+		fi
+	done
+}
+
+test_readlink () {
+	perl -le 'print readlink($_) for @ARGV' "$@"
+}
+
+test_expect_success 'setup repo' '
+	git init src &&
+	(
+		cd src &&
+		for d in a b c d/e
+		do
+			mkdir -p $d &&
+			for i in $(test_seq 1 30)
+			do
+				echo "$d $i" >$d/file$i || return 1
+			done
+		done &&
+		printf "one\ntwo\n" >crlf.txt &&
+		echo "\$Id\$" >ident.txt &&
+		printf "#!/bin/sh\n" >script &&
+		chmod +x script &&
+		cat >.gitattributes <<-\EOF &&
+		crlf.txt text eol=crlf
+		ident.txt ident
+		smudged.txt filter=rot13
+		EOF
+		echo abc >smudged.txt &&
+		git add . &&
+		git update-index --chmod=+x script &&
+		git commit -m initial &&
+
+		git checkout -b other &&
+		git rm -r a &&
+		for i in $(test_seq 1 30)
+		do
+			echo "changed $i" >b/file$i || return 1
+		done &&
+		mkdir a &&
+		echo "now a file" >a/new &&
+		git add . &&
+		git commit -m other &&
+		git checkout master
+	)
+'
+
+test_expect_success 'sequential clone' '
+	git -c checkout.workers=1 clone src seq &&
+	git -C seq checkout -q other &&
+	git -C seq checkout -q master
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 clone src parallel &&
+	test_cmp_worktrees seq parallel
+'
+
+test_expect_success 'parallel switch' '
+	test_checkout_workers 2 -C parallel checkout other &&
+	git -C seq checkout other &&
+	test_cmp_worktrees seq parallel &&
+	test_checkout_workers 2 -C parallel checkout master &&
+	git -C seq checkout master &&
+	test_cmp_worktrees seq parallel
+'
+
+test_expect_success 'parallel reset --hard' '
+	rm -rf parallel/b parallel/d &&
+	echo dirty >parallel/a/file1 &&
+	test_checkout_workers 2 -C parallel reset --hard &&
+	test_cmp_worktrees seq parallel
+'
+
+test_expect_success 'conversions are applied by the workers' '
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect parallel/crlf.txt &&
+	echo "\$Id: $(git -C src rev-parse HEAD:ident.txt) \$" >expect &&
+	test_cmp expect parallel/ident.txt &&
+	test -x parallel/script
+'
+
+test_expect_success 'entries with a smudge filter are written sequentially' '
+	test_config_global filter.rot13.smudge "tr a-z n-za-m" &&
+	git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+		clone src smudge &&
+	echo nop >expect &&
+	test_cmp expect smudge/smudged.txt
+'
+
+test_expect_success 'threshold falls back to sequential checkout' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c checkout.workers=2 \
+		    -c checkout.thresholdForParallelism=1000 \
+		    clone src threshold &&
+	! grep "parallel-checkout/workers" trace &&
+	test_cmp_worktrees seq threshold
+'
+
+test_expect_success 'GIT_TEST_CHECKOUT_WORKERS overrides config' '
+	rm -f trace &&
+	GIT_TEST_CHECKOUT_WORKERS=3 GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c checkout.workers=1 clone src env &&
+	grep "\"key\":\"parallel-checkout/workers\",\"value\":\"3\"" trace &&
+	test_cmp_worktrees seq env
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are still detected' '
+	git init collide-src &&
+	(
+		cd collide-src &&
+		for i in $(test_seq 1 10)
+		do
+			echo $i >file$i || return 1
+		done &&
+		git hash-object -w -t blob --stdin </dev/null >../blob &&
+		git add . &&
+		git update-index --add --cacheinfo 100644,$(cat ../blob),FILE_X &&
+		git update-index --add --cacheinfo 100644,$(cat ../blob),file_x &&
+		git commit -m collide
+	) &&
+	GIT_TEST_CHECKOUT_WORKERS=2 git clone collide-src collide-clone 2>err &&
+	test_i18ngrep "the following paths have collided" err &&
+	grep FILE_X err &&
+	grep file_x err
+'
+
+test_done
@@ -262,4 +262,108 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'setup for renames beyond the rename limit' '
+	mkdir index &&
+	for i in $(test_seq 20)
+	do
+		for j in $(test_seq 20)
+		do
+			echo "line $j of file $i" || return 1
+		done >index/file$i || return 1
+	done &&
+	git add index &&
+	git commit -m "twenty files" &&
+	mkdir moved &&
+	for i in $(test_seq 20)
+	do
+		git mv index/file$i moved/renamed$i &&
+		echo "appended to file $i" >>moved/renamed$i || return 1
+	done &&
+	git add moved &&
+	git commit -m "move and edit twenty files"
+'
+
+test_expect_success 'renames are not found beyond the rename limit' '
+	git diff-tree -r -M -l5 --name-status HEAD^ HEAD >actual &&
+	! grep "^R" actual
+'
+
+test_expect_success 'diff.renameIndex finds renames beyond the rename limit' '
+	git diff-tree -r -M --name-status HEAD^ HEAD >expect &&
+	test_line_count = 20 expect &&
+	git -c diff.renameIndex=true diff-tree -r -M -l5 --name-status \
+		HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'inexact renames are found with threads' '
+	GIT_TEST_RENAME_THREADS=1 \
+		git diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'files keeping their basename are paired beyond the limit' '
+	git checkout -b basenames HEAD^ &&
+	git mv index moved &&
+	for i in $(test_seq 20)
+	do
+		echo "appended to file $i" >>moved/file$i || return 1
+	done &&
+	git add moved &&
+	git commit -m "move twenty files keeping their name" &&
+	git diff-tree -r -M -l1 --name-status HEAD^ HEAD >actual &&
+	grep "^R" actual >renames &&
+	test_line_count = 20 renames
+'
+
+test_expect_success 'files in renamed directories are paired beyond the limit' '
+	git checkout -b dirs HEAD^ &&
+	mkdir -p old/one old/two &&
+	for d in one two
+	do
+		for i in $(test_seq 10)
+		do
+			echo "line $i of $d/unique" || return 1
+		done >old/$d/unique-$d &&
+		for i in $(test_seq 10)
+		do
+			echo "line $i of $d/Makefile" || return 1
+		done >old/$d/Makefile || return 1
+	done &&
+	git add old &&
+	git commit -m "two directories" &&
+	git mv old new &&
+	echo more >>new/one/Makefile &&
+	echo more >>new/two/Makefile &&
+	git add new &&
+	git commit -m "move them" &&
+	git diff-tree -r -M -l1 --name-status HEAD^ HEAD >actual &&
+	grep "old/one/Makefile	new/one/Makefile" actual &&
+	grep "old/two/Makefile	new/two/Makefile" actual
+'
+
+test_expect_success LONG_IS_64BIT 'blobs too large to be renamed are not read' '
+	test_oid_cache <<-EOF &&
+	huge sha1:19f9c8273ec45a8938e6999cb59b3ff66739902a
+	huge sha256:3c666f798798601571f5cec0adb57ce4aba8546875e7693177e0535f34d2c49b
+	EOF
+	git init huge &&
+	(
+		cd huge &&
+		echo content >small &&
+		git add small &&
+		git commit -m small &&
+		obj=$(test_oid huge) &&
+		path=$(test_oid_to_path $obj) &&
+		mkdir -p .git/objects/$(dirname $path) &&
+		cp "$TEST_DIRECTORY"/t5000/huge-object .git/objects/$path &&
+		git rm -q small &&
+		git update-index --add --cacheinfo 100644,$obj,huge &&
+		git commit -m huge &&
+		printf "A\thuge\nD\tsmall\n" >expect &&
+		git diff -M --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
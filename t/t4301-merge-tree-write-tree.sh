@@ -0,0 +1,125 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i >letters &&
+	echo hello >greeting &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b side1 &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >numbers &&
+	git mv letters alphabet &&
+	echo hi >greeting &&
+	test_tick &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 base &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >numbers &&
+	test_write_lines a b c d e f g h eye >letters &&
+	test_tick &&
+	git commit -a -m side2 &&
+
+	git checkout -b side3 base &&
+	echo howdy >greeting &&
+	test_tick &&
+	git commit -a -m side3
+'
+
+test_expect_success 'clean merge' '
+	git checkout -b merged side1 &&
+	git merge side2 &&
+	git rev-parse merged^{tree} >expect &&
+	git merge-tree --write-tree side1 side2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'conflicted merge' '
+	test_expect_code 1 git merge-tree --write-tree side1 side3 >out &&
+	tree=$(head -n 1 out) &&
+	cat >expect <<-EOF &&
+	$tree
+	100644 $(git rev-parse base:greeting) 1	greeting
+	100644 $(git rev-parse side1:greeting) 2	greeting
+	100644 $(git rev-parse side3:greeting) 3	greeting
+
+	content	greeting
+	EOF
+	test_cmp expect out &&
+	git cat-file blob $tree:greeting >actual &&
+	cat >expect <<-\EOF &&
+	<<<<<<< side1
+	hi
+	=======
+	howdy
+	>>>>>>> side3
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'renamed stages are shown at their old path' '
+	git checkout -b delete base &&
+	git rm letters &&
+	test_tick &&
+	git commit -m delete &&
+	test_expect_code 1 git merge-tree --write-tree side1 delete >out &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse base:letters) 1	letters
+	100644 $(git rev-parse side1:alphabet) 2	alphabet
+
+	rename/delete	alphabet
+	EOF
+	tail -n +2 out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '-z terminates lines with NUL' '
+	test_expect_code 1 git merge-tree --write-tree -z side1 side3 >out &&
+	tr "\000" Q <out >actual &&
+	tree=$(git merge-tree --write-tree side1 side3 | head -n 1) &&
+	printf "%sQ" "$tree" \
+		"100644 $(git rev-parse base:greeting) 1	greeting" \
+		"100644 $(git rev-parse side1:greeting) 2	greeting" \
+		"100644 $(git rev-parse side3:greeting) 3	greeting" \
+		"" "content	greeting" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'works in a bare repository without an index' '
+	git clone --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	git rev-parse merged^{tree} >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing bare.git/index
+'
+
+test_expect_success 'merges can run in parallel in one repository' '
+	for i in 1 2 3 4
+	do
+		git -C bare.git merge-tree --write-tree side1 side2 >out$i &
+	done &&
+	wait &&
+	for i in 1 2 3 4
+	do
+		test_cmp expect out$i || return 1
+	done
+'
+
+test_expect_success 'merge.conflictstyle is honored' '
+	test_expect_code 1 git -c merge.conflictstyle=diff3 \
+		merge-tree --write-tree side1 side3 >out &&
+	git cat-file blob $(head -n 1 out):greeting >actual &&
+	grep "^||||||| " actual
+'
+
+test_expect_success 'unknown revision' '
+	test_must_fail git merge-tree --write-tree side1 no-such-branch
+'
+
+test_done
@@ -333,6 +333,29 @@ test_expect_success GZIP 'remote tar.gz can be disabled' '
 		>remote.tar.gz
 '
 
+test_expect_success GZIP 'git archive --format=tgz with internal gzip' '
+	test_config tar.tgz.command "git archive gzip" &&
+	git archive --format=tgz HEAD >internal.tgz &&
+	gzip -d -c <internal.tgz >internal.tar &&
+	test_cmp_bin b.tar internal.tar
+'
+
+test_expect_success GZIP 'internal gzip output does not depend on --threads' '
+	git init big &&
+	test-tool genrandom big 3000000 >big/random &&
+	test_seq 100000 >big/seq &&
+	git -C big add . &&
+	git -C big commit -m big &&
+	git -C big archive --format=tar HEAD >big.tar &&
+	git -C big -c tar.tgz.command="git archive gzip" \
+		archive --threads=1 --format=tgz HEAD >big-1.tgz &&
+	git -C big -c tar.tgz.command="git archive gzip" \
+		archive --threads=4 --format=tgz HEAD >big-4.tgz &&
+	test_cmp_bin big-1.tgz big-4.tgz &&
+	gzip -d -c <big-4.tgz >big-4.tar &&
+	test_cmp_bin big.tar big-4.tar
+'
+
 test_expect_success 'archive and :(glob)' '
 	git archive -v HEAD -- ":(glob)**/sh" >/dev/null 2>actual &&
 	cat >expect <<EOF &&
@@ -188,4 +188,11 @@ test_expect_success 'git archive --format=zip on large files' '
 
 check_zip large-compressed
 
+test_expect_success 'git archive --format=zip does not depend on --threads' '
+	git archive --threads=1 --format=zip HEAD >threads-1.zip &&
+	git archive --threads=4 --format=zip HEAD >threads-4.zip &&
+	test_cmp_bin threads-1.zip threads-4.zip &&
+	test_cmp_bin d.zip threads-4.zip
+'
+
 test_done
@@ -92,6 +92,22 @@ rev_list_tests() {
 
 rev_list_tests 'full bitmap'
 
+test_expect_success 'full repack writes a lookup table' '
+	git config pack.writeBitmapLookupTable true &&
+	git repack -ad &&
+	git rev-list --test-bitmap HEAD &&
+	GIT_TEST_READ_BITMAP_LOOKUP_TABLE=0 git rev-list --test-bitmap HEAD
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'lookup table agrees with reading all bitmaps' '
+	git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
+	GIT_TEST_READ_BITMAP_LOOKUP_TABLE=0 \
+		git rev-list --use-bitmap-index --count HEAD~5..HEAD >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success 'clone from bitmapped repository' '
 	git clone --no-local --bare . clone.git &&
 	git rev-parse HEAD >expect &&
@@ -74,16 +74,16 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 
 graph_read_expect() {
 	OPTIONAL=""
-	NUM_CHUNKS=3
+	NUM_CHUNKS=4
 	if test ! -z $2
 	then
 		OPTIONAL=" $2"
-		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+		NUM_CHUNKS=$((4 + $(echo "$2" | wc -w)))
 	fi
 	cat >expect <<- EOF
 	header: 43475048 1 1 $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -392,7 +392,7 @@ GRAPH_BYTE_HASH=5
 GRAPH_BYTE_CHUNK_COUNT=6
 GRAPH_CHUNK_LOOKUP_OFFSET=8
 GRAPH_CHUNK_LOOKUP_WIDTH=12
-GRAPH_CHUNK_LOOKUP_ROWS=5
+GRAPH_CHUNK_LOOKUP_ROWS=6
 GRAPH_BYTE_OID_FANOUT_ID=$GRAPH_CHUNK_LOOKUP_OFFSET
 GRAPH_BYTE_OID_LOOKUP_ID=$(($GRAPH_CHUNK_LOOKUP_OFFSET + \
 			    1 * $GRAPH_CHUNK_LOOKUP_WIDTH))
@@ -413,8 +413,10 @@ GRAPH_BYTE_COMMIT_WRONG_PARENT=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 3))
 GRAPH_BYTE_COMMIT_GENERATION=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 11))
 GRAPH_BYTE_COMMIT_DATE=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 12))
 GRAPH_COMMIT_DATA_WIDTH=$(($HASH_LEN + 16))
-GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
-			     $GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
+				$GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_BYTE_GENERATION_DATA=$(($GRAPH_GENERATION_DATA_OFFSET + 3))
+GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_GENERATION_DATA_OFFSET + 4 * $NUM_COMMITS))
 GRAPH_BYTE_OCTOPUS=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4))
 GRAPH_BYTE_FOOTER=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4 * $NUM_OCTOPUS_EDGES))
 
@@ -555,6 +557,11 @@ test_expect_success 'detect incorrect generation number' '
 		"non-zero generation number"
 '
 
+test_expect_success 'detect incorrect corrected commit date' '
+	corrupt_graph_and_verify $GRAPH_BYTE_GENERATION_DATA "\01" \
+		"corrected commit date for commit"
+'
+
 test_expect_success 'detect incorrect commit date' '
 	corrupt_graph_and_verify $GRAPH_BYTE_COMMIT_DATE "\01" \
 		"commit date"
@@ -621,6 +628,53 @@ test_expect_success 'get_commit_tree_in_graph works for non-the_repository' '
 	test_cmp expect actual
 '
 
+test_expect_success 'commitGraph.generationVersion=1 writes no generation data' '
+	cd "$TRASH_DIRECTORY/full" &&
+	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+	test-tool read-graph >output &&
+	grep "^chunks:" output >actual &&
+	echo "chunks: oid_fanout oid_lookup commit_metadata extra_edges" >expect &&
+	test_cmp expect actual &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'generation version 1' full commits/8 merge/1
+
+test_expect_success 'setup commits with skewed dates' '
+	cd "$TRASH_DIRECTORY" &&
+	git init skew &&
+	cd skew &&
+	test_commit base &&
+	GIT_COMMITTER_DATE="@4102444800 +0000" git commit --allow-empty -m future &&
+	git branch future &&
+	GIT_COMMITTER_DATE="@1000000000 +0000" git commit --allow-empty -m past &&
+	test_commit after-past &&
+	git branch skewed &&
+	git checkout -b topic base &&
+	test_commit side &&
+	git merge -m merge skewed &&
+	git branch merged
+'
+
+test_expect_success 'corrected commit dates overflowing 31 bits' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	git commit-graph write --reachable &&
+	test-tool read-graph >output &&
+	grep "^chunks: .* generation_data generation_data_overflow" output &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'skewed dates' skew merged future
+graph_git_behavior 'skewed dates, topic' skew topic skewed
+
+test_expect_success 'reachability queries with skewed dates' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	graph_git_two_modes "branch --contains future" &&
+	graph_git_two_modes "branch --merged topic" &&
+	graph_git_two_modes "tag --contains base" &&
+	graph_git_two_modes "rev-list --topo-order merged"
+'
+
 test_expect_success 'corrupt commit-graph write (broken parent)' '
 	rm -rf repo &&
 	git init repo &&
@@ -13,11 +13,11 @@ test_expect_success 'setup repo' '
 	graphdir="$infodir/commit-graphs" &&
 	test_oid_init &&
 	test_oid_cache <<-EOM
-	shallow sha1:1760
-	shallow sha256:2064
+	shallow sha1:1812
+	shallow sha256:2116
 
-	base sha1:1376
-	base sha256:1496
+	base sha1:1404
+	base sha256:1524
 	EOM
 '
 
@@ -28,9 +28,9 @@ graph_read_expect() {
 		NUM_BASE=$2
 	fi
 	cat >expect <<- EOF
-	header: 43475048 1 1 3 $NUM_BASE
+	header: 43475048 1 1 4 $NUM_BASE
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata
+	chunks: oid_fanout oid_lookup commit_metadata generation_data
 	EOF
 	test-tool read-graph >output &&
 	test_cmp expect output
@@ -335,6 +335,30 @@ test_expect_success 'add octopus merge' '
 
 graph_git_behavior 'graph exists' merge/octopus commits/12
 
+test_expect_success 'chain with and without generation data' '
+	git clone --no-hardlinks . mixed &&
+	(
+		cd mixed &&
+		rm -rf .git/objects/info/commit-graph $graphdir &&
+		git -c commitGraph.generationVersion=1 \
+			commit-graph write --reachable --split &&
+		test_commit mixed-1 &&
+		git commit-graph write --reachable --split &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		git commit-graph verify &&
+		git -c core.commitGraph=true log --topo-order --format=%H >actual &&
+		git -c core.commitGraph=false log --topo-order --format=%H >expect &&
+		test_cmp expect actual &&
+		test_commit mixed-2 &&
+		git commit-graph write --reachable --split --size-multiple=1000 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		git commit-graph verify &&
+		git -c core.commitGraph=true log --topo-order --format=%H >actual &&
+		git -c core.commitGraph=false log --topo-order --format=%H >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success 'split across alternate where alternate is not split' '
 	git commit-graph write --reachable &&
 	test_path_is_file .git/objects/info/commit-graph &&
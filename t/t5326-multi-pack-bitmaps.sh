@@ -0,0 +1,151 @@
+#!/bin/sh
+
+test_description='exercise basic multi-pack bitmap functionality'
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+export GIT_TEST_MULTI_PACK_INDEX
+
+midx_checksum () {
+	test-tool read-midx --checksum "$1"
+}
+
+midx_bitmaps () {
+	find .git/objects/pack -name "multi-pack-index-*.bitmap" >"$1"
+}
+
+test_expect_success 'setup repo with several packs' '
+	git config core.multiPackIndex true &&
+	test_commit_bulk --id=file 50 &&
+	git repack -d &&
+	git checkout -b other HEAD~5 &&
+	test_commit_bulk --id=side 10 &&
+	git repack -d &&
+	git checkout master &&
+	test_commit_bulk --id=more 10 &&
+	git repack -d &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'write multi-pack-index with a bitmap' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	midx_bitmaps bitmaps &&
+	test_line_count = 1 bitmaps &&
+	test_path_is_file .git/objects/pack/multi-pack-index-$(midx_checksum .git/objects).bitmap
+'
+
+test_expect_success 'multi-pack-index has a reverse index chunk' '
+	test-tool read-midx .git/objects >midx-info &&
+	grep "^chunks:.* pack-order" midx-info
+'
+
+test_expect_success 'rev-list --test-bitmap verifies bitmaps' '
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out
+'
+
+test_expect_success 'counting commits via bitmap' '
+	git rev-list --count HEAD >expect &&
+	git rev-list --use-bitmap-index --count HEAD >actual &&
+	test_cmp expect actual &&
+	git rev-list --count other...master >expect &&
+	git rev-list --use-bitmap-index --count other...master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'enumerate --objects via bitmap' '
+	git rev-list --objects --all >tmp &&
+	cut -d" " -f1 <tmp | sort >expect &&
+	git rev-list --objects --use-bitmap-index --all >tmp &&
+	cut -d" " -f1 <tmp | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'multi-pack bitmap with a lookup table' '
+	git -c pack.writeBitmapLookupTable=true multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD 2>out &&
+	grep "^OK!" out &&
+	git rev-list --count other...master >expect &&
+	git rev-list --use-bitmap-index --count other...master >actual &&
+	test_cmp expect actual &&
+	git rev-list --objects --all >tmp &&
+	cut -d" " -f1 <tmp | sort >expect &&
+	git rev-list --objects --use-bitmap-index --all >tmp &&
+	cut -d" " -f1 <tmp | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --use-bitmap-index produces a complete pack' '
+	git pack-objects --all --stdout --use-bitmap-index </dev/null >all.pack &&
+	git init --bare unpack.git &&
+	git -C unpack.git index-pack --stdin <all.pack &&
+	git rev-list --objects --all >tmp &&
+	cut -d" " -f1 <tmp | sort >expect &&
+	git -C unpack.git cat-file --batch-all-objects --batch-check="%(objectname)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git rev-parse --all >expect &&
+	git -C clone.git rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental fetch uses the bitmap' '
+	git clone --no-local . partial &&
+	git -C partial reset --hard HEAD~3 &&
+	git -C partial fetch origin &&
+	git -C partial fsck
+'
+
+test_expect_success 'honor --preferred-pack' '
+	smallest=$(ls -S .git/objects/pack/*.pack | tail -n 1) &&
+	git multi-pack-index write --bitmap \
+		--preferred-pack=$(basename $smallest) &&
+	git rev-list --test-bitmap HEAD &&
+	test-tool read-midx --preferred-pack .git/objects >actual &&
+	echo "$(basename $smallest .pack).idx" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown --preferred-pack is an error' '
+	test_must_fail git multi-pack-index write --bitmap \
+		--preferred-pack=pack-does-not-exist.pack 2>err &&
+	test_i18ngrep "unknown preferred pack" err
+'
+
+test_expect_success 'rewriting the multi-pack-index removes stale bitmaps' '
+	old=$(ls .git/objects/pack/multi-pack-index-*.bitmap) &&
+	test_commit stale &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	test_path_is_missing $old &&
+	midx_bitmaps bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'writing without --bitmap removes the bitmap' '
+	test_commit no-bitmap &&
+	git repack -d &&
+	git multi-pack-index write &&
+	midx_bitmaps bitmaps &&
+	test_line_count = 0 bitmaps
+'
+
+test_expect_success 'refs pointing outside of the midx are not bitmapped' '
+	test_commit loose &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD~1 &&
+	git rev-list --count HEAD >expect &&
+	git rev-list --use-bitmap-index --count HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_done
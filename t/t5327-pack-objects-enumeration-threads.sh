@@ -0,0 +1,121 @@
+#!/bin/sh
+
+test_description='pack-objects enumerating objects with several threads'
+
+. ./test-lib.sh
+
+# Packs must not depend on the number of enumeration threads; use a
+# single delta search thread so that they are reproducible.
+pack () {
+	threads=$1 &&
+	shift &&
+	git pack-objects --revs --stdout --threads=1 \
+		--enumeration-threads=$threads "$@"
+}
+
+test_expect_success 'setup' '
+	mkdir -p a/b/c d &&
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >a/file$i &&
+		echo "nested $i" >a/b/c/file$i &&
+		echo "shared $i" >d/file$((i % 5)) &&
+		git add a d &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git mv a e &&
+	git commit -q -m rename &&
+	cp -R d f &&
+	git add f &&
+	git commit -q -m copy &&
+	git tag -a -m tag v1 HEAD~5
+'
+
+test_expect_success 'full pack is the same with threads' '
+	printf "HEAD\nv1\n" >revs &&
+	pack 1 <revs >one.pack &&
+	(
+		GIT_TRACE2_EVENT="$(pwd)/trace" &&
+		export GIT_TRACE2_EVENT &&
+		pack 4 <revs >four.pack
+	) &&
+	grep "\"key\":\"parallel/threads\",\"value\":\"4\"" trace &&
+	test_cmp_bin one.pack four.pack &&
+	git index-pack -o four.idx four.pack &&
+	git rev-list --objects HEAD v1 >expect &&
+	test_line_count = $(git show-index <four.idx | wc -l) expect
+'
+
+test_expect_success 'incremental pack is the same with threads' '
+	printf "HEAD\n--not\nHEAD~10\n" >revs &&
+	pack 1 <revs >one.pack &&
+	pack 3 <revs >three.pack &&
+	test_cmp_bin one.pack three.pack &&
+	pack 0 --thin <revs >auto.pack &&
+	pack 1 --thin <revs >one.pack &&
+	test_cmp_bin one.pack auto.pack
+'
+
+test_expect_success 'single commit is split into subtrees' '
+	echo HEAD >revs &&
+	pack 1 --no-reuse-object <revs >one.pack &&
+	(
+		GIT_TRACE2_EVENT="$(pwd)/trace" &&
+		export GIT_TRACE2_EVENT &&
+		pack 8 --no-reuse-object <revs >eight.pack
+	) &&
+	test_cmp_bin one.pack eight.pack &&
+	grep "\"key\":\"parallel/threads\",\"value\":\"8\"" trace
+'
+
+test_expect_success 'trees and blobs given on the command line' '
+	printf "HEAD:e\nHEAD:d/file1\nHEAD~3\n" >revs &&
+	pack 1 <revs >one.pack &&
+	pack 2 <revs >two.pack &&
+	test_cmp_bin one.pack two.pack
+'
+
+test_expect_success 'blob:none filter' '
+	echo HEAD >revs &&
+	pack 1 --filter=blob:none <revs >one.pack &&
+	pack 4 --filter=blob:none <revs >four.pack &&
+	test_cmp_bin one.pack four.pack &&
+	git index-pack -o four.idx four.pack &&
+	git verify-pack -v four.idx >verify &&
+	! grep blob verify &&
+	printf "HEAD\nHEAD:d/file1\n" >revs &&
+	pack 1 --filter=blob:none <revs >one.pack &&
+	pack 4 --filter=blob:none <revs >four.pack &&
+	test_cmp_bin one.pack four.pack &&
+	git index-pack -o four.idx four.pack &&
+	git verify-pack -v four.idx >verify &&
+	grep $(git rev-parse HEAD:d/file1) verify
+'
+
+test_expect_success 'pack.enumerationThreads' '
+	echo HEAD >revs &&
+	pack 1 <revs >one.pack &&
+	git -c pack.enumerationThreads=4 pack-objects --revs --stdout \
+		--threads=1 <revs >four.pack &&
+	test_cmp_bin one.pack four.pack
+'
+
+test_expect_success 'missing tree is an error' '
+	git init broken &&
+	(
+		cd broken &&
+		mkdir dir &&
+		echo content >dir/file &&
+		git add dir &&
+		git commit -q -m broken &&
+		tree=$(git rev-parse HEAD:dir) &&
+		rm .git/objects/$(test_oid_to_path $tree) &&
+		echo HEAD >revs &&
+		test_must_fail git pack-objects --revs --stdout \
+			--enumeration-threads=2 <revs >/dev/null 2>err &&
+		test_i18ngrep "bad tree object $tree" err
+	)
+'
+
+test_done
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='upload-pack serves repeated requests from its pack cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	write_script "$TRASH_DIRECTORY/hook" <<-EOF &&
+	echo run >>"$TRASH_DIRECTORY/pack-objects.log"
+	exec "\$@"
+	EOF
+	git config --global uploadpack.packObjectsHook \
+		"\"$TRASH_DIRECTORY/hook\"" &&
+	git config uploadpack.packCache true
+'
+
+pack_objects_runs () {
+	if test -f pack-objects.log
+	then
+		test_line_count = "$1" pack-objects.log
+	else
+		test "$1" = 0
+	fi
+}
+
+cache_entries () {
+	ls .git/upload-pack-cache | grep "\.pack$"
+}
+
+test_expect_success 'first clone fills the cache' '
+	rm -f pack-objects.log &&
+	git clone --no-local . first &&
+	pack_objects_runs 1 &&
+	cache_entries >entries &&
+	test_line_count = 1 entries
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	rm -f pack-objects.log &&
+	git clone --no-local . second &&
+	pack_objects_runs 0 &&
+	git -C second fsck &&
+	git -C first rev-parse --all >expect &&
+	git -C second rev-parse --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'protocol v2 shares the cache' '
+	rm -f pack-objects.log &&
+	git -c protocol.version=2 clone --no-local . v2 &&
+	git -c protocol.version=2 clone --no-local . v2-again &&
+	pack_objects_runs 0 &&
+	git -C v2-again fsck
+'
+
+test_expect_success 'different requests get their own entries' '
+	rm -f pack-objects.log &&
+	git clone --no-local --depth=1 . shallow &&
+	git clone --no-local --depth=1 . shallow-again &&
+	pack_objects_runs 1 &&
+	git -C shallow-again fsck &&
+	echo 1 >expect &&
+	git -C shallow-again rev-list --count HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'moving a ref invalidates the cache' '
+	rm -f pack-objects.log &&
+	test_commit four &&
+	git clone --no-local . third &&
+	pack_objects_runs 1 &&
+	git -C third rev-parse --verify four
+'
+
+test_expect_success 'packs above the size limit are not kept' '
+	test_config uploadpack.packCacheLimit 1 &&
+	rm -rf .git/upload-pack-cache pack-objects.log &&
+	git clone --no-local . fourth &&
+	git clone --no-local . fifth &&
+	pack_objects_runs 2 &&
+	! cache_entries
+'
+
+test_expect_success 'old entries are evicted to honor the limit' '
+	rm -rf .git/upload-pack-cache &&
+	git clone --no-local . sixth &&
+	cache_entries >old &&
+	test_line_count = 1 old &&
+	size=$(test-tool path-utils file-size .git/upload-pack-cache/*.pack) &&
+	test_config uploadpack.packCacheLimit $(($size * 3 / 2)) &&
+	test_commit five &&
+	git clone --no-local . seventh &&
+	cache_entries >new &&
+	test_line_count = 1 new &&
+	! test_cmp old new
+'
+
+test_done
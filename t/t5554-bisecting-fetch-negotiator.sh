@@ -0,0 +1,104 @@
+#!/bin/sh
+
+test_description='test bisecting fetch negotiator'
+. ./test-lib.sh
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" -c fetch.negotiationalgorithm=bisecting \
+	  -c protocol.version=${protocol:-2} fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+# Count the requests of the last fetch
+rounds () {
+	grep -c "fetch> command=fetch" trace
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	for i in $(test_seq 60)
+	do
+		test_commit -C server c$i || return 1
+	done &&
+	git clone server client &&
+	test_commit -C server to_fetch &&
+	for i in $(test_seq 61 300)
+	do
+		test_commit -C client c$i || return 1
+	done &&
+	# Forget what the client knows of the server
+	git -C client remote remove origin &&
+	for i in $(test_seq 60)
+	do
+		git -C client tag -d c$i >/dev/null || return 1
+	done &&
+	git -C client commit-graph write --reachable
+'
+
+test_expect_success 'few rounds are needed to find a common commit' '
+	rm -f trace &&
+	cp -R client client1 &&
+	trace_fetch client1 "$(pwd)/server" --no-tags master &&
+	grep "fetch< ACK" trace &&
+	test $(rounds) -le 6 &&
+	git -C client1 fsck
+'
+
+# An unrelated branch has no common commit, so that the server does not tell
+# the client to stop negotiating before it has found the last common commit.
+test_expect_success 'the last common commit is found' '
+	git -C server checkout --orphan other &&
+	test_commit -C server o1 &&
+	git -C server checkout master &&
+	rm -f trace &&
+	cp -R client client2 &&
+	trace_fetch client2 "$(pwd)/server" --no-tags master other &&
+	grep "fetch> have $(git -C server rev-parse c60)" trace &&
+	grep "fetch< ACK $(git -C server rev-parse c60)" trace &&
+	! grep "fetch< ready" trace &&
+	test $(rounds) -le 10 &&
+	git -C client2 fsck
+'
+
+test_expect_success 'tips that are ancestors of other tips cost nothing' '
+	rm -f trace &&
+	cp -R client client3 &&
+	for i in $(test_seq 61 300)
+	do
+		echo "create refs/heads/b$i c$i" || return 1
+	done | git -C client3 update-ref --stdin &&
+	git -C client3 commit-graph write --reachable &&
+	trace_fetch client3 "$(pwd)/server" --no-tags master other &&
+	test $(grep -c "fetch> have" trace) -le 50 &&
+	git -C client3 fsck
+'
+
+test_expect_success 'protocol v0 skips without bisecting' '
+	rm -f trace &&
+	cp -R client client4 &&
+	protocol=0 trace_fetch client4 "$(pwd)/server" --no-tags master &&
+	git -C server rev-parse master >expect &&
+	git -C client4 rev-parse FETCH_HEAD >actual &&
+	test_cmp expect actual &&
+	git -C client4 fsck
+'
+
+test_expect_success 'unrelated histories' '
+	rm -f trace &&
+	git init unrelated &&
+	test_commit -C unrelated u1 &&
+	test_commit -C unrelated u2 &&
+	trace_fetch unrelated "$(pwd)/server" --no-tags master &&
+	! grep "fetch< ACK" trace &&
+	git -C unrelated fsck
+'
+
+test_done
@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='seed clones and fetches from bundles'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git -C server branch base &&
+	git -C server bundle create "$(pwd)/base.bundle" base &&
+	test_commit -C server three &&
+	test_commit -C server four &&
+	git -C server bundle create "$(pwd)/incr.bundle" base..master
+'
+
+test_expect_success 'clone --bundle-uri negotiates only the rest' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone --bundle-uri=base.bundle "file://$(pwd)/server" \
+		clone-base &&
+	git -C clone-base rev-parse refs/bundles/heads/base >actual &&
+	git -C server rev-parse base >expect &&
+	test_cmp expect actual &&
+	grep "clone> have $(cat expect)" trace &&
+	git -C clone-base fsck &&
+	git -C clone-base rev-parse origin/master >actual &&
+	git -C server rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bundles are applied in order' '
+	GIT_TRACE2_EVENT="$(pwd)/trace2" \
+		git clone --bundle-uri="file://$(pwd)/base.bundle" \
+		--bundle-uri="$(pwd)/incr.bundle" \
+		"file://$(pwd)/server" clone-both &&
+	grep "\"key\":\"applied\",\"value\":\"2\"" trace2 &&
+	git -C clone-both rev-parse refs/bundles/heads/master >actual &&
+	git -C server rev-parse master >expect &&
+	test_cmp expect actual &&
+	git -C clone-both fsck
+'
+
+test_expect_success 'bundles which cannot be applied are skipped' '
+	git clone --bundle-uri=incr.bundle --bundle-uri=missing.bundle \
+		"file://$(pwd)/server" clone-skip 2>err &&
+	test_i18ngrep "ignoring bundle .incr.bundle." err &&
+	test_i18ngrep "ignoring bundle .missing.bundle." err &&
+	test_must_fail git -C clone-skip rev-parse --verify refs/bundles/heads/master &&
+	git -C clone-skip fsck
+'
+
+test_expect_success '--bundle-uri is incompatible with --depth' '
+	test_must_fail git clone --depth=1 --bundle-uri=base.bundle \
+		"file://$(pwd)/server" clone-shallow 2>err &&
+	test_i18ngrep "incompatible with --depth" err
+'
+
+test_expect_success 'clone ignores local bundles the server advertises' '
+	git -C server config --add uploadpack.bundleURI \
+		"file://$(pwd)/base.bundle" &&
+	git -C server config --add uploadpack.bundleURI "$(pwd)/base.bundle" &&
+	test_when_finished "git -C server config --unset-all uploadpack.bundleURI" &&
+	git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$(pwd)/server" clone-advertised 2>err &&
+	test_i18ngrep "bundle URI .file://.* from the server is not http(s)" err &&
+	test_i18ngrep "bundle URI .$(pwd)/base.bundle. from the server is not http(s)" err &&
+	test_must_fail git -C clone-advertised rev-parse --verify \
+		refs/bundles/heads/base &&
+	git -C clone-advertised fsck
+'
+
+test_expect_success 'advertised bundles are ignored by default' '
+	git -C server config uploadpack.bundleURI "file://$(pwd)/base.bundle" &&
+	test_when_finished "git -C server config --unset uploadpack.bundleURI" &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone "file://$(pwd)/server" clone-default &&
+	grep "clone< bundle-uri" trace &&
+	! grep "command=bundle-uri" trace &&
+	test_must_fail git -C clone-default rev-parse --verify refs/bundles/heads/base
+'
+
+test_expect_success 'fetch --bundle-uri' '
+	git clone --no-local -b base --single-branch server fetch-repo &&
+	(
+		cd fetch-repo &&
+		mkdir sub &&
+		cd sub &&
+		git fetch --bundle-uri=../../incr.bundle origin master
+	) &&
+	git -C fetch-repo rev-parse refs/bundles/heads/master >actual &&
+	git -C server rev-parse master >expect &&
+	test_cmp expect actual &&
+	git -C fetch-repo fsck
+'
+
+# DO NOT add non-httpd-specific tests here, because the last part of this
+# test script is only executed when httpd is available and enabled.
+
+. "$TEST_DIRECTORY"/lib-httpd.sh
+start_httpd
+
+test_expect_success 'clone uses the http bundles the server advertises' '
+	cp base.bundle "$HTTPD_DOCUMENT_ROOT_PATH/" &&
+	git -C server config uploadpack.bundleURI \
+		"$HTTPD_URL/dumb/base.bundle" &&
+	test_when_finished "git -C server config --unset uploadpack.bundleURI" &&
+	git -c protocol.version=2 -c transfer.bundleURI=true \
+		clone "file://$(pwd)/server" clone-http &&
+	git -C clone-http rev-parse refs/bundles/heads/base >actual &&
+	git -C server rev-parse base >expect &&
+	test_cmp expect actual &&
+	git -C clone-http fsck
+'
+
+test_done
@@ -133,6 +133,53 @@ test_expect_success 'refs/heads prefix' '
 	test_cmp expect actual
 '
 
+test_expect_success 'overlapping and partial ref-prefixes' '
+	git pack-refs --all &&
+	git update-ref refs/tags/two-loose two &&
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	ref-prefix refs/tags/t
+	ref-prefix refs/heads/master
+	ref-prefix refs/heads/
+	ref-prefix refs/heads/d
+	ref-prefix refs/tags/two
+	ref-prefix unrelated
+	0000
+	EOF
+
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/dev) refs/heads/dev
+	$(git rev-parse refs/heads/master) refs/heads/master
+	$(git rev-parse refs/heads/release) refs/heads/release
+	$(git rev-parse refs/tags/two) refs/tags/two
+	$(git rev-parse refs/tags/two-loose) refs/tags/two-loose
+	0000
+	EOF
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual &&
+	git update-ref -d refs/tags/two-loose
+'
+
+test_expect_success 'ref-prefix of "refs/" itself' '
+	test-tool pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	ref-prefix ref
+	ref-prefix refs/heads/master
+	0000
+	EOF
+
+	git for-each-ref --format="%(objectname) %(refname)" >expect &&
+	echo 0000 >>expect &&
+
+	test-tool serve-v2 --stateless-rpc <in >out &&
+	test-tool pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'peel parameter' '
 	test-tool pkt-line pack >in <<-EOF &&
 	command=ls-refs
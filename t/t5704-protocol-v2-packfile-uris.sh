@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='test packfile URIs in git wire-protocol version 2'
+
+TEST_NO_CREATE_REPO=1
+
+. ./test-lib.sh
+
+setup_packfile_uri_server () {
+	rm -rf server client trace &&
+	test_create_repo server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	# pack the history up to "one" on its own, to be served by URI
+	pack=$(echo one | git -C server pack-objects --revs \
+		.git/objects/pack/pack) &&
+	git -C server config uploadpack.packfileUri \
+		"$pack file://$(pwd)/server/.git/objects/pack/pack-$pack.pack"
+}
+
+test_expect_success 'clone with packfile URIs' '
+	setup_packfile_uri_server &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		-c fetch.uriProtocols=file \
+		clone "file://$(pwd)/server" client &&
+	grep "clone< [^ ]*packfile-uris$" trace &&
+	grep "clone< .*$pack file://" trace &&
+
+	# the pack was downloaded as is, and is not locked anymore
+	test_path_is_file client/.git/objects/pack/pack-$pack.pack &&
+	find client/.git/objects/pack -name "*.keep" >keeps &&
+	test_must_be_empty keeps &&
+	git -C client fsck &&
+	git -C client log --format=%s origin/master >actual &&
+	test_write_lines two one >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packfile URIs are only used when accepted' '
+	setup_packfile_uri_server &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		-c fetch.uriProtocols=https \
+		clone "file://$(pwd)/server" client &&
+	! grep "clone< [^ ]*packfile-uris$" trace &&
+	test_path_is_missing client/.git/objects/pack/pack-$pack.pack &&
+	git -C client fsck
+'
+
+test_expect_success 'packfile URIs are not sent for objects the client has' '
+	setup_packfile_uri_server &&
+	git clone --no-local --single-branch --branch one server client &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client -c protocol.version=2 \
+		-c fetch.uriProtocols=file fetch origin master &&
+	! grep "fetch< [^ ]*packfile-uris$" trace &&
+	git -C client fsck
+'
+
+test_expect_success 'packfile URI must provide the advertised pack' '
+	setup_packfile_uri_server &&
+	other=$(echo two | git -C server pack-objects --revs other) &&
+	git -C server config uploadpack.packfileUri \
+		"$pack file://$(pwd)/server/other-$other.pack" &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone "file://$(pwd)/server" client 2>err &&
+	test_i18ngrep "did not provide pack $pack" err
+'
+
+test_expect_success 'packfile URIs with a protocol not requested are rejected' '
+	setup_packfile_uri_server &&
+	# make the server send the file:// URI to a client asking for https
+	write_script server/.git/hook <<-\EOF &&
+	for arg
+	do
+		shift
+		case "$arg" in
+		--uri-protocol=*)
+			set -- "$@" --uri-protocol=file ;;
+		*)
+			set -- "$@" "$arg" ;;
+		esac
+	done
+	exec "$@"
+	EOF
+	test_config_global uploadpack.packObjectsHook ./hook &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=https \
+		clone "file://$(pwd)/server" client 2>err &&
+	test_i18ngrep "uses protocol .file., which was not requested" err &&
+	test_path_is_missing client
+'
+
+test_expect_success 'packfile URIs must use an allowed protocol' '
+	setup_packfile_uri_server &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=file \
+		-c protocol.file.allow=user \
+		clone "file://$(pwd)/server" client 2>err &&
+	test_i18ngrep "uses protocol .file., which is not allowed" err
+'
+
+# DO NOT add non-httpd-specific tests here, because the last part of this
+# test script is only executed when httpd is available and enabled.
+
+. "$TEST_DIRECTORY"/lib-httpd.sh
+start_httpd
+
+test_expect_success 'http-fetch --packfile' '
+	setup_packfile_uri_server &&
+	cp server/.git/objects/pack/pack-$pack.pack \
+		"$HTTPD_DOCUMENT_ROOT_PATH/" &&
+	git init http-fetch &&
+	git -C http-fetch http-fetch --packfile=$pack \
+		"$HTTPD_URL/dumb/pack-$pack.pack" >fetched.pack &&
+	test_cmp_bin server/.git/objects/pack/pack-$pack.pack fetched.pack
+'
+
+test_expect_success 'clone with http packfile URIs' '
+	setup_packfile_uri_server &&
+	cp server/.git/objects/pack/pack-$pack.pack \
+		"$HTTPD_DOCUMENT_ROOT_PATH/" &&
+	git -C server config uploadpack.packfileUri \
+		"$pack $HTTPD_URL/dumb/pack-$pack.pack" &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		-c fetch.uriProtocols=http \
+		clone "file://$(pwd)/server" client &&
+	grep "clone< .*$pack $HTTPD_URL/dumb/" trace &&
+	test_path_is_file client/.git/objects/pack/pack-$pack.pack &&
+	git -C client fsck
+'
+
+test_done
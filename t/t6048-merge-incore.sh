@@ -0,0 +1,191 @@
+#!/bin/sh
+
+test_description='merging trees in memory
+
+The results of the in-core merge are compared with those of
+merge-recursive where the two are expected to agree.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i >letters &&
+	mkdir dir &&
+	echo nested >dir/file &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b side1 &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >numbers &&
+	git mv letters renamed &&
+	test_tick &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 base &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >numbers &&
+	test_write_lines a b c d e f g h eye >letters &&
+	test_tick &&
+	git commit -a -m side2
+'
+
+test_expect_success 'clean merge with a rename' '
+	test_tick &&
+	git checkout -b expect side1 &&
+	git merge side2 &&
+	git rev-parse expect^{tree} >expect &&
+	test-tool merge-incore recursive side1 side2 >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q side1:letters &&
+	test_write_lines a b c d e f g h eye >expect &&
+	git cat-file blob $(head -n 1 actual):renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'non-recursive merge of trees' '
+	test-tool merge-incore nonrecursive base side1^{tree} side2 >actual &&
+	git rev-parse expect^{tree} >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'content conflict' '
+	git checkout -b conflict1 base &&
+	test_write_lines 1 2 3 4 five 6 7 8 9 >numbers &&
+	test_tick &&
+	git commit -a -m conflict1 &&
+	git checkout -b conflict2 base &&
+	test_write_lines 1 2 3 4 FIVE 6 7 8 9 >numbers &&
+	test_tick &&
+	git commit -a -m conflict2 &&
+
+	test_expect_code 1 test-tool merge-incore recursive conflict1 conflict2 >out &&
+	cat >expect <<-EOF &&
+	content numbers
+	100644 $(git rev-parse base:numbers) 1	numbers
+	100644 $(git rev-parse conflict1:numbers) 2	numbers
+	100644 $(git rev-parse conflict2:numbers) 3	numbers
+	EOF
+	tail -n +2 out >actual &&
+	test_cmp expect actual &&
+	git cat-file blob $(head -n 1 out):numbers >actual &&
+	grep "^<<<<<<< conflict1$" actual &&
+	grep "^>>>>>>> conflict2$" actual
+'
+
+test_expect_success 'modify/delete' '
+	git checkout -b delete base &&
+	git rm numbers &&
+	test_tick &&
+	git commit -m delete &&
+
+	test_expect_code 1 test-tool merge-incore recursive delete side2 >out &&
+	cat >expect <<-EOF &&
+	modify/delete numbers
+	100644 $(git rev-parse base:numbers) 1	numbers
+	100644 $(git rev-parse side2:numbers) 3	numbers
+	EOF
+	tail -n +2 out >actual &&
+	test_cmp expect actual &&
+	git rev-parse side2:numbers >expect &&
+	git rev-parse $(head -n 1 out):numbers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename/delete' '
+	git checkout -b delete-letters base &&
+	git rm letters &&
+	test_tick &&
+	git commit -m delete-letters &&
+
+	test_expect_code 1 test-tool merge-incore recursive side1 delete-letters >out &&
+	cat >expect <<-EOF &&
+	rename/delete renamed
+	100644 $(git rev-parse base:letters) 1	letters
+	100644 $(git rev-parse side1:renamed) 2	renamed
+	EOF
+	tail -n +2 out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'file/directory conflict' '
+	git checkout -b add-file base &&
+	echo file >new &&
+	git add new &&
+	test_tick &&
+	git commit -m add-file &&
+	git checkout -b add-dir base &&
+	mkdir new &&
+	echo file >new/file &&
+	git add new &&
+	test_tick &&
+	git commit -m add-dir &&
+
+	test_expect_code 1 test-tool merge-incore recursive add-file add-dir >out &&
+	cat >expect <<-EOF &&
+	file/directory new~add-file
+	100644 $(git rev-parse add-file:new) 2	new
+	EOF
+	tail -n +2 out >actual &&
+	test_cmp expect actual &&
+	git ls-tree -r --name-only $(head -n 1 out) >actual &&
+	cat >expect <<-\EOF &&
+	dir/file
+	letters
+	new/file
+	new~add-file
+	numbers
+	EOF
+	test_cmp expect actual
+'
+
+#
+#  B   D
+#  o---o
+#  |\ /|
+#  | X |
+#  |/ \|
+#  o---o
+#  C   E
+#
+test_expect_success 'criss-cross merge' '
+	git checkout -b cc-b base &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	test_tick &&
+	git commit -a -m B &&
+	git checkout -b cc-c base &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_tick &&
+	git commit -a -m C &&
+	git checkout -b cc-d cc-b &&
+	git merge -m D cc-c &&
+	test_write_lines a b c d e f g h i j >letters &&
+	test_tick &&
+	git commit -a -m D2 &&
+	git checkout -b cc-e cc-c &&
+	git merge -m E cc-b &&
+	test_write_lines zero 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	test_tick &&
+	git commit -a -m E2 &&
+
+	test $(git merge-base --all cc-d cc-e | wc -l) = 2 &&
+	git checkout -b cc-expect cc-d &&
+	git merge cc-e &&
+	git rev-parse cc-expect^{tree} >expect &&
+	test-tool merge-incore recursive cc-d cc-e >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge in a bare repository' '
+	git clone --bare . bare.git &&
+	(
+		cd bare.git &&
+		test-tool merge-incore recursive side1 side2 >../actual &&
+		test_path_is_missing index
+	) &&
+	git rev-parse expect^{tree} >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+test_description='rev-list combining bitmaps and filters'
+. ./test-lib.sh
+
+test_expect_success 'set up bitmapped repo' '
+	# one commit will have bitmaps, the other will not
+	test_commit one &&
+	test_commit much-larger-blob-one &&
+	git repack -adb &&
+	test_commit two &&
+	test_commit much-larger-blob-two &&
+	git tag -a -m tag annotated one
+'
+
+# Bitmaps do not give the names of the objects, and list them in pack
+# order; compare the object names only.
+compare_with_bitmap () {
+	git rev-list --objects --no-object-names "$@" >expect.raw &&
+	sort expect.raw >expect &&
+	git rev-list --objects --no-object-names --use-bitmap-index "$@" \
+		>actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual
+}
+
+for filter in blob:none blob:limit=10 blob:limit=1k tree:0 \
+	combine:blob:none+tree:0
+do
+	test_expect_success "filter $filter" '
+		compare_with_bitmap --filter=$filter --all &&
+		compare_with_bitmap --filter=$filter HEAD &&
+		compare_with_bitmap --filter=$filter HEAD ^HEAD~2 &&
+		compare_with_bitmap --filter=$filter annotated &&
+		compare_with_bitmap --filter=$filter HEAD:one.t HEAD^{tree}
+	'
+done
+
+test_expect_success 'unsupported filters fall back to a traversal' '
+	compare_with_bitmap --filter=tree:1 HEAD &&
+	compare_with_bitmap --filter=sparse:oid=HEAD:one.t HEAD
+'
+
+test_expect_success 'rev-list --count with a filter' '
+	git rev-list --count --objects --filter=blob:none HEAD >out &&
+	tail -n 1 out >expect &&
+	git rev-list --count --objects --filter=blob:none \
+		--use-bitmap-index HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects uses the bitmap with a filter' '
+	echo HEAD >revs &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git pack-objects --revs --stdout \
+		--use-bitmap-index --enumeration-threads=2 --filter=blob:none \
+		<revs >filtered.pack &&
+	! grep "\"key\":\"parallel/threads\"" trace &&
+	git index-pack -o filtered.idx filtered.pack &&
+	git show-index <filtered.idx >objects &&
+	cut -d" " -f2 objects | sort >actual &&
+	git rev-list --objects --no-object-names --filter=blob:none HEAD |
+	sort >expect &&
+	test_cmp expect actual
+'
+
+test_done
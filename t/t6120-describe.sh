@@ -479,4 +479,41 @@ test_expect_success 'name-rev covers all conditions while looking at parents' '
 	)
 '
 
+test_expect_success 'name-rev uses generation numbers to cut the walk' '
+	git init skew &&
+	(
+		cd skew &&
+		GIT_TEST_COMMIT_GRAPH=0 &&
+		export GIT_TEST_COMMIT_GRAPH &&
+		git commit --allow-empty -m base &&
+		git commit --allow-empty -m target &&
+		GIT_COMMITTER_DATE="@1000000000 +0000" \
+			git commit --allow-empty -m skewed &&
+		test_commit tip &&
+
+		echo "undefined" >expect &&
+		git name-rev --name-only --tags HEAD~2 >actual &&
+		test_cmp expect actual &&
+
+		git commit-graph write --reachable &&
+		echo "tip~2" >expect &&
+		git name-rev --name-only --tags HEAD~2 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'describe --stdin' '
+	git describe A B c e >expect &&
+	printf "%s\n" A B c e | git describe --stdin >actual &&
+	test_cmp expect actual &&
+	git describe --tags --contains A B c >expect &&
+	printf "%s\n" A B c | git describe --tags --contains --stdin >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'describe --stdin rejects commit-ishes and --dirty' '
+	test_must_fail git describe --stdin HEAD </dev/null &&
+	test_must_fail git describe --stdin --dirty </dev/null
+'
+
 test_done
@@ -0,0 +1,147 @@
+#!/bin/sh
+
+test_description='built-in file system watcher'
+
+. ./test-lib.sh
+
+if ! test-tool fsmonitor-client is-supported
+then
+	skip_all='fsmonitor--daemon is not supported on this platform'
+	test_done
+fi
+
+stop_daemon () {
+	git -C "${1:-repo}" fsmonitor--daemon stop 2>/dev/null || :
+}
+
+# The scratch files of the tests live outside of the watched "repo".
+test_expect_success 'setup' '
+	git init repo &&
+	mkdir repo/dir1 repo/dir2 &&
+	echo 1 >repo/modified &&
+	echo 2 >repo/deleted &&
+	echo 3 >repo/dir1/modified &&
+	echo 4 >repo/dir2/moved &&
+	echo 5 >repo/dir2/also-moved &&
+	git -C repo add . &&
+	git -C repo commit -m initial
+'
+
+test_expect_success 'start, check and stop the daemon' '
+	test_when_finished stop_daemon &&
+	test_must_fail git -C repo fsmonitor--daemon status &&
+	git -C repo fsmonitor--daemon start &&
+	git -C repo fsmonitor--daemon status >actual &&
+	echo "fsmonitor-daemon is watching '\''$(pwd)/repo'\''" >expect &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo fsmonitor--daemon start &&
+	git -C repo fsmonitor--daemon stop &&
+	test_path_is_missing repo/.git/fsmonitor--daemon.ipc &&
+	test_must_fail git -C repo fsmonitor--daemon status &&
+	test_must_fail git -C repo fsmonitor--daemon stop
+'
+
+test_expect_success 'queries from before the daemon started ask for a rescan' '
+	test_when_finished stop_daemon &&
+	git -C repo fsmonitor--daemon start &&
+	(cd repo && test-tool fsmonitor-client query 0) >actual &&
+	echo / >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'daemon reports changed paths' '
+	test_when_finished "stop_daemon; git -C repo reset --hard; git -C repo clean -fd" &&
+	git -C repo fsmonitor--daemon start &&
+	since=$(test-tool fsmonitor-client now) &&
+	echo changed >repo/modified &&
+	echo changed >repo/dir1/modified &&
+	rm repo/deleted &&
+	mkdir repo/dir3 &&
+	echo new >repo/dir3/new &&
+	(cd repo && test-tool fsmonitor-client query $since) >out &&
+	sort <out >actual &&
+	cat >expect <<-\EOF &&
+	deleted
+	dir1/modified
+	dir3/
+	dir3/new
+	modified
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'changes to the repository are not reported' '
+	test_when_finished stop_daemon &&
+	git -C repo fsmonitor--daemon start &&
+	since=$(test-tool fsmonitor-client now) &&
+	git -C repo commit --allow-empty -m empty &&
+	(cd repo && test-tool fsmonitor-client query $since) >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'git status uses the daemon' '
+	test_when_finished "stop_daemon; git -C repo reset --hard" &&
+	git -C repo config core.useBuiltinFSMonitor true &&
+	git -C repo fsmonitor--daemon start &&
+	git -C repo status &&
+	git -C repo ls-files -f >actual &&
+	cat >expect <<-\EOF &&
+	h deleted
+	h dir1/modified
+	h dir2/also-moved
+	h dir2/moved
+	h modified
+	EOF
+	test_cmp expect actual &&
+	echo changed >repo/dir1/modified &&
+	git -C repo ls-files -f >actual &&
+	cat >expect <<-\EOF &&
+	h deleted
+	H dir1/modified
+	h dir2/also-moved
+	h dir2/moved
+	h modified
+	EOF
+	test_cmp expect actual &&
+	git -C repo status --porcelain >actual &&
+	echo " M dir1/modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'renamed directories invalidate their contents' '
+	test_when_finished "stop_daemon; git -C repo reset --hard; git -C repo clean -fd" &&
+	git -C repo fsmonitor--daemon start &&
+	git -C repo status &&
+	mv repo/dir2 repo/dir4 &&
+	git -C repo status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 D dir2/also-moved
+	 D dir2/moved
+	?? dir4/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'git status falls back to a full scan without daemon' '
+	test_when_finished "git -C repo reset --hard" &&
+	git -C repo status &&
+	echo changed >repo/modified &&
+	git -C repo status --porcelain >actual &&
+	echo " M modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'daemon exits when the worktree goes away' '
+	git init moving &&
+	git -C moving fsmonitor--daemon start &&
+	test_when_finished "stop_daemon moved" &&
+	mv moving moved &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test_must_fail git -C moved fsmonitor--daemon status && break
+		sleep 1
+	done &&
+	test_must_fail git -C moved fsmonitor--daemon status
+'
+
+test_done
@@ -931,6 +931,16 @@ do
 	"
 done
 
+test_expect_success 'threaded grep of trees and the index' '
+	git repack -adf &&
+	git grep --threads=1 -e . HEAD >expect &&
+	git grep --threads=8 -e . HEAD >actual &&
+	test_cmp expect actual &&
+	git grep --threads=1 --cached -e . >expect &&
+	git grep --threads=8 --cached -e . >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
 	grep ^warning: err >warnings &&
@@ -409,10 +409,7 @@ static int fetch_with_fetch(struct transport *transport,
 
 		if (starts_with(buf.buf, "lock ")) {
 			const char *name = buf.buf + 5;
-			if (transport->pack_lockfile)
-				warning(_("%s also locked %s"), data->name, name);
-			else
-				transport->pack_lockfile = xstrdup(name);
+			string_list_append(&transport->pack_lockfiles, name);
 		}
 		else if (data->check_connectivity &&
 			 data->transport_options.check_self_contained_and_connected &&
@@ -65,6 +65,14 @@ struct transport_vtable {
 	 * use. disconnect() releases these resources.
 	 **/
 	int (*disconnect)(struct transport *connection);
+
+	/**
+	 * Append to "uris" the bundles the remote advertises for seeding
+	 * a clone, if any. Transports which cannot ask for them leave
+	 * this NULL.
+	 **/
+	int (*get_bundle_uris)(struct transport *transport,
+			       struct string_list *uris);
 };
 
 #endif
@@ -324,6 +324,27 @@ static struct ref *get_refs_via_connect(struct transport *transport, int for_pus
 	return handshake(transport, for_push, ref_prefixes, 1);
 }
 
+static int get_bundle_uris_via_connect(struct transport *transport,
+				       struct string_list *uris)
+{
+	struct git_transport_data *data = transport->data;
+	struct packet_reader reader;
+
+	if (!data->got_remote_heads)
+		handshake(transport, 0, NULL, 0);
+
+	if (data->version != protocol_v2 ||
+	    !server_supports_v2("bundle-uri", 0))
+		return 0;
+
+	packet_reader_init(&reader, data->fd[0], NULL, 0,
+			   PACKET_READ_CHOMP_NEWLINE |
+			   PACKET_READ_DIE_ON_ERR_PACKET);
+	get_remote_bundle_uris(data->fd[1], &reader, uris,
+			       transport->server_options);
+	return 0;
+}
+
 static int fetch_refs_via_pack(struct transport *transport,
 			       int nr_heads, struct ref **to_fetch)
 {
@@ -374,7 +395,7 @@ static int fetch_refs_via_pack(struct transport *transport,
 		refs = fetch_pack(&args, data->fd,
 				  refs_tmp ? refs_tmp : transport->remote_refs,
 				  to_fetch, nr_heads, &data->shallow,
-				  &transport->pack_lockfile, data->version);
+				  &transport->pack_lockfiles, data->version);
 		break;
 	case protocol_v1:
 	case protocol_v0:
@@ -382,7 +403,7 @@ static int fetch_refs_via_pack(struct transport *transport,
 		refs = fetch_pack(&args, data->fd,
 				  refs_tmp ? refs_tmp : transport->remote_refs,
 				  to_fetch, nr_heads, &data->shallow,
-				  &transport->pack_lockfile, data->version);
+				  &transport->pack_lockfiles, data->version);
 		break;
 	case protocol_unknown_version:
 		BUG("unknown protocol version");
@@ -754,7 +775,8 @@ static struct transport_vtable taken_over_vtable = {
 	fetch_refs_via_pack,
 	git_transport_push,
 	NULL,
-	disconnect_git
+	disconnect_git,
+	get_bundle_uris_via_connect
 };
 
 void transport_take_over(struct transport *transport,
@@ -912,7 +934,8 @@ static struct transport_vtable builtin_smart_vtable = {
 	fetch_refs_via_pack,
 	git_transport_push,
 	connect_git,
-	disconnect_git
+	disconnect_git,
+	get_bundle_uris_via_connect
 };
 
 struct transport *transport_get(struct remote *remote, const char *url)
@@ -921,6 +944,7 @@ struct transport *transport_get(struct remote *remote, const char *url)
 	struct transport *ret = xcalloc(1, sizeof(*ret));
 
 	ret->progress = isatty(2);
+	string_list_init(&ret->pack_lockfiles, 1);
 
 	if (!remote)
 		BUG("No remote provided to transport_get()");
@@ -1292,6 +1316,14 @@ const struct ref *transport_get_remote_refs(struct transport *transport,
 	return transport->remote_refs;
 }
 
+int transport_get_bundle_uris(struct transport *transport,
+			      struct string_list *uris)
+{
+	if (!transport->vtable->get_bundle_uris)
+		return 0;
+	return transport->vtable->get_bundle_uris(transport, uris);
+}
+
 int transport_fetch_refs(struct transport *transport, struct ref *refs)
 {
 	int rc;
@@ -1330,10 +1362,11 @@ int transport_fetch_refs(struct transport *transport, struct ref *refs)
 
 void transport_unlock_pack(struct transport *transport)
 {
-	if (transport->pack_lockfile) {
-		unlink_or_warn(transport->pack_lockfile);
-		FREE_AND_NULL(transport->pack_lockfile);
-	}
+	int i;
+
+	for (i = 0; i < transport->pack_lockfiles.nr; i++)
+		unlink_or_warn(transport->pack_lockfiles.items[i].string);
+	string_list_clear(&transport->pack_lockfiles, 0);
 }
 
 int transport_connect(struct transport *transport, const char *name,
@@ -98,7 +98,8 @@ struct transport {
 	 */
 	const struct string_list *server_options;
 
-	char *pack_lockfile;
+	/* The .keep files of the packs fetched, until the refs are updated */
+	struct string_list pack_lockfiles;
 	signed verbose : 3;
 	/**
 	 * Transports should not set this directly, and should use this
@@ -243,6 +244,14 @@ int transport_push(struct repository *repo,
 const struct ref *transport_get_remote_refs(struct transport *transport,
 					    const struct argv_array *ref_prefixes);
 
+/*
+ * Retrieve the bundle URIs advertised by a remote (only when communicating
+ * using protocol v2) and append them to "uris". Returns 0 on success, even
+ * if the remote advertises none.
+ */
+int transport_get_bundle_uris(struct transport *transport,
+			      struct string_list *uris);
+
 int transport_fetch_refs(struct transport *transport, struct ref *refs);
 void transport_unlock_pack(struct transport *transport);
 int transport_disconnect(struct transport *transport);
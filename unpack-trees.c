@@ -11,11 +11,13 @@
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "sparse-index.h"
 #include "submodule.h"
 #include "submodule-config.h"
 #include "fsmonitor.h"
 #include "object-store.h"
 #include "promisor-remote.h"
+#include "parallel-checkout.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -364,7 +366,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -427,18 +429,34 @@ static int check_updates(struct unpack_trees_options *o)
 						   to_fetch.oid, to_fetch.nr);
 		oid_array_clear(&to_fetch);
 	}
+
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
+			size_t last_pc_queue_size = parallel_checkout_queue_size();
+
 			if (ce->ce_flags & CE_WT_REMOVE)
 				BUG("both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			errs |= checkout_entry(ce, &state, NULL, NULL);
+
+			/*
+			 * Entries queued for parallel checkout are counted
+			 * when they are actually written.
+			 */
+			if (last_pc_queue_size == parallel_checkout_queue_size())
+				display_progress(progress, ++cnt);
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress, &cnt);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state, NULL);
 	git_attr_set_direction(GIT_ATTR_CHECKIN);
@@ -933,6 +951,14 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	if (cmp)
 		return cmp;
 
+	/*
+	 * A sparse directory entry, whose name ends in a slash, is the
+	 * directory itself.
+	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, tree_entry_len(n)) + 1)
+		return 0;
+
 	/*
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
@@ -959,13 +985,15 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	const struct name_entry *n,
 	int stage,
 	struct index_state *istate,
-	int is_transient)
+	int is_transient,
+	int is_sparse_directory)
 {
 	size_t len = traverse_path_len(info, tree_entry_len(n));
+	size_t alloc_len = is_sparse_directory ? len + 1 : len;
 	struct cache_entry *ce =
 		is_transient ?
-		make_empty_transient_cache_entry(len) :
-		make_empty_cache_entry(istate, len);
+		make_empty_transient_cache_entry(alloc_len) :
+		make_empty_cache_entry(istate, alloc_len);
 
 	ce->ce_mode = create_ce_mode(n->mode);
 	ce->ce_flags = create_ce_flags(stage);
@@ -974,6 +1002,14 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info,
 	/* len+1 because the cache_entry allocates space for NUL */
 	make_traverse_path(ce->name, len + 1, info, n->path, n->pathlen);
 
+	if (is_sparse_directory) {
+		ce->ce_mode = S_IFDIR;
+		ce->name[len] = '/';
+		ce->name[len + 1] = '\0';
+		ce->ce_namelen++;
+		ce->ce_flags |= CE_SKIP_WORKTREE;
+	}
+
 	return ce;
 }
 
@@ -991,11 +1027,22 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	int i;
 	struct unpack_trees_options *o = info->data;
 	unsigned long conflicts = info->df_conflicts | dirmask;
+	int sparse_directory = 0;
 
 	/* Do we have *only* directories? Nothing to do */
 	if (mask == dirmask && !src[0])
 		return 0;
 
+	/*
+	 * Directories matching a sparse directory entry of the index
+	 * are not in conflict with it; they are unpacked as sparse
+	 * directory entries themselves.
+	 */
+	if (mask == dirmask && S_ISSPARSEDIR(src[0]->ce_mode)) {
+		conflicts = info->df_conflicts;
+		sparse_directory = 1;
+	}
+
 	/*
 	 * Ok, we've filled in up to any potential index entry in src[0],
 	 * now do the rest.
@@ -1025,7 +1072,9 @@ static int unpack_nondirectories(int n, unsigned long mask,
 		 * not stored in the index.  otherwise construct the
 		 * cache entry from the index aware logic.
 		 */
-		src[i + o->merge] = create_ce_entry(info, names + i, stage, &o->result, o->merge);
+		src[i + o->merge] = create_ce_entry(info, names + i, stage,
+						   &o->result, o->merge,
+						   sparse_directory);
 	}
 
 	if (o->merge) {
@@ -1109,10 +1158,15 @@ static int find_cache_pos(struct traverse_info *info,
 		cmp = name_compare(p, p_len, ce_name, ce_len);
 		/*
 		 * Exact match; if we have a directory we need to
-		 * delay returning it.
+		 * delay returning it, unless it is a sparse directory
+		 * entry which stands for the directory as a whole.
 		 */
-		if (!cmp)
-			return ce_slash ? -2 - pos : pos;
+		if (!cmp) {
+			if (ce_slash && !(S_ISSPARSEDIR(ce->ce_mode) &&
+					  !ce_slash[1]))
+				return -2 - pos;
+			return pos;
+		}
 		if (0 < cmp)
 			continue; /* keep looking */
 		/*
@@ -1241,6 +1295,10 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 	/* Now handle any directories.. */
 	if (dirmask) {
+		/* A sparse directory entry was unpacked as a whole above. */
+		if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode))
+			return mask;
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1525,8 +1583,25 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		free(sparse);
 	}
 
+	/*
+	 * Only the one- and two-tree merges (and diff-index) know how to
+	 * deal with sparse directory entries, and only as long as these
+	 * remain outside of the worktree; everything else needs to see
+	 * every path.
+	 */
+	if (o->src_index->sparse_index) {
+		if ((o->fn != oneway_merge && o->fn != twoway_merge &&
+		     !o->sparse_dirs_ok) || o->prefix)
+			ensure_full_index(o->src_index);
+		else if (o->update && o->skip_sparse_checkout)
+			ensure_full_index(o->src_index);
+		else if (o->update)
+			ensure_full_index_for_patterns(o->src_index, o->pl);
+	}
+
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
+	o->result.sparse_index = o->src_index->sparse_index;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
@@ -1739,6 +1814,10 @@ static int verify_uptodate_1(const struct cache_entry *ce,
 	if (o->index_only)
 		return 0;
 
+	/* Sparse directories are never checked out. */
+	if (S_ISSPARSEDIR(ce->ce_mode))
+		return 0;
+
 	/*
 	 * CE_VALID and CE_SKIP_WORKTREE cheat, we better check again
 	 * if this entry is truly up-to-date because this file may be
@@ -60,7 +60,8 @@ struct unpack_trees_options {
 		     exiting_early,
 		     show_all_errors,
 		     dry_run,
-		     keep_pattern_list;
+		     keep_pattern_list,
+		     sparse_dirs_ok;
 	const char *prefix;
 	int cache_bottom;
 	struct dir_struct *dir;
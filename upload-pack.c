@@ -26,6 +26,8 @@
 #include "serve.h"
 #include "commit-graph.h"
 #include "commit-reach.h"
+#include "sha1-array.h"
+#include "tempfile.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -72,6 +74,9 @@ static struct list_objects_filter_options filter_options;
 
 static int allow_sideband_all;
 
+/* Protocols of the packfile URIs the client accepts, if any */
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -102,17 +107,363 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
-static void create_pack_file(const struct object_array *have_obj,
+/*
+ * The pack cache keeps the output of pack-objects in
+ * $GIT_DIR/upload-pack-cache, named after a hash of everything that
+ * went into it: the options we pass to pack-objects, the (sorted)
+ * wants, haves and shallow boundaries, and the state of every ref in
+ * the repository.  A request that hashes to the name of an existing
+ * file is answered by streaming that file.  Because the refs are part
+ * of the key, entries written before a ref moved are never used again
+ * and are eventually evicted, oldest first, to keep the cache below
+ * uploadpack.packCacheLimit bytes.
+ */
+static int pack_cache_enabled;
+static unsigned long pack_cache_limit = 1024 * 1024 * 1024;
+
+struct pack_cache_entry {
+	char *path;
+	struct tempfile *tmp;
+	unsigned long size;
+};
+
+static int hash_one_ref(const char *refname, const struct object_id *oid,
+			int flags, void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+	struct strbuf buf = STRBUF_INIT;
+
+	strbuf_addf(&buf, "ref %s %s\n", oid_to_hex(oid), refname);
+	the_hash_algo->update_fn(ctx, buf.buf, buf.len);
+	strbuf_release(&buf);
+	return 0;
+}
+
+static int hash_one_oid(const struct object_id *oid, void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static void hash_oid_array(git_hash_ctx *ctx, const char *label,
+			   struct oid_array *oids)
+{
+	the_hash_algo->update_fn(ctx, label, strlen(label) + 1);
+	oid_array_for_each_unique(oids, hash_one_oid, ctx);
+}
+
+static void hash_oid_list(git_hash_ctx *ctx, const char *label,
+			  const struct object_array *objs)
+{
+	struct oid_array oids = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < objs->nr; i++)
+		oid_array_append(&oids, &objs->objects[i].item->oid);
+	hash_oid_array(ctx, label, &oids);
+	oid_array_clear(&oids);
+}
+
+static int collect_one_shallow(const struct commit_graft *graft, void *cb_data)
+{
+	struct oid_array *shallows = cb_data;
+	if (graft->nr_parent == -1)
+		oid_array_append(shallows, &graft->oid);
+	return 0;
+}
+
+static char *pack_cache_path(const struct object_array *have_obj,
 			     const struct object_array *want_obj)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct strbuf opts = STRBUF_INIT;
+	struct oid_array shallows = OID_ARRAY_INIT;
+
+	/*
+	 * pack-objects would read the shallow file of a shallow
+	 * repository behind our back; do not bother caching there.
+	 */
+	if (!shallow_nr && is_repository_shallow(the_repository))
+		return NULL;
+
+	strbuf_addf(&opts, "thin=%d ofs-delta=%d include-tag=%d shallow=%d",
+		    use_thin_pack, use_ofs_delta, use_include_tag, !!shallow_nr);
+	if (filter_options.choice)
+		strbuf_addf(&opts, " filter=%s",
+			    expand_list_objects_filter_spec(&filter_options));
+	if (pack_objects_hook)
+		strbuf_addf(&opts, " hook=%s", pack_objects_hook);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, opts.buf, opts.len + 1);
+	strbuf_release(&opts);
+
+	if (shallow_nr) {
+		for_each_commit_graft(collect_one_shallow, &shallows);
+		hash_oid_array(&ctx, "shallow", &shallows);
+		oid_array_clear(&shallows);
+	}
+	hash_oid_list(&ctx, "want", want_obj);
+	hash_oid_list(&ctx, "have", have_obj);
+	hash_oid_list(&ctx, "edge", &extra_edge_obj);
+
+	head_ref(hash_one_ref, &ctx);
+	for_each_ref(hash_one_ref, &ctx);
+
+	the_hash_algo->final_fn(hash, &ctx);
+	return git_pathdup("upload-pack-cache/%s.pack", hash_to_hex(hash));
+}
+
+/*
+ * Stream the cached pack at "path" to the client, after the "packfile"
+ * section header if "writer" is given. Returns -1 without sending
+ * anything if there is no such pack.
+ */
+static int send_cached_pack(const char *path, struct packet_writer *writer)
+{
+	char data[8192];
+	ssize_t sz;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+
+	if (writer)
+		packet_writer_write(writer, "packfile\n");
+
+	/* keep recently used entries from being evicted */
+	utime(path, NULL);
+
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	if (sz < 0) {
+		static const char abort_msg[] = "aborting due to an unreadable "
+			"pack cache entry on the remote side.";
+		send_client_data(3, abort_msg, sizeof(abort_msg));
+		die_errno("git upload-pack: unable to read '%s'", path);
+	}
+	close(fd);
+
+	if (use_sideband)
+		packet_flush(1);
+	return 0;
+}
+
+static void pack_cache_write(struct pack_cache_entry *e,
+			     const char *data, ssize_t sz)
+{
+	if (!e->tmp)
+		return;
+	e->size += sz;
+	if (e->size > pack_cache_limit ||
+	    write_in_full(get_tempfile_fd(e->tmp), data, sz) < 0)
+		delete_tempfile(&e->tmp);
+}
+
+struct pack_cache_file {
+	char *path;
+	timestamp_t mtime;
+	off_t size;
+};
+
+static int pack_cache_file_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_file *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Evict the least recently used entries until the cache fits its limit,
+ * sparing the entry at "keep" that we have just written.
+ */
+static void prune_pack_cache(const char *keep)
+{
+	struct pack_cache_file *files = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addstr(&path, git_path("upload-pack-cache"));
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir))) {
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st))
+			continue;
+		ALLOC_GROW(files, nr + 1, alloc);
+		files[nr].path = xstrdup(path.buf);
+		files[nr].mtime = st.st_mtime;
+		files[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(files, nr, pack_cache_file_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_limit && strcmp(files[i].path, keep) &&
+		    !unlink(files[i].path))
+			total -= files[i].size;
+		free(files[i].path);
+	}
+	free(files);
+	strbuf_release(&path);
+}
+
+static void pack_cache_start(struct pack_cache_entry *e)
+{
+	struct strbuf template = STRBUF_INIT;
+
+	if (safe_create_leading_directories_const(e->path))
+		return;
+	strbuf_addstr(&template, git_path("upload-pack-cache/tmp_pack_XXXXXX"));
+	e->tmp = mks_tempfile(template.buf);
+	strbuf_release(&template);
+}
+
+static void pack_cache_finish(struct pack_cache_entry *e)
+{
+	if (e->tmp && !rename_tempfile(&e->tmp, e->path))
+		prune_pack_cache(e->path);
+	free(e->path);
+	e->path = NULL;
+}
+
+struct output_state {
+	char buffer[8193];
+	int used;
+	unsigned packfile_uris_started : 1;
+	unsigned packfile_started : 1;
+};
+
+/*
+ * Relay what pack-objects wrote to us. With protocol v2, it may start
+ * with "<pack-hash> <uri>" lines, which go to a "packfile-uris" section
+ * before the "packfile" section holding the pack data.
+ *
+ * We keep the last byte of the pack data to ourselves in case we detect
+ * broken rev-list, so that we can leave the stream corrupted.  This is
+ * unfortunate -- unpack-objects would happily accept a valid packdata
+ * with trailing garbage, so appending garbage after we pass all the
+ * pack data is not good enough to signal breakage to downstream.
+ *
+ * Returns what xread() returned.
+ */
+static ssize_t relay_pack_data(int pack_objects_out, struct output_state *os,
+			       struct packet_writer *writer,
+			       struct pack_cache_entry *cache)
+{
+	ssize_t readsz;
+
+	readsz = xread(pack_objects_out, os->buffer + os->used,
+		       sizeof(os->buffer) - os->used);
+	if (readsz < 0)
+		return readsz;
+	os->used += readsz;
+
+	while (!os->packfile_started) {
+		char *p;
+
+		if (os->used >= 4 && !memcmp(os->buffer, "PACK", 4)) {
+			os->packfile_started = 1;
+			if (os->packfile_uris_started)
+				packet_writer_delim(writer);
+			packet_writer_write(writer, "packfile\n");
+			break;
+		}
+
+		p = memchr(os->buffer, '\n', os->used);
+		if (!p) {
+			if (os->used == sizeof(os->buffer))
+				return -1;
+			/* wait for the rest of the line */
+			return readsz;
+		}
+		if (!os->packfile_uris_started) {
+			os->packfile_uris_started = 1;
+			packet_writer_write(writer, "packfile-uris\n");
+		}
+		*p = '\0';
+		packet_writer_write(writer, "%s\n", os->buffer);
+		os->used -= p - os->buffer + 1;
+		memmove(os->buffer, p + 1, os->used);
+	}
+
+	if (os->used > 1) {
+		send_client_data(1, os->buffer, os->used - 1);
+		pack_cache_write(cache, os->buffer, os->used - 1);
+		os->buffer[0] = os->buffer[os->used - 1];
+		os->used = 1;
+	} else {
+		send_client_data(1, os->buffer, os->used);
+		pack_cache_write(cache, os->buffer, os->used);
+		os->used = 0;
+	}
+	return readsz;
+}
+
+/*
+ * Run pack-objects and send its output to the client. With protocol v2,
+ * "writer" is given and used for the section headers.
+ */
+static void create_pack_file(const struct object_array *have_obj,
+			     const struct object_array *want_obj,
+			     struct packet_writer *writer)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
-	char data[8193], progress[128];
+	struct output_state output_state = { { 0 } };
+	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
-	int buffered = -1;
 	ssize_t sz;
 	int i;
 	FILE *pipe_fd;
+	struct pack_cache_entry cache = { NULL };
+
+	/*
+	 * The cache stores the pack data only; do not use it when the
+	 * client may get part of the objects through packfile URIs.
+	 */
+	if (pack_cache_enabled && !uri_protocols.nr) {
+		cache.path = pack_cache_path(have_obj, want_obj);
+		if (cache.path && !send_cached_pack(cache.path, writer)) {
+			free(cache.path);
+			return;
+		}
+		if (cache.path)
+			pack_cache_start(&cache);
+	}
+
+	/*
+	 * Unless pack-objects may send packfile URIs first, the pack data
+	 * comes right away; start the section now so that keepalives can
+	 * be sent while pack-objects is counting objects.
+	 */
+	if (writer && !uri_protocols.nr)
+		packet_writer_write(writer, "packfile\n");
+	if (!writer || !uri_protocols.nr)
+		output_state.packfile_started = 1;
 
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -153,6 +504,9 @@ static void create_pack_file(const struct object_array *have_obj,
 					 spec);
 		}
 	}
+	for (i = 0; i < uri_protocols.nr; i++)
+		argv_array_pushf(&pack_objects.args, "--uri-protocol=%s",
+				 uri_protocols.items[i].string);
 
 	pack_objects.in = -1;
 	pack_objects.out = -1;
@@ -238,23 +592,8 @@ static void create_pack_file(const struct object_array *have_obj,
 			continue;
 		}
 		if (0 <= pu && (pfd[pu].revents & (POLLIN|POLLHUP))) {
-			/* Data ready; we keep the last byte to ourselves
-			 * in case we detect broken rev-list, so that we
-			 * can leave the stream corrupted.  This is
-			 * unfortunate -- unpack-objects would happily
-			 * accept a valid packdata with trailing garbage,
-			 * so appending garbage after we pass all the
-			 * pack data is not good enough to signal
-			 * breakage to downstream.
-			 */
-			char *cp = data;
-			ssize_t outsz = 0;
-			if (0 <= buffered) {
-				*cp++ = buffered;
-				outsz++;
-			}
-			sz = xread(pack_objects.out, cp,
-				  sizeof(data) - outsz);
+			sz = relay_pack_data(pack_objects.out, &output_state,
+					     writer, &cache);
 			if (0 < sz)
 				;
 			else if (sz == 0) {
@@ -263,14 +602,6 @@ static void create_pack_file(const struct object_array *have_obj,
 			}
 			else
 				goto fail;
-			sz += outsz;
-			if (1 < sz) {
-				buffered = data[sz-1] & 0xFF;
-				sz--;
-			}
-			else
-				buffered = -1;
-			send_client_data(1, data, sz);
 		}
 
 		/*
@@ -279,11 +610,12 @@ static void create_pack_file(const struct object_array *have_obj,
 		 * side know we're still working on it, but don't have any data
 		 * yet.
 		 *
-		 * If we don't have a sideband channel, there's no room in the
-		 * protocol to say anything, so those clients are just out of
-		 * luck.
+		 * If we don't have a sideband channel, or the "packfile"
+		 * section that carries it has not started yet, there's no
+		 * room in the protocol to say anything, so those clients are
+		 * just out of luck.
 		 */
-		if (!ret && use_sideband) {
+		if (!ret && use_sideband && output_state.packfile_started) {
 			static const char buf[] = "0005\1";
 			write_or_die(1, buf, 5);
 		}
@@ -294,14 +626,20 @@ static void create_pack_file(const struct object_array *have_obj,
 		goto fail;
 	}
 
+	if (!output_state.packfile_started) {
+		error("git upload-pack: git-pack-objects did not write a pack.");
+		goto fail;
+	}
+
 	/* flush the data */
-	if (0 <= buffered) {
-		data[0] = buffered;
-		send_client_data(1, data, 1);
+	if (output_state.used > 0) {
+		send_client_data(1, output_state.buffer, output_state.used);
+		pack_cache_write(&cache, output_state.buffer, output_state.used);
 		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	pack_cache_finish(&cache);
 	return;
 
  fail:
@@ -347,7 +685,7 @@ static int got_oid(const char *hex, struct object_id *oid,
 static int ok_to_give_up(const struct object_array *have_obj,
 			 struct object_array *want_obj)
 {
-	uint32_t min_generation = GENERATION_NUMBER_ZERO;
+	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
 
 	if (!have_obj->nr)
 		return 0;
@@ -1069,6 +1407,10 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		pack_cache_enabled = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachelimit", var)) {
+		pack_cache_limit = git_config_ulong(var, value);
 	} else if (!strcmp("core.precomposeunicode", var)) {
 		precomposed_unicode = git_config_bool(var, value);
 	}
@@ -1117,7 +1459,7 @@ void upload_pack(struct upload_pack_options *options)
 	if (want_obj.nr) {
 		struct object_array have_obj = OBJECT_ARRAY_INIT;
 		get_common_commits(&reader, &have_obj, &want_obj);
-		create_pack_file(&have_obj, &want_obj);
+		create_pack_file(&have_obj, &want_obj, NULL);
 	}
 }
 
@@ -1310,6 +1652,11 @@ static void process_args(struct packet_reader *request,
 			continue;
 		}
 
+		if (skip_prefix(arg, "packfile-uris ", &p)) {
+			string_list_split(&uri_protocols, p, ',', -1);
+			continue;
+		}
+
 		if ((git_env_bool("GIT_TEST_SIDEBAND_ALL", 0) ||
 		     allow_sideband_all) &&
 		    !strcmp(arg, "sideband-all")) {
@@ -1509,8 +1856,7 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 			send_wanted_ref_info(&data);
 			send_shallow_info(&data, &want_obj);
 
-			packet_writer_write(&data.writer, "packfile\n");
-			create_pack_file(&have_obj, &want_obj);
+			create_pack_file(&have_obj, &want_obj, &data.writer);
 			state = FETCH_DONE;
 			break;
 		case FETCH_DONE:
@@ -1521,6 +1867,7 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 	upload_pack_data_clear(&data);
 	object_array_clear(&have_obj);
 	object_array_clear(&want_obj);
+	string_list_clear(&uri_protocols, 0);
 	return 0;
 }
 
@@ -1552,6 +1899,10 @@ int upload_pack_advertise(struct repository *r,
 					   &allow_sideband_all_value) &&
 		     allow_sideband_all_value))
 			strbuf_addstr(value, " sideband-all");
+
+		if (repo_config_get_value_multi(the_repository,
+						"uploadpack.packfileuri"))
+			strbuf_addstr(value, " packfile-uris");
 	}
 
 	return 1;
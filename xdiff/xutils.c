@@ -249,26 +249,44 @@ int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
 	return 1;
 }
 
+/*
+ * The end of the line starting at "ptr": finding it with memchr() lets
+ * the C library look at many bytes at a time, and leaves the loops
+ * hashing the line with a single bound to check.
+ */
+static char const *xdl_find_eol(char const *ptr, char const *top) {
+	char const *eol = memchr(ptr, '\n', top - ptr);
+
+	return eol ? eol : top;
+}
+
 static unsigned long xdl_hash_record_with_whitespace(char const **data,
 		char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
-	int cr_at_eol_only = (flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL;
+	char const *eol = xdl_find_eol(ptr, top);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		if (cr_at_eol_only) {
-			/* do not ignore CR at the end of an incomplete line */
-			if (*ptr == '\r' &&
-			    (ptr + 1 < top && ptr[1] == '\n'))
-				continue;
+	if ((flags & XDF_WHITESPACE_FLAGS) == XDF_IGNORE_CR_AT_EOL) {
+		char const *end = eol;
+
+		/* do not ignore CR at the end of an incomplete line */
+		if (eol < top && ptr < eol && eol[-1] == '\r')
+			end--;
+		for (; ptr < end; ptr++) {
+			ha += (ha << 5);
+			ha ^= (unsigned long) *ptr;
 		}
-		else if (XDL_ISSPACE(*ptr)) {
+		*data = eol < top ? eol + 1 : eol;
+		return ha;
+	}
+
+	for (; ptr < eol; ptr++) {
+		if (XDL_ISSPACE(*ptr)) {
 			const char *ptr2 = ptr;
 			int at_eol;
-			while (ptr + 1 < top && XDL_ISSPACE(ptr[1])
-					&& ptr[1] != '\n')
+			while (ptr + 1 < eol && XDL_ISSPACE(ptr[1]))
 				ptr++;
-			at_eol = (top <= ptr + 1 || ptr[1] == '\n');
+			at_eol = (ptr + 1 == eol);
 			if (flags & XDF_IGNORE_WHITESPACE)
 				; /* already handled */
 			else if (flags & XDF_IGNORE_WHITESPACE_CHANGE
@@ -289,7 +307,7 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 		ha += (ha << 5);
 		ha ^= (unsigned long) *ptr;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	*data = eol < top ? eol + 1 : eol;
 
 	return ha;
 }
@@ -297,15 +315,17 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
+	char const *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	eol = xdl_find_eol(ptr, top);
+	for (; ptr < eol; ptr++) {
 		ha += (ha << 5);
 		ha ^= (unsigned long) *ptr;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
+	*data = eol < top ? eol + 1 : eol;
 
 	return ha;
 }